@@ -0,0 +1,196 @@
+/** @file codectest.c
+*
+* @brief  Sample compression benchmark.
+*         Encodes ECG-like and accelerometer-like test vectors with the sample
+*         codec, checks the round trip and prints the compression ratio and
+*         MCLK cycles per sample over the UART.
+*
+* @author Alvaro Prieto
+*/
+#include "common.h"
+#include <signal.h>
+#include "intrinsics.h"
+#include "oscillator.h"
+#include "leds.h"
+#include "uart.h"
+#include "codec.h"
+
+#define BLOCK_SAMPLES (50)
+#define TOTAL_BLOCKS (40)
+#define PAYLOAD_SIZE (50)
+
+// One heartbeat (P wave, QRS complex, T wave) as offsets from the baseline,
+// roughly what the 8-bit ADC sees from an ECG front end at ~300Hz
+static const int8_t ecg_beat[] = {
+    0,   1,   2,   4,   5,   5,   4,   2,   1,   0,   0,   0,  -2,  -6,  20,
+   60,  95,  70,  25, -15, -10,  -4,   0,   0,   1,   2,   4,   6,   8,  10,
+   11,  11,  10,   8,   6,   4,   2,   1,   0,   0 };
+
+uint8_t samples[BLOCK_SAMPLES];
+uint8_t encoded[PAYLOAD_SIZE];
+uint8_t decoded[BLOCK_SAMPLES];
+
+static uint16_t lfsr = 0xACE1;
+
+static int8_t noise( uint8_t );
+static void make_ecg_block( uint16_t );
+static void make_accel_block( uint16_t );
+static void run_benchmark( const char*, void (*)(uint16_t) );
+static void print_number( uint16_t );
+
+int main( void )
+{
+  // Stop watchdog timer to prevent time out reset
+  WDTCTL = WDTPW + WDTHOLD;
+
+  // Make sure processor is running at 12MHz
+  setup_oscillator();
+
+  setup_leds();
+
+  // Initialize UART for communications at 115200baud
+  setup_uart();
+
+  // Timer1_A3 free running from SMCLK (== MCLK) to count cycles
+  TA1CTL = TASSEL__SMCLK + MC_2 + TACLR;
+
+  uart_write( "\r\nCodec benchmark\r\n", 19 );
+
+  run_benchmark( "ECG   ", make_ecg_block );
+  run_benchmark( "Accel ", make_accel_block );
+
+  for(;;)
+  {
+    led1_toggle();
+    __delay_cycles(0x40000);
+  }
+}
+
+/*******************************************************************************
+ * @fn     void run_benchmark( const char* name, void (*generator)(uint16_t) )
+ * @brief  encode/decode TOTAL_BLOCKS blocks and print the results
+ * ****************************************************************************/
+static void run_benchmark( const char* name, void (*generator)(uint16_t) )
+{
+  uint32_t raw_bytes = 0;
+  uint32_t encoded_bytes = 0;
+  uint32_t cycles = 0;
+  uint16_t start;
+  uint16_t block;
+  uint8_t length;
+  uint8_t index;
+  uint8_t errors = 0;
+
+  for( block = 0; block < TOTAL_BLOCKS; block++ )
+  {
+    generator( block );
+
+    start = TA1R;
+    codec_encode( samples, BLOCK_SAMPLES, encoded, PAYLOAD_SIZE, &length );
+    cycles += (uint16_t)(TA1R - start);
+
+    raw_bytes += BLOCK_SAMPLES;
+    encoded_bytes += length;
+
+    if( BLOCK_SAMPLES != codec_decode( encoded, length, decoded, BLOCK_SAMPLES ) )
+    {
+      errors++;
+      continue;
+    }
+
+    for( index = 0; index < BLOCK_SAMPLES; index++ )
+    {
+      if( decoded[index] != samples[index] )
+      {
+        errors++;
+        break;
+      }
+    }
+  }
+
+  uart_write( (uint8_t*)name, 6 );
+  uart_write( "ratio x100: ", 12 );
+  print_number( (uint16_t)((raw_bytes * 100) / encoded_bytes) );
+  uart_write( " cycles/sample: ", 16 );
+  print_number( (uint16_t)(cycles / raw_bytes) );
+  uart_write( " errors: ", 9 );
+  print_number( errors );
+  uart_write( "\r\n", 2 );
+}
+
+/*******************************************************************************
+ * @fn     void make_ecg_block( uint16_t block )
+ * @brief  fill samples with the repeating heartbeat plus baseline wander
+ * ****************************************************************************/
+static void make_ecg_block( uint16_t block )
+{
+  uint16_t time;
+  uint16_t phase;
+  uint8_t index;
+
+  for( index = 0; index < BLOCK_SAMPLES; index++ )
+  {
+    time = block * BLOCK_SAMPLES + index;
+
+    // ~72 beats per minute at 300Hz is one beat every 250 samples
+    phase = time % 250;
+
+    samples[index] = 100 + ((time >> 5) & 0x07) + noise( 1 );
+    if( phase < sizeof(ecg_beat) )
+    {
+      samples[index] += ecg_beat[phase];
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void make_accel_block( uint16_t block )
+ * @brief  fill samples with a slow triangle (limb swing) plus sensor noise
+ * ****************************************************************************/
+static void make_accel_block( uint16_t block )
+{
+  uint16_t phase;
+  uint8_t index;
+
+  for( index = 0; index < BLOCK_SAMPLES; index++ )
+  {
+    phase = (block * BLOCK_SAMPLES + index) % 300;
+    if( phase >= 150 )
+    {
+      phase = 300 - phase;
+    }
+    samples[index] = 53 + (uint8_t)phase + noise( 3 );
+  }
+}
+
+/*******************************************************************************
+ * @fn     int8_t noise( uint8_t mask )
+ * @brief  small pseudo random value in [-mask/2, mask/2] from a 16-bit LFSR
+ * ****************************************************************************/
+static int8_t noise( uint8_t mask )
+{
+  lfsr = (lfsr >> 1) ^ (-(lfsr & 1) & 0xB400);
+
+  return (int8_t)(lfsr & mask) - (int8_t)(mask >> 1);
+}
+
+/*******************************************************************************
+ * @fn     void print_number( uint16_t value )
+ * @brief  print value in decimal
+ * ****************************************************************************/
+static void print_number( uint16_t value )
+{
+  uint8_t digits[5];
+  uint8_t count = 0;
+
+  do
+  {
+    digits[count++] = '0' + (value % 10);
+    value /= 10;
+  } while( value );
+
+  while( count )
+  {
+    uart_put_char( digits[--count] );
+  }
+}
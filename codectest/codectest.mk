@@ -0,0 +1,7 @@
+CODECTEST_OBJS += \
+	$(LIB_OBJS) \
+	codectest/codectest.o
+
+codectest: $(addprefix $(BUILD_DIR)/, $(CODECTEST_OBJS))
+	$(CC) $(CFLAGS) $(addprefix $(BUILD_DIR)/, $(CODECTEST_OBJS)) -o \
+		$(addprefix $(BUILD_DIR)/, program.elf) $(LFLAGS)
@@ -13,6 +13,13 @@
 #include "uart.h"
 #include "timers.h"
 #include "radio.h"
+#include "events.h"
+#include "route.h"
+#include "aggregate.h"
+#include "nack.h"
+#include "survey.h"
+#include "profiler.h"
+#include "trace.h"
 
 uint8_t tx_buffer[PACKET_LEN+1];
 
@@ -28,7 +35,7 @@ typedef struct
 
 typedef struct
 {
-  uint8_t samples[ADC_MAX_SAMPLES];
+  uint8_t samples[ADC_SAMPLES_LEN];
 } packet_data_t;
 
 typedef struct
@@ -37,8 +44,74 @@ typedef struct
   uint8_t lqi_crcok;
 } packet_footer_t;
 
-uint8_t send_sync_message();
+// Main loop events, lower number runs first
+#define EVENT_SYNC (0)
+#define EVENT_RX (1)
+
+uint8_t sync_timer();
+void send_sync_message();
 uint8_t process_rx( uint8_t*, uint8_t );
+uint8_t deliver_packet( uint8_t* );
+void print_packet();
+
+uint8_t beacon_count = 0;
+uint8_t sync_count = 0;
+uint8_t sync_sequence = 0;
+
+// Device address owning each sample slot, 0 if free
+uint8_t slot_map[MAX_SLOTS];
+// Beacons since each slot owner was last heard from
+uint8_t slot_idle[MAX_SLOTS];
+// Sample blocks each slot owner sent that never arrived
+nack_tracker_t slot_blocks[MAX_SLOTS];
+// Slot whose requests go first in the next beacon, so every owner gets its
+// turn
+uint8_t nack_turn = 0;
+
+void update_slot_map();
+void update_requests();
+uint8_t slot_heard( uint8_t, uint8_t );
+
+// Channel survey (see SURVEY_CHANNELS). The cell is on channel_index and
+// the next visit goes to survey_next
+survey_channel_t survey_stats[SURVEY_CHANNELS];
+uint8_t channel_index = 0;
+uint8_t survey_next = 0;
+uint8_t survey_visits = 0;
+// Channel the cell is moving to, and beacons left announcing it (0 if none)
+uint8_t move_index = 0;
+uint8_t move_left = 0;
+
+// Survey results sent through the UART after a round of visits:
+// [0] SURVEY_RECORD_MARKER
+// [1] DEVICE_ADDRESS
+// [2] SURVEY_CHANNELS
+// [3] channel (CHANNR) in use
+// [4] channel moving to, same as [3] if staying
+// [5...] per channel: CHANNR, noise floor, peak, busy percentage, samples
+//        (uint16_t, little endian). Levels are dBm + 128
+#define SURVEY_RECORD_HEADER_LEN (5)
+#define SURVEY_RECORD_ENTRY_LEN (6)
+uint8_t survey_record[SURVEY_RECORD_HEADER_LEN +
+                      SURVEY_CHANNELS * SURVEY_RECORD_ENTRY_LEN];
+
+uint8_t survey_timer();
+void survey_visit();
+uint8_t update_survey();
+
+// Drops the copies of packets that arrive through more than one path
+route_t route;
+
+// Received packets waiting to be printed by the main loop. A relay's
+// aggregate brings several at once
+#define RX_QUEUE_LEN (8)
+uint8_t rx_queue[RX_QUEUE_LEN][PACKET_LEN+1];
+uint8_t rx_head = 0;
+volatile uint8_t rx_count = 0;
+uint16_t rx_overwritten = 0;
+
+// Packets taken out of an aggregate
+uint8_t split_packet[PACKET_LEN+1];
 
 int main( void )
 {
@@ -51,10 +124,12 @@ int main( void )
   header = (packet_header_t*)tx_buffer;
   
   // Initialize Tx Buffer
-  header->length = sizeof(packet_header_t) - 1;
+  header->length = sizeof(packet_header_t) + SYNC_PAYLOAD_LEN - 1;
   header->source = DEVICE_ADDRESS;
   header->type = 0x66; // Sync message
-  header->flags = 0xAA;
+  header->flags = 0x00;
+  
+  route_init( &route, DEVICE_ADDRESS, 1 );
   
   // Make sure processor is running at 12MHz
   setup_oscillator();
@@ -69,37 +144,131 @@ int main( void )
   set_ccr( 0, TIMER_LIMIT );
   setup_timer_a(MODE_UP);
   
+  // UART clock (SMCLK) has to keep running while idle
+  setup_events( LPM0_bits );
+  register_event_handler( EVENT_SYNC, send_sync_message );
+  register_event_handler( EVENT_RX, print_packet );
+  
   // Send sync message
-  register_timer_callback( send_sync_message, 0 );
+  register_timer_callback( sync_timer, 0 );
+
+#if ISR_PROFILE
+  setup_isr_profiler();
+#endif
 
   // Initialize radio and enable receive callback function
   setup_radio( process_rx );
+  radio_set_channel( CELL_CHANNEL( CELL ) );
+  
+#if SURVEY_CHANNELS > 1
+  // Go through every channel before the first beacon. The devices look for
+  // the cell on CELL_CHANNEL, so a quieter one is announced like any other
+  // move
+  while( survey_visits < SURVEY_VISITS )
+  {
+    survey_visit();
+  }
+  
+  // Then one visit per major cycle, while the cell is quiet
+  register_timer_callback( survey_timer, 1 );
+  set_ccr( 1, SURVEY_OFFSET );
+#endif
   
   // Enable interrupts, otherwise nothing will work
   eint();
-   
-  while (1)
+  
+  // Sleep and run event handlers, never returns
+  run_events();
+  
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t sync_timer()
+ * @brief  CCR0 callback, end of a timer period. Every SYNC_PERIOD of them the
+ *         next period starts with a beacon
+ * ****************************************************************************/
+uint8_t sync_timer()
+{
+  sync_count++;
+  if( SYNC_PERIOD != sync_count )
   {
-    // Enter sleep mode
-    __bis_SR_register( LPM0_bits + GIE );
-    __no_operation();
-        
+    return 0;
   }
+  sync_count = 0;
   
-  return 0;
+#if SURVEY_CHANNELS > 1
+  // The end devices start their superframes over at every beacon, the
+  // visits follow them (see survey_timer)
+  set_ccr( 1, SURVEY_OFFSET );
+#endif
+  
+  return post_event( EVENT_SYNC );
 }
 
 /*******************************************************************************
- * @fn     uint8_t send_sync_message()
+ * @fn     void send_sync_message()
  * @brief  TODO
  * ****************************************************************************/
-uint8_t send_sync_message()
+void send_sync_message()
 {
+  packet_header_t* header;
+  uint32_t last_sync;
+  uint8_t survey_done;
+  
+  header = (packet_header_t*)tx_buffer;
+  
+  // Every so often ask the devices for their energy counters, the
+  // POWER_PACKET replies are printed like any other packet
+  beacon_count++;
+  if( ENERGY_REPORT_PERIOD == beacon_count )
+  {
+    beacon_count = 0;
+    header->flags |= ENERGY_REQUEST_FLAG;
+  }
+  else
+  {
+    header->flags &= ~ENERGY_REQUEST_FLAG;
+  }
+  
+  update_slot_map();
+  survey_done = update_survey();
+  update_requests();
+  
+  // Only beacons are sent from here, so the last packet sent was the
+  // previous beacon
+  last_sync = radio_tx_timestamp();
+  tx_buffer[sizeof(packet_header_t) + SYNC_RELAYS_OFFSET] = 0;
+  tx_buffer[sizeof(packet_header_t) + SYNC_SEQUENCE_OFFSET] = sync_sequence++;
+  memcpy( tx_buffer + sizeof(packet_header_t) + SYNC_TIME_OFFSET, &last_sync,
+          sizeof(uint32_t) );
+  
   // Send sync message
-  radio_tx( tx_buffer, sizeof(packet_header_t) );
+  radio_tx( tx_buffer, sizeof(packet_header_t) + SYNC_PAYLOAD_LEN );
   led2_toggle();
   
-  return 1;
+  // The cell moves as soon as the last announcement is out. The new channel
+  // is used once the radio is done sending
+  if( move_left && (0 == --move_left) )
+  {
+    channel_index = move_index;
+    radio_set_channel( SURVEY_CHANNEL( CELL, channel_index ) );
+  }
+  
+  if( survey_done )
+  {
+    uart_write_escaped( survey_record, sizeof(survey_record) );
+  }
+
+#if ISR_PROFILE
+  isr_profile_dump();
+#endif
+#if STATS_ENABLE
+  event_stats_dump();
+#endif
+#if TRACE_ENABLE
+  trace_dump();
+#endif
 }
 
 /*******************************************************************************
@@ -109,20 +278,395 @@ uint8_t send_sync_message()
 uint8_t process_rx( uint8_t* buffer, uint8_t size )
 {
   packet_header_t* header;
-  static uint8_t counter = 0;
-  header = (packet_header_t*)(buffer);
+  uint8_t offset = 0;
+  uint8_t wake = 0;
+  
+  header = (packet_header_t*)buffer;
+  
+  // Relayed copies of our own beacon
+  if( 0x66 == header->type )
+  {
+    return 0;
+  }
+  
+  if( AGGREGATE_PACKET != header->type )
+  {
+    return deliver_packet( buffer );
+  }
+  
+  if( (header->length < sizeof(packet_header_t) + ROUTE_HEADER_LEN - 1) ||
+      (ROUTE_DELIVER != route_receive( &route, header->source, 
+                  (route_header_t*)(buffer + sizeof(packet_header_t)) )) )
+  {
+    // Already got this one
+    return 0;
+  }
+  
+  // Split it back into the packets the relay got, they are printed as if
+  // they had come straight from the end devices
+  while( aggregate_split( buffer, &offset, split_packet, PACKET_LEN ) )
+  {
+    wake |= deliver_packet( split_packet );
+  }
+  
+  return wake;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t deliver_packet( uint8_t* packet )
+ * @brief  Keep track of the sender's slot and queue the packet for printing
+ * ****************************************************************************/
+uint8_t deliver_packet( uint8_t* packet )
+{
+  packet_header_t* header;
+  uint32_t grid_index = 0;
+  uint8_t size;
+  uint8_t slot;
+  
+  header = (packet_header_t*)packet;
+  
+  // Add one to account for the byte with the packet length
+  size = header->length + 1;
+  if( size > sizeof(rx_queue[0]) )
+  {
+    return 0;
+  }
+  
+  if( ROUTED_PACKET( header->type ) )
+  {
+    if( (header->length < sizeof(packet_header_t) + ROUTE_HEADER_LEN - 1) ||
+        (ROUTE_DELIVER != route_receive( &route, header->source, 
+                    (route_header_t*)(packet + sizeof(packet_header_t)) )) )
+    {
+      // Already got this one
+      return 0;
+    }
+    
+    slot = slot_heard( header->source, (header->type == JOIN_PACKET) );
+    
+    // Blocks re-sent after a request may have made it the first time after
+    // all, e.g. through another relay
+    if( (slot < MAX_SLOTS) &&
+        ((SAMPLES_PACKET == header->type) ||
+         (COMPRESSED_SAMPLES_PACKET == header->type)) &&
+        (header->length >= sizeof(packet_header_t) + ROUTE_HEADER_LEN +
+                           GRID_INDEX_LEN - 1) )
+    {
+      memcpy( &grid_index, 
+              packet + sizeof(packet_header_t) + ROUTE_HEADER_LEN,
+              GRID_INDEX_LEN );
+      if( !nack_heard( &slot_blocks[slot], BLOCK_NUMBER( grid_index ) ) )
+      {
+        return 0;
+      }
+    }
+  }
+  
+  // Printing takes several ms at 115200baud, so only copy the packet here.
+  // When the queue is full the oldest packet is dropped
+  if( RX_QUEUE_LEN == rx_count )
+  {
+    rx_head = ( rx_head + 1 ) % RX_QUEUE_LEN;
+    rx_count--;
+    rx_overwritten++;
+  }
+  memcpy( rx_queue[(rx_head + rx_count) % RX_QUEUE_LEN], packet, size );
+  rx_count++;
+  
+  led3_toggle();
+  return post_event( EVENT_RX );
+}
 
+/*******************************************************************************
+ * @fn     void print_packet()
+ * @brief  send the oldest received packet through the UART. One per run, so
+ *         a beacon due meanwhile goes out between packets
+ * ****************************************************************************/
+void print_packet()
+{
+  packet_header_t* header;
+  header = (packet_header_t*)(print_buffer);
+
+  // Take a copy so a packet arriving while printing can't change it
+  dint();
+  if( 0 == rx_count )
+  {
+    eint();
+    return;
+  }
+  memcpy( print_buffer, rx_queue[rx_head], sizeof(rx_queue[0]) );
+  rx_head = ( rx_head + 1 ) % RX_QUEUE_LEN;
+  rx_count--;
+  if( rx_count )
+  {
+    post_event( EVENT_RX );
+  }
+  eint();
+  
   //packet_footer_t* footer;
   // Add one to account for the byte with the packet length
-  //footer = (packet_footer_t*)(buffer + header->length + 1 );
-
+  //footer = (packet_footer_t*)(print_buffer + header->length + 1 );
+  
   //uart_write( , 1 );
-  uart_write_escaped( buffer, header->length + 1 );  
+  uart_write_escaped( print_buffer, header->length + 1 );
+}
+
+/*******************************************************************************
+ * @fn     uint8_t slot_heard( uint8_t address, uint8_t join )
+ * @brief  Keep address' slot alive. If it has none and is asking to join,
+ *         give it the first free one. Returns the slot, MAX_SLOTS if none
+ * ****************************************************************************/
+uint8_t slot_heard( uint8_t address, uint8_t join )
+{
+  uint8_t slot;
+  uint8_t free_slot = MAX_SLOTS;
+  
+  if( 0 == address )
+  {
+    return MAX_SLOTS;
+  }
   
-  // Erase buffer just for fun
-  memset( buffer, 0x00, size );
+  for( slot = 0; slot < MAX_SLOTS; slot++ )
+  {
+    if( address == slot_map[slot] )
+    {
+      slot_idle[slot] = 0;
+      return slot;
+    }
+    if( (0 == slot_map[slot]) && (MAX_SLOTS == free_slot) )
+    {
+      free_slot = slot;
+    }
+  }
   
-  led3_toggle();
-  return 1;
+  if( join && (free_slot < MAX_SLOTS) )
+  {
+    slot_map[free_slot] = address;
+    slot_idle[free_slot] = 0;
+    nack_init( &slot_blocks[free_slot] );
+    return free_slot;
+  }
+  
+  return MAX_SLOTS;
 }
 
+/*******************************************************************************
+ * @fn     void update_slot_map()
+ * @brief  Called once per beacon. Take back slots that went quiet, move the
+ *         last owners into the gaps so the used slots stay packed at the start
+ *         of the superframe, and copy the map into the beacon along with
+ *         the cell devices without a slot should join
+ * ****************************************************************************/
+void update_slot_map()
+{
+  uint8_t slot;
+  uint8_t last;
+  
+  // slot_heard runs in the radio interrupt
+  dint();
+  
+  for( slot = 0; slot < MAX_SLOTS; slot++ )
+  {
+    if( slot_map[slot] && (++slot_idle[slot] > SLOT_TIMEOUT) )
+    {
+      slot_map[slot] = 0;
+    }
+  }
+  
+  last = MAX_SLOTS;
+  for( slot = 0; slot < last; slot++ )
+  {
+    if( slot_map[slot] )
+    {
+      continue;
+    }
+    
+    // Find the last used slot after this gap
+    while( (last > slot + 1) && (0 == slot_map[last - 1]) )
+    {
+      last--;
+    }
+    if( last <= slot + 1 )
+    {
+      break;
+    }
+    
+    last--;
+    slot_map[slot] = slot_map[last];
+    slot_idle[slot] = slot_idle[last];
+    slot_blocks[slot] = slot_blocks[last];
+    slot_map[last] = 0;
+  }
+  
+  memcpy( tx_buffer + sizeof(packet_header_t) + SYNC_MAP_OFFSET, slot_map,
+          MAX_SLOTS );
+  
+  // The used slots are packed, the cell is full if the last one is taken.
+  // Devices without a slot move on to the next cell then
+  tx_buffer[sizeof(packet_header_t) + SYNC_CELL_OFFSET] = 
+                        slot_map[MAX_SLOTS - 1] ? ( CELL + 1 ) % CELLS : CELL;
+  
+  eint();
+}
+
+/*******************************************************************************
+ * @fn     void update_requests()
+ * @brief  Called once per beacon, after update_slot_map. Ask the slot owners
+ *         for the blocks they sent that never arrived, one request per free
+ *         slot (see NACK_ENTRIES). A move to another channel takes the last
+ *         entry
+ * ****************************************************************************/
+void update_requests()
+{
+  uint8_t* entry;
+  uint8_t entries = NACK_ENTRIES;
+  uint8_t free_slots = 0;
+  uint8_t requests = 0;
+  uint8_t count;
+  uint8_t slot;
+  
+  entry = tx_buffer + sizeof(packet_header_t) + SYNC_NACK_OFFSET;
+  memset( entry, 0, NACK_ENTRIES * NACK_ENTRY_LEN );
+  
+  if( move_left )
+  {
+    entries--;
+    survey_announce( entry + entries * NACK_ENTRY_LEN, move_index,
+                     move_left - 1 );
+  }
+  
+  // nack_heard runs in the radio interrupt
+  dint();
+  
+  for( slot = 0; slot < MAX_SLOTS; slot++ )
+  {
+    if( 0 == slot_map[slot] )
+    {
+      free_slots++;
+    }
+  }
+  
+  // Start where the last beacon left off
+  for( count = 0; (count < MAX_SLOTS) && (requests < entries) &&
+                  (requests < free_slots); count++ )
+  {
+    slot = ( nack_turn + count ) % MAX_SLOTS;
+    if( slot_map[slot] && 
+        nack_request( &slot_blocks[slot], slot_map[slot], entry ) )
+    {
+      entry += NACK_ENTRY_LEN;
+      requests++;
+      nack_turn = ( slot + 1 ) % MAX_SLOTS;
+    }
+  }
+  
+  eint();
+}
+
+/*******************************************************************************
+ * @fn     uint8_t survey_timer()
+ * @brief  CCR1 callback, SURVEY_OFFSET into every major cycle. Visit the next
+ *         channel, unless a round is done and waiting for the next beacon or
+ *         a move is being announced
+ * ****************************************************************************/
+uint8_t survey_timer()
+{
+  uint32_t next;
+  
+  // The counter wraps after TIMER_LIMIT + 1 ticks
+  next = (uint32_t)TA0CCR1 + MAJOR_CYCLE;
+  if( next > TIMER_LIMIT )
+  {
+    next -= (uint32_t)TIMER_LIMIT + 1;
+  }
+  set_ccr( 1, (uint16_t)next );
+  
+  if( (0 == move_left) && (survey_visits < SURVEY_VISITS) )
+  {
+    survey_visit();
+  }
+  
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     void survey_visit()
+ * @brief  Sample the RSSI of the next channel for a moment, see
+ *         radio_sample_rssi
+ * ****************************************************************************/
+void survey_visit()
+{
+  uint8_t levels[SURVEY_SAMPLES];
+  uint8_t index;
+  
+  if( !radio_sample_rssi( SURVEY_CHANNEL( CELL, survey_next ), levels, 
+                          SURVEY_SAMPLES ) )
+  {
+    // Still sending, the same channel is visited next time
+    return;
+  }
+  
+  for( index = 0; index < SURVEY_SAMPLES; index++ )
+  {
+    survey_sample( &survey_stats[survey_next], route_quality( levels[index] ) );
+  }
+  
+  survey_next++;
+  if( SURVEY_CHANNELS == survey_next )
+  {
+    survey_next = 0;
+    survey_visits++;
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t update_survey()
+ * @brief  Called once per beacon, before update_requests. Once every channel
+ *         had SURVEY_VISITS visits, fill the survey record, start announcing
+ *         a move if another channel is clearly quieter and start over.
+ *         Returns 1 if there is a new record to send
+ * ****************************************************************************/
+uint8_t update_survey()
+{
+  uint8_t* entry;
+  uint8_t pick;
+  uint8_t index;
+  
+  // survey_timer leaves the statistics alone until the round starts over
+  if( move_left || (survey_visits < SURVEY_VISITS) )
+  {
+    return 0;
+  }
+  
+  pick = survey_pick( survey_stats, SURVEY_CHANNELS, channel_index );
+  
+  survey_record[0] = SURVEY_RECORD_MARKER;
+  survey_record[1] = DEVICE_ADDRESS;
+  survey_record[2] = SURVEY_CHANNELS;
+  survey_record[3] = SURVEY_CHANNEL( CELL, channel_index );
+  survey_record[4] = SURVEY_CHANNEL( CELL, pick );
+  
+  entry = survey_record + SURVEY_RECORD_HEADER_LEN;
+  for( index = 0; index < SURVEY_CHANNELS; index++ )
+  {
+    entry[0] = SURVEY_CHANNEL( CELL, index );
+    entry[1] = survey_floor( &survey_stats[index] );
+    entry[2] = survey_stats[index].peak;
+    entry[3] = survey_busy( &survey_stats[index] );
+    entry[4] = (uint8_t)survey_stats[index].samples;
+    entry[5] = (uint8_t)(survey_stats[index].samples >> 8);
+    entry += SURVEY_RECORD_ENTRY_LEN;
+  }
+  
+  if( pick != channel_index )
+  {
+    move_index = pick;
+    move_left = SURVEY_ANNOUNCE;
+  }
+  
+  survey_reset( survey_stats, SURVEY_CHANNELS );
+  survey_next = 0;
+  survey_visits = 0;
+  
+  return 1;
+}
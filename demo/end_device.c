@@ -12,6 +12,19 @@
 #include "uart.h"
 #include "timers.h"
 #include "radio.h"
+#include "codec.h"
+#include "pack12.h"
+#include "sample_ring.h"
+#include "events.h"
+#include "soft_timers.h"
+#include "energy.h"
+#include "tdma.h"
+#include "clock_sync.h"
+#include "sample_grid.h"
+#include "route.h"
+#include "profiler.h"
+#include "trace.h"
+#include "adc.h"
 #include "settings.h"
 
 uint8_t tx_buffer[PACKET_LEN+1];
@@ -28,7 +41,9 @@ typedef struct
 
 typedef struct
 {
-  uint8_t samples[ADC_MAX_SAMPLES];
+  route_header_t route;
+  uint8_t grid_index[GRID_INDEX_LEN];
+  uint8_t samples[ADC_SAMPLES_LEN];
 } packet_data_t;
 
 typedef struct
@@ -37,15 +52,128 @@ typedef struct
   uint8_t lqi_crcok;
 } packet_footer_t;
 
-uint8_t start_sample();
+// Main loop events, lower number runs first
+#define EVENT_SEND_SAMPLES (0)
+#define EVENT_ENERGY_REPORT (1)
+#define EVENT_JOIN (2)
+#define EVENT_RESEND (3)
+
+// arg: BLOCK_NUMBER of the sample block dropped, the ring was full
+#define TRACE_SAMPLE_OVERRUN (TRACE_USER)
+
+uint8_t start_sample( uint32_t );
+#if !SAMPLE_GRID
+uint8_t sample_timer();
+#endif
 uint8_t process_rx( uint8_t*, uint8_t );
-uint8_t send_samples();
-void setup_adc();
+uint8_t slot_start( const tdma_slot_t* );
+void send_samples();
+void send_resend();
+void send_energy_report();
+void send_join();
+uint8_t update_slot( uint8_t*, uint8_t* );
+uint8_t set_slot( uint8_t, uint16_t, uint16_t );
+void change_cell( uint8_t, uint8_t );
+void set_channel( uint8_t );
+uint8_t move_timer();
+uint8_t cell_timer_tick();
+uint8_t free_slot( uint8_t*, uint8_t );
+uint8_t block_done( uint8_t );
+
+// Inputs sampled, the first ADC_CHANNELS are used
+const uint8_t adc_inputs[] = { ADC12INCH_0, ADC12INCH_1, ADC12INCH_2 };
+
+// Filled by the DMA, see adc.h
+uint16_t sample_buffer[ADC_BUFFER_LEN( ADC_CHANNELS, ADC_BLOCK_SAMPLES )];
+
+// Grid index of the first sample in each block of sample_buffer
+uint32_t block_index[2];
+uint32_t next_sample_index = 0;
+
+// Full blocks waiting for a sample slot, copied out of sample_buffer by the
+// DMA interrupt and sent in order by send_samples (see sample_ring.h)
+typedef struct
+{
+  uint32_t index;   // Grid index of the first sample
+  uint16_t samples[ADC_BLOCK_LEN];
+} sample_block_t;
 
+sample_block_t sample_blocks[SAMPLE_RING_BLOCKS];
+sample_ring_t sample_ring;
+
+// Sync word time of the last beacon, paired with the access point's time
+// for it when the next beacon arrives
+uint32_t last_sync;
+uint8_t last_sync_sequence;
+uint8_t last_sync_valid = 0;
+
+#if ISR_PROFILE || STATS_ENABLE
+// Sequence of the beacon the last profile and statistics records were sent
+// after
+uint8_t dump_sequence;
+#endif
+
+uint8_t power_buffer[PACKET_LEN+1];
+uint8_t join_buffer[sizeof(packet_header_t) + sizeof(route_header_t)];
+
+// Parent toward the access point, see route.h
+route_t route;
+
+// Superframe schedule, the one sample slot the access point gave this device
+// in the last beacon's slot map, a free slot to re-send blocks in when the
+// beacon asked for some, and the energy report slot that goes with the
+// sample slot (see update_slot). Without a slot, only the contention slot
+// picked for the next join
+tdma_slot_t slot_table[3] = {
+  // owner, channel, offset, length
+  { DEVICE_ADDRESS, CELL_CHANNEL( CELL ), SAMPLE_SLOT_OFFSET( 0 ),
+    SAMPLE_SLOT },
+  { DEVICE_ADDRESS, CELL_CHANNEL( CELL ), SAMPLE_SLOT_OFFSET( 0 ),
+    SAMPLE_SLOT },
+  { DEVICE_ADDRESS, CELL_CHANNEL( CELL ), ENERGY_REPORT_SLOT,
+    POWER_SLOT },
+};
+// Entry of the report slot in slot_table, after the sample slots
+uint8_t report_entry = 1;
+// The last beacon asked for an energy report, sent in the report slot of
+// the superframe it starts
+uint8_t energy_report_due = 0;
+// Index of the slot in the map, MAX_SLOTS if none has been given yet
+uint8_t my_slot = MAX_SLOTS;
+// Index of the re-send slot in the map, MAX_SLOTS if there is none
+uint8_t spare_slot = MAX_SLOTS;
+
+// The last NACK_WINDOW sample blocks sent, as they were sent
+typedef struct
+{
+  uint8_t block;    // BLOCK_NUMBER of the first sample
+  uint8_t type;     // 0 if the entry is unused
+  uint8_t length;   // Grid index and samples
+  uint8_t data[GRID_INDEX_LEN + ADC_SAMPLES_LEN];
+} sent_block_t;
 
-uint8_t sample_buffer[ADC_MAX_SAMPLES * 2];
-uint8_t buffer_index = 0;
-uint8_t current_buffer = 0;
+sent_block_t sent_blocks[NACK_WINDOW];
+uint8_t sent_next = 0;
+
+// This device's request from the last beacon, see nack.h. Blocks are taken
+// out of it as they are re-sent
+uint8_t resend_request[NACK_ENTRY_LEN];
+uint8_t resend_buffer[PACKET_LEN+1];
+
+// Cell (see CELLS) this device is in, and timer periods since its access
+// point was last heard
+uint8_t cell = CELL;
+uint8_t cell_silence = 0;
+soft_timer_t cell_timer;
+
+// Which of the cell's channels (see SURVEY_CHANNEL) it is on, and the one
+// its access point announced it is moving to, SURVEY_CHANNELS if none
+uint8_t channel_index = 0;
+uint8_t move_index = SURVEY_CHANNELS;
+soft_timer_t move_delay;
+
+// Linear congruential generator state for picking join slots
+uint16_t join_random = DEVICE_ADDRESS;
 
 int main( void )
 {
@@ -60,16 +188,26 @@ int main( void )
   // Initialize Tx Buffer
   header->length = sizeof(packet_header_t) + sizeof(packet_data_t) - 1;
   header->source = DEVICE_ADDRESS;
-  header->type = 0xAA; // Samples
+  header->type = SAMPLES_PACKET;
   header->flags = 0x00;
   
+  route_init( &route, DEVICE_ADDRESS, 0 );
+  sample_ring_init( &sample_ring, sample_blocks, sizeof(sample_block_t),
+                    SAMPLE_RING_BLOCKS );
+  
   // Make sure processor is running at 12MHz
   setup_oscillator();
   
   // Initialize UART for communications at 115200baud
   //setup_uart();
+#if TRACE_ENABLE || ADC_JITTER || ISR_PROFILE || STATS_ENABLE
+  // Trace, jitter, profile and statistics dumps are sent through the UART
+  setup_uart();
+#endif
   
-  setup_adc();
+  setup_adc( adc_inputs, ADC_CHANNELS, sample_buffer, ADC_BLOCK_SAMPLES,
+             ADC_TIMER_TRIGGER ? ADC_TRIGGER_TIMER : ADC_TRIGGER_SOFTWARE,
+             block_done );
    
   // Initialize LEDs
   setup_leds();
@@ -77,16 +215,46 @@ int main( void )
   // Initialize timer
   set_ccr( 0, TIMER_LIMIT );
   setup_timer_a(MODE_UP);
+  setup_soft_timers();
+  setup_energy();
+  setup_clock_sync();
+  
+#if ISR_PROFILE
+  setup_isr_profiler();
+#endif
   
-  // Send sync message
-  register_timer_callback( start_sample, 1 );
-  set_ccr( 1, SAMPLE_RATE );
+  // The sample clock's CCR output triggers the ADC (see ADC_TIMER_TRIGGER)
+#if SAMPLE_GRID
+  setup_sample_grid( ADC_TIMER_CCR, SAMPLE_RATE, start_sample );
+#else
+  register_timer_callback( sample_timer, ADC_TIMER_CCR );
+  set_ccr( ADC_TIMER_CCR, SAMPLE_RATE );
+#endif
   
-  register_timer_callback( send_samples, 2 );
-  set_ccr( 2, (( REST_TIME/2) + MINOR_CYCLE * (DEVICE_ADDRESS - 1) ) );
+  setup_events( LPM3_bits );
+  register_event_handler( EVENT_SEND_SAMPLES, send_samples );
+  register_event_handler( EVENT_ENERGY_REPORT, send_energy_report );
+  register_event_handler( EVENT_JOIN, send_join );
+  register_event_handler( EVENT_RESEND, send_resend );
+  
+  // Slots start once the first sync message arrives with a slot for us
+  setup_tdma( slot_table, 0, MAJOR_CYCLE, slot_start );
     
   // Initialize radio and enable receive callback function
   setup_radio( process_rx );
+  radio_set_channel( CELL_CHANNEL( cell ) );
+  
+#if (CELLS > 1) || (SURVEY_CHANNELS > 1)
+  // Look elsewhere when the access point goes quiet
+  soft_timer_start( &cell_timer, TIMER_LIMIT + 1, TIMER_LIMIT + 1,
+                    cell_timer_tick );
+#endif
+  
+#if FLOOD_BEACONS
+  // Re-send beacons right as they end, along with every other node
+  radio_flood( 0x66, sizeof(packet_header_t) + SYNC_RELAYS_OFFSET, 
+               FLOOD_MAX_RELAYS );
+#endif
   
   // Lower power so relays can be used
   WriteSinglePATable(0x0D);
@@ -96,41 +264,92 @@ int main( void )
   
   // Enable interrupts, otherwise nothing will work
   eint();
-   
-  while (1)
-  {
-    // Enter sleep mode
-    __bis_SR_register( LPM3_bits + GIE );
-    __no_operation();
-    //led2_toggle();
-  }
+  
+  // Sleep and run event handlers, never returns
+  run_events();
   
   return 0;
 }
 
 /*******************************************************************************
- * @fn     uint8_t start_sample()
- * @brief  TODO
+ * @fn     uint8_t start_sample( uint32_t index )
+ * @brief  Start the conversion for grid sample index. With ADC_TIMER_TRIGGER
+ *         it started at the CCR match already, before this runs
  * ****************************************************************************/
-uint8_t start_sample()
+uint8_t start_sample( uint32_t index )
 { 
-  //TODO Actually use timer functions later
-  // Direct access to timer registers for faster development
+  // Blocks must be made of consecutive samples, start the block over if
+  // the grid jumped. A conversion that is already stored is left out, the
+  // block starts with the next one
+  if( (index != next_sample_index) && !adc_restart() )
+  {
+    next_sample_index = index + 1;
+    return 0;
+  }
+  next_sample_index = index + 1;
   
-  // Queue ADC conversion
-	ADC12CTL0 |= ADC12SC;
+  if( 0 == adc_position() )
+  {
+    block_index[adc_block()] = index;
+  }
+  
+  // Convert all the inputs (or count the conversion the timer started), the
+  // DMA stores the results
+  adc_start();
+  
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t block_done( uint8_t block )
+ * @brief  ADC callback, block of sample_buffer is full. It goes to the ring,
+ *         the oldest block there goes out in the next sample slot
+ * ****************************************************************************/
+uint8_t block_done( uint8_t block )
+{
+  sample_block_t* ready;
   
-  TA0CCR1 += SAMPLE_RATE;
-  if (TA0CCR1 > TIMER_LIMIT)
+  // The DMA only writes to this block again once the other one is full
+  ready = sample_ring_claim( &sample_ring );
+  if( 0 != ready )
   {
-    TA0CCR1 -= TIMER_LIMIT;
+    ready->index = block_index[block];
+    memcpy( ready->samples, &sample_buffer[block * ADC_BLOCK_LEN],
+            sizeof(ready->samples) );
+    sample_ring_publish( &sample_ring );
+  }
+  else
+  {
+    TRACE( TRACE_SAMPLE_OVERRUN, BLOCK_NUMBER( block_index[block] ) )
   }
-    
-  led1_on();
+  
+  led1_toggle();
   
   return 0;
 }
 
+#if !SAMPLE_GRID
+/*******************************************************************************
+ * @fn     uint8_t sample_timer()
+ * @brief  CCR1 callback, free running sample clock. Samples are numbered
+ *         locally
+ * ****************************************************************************/
+uint8_t sample_timer()
+{ 
+  uint16_t next;
+  
+  // set_ccr also takes the timer output back down for the next ADC trigger
+  next = TA0CCR1 + SAMPLE_RATE;
+  if( next > TIMER_LIMIT )
+  {
+    next -= TIMER_LIMIT + 1;
+  }
+  set_ccr( ADC_TIMER_CCR, next );
+  
+  return start_sample( next_sample_index );
+}
+#endif
+
 /*******************************************************************************
  * @fn     uint8_t process_rx( uint8_t* buffer, uint8_t size )
  * @brief  callback function called when new message is received
@@ -138,19 +357,112 @@ uint8_t start_sample()
 uint8_t process_rx( uint8_t* buffer, uint8_t size )
 {
   packet_header_t* header;
+  packet_footer_t* footer;
+  route_header_t* route_header;
+  uint32_t sync_time;
+  uint8_t sequence;
+  uint8_t relays;
+  uint8_t move;
+  uint8_t left;
+  
   header = (packet_header_t*)buffer;
+  // Add one to account for the byte with the packet length
+  footer = (packet_footer_t*)(buffer + header->length + 1 );
   
-  if( header->type == 0x66 )
+  if( (header->type == 0x66) && 
+      (header->length >= sizeof(packet_header_t) + SYNC_PAYLOAD_LEN - 1) &&
+      !(last_sync_valid && (last_sync_sequence == 
+                buffer[sizeof(packet_header_t) + SYNC_SEQUENCE_OFFSET])) )
   {
-    // TODO: save current timer value here
-    clear_timer();
-    TA0CCR1 = SAMPLE_RATE;
-    led1_off();
+    TRACE( TRACE_SYNC, header->source )
+    
+    cell_silence = 0;
+    
+    // Copies of a flooded beacon are heard after relays re-sends, the
+    // later copies of the same beacon are ignored
+    relays = buffer[sizeof(packet_header_t) + SYNC_RELAYS_OFFSET];
+    
+    // The access point is at depth 0. A relayed copy is the sum of several
+    // relays sending at once, so it says nothing about the link to it
+    route_age( &route );
+    if( 0 == relays )
+    {
+      route_heard( &route, header->source, 0, route_quality( footer->rssi ) );
+    }
+    
+    sequence = buffer[sizeof(packet_header_t) + SYNC_SEQUENCE_OFFSET];
+    memcpy( &sync_time, buffer + sizeof(packet_header_t) + SYNC_TIME_OFFSET,
+            sizeof(uint32_t) );
+    
+    // Correct the slot times in software instead of resetting the timer
+    if( last_sync_valid && ((uint8_t)(last_sync_sequence + 1) == sequence) )
+    {
+      clock_sync_beacon( last_sync, sync_time );
+    }
+    // Each re-send starts a fixed time after the one before it
+    last_sync = radio_rx_timestamp() - RADIO_FLOOD_DELAY( BEACON_LEN, relays );
+    last_sync_sequence = sequence;
+    last_sync_valid = 1;
+    
+    // The cell is moving to another channel, the last beacon on this one
+    // says when. Everyone switches once its re-sends are over
+    if( survey_find_move( buffer + sizeof(packet_header_t) + SYNC_NACK_OFFSET,
+                          NACK_ENTRIES, &move, &left ) &&
+        (move < SURVEY_CHANNELS) )
+    {
+      move_index = move;
+      if( 0 == left )
+      {
+        soft_timer_start( &move_delay, FLOOD_REMAINING( relays ) + 1, 0,
+                          move_timer );
+      }
+    }
+    
+    // The superframe starts with this beacon
+    if( update_slot( buffer + sizeof(packet_header_t) + SYNC_MAP_OFFSET,
+                     buffer + sizeof(packet_header_t) + SYNC_NACK_OFFSET ) )
+    {
+      if( clock_sync_points() )
+      {
+        tdma_sync( local_to_global( last_sync ) );
+      }
+      
+      // Answered in this device's report slot, after all the sample slots
+      energy_report_due = ( 0 != (header->flags & ENERGY_REQUEST_FLAG) );
+    }
+    else if( (buffer[sizeof(packet_header_t) + SYNC_CELL_OFFSET] != cell) &&
+             (buffer[sizeof(packet_header_t) + SYNC_CELL_OFFSET] < CELLS) )
+    {
+      // No free slot here, the access point says which cell to try next
+      change_cell( buffer[sizeof(packet_header_t) + SYNC_CELL_OFFSET], 0 );
+    }
+    else if( clock_sync_points() )
+    {
+      // Ask for a slot in a random contention slot, and only after every
+      // other beacon on average, so devices that collided once don't keep
+      // colliding
+      join_random = join_random * 25173 + 13849 + (uint16_t)last_sync;
+      if( join_random & 0x8000 )
+      {
+        tdma_set_table( slot_table, set_slot( 0, JOIN_OFFSET + JOIN_SLOT *
+                          ((join_random >> 8) % JOIN_WINDOW), JOIN_SLOT ) );
+        tdma_sync( local_to_global( last_sync ) );
+        post_event( EVENT_JOIN );
+      }
+      else
+      {
+        tdma_set_table( slot_table, 0 );
+      }
+    }
+  }
+  else if( ROUTED_PACKET( header->type ) && (header->flags & REPEATER_FLAG) &&
+           (header->length >= sizeof(packet_header_t) + ROUTE_HEADER_LEN - 1) )
+  {
+    // Overheard a relay, it could be a parent
+    route_header = (route_header_t*)(buffer + sizeof(packet_header_t));
+    route_heard( &route, route_header->sender, ROUTE_DEPTH( route_header ),
+                 route_quality( footer->rssi ) );
   }
-  
-  packet_footer_t* footer;
-  // Add one to account for the byte with the packet length
-  footer = (packet_footer_t*)(buffer + header->length + 1 );
     
   // Erase buffer just for fun
   memset( buffer, 0x00, size );
@@ -161,87 +473,440 @@ uint8_t process_rx( uint8_t* buffer, uint8_t size )
 }
 
 /*******************************************************************************
- * @fn     uint8_t send_samples()
- * @brief  TODO
+ * @fn     uint8_t update_slot( uint8_t* map, uint8_t* requests )
+ * @brief  Look for this device in the beacon's slot map and re-send requests
+ *         and update the slot table. Returns 1 if the device has a slot
  * ****************************************************************************/
-uint8_t send_samples()
-{ 
-  packet_data_t* data;
+uint8_t update_slot( uint8_t* map, uint8_t* requests )
+{
+  uint8_t slot;
+  uint8_t spare = MAX_SLOTS;
+  uint8_t request;
+  uint8_t count;
   
-  led2_toggle();
+  for( slot = 0; slot < MAX_SLOTS; slot++ )
+  {
+    if( DEVICE_ADDRESS == map[slot] )
+    {
+      break;
+    }
+  }
   
-  if( TA0CCR2 > MAJOR_CYCLE_LOOP )
+  // The k-th request is answered in the k-th free slot
+  memset( resend_request, 0, sizeof(resend_request) );
+  for( request = 0; (slot < MAX_SLOTS) && (request < NACK_ENTRIES);
+       request++ )
   {
-    TA0CCR2 = ( REST_TIME/2 ) + MINOR_CYCLE * (DEVICE_ADDRESS - 1);
+    if( DEVICE_ADDRESS == requests[request * NACK_ENTRY_LEN] )
+    {
+      spare = free_slot( map, request );
+      if( spare < MAX_SLOTS )
+      {
+        memcpy( resend_request, requests + request * NACK_ENTRY_LEN,
+                NACK_ENTRY_LEN );
+      }
+      break;
+    }
   }
-  else
+  
+  if( (slot != my_slot) || (spare != spare_slot) )
   {
-    TA0CCR2 += ( MAJOR_CYCLE );
+    my_slot = slot;
+    spare_slot = spare;
+    if( slot < MAX_SLOTS )
+    {
+      // Free slots come after the used ones and the report slots after all
+      // the sample slots, the table stays in order
+      count = set_slot( 0, SAMPLE_SLOT_OFFSET( slot ), SAMPLE_SLOT );
+      if( spare < MAX_SLOTS )
+      {
+        count = set_slot( count, SAMPLE_SLOT_OFFSET( spare ), SAMPLE_SLOT );
+      }
+      report_entry = count;
+      count = set_slot( count, ENERGY_REPORT_SLOT + POWER_SLOT * slot,
+                        POWER_SLOT );
+      tdma_set_table( slot_table, count );
+    }
+    else
+    {
+      // Lost the slot (timed out), stop sending until a new one is given
+      tdma_set_table( slot_table, 0 );
+    }
   }
   
+  return ( my_slot < MAX_SLOTS );
+}
+
+/*******************************************************************************
+ * @fn     uint8_t set_slot( uint8_t index, uint16_t offset, uint16_t length )
+ * @brief  Fill in the index-th entry of slot_table, returns the next index
+ * ****************************************************************************/
+uint8_t set_slot( uint8_t index, uint16_t offset, uint16_t length )
+{
+  slot_table[index].offset = offset;
+  slot_table[index].length = length;
   
-  data = (packet_data_t*)(tx_buffer + sizeof(packet_header_t));
+  return index + 1;
+}
+
+/*******************************************************************************
+ * @fn     void change_cell( uint8_t new_cell, uint8_t index )
+ * @brief  Move to another cell, on its index-th channel. Its access point has
+ *         its own time, slot map and neighbors, start over as if just
+ *         switched on
+ * ****************************************************************************/
+void change_cell( uint8_t new_cell, uint8_t index )
+{
+  cell = new_cell;
+  cell_silence = 0;
   
-  memcpy( data->samples, &sample_buffer[ current_buffer * ADC_MAX_SAMPLES ], 
-  ( sizeof(sample_buffer) / 2 ) );
+  soft_timer_cancel( &move_delay );
+  move_index = SURVEY_CHANNELS;
   
-  radio_tx( tx_buffer, sizeof(packet_header_t) + sizeof(packet_data_t) );
+  last_sync_valid = 0;
+  setup_clock_sync();
   
-  return 0;
+  my_slot = MAX_SLOTS;
+  spare_slot = MAX_SLOTS;
+  energy_report_due = 0;
+  memset( resend_request, 0, sizeof(resend_request) );
+  tdma_set_table( slot_table, 0 );
+  
+  route_init( &route, DEVICE_ADDRESS, 0 );
+  
+  set_channel( index );
 }
 
 /*******************************************************************************
- * @fn     void setup_adc()
- * @brief  TODO (Code from VIBE)
+ * @fn     void set_channel( uint8_t index )
+ * @brief  Switch to the cell's index-th channel (see SURVEY_CHANNEL), to
+ *         listen and send on
  * ****************************************************************************/
-void setup_adc()
+void set_channel( uint8_t index )
 {
-  // Enable 2.5V shared reference, disable temperature sensor to save power
-	REFCTL0 |= REFMSTR+REFVSEL_2+REFON+REFTCOFF;
-
-  /* Initialize ADC12_A */
-  ADC12CTL0 = ADC12ON+ADC12SHT0_10;	// Turn on ADC12, set sampling time
-  ADC12CTL1 = ADC12SHP; // Use sampling timer, single channel, single conversion
-  ADC12MCTL0 = ADC12INCH_0;		// ref+=AVcc, channel = A1
-  ADC12IE = 0x01;                           	// Enable ADC12IFG.0
-  ADC12CTL0 |= ADC12ENC;                    	// Enable conversions
+  uint8_t entry;
+  
+  channel_index = index;
+  
+  for( entry = 0; entry < sizeof(slot_table)/sizeof(tdma_slot_t); entry++ )
+  {
+    slot_table[entry].channel = SURVEY_CHANNEL( cell, channel_index );
+  }
+  radio_set_channel( SURVEY_CHANNEL( cell, channel_index ) );
+}
 
+/*******************************************************************************
+ * @fn     uint8_t move_timer()
+ * @brief  Soft timer callback, the re-sends of the last beacon announcing a
+ *         move are over. Same access point on another channel, so the time
+ *         and slot stay good
+ * ****************************************************************************/
+uint8_t move_timer()
+{
+  if( move_index < SURVEY_CHANNELS )
+  {
+    set_channel( move_index );
+    move_index = SURVEY_CHANNELS;
+  }
+  
+  return 0;
 }
 
-/**************************************************************************//**
- * @fn		__interrupt void ADC12ISR (void)
- * @brief	ADC ISR. Peripherals using ADC include:
- * 			gyroscope - 3 channels for triple-axis gyro data
- * ***************************************************************************/
-wakeup interrupt (ADC12_VECTOR) ADC12ISR(void) 	// CHANGE
+/*******************************************************************************
+ * @fn     uint8_t cell_timer_tick()
+ * @brief  Soft timer callback every timer period. When the access point
+ *         hasn't been heard for CELL_TIMEOUT, go back to the home cell (CELL)
+ *         from another one, or look for it on the home cell's next channel
+ *         (the one announced, if a move was missed)
+ * ****************************************************************************/
+uint8_t cell_timer_tick()
 {
-	switch(ADC12IV)
-	{
-	case  6:	// Vector  6:  ADC12IFG0
+  if( ++cell_silence <= CELL_TIMEOUT )
+  {
+    return 0;
+  }
+  
+  if( CELL != cell )
+  {
+    change_cell( CELL, 0 );
+  }
+  else
+  {
+    cell_silence = 0;
+    set_channel( ( move_index < SURVEY_CHANNELS ) ? move_index :
+                                 ( channel_index + 1 ) % SURVEY_CHANNELS );
+    move_index = SURVEY_CHANNELS;
+  }
+  
+  return 0;
+}
 
-    // This will be in ADC ISR, just testing for now
-    sample_buffer[buffer_index] = (uint8_t)(ADC12MEM0>>4);       
-    buffer_index++;
-    
-     if ( (ADC_MAX_SAMPLES) == buffer_index )
-    {      
-        current_buffer = 0;
-        
-    }
-    else if( (2*ADC_MAX_SAMPLES) == buffer_index )
+/*******************************************************************************
+ * @fn     uint8_t free_slot( uint8_t* map, uint8_t index )
+ * @brief  Slot of the index-th free slot in the map, MAX_SLOTS if there are
+ *         not that many
+ * ****************************************************************************/
+uint8_t free_slot( uint8_t* map, uint8_t index )
+{
+  uint8_t slot;
+  
+  for( slot = 0; slot < MAX_SLOTS; slot++ )
+  {
+    if( 0 == map[slot] )
     {
-        buffer_index = 0;
-        current_buffer = 1;       
+      if( 0 == index )
+      {
+        break;
+      }
+      index--;
     }
+  }
+  
+  return slot;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t slot_start( const tdma_slot_t* slot )
+ * @brief  TDMA callback, the queued packet was just sent. Prepare the next
+ *         one in the main loop
+ * ****************************************************************************/
+uint8_t slot_start( const tdma_slot_t* slot )
+{ 
+  // The join slot, a join that missed it waits for the next beacon
+  if( my_slot >= MAX_SLOTS )
+  {
+    tdma_queue( 0, 0 );
+    return 0;
+  }
+  
+  // With a re-send slot, a re-send goes out right after the sample slot and
+  // the next samples after the re-send slot. A block can go out twice or be
+  // skipped when the re-send slot comes or goes, the access point drops the
+  // copy and asks for the one skipped
+  if( (slot == &slot_table[0]) && (spare_slot < MAX_SLOTS) )
+  {
+    return post_event( EVENT_RESEND );
+  }
+  
+  // The report slot is next, it stays empty unless the beacon that started
+  // this superframe asked for a report
+  if( slot != &slot_table[report_entry] )
+  {
+    return energy_report_due ? post_event( EVENT_ENERGY_REPORT ) : 0;
+  }
+  
+  energy_report_due = 0;
+  return post_event( EVENT_SEND_SAMPLES );
+}
+
+/*******************************************************************************
+ * @fn     void send_samples()
+ * @brief  Queue the oldest sample block waiting in the ring for the next
+ *         slot. Nothing is sent if no block was filled since the last one
+ * ****************************************************************************/
+void send_samples()
+{ 
+  packet_header_t* header;
+  packet_data_t* data;
+  sample_block_t* block;
+  uint8_t length;
+  
+  block = sample_ring_peek( &sample_ring );
+  if( 0 == block )
+  {
+    return;
+  }
+  
+  led2_toggle();
+  
+  header = (packet_header_t*)tx_buffer;
+  data = (packet_data_t*)(tx_buffer + sizeof(packet_header_t));
+  
+#if COMPRESS_SAMPLES
+  // Only send the compressed block if the whole block fit in the space of
+  // the packed one, otherwise fall through and send it packed so nothing is
+  // lost
+  if( ADC_BLOCK_LEN == codec_encode( block->samples, ADC_BLOCK_LEN,
+                                      data->samples,
+                                      PACK12_LEN( ADC_BLOCK_LEN ), &length ) )
+  {
+    header->type = COMPRESSED_SAMPLES_PACKET;
+  }
+  else
+#endif
+  {
+    pack12( block->samples, ADC_BLOCK_LEN, data->samples );
+    length = PACK12_LEN( ADC_BLOCK_LEN );
+    header->type = SAMPLES_PACKET;
+  }
+  
+  // Little endian, same as the MSP430
+  memcpy( data->grid_index, &block->index, GRID_INDEX_LEN );
+  length += GRID_INDEX_LEN;
+  
+  // Keep it in case it has to be re-sent
+  sent_blocks[sent_next].block = BLOCK_NUMBER( block->index );
+  sent_blocks[sent_next].type = header->type;
+  sent_blocks[sent_next].length = length;
+  memcpy( sent_blocks[sent_next].data, data->grid_index, length );
+  sent_next = ( sent_next + 1 ) % NACK_WINDOW;
+  
+  // Everything needed from the block is in the packet now
+  sample_ring_release( &sample_ring );
+  
+  length += sizeof(route_header_t);
+  header->length = sizeof(packet_header_t) + length - 1;
+  
+  // route is also used from the radio interrupt
+  dint();
+  route_originate( &route, &data->route );
+  eint();
+  
+  tdma_queue( tx_buffer, sizeof(packet_header_t) + length );
 
-		led1_off();
-		break;
+#if ISR_PROFILE || STATS_ENABLE
+  // Once per beacon, like the access point
+  if( dump_sequence != last_sync_sequence )
+  {
+    dump_sequence = last_sync_sequence;
+#if ISR_PROFILE
+    isr_profile_dump();
+#endif
+#if STATS_ENABLE
+    event_stats_dump();
+    tdma_stats_dump();
+    soft_timer_stats_dump();
+#endif
+  }
+#endif
+#if TRACE_ENABLE
+  trace_dump();
+#endif
+#if ADC_JITTER
+  adc_jitter_dump();
+#endif
+}
 
-	default: break;
-	}
+/*******************************************************************************
+ * @fn     void send_resend()
+ * @brief  Queue the oldest block the access point asked for that is still
+ *         kept, for the re-send slot
+ * ****************************************************************************/
+void send_resend()
+{
+  packet_header_t* header;
+  sent_block_t* sent;
+  uint8_t found = 0;
+  uint8_t block;
+  uint8_t index;
+  
+  // resend_request is replaced from the radio interrupt
+  dint();
+  while( !found && nack_next( resend_request, &block ) )
+  {
+    for( index = 0; index < NACK_WINDOW; index++ )
+    {
+      sent = &sent_blocks[index];
+      if( sent->type && (block == sent->block) )
+      {
+        found = 1;
+        break;
+      }
+    }
+  }
+  eint();
+  
+  if( !found )
+  {
+    return;
+  }
+  
+  // Same packet as the first time, with a new route header
+  header = (packet_header_t*)resend_buffer;
+  header->source = DEVICE_ADDRESS;
+  header->type = sent->type;
+  header->flags = 0x00;
+  header->length = sizeof(packet_header_t) + sizeof(route_header_t) +
+                   sent->length - 1;
+  
+  memcpy( resend_buffer + sizeof(packet_header_t) + sizeof(route_header_t),
+          sent->data, sent->length );
+  
+  dint();
+  route_originate( &route, 
+                   (route_header_t*)(resend_buffer + sizeof(packet_header_t)) );
+  eint();
+  
+  tdma_queue( resend_buffer, header->length + 1 );
+}
 
-  // Exit from low-power mode on return from interrupt
-//	_BIC_SR_IRQ(LPM0_bits);
+/*******************************************************************************
+ * @fn     void send_energy_report()
+ * @brief  Queue the residency counters and charge estimate in a POWER_PACKET
+ *         for the report slot
+ * ****************************************************************************/
+void send_energy_report()
+{
+  packet_header_t* header;
+  energy_report_t report;
+  
+  get_energy_counters( &report.counters );
+  report.charge_per_hour = energy_charge_per_hour( &report.counters );
+  
+  // tx_buffer may be queued for the next slot, use a separate buffer
+  header = (packet_header_t*)power_buffer;
+  header->source = DEVICE_ADDRESS;
+  header->type = POWER_PACKET;
+  header->flags = 0x00;
+  header->length = sizeof(packet_header_t) + sizeof(route_header_t) +
+                   sizeof(energy_report_t) - 1;
+  
+  dint();
+  route_originate( &route, 
+                   (route_header_t*)(power_buffer + sizeof(packet_header_t)) );
+  eint();
+  
+  // power_buffer has no alignment guarantees, so copy instead of casting
+  memcpy( power_buffer + sizeof(packet_header_t) + sizeof(route_header_t), 
+          &report, sizeof(energy_report_t) );
+  
+  // Too late once the report slot has started, the samples for the next
+  // superframe may already be queued
+  dint();
+  if( energy_report_due )
+  {
+    tdma_queue( power_buffer, header->length + 1 );
+    energy_report_due = 0;
+  }
+  eint();
+}
 
+/*******************************************************************************
+ * @fn     void send_join()
+ * @brief  Ask the access point for a sample slot, in the join slot picked
+ *         from the last beacon
+ * ****************************************************************************/
+void send_join()
+{
+  packet_header_t* header;
+  
+  header = (packet_header_t*)join_buffer;
+  header->source = DEVICE_ADDRESS;
+  header->type = JOIN_PACKET;
+  header->flags = 0x00;
+  header->length = sizeof(join_buffer) - 1;
+  
+  dint();
+  route_originate( &route, 
+                   (route_header_t*)(join_buffer + sizeof(packet_header_t)) );
+  eint();
+  
+  // Not needed anymore if a slot was given in the meantime
+  dint();
+  if( my_slot >= MAX_SLOTS )
+  {
+    tdma_queue( join_buffer, sizeof(join_buffer) );
+  }
+  eint();
 }
 
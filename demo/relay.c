@@ -12,6 +12,16 @@
 #include "oscillator.h"
 #include "timers.h"
 #include "radio.h"
+#include "events.h"
+#include "soft_timers.h"
+#include "tdma.h"
+#include "clock_sync.h"
+#include "route.h"
+#include "aggregate.h"
+#include "survey.h"
+#include "trace.h"
+#include "profiler.h"
+#include "uart.h"
 
 typedef struct
 {
@@ -23,7 +33,7 @@ typedef struct
 
 typedef struct
 {
-  uint8_t samples[ADC_MAX_SAMPLES];
+  uint8_t samples[ADC_SAMPLES_LEN];
 } packet_data_t;
 
 typedef struct
@@ -32,11 +42,101 @@ typedef struct
   uint8_t lqi_crcok;
 } packet_footer_t;
 
+// Main loop events, lower number runs first
+#define EVENT_FORWARD (0)
+
+// Packets waiting to be forwarded, no more than the forward slots drain in one
+// major cycle (FORWARD_SLOTS full aggregates), anything past that would only
+// wait longer. At 16 entries of 66 bytes it's still a quarter of the RAM.
+// When the queue is full the oldest packet is dropped, and packets that
+// waited longer than FORWARD_MAX_AGE (ACLK ticks, ~4s) are dropped instead
+// of sent, the data is stale by then
+#define FORWARD_QUEUE_LEN ( FORWARD_SLOTS * AGGREGATE_PACKETS )
+#define FORWARD_MAX_AGE ( 2 * ((uint32_t)TIMER_LIMIT + 1) )
+
+// arg: source of the dropped packet
+#define TRACE_FORWARD_DROP (TRACE_USER)
+
+typedef struct
+{
+  uint32_t received;              // get_timestamp() when it arrived
+  uint8_t packet[PACKET_LEN+1];
+} forward_entry_t;
+
+typedef struct
+{
+  uint16_t received;      // Packets put in the queue
+  uint16_t forwarded;     // Packets sent in a forward slot
+  uint16_t dropped_full;  // Oldest packets dropped to make room
+  uint16_t dropped_stale; // Packets older than FORWARD_MAX_AGE
+} forward_stats_t;
+
 uint8_t heartbeat();
 uint8_t process_rx( uint8_t*, uint8_t );
+uint8_t forward_slot( const tdma_slot_t* );
+void forward_message();
+void forward_push( uint8_t* );
+void forward_pop();
+void forward_drop_stale();
+void forward_queue_head();
+void set_channel( uint8_t );
+uint8_t move_timer();
+
+// FIFO, oldest at forward_head. The oldest forward_batch packets are the
+// ones queued in the TDMA layer. Only used from the radio and timer
+// interrupts
+forward_entry_t forward_queue[FORWARD_QUEUE_LEN];
+uint8_t forward_head = 0;
+uint8_t forward_count = 0;
+forward_stats_t forward_stats;
 
-uint8_t tx_buffer[256];
-volatile uint8_t new_message = 0;
+// More than one packet is sent as an aggregate (see aggregate.h), built in
+// one buffer while the other may still be going out (radio_tx streams long
+// packets from the buffer). forward_originated is set once the aggregate
+// being built has its own route sequence number
+uint8_t forward_aggregate[2][AGGREGATE_LEN+1];
+uint8_t forward_next = 0;
+uint8_t forward_batch = 0;
+uint8_t forward_originated = 0;
+
+// Packets taken out of a received aggregate
+uint8_t forward_split[PACKET_LEN+1];
+
+// Parent toward the access point, see route.h
+route_t route;
+
+// Sync word time of the last beacon, see end_device.c
+uint32_t last_sync;
+uint8_t last_sync_sequence;
+uint8_t last_sync_valid = 0;
+
+#if ISR_PROFILE || STATS_ENABLE
+// Sequence of the beacon the last profile and statistics records were sent
+// after
+uint8_t dump_sequence;
+#endif
+
+// Which of the cell's channels (see SURVEY_CHANNEL) the relay is on, the one
+// the access point announced it is moving to (SURVEY_CHANNELS if none), and
+// heartbeats since the last beacon, see cell_timer_tick in end_device.c
+uint8_t channel_index = 0;
+uint8_t move_index = SURVEY_CHANNELS;
+uint8_t silence = 0;
+soft_timer_t move_delay;
+soft_timer_t heartbeat_timer;
+
+// Forward slots at the end of each major cycle, after every end device slot
+tdma_slot_t forward_table[FORWARD_SLOTS] = {
+  // owner, channel, offset, length
+  { DEVICE_ADDRESS, CELL_CHANNEL( CELL ), FORWARD_SLOT_OFFSET( 0 ),
+    FORWARD_SLOT },
+  { DEVICE_ADDRESS, CELL_CHANNEL( CELL ), FORWARD_SLOT_OFFSET( 1 ),
+    FORWARD_SLOT },
+  { DEVICE_ADDRESS, CELL_CHANNEL( CELL ), FORWARD_SLOT_OFFSET( 2 ),
+    FORWARD_SLOT },
+  { DEVICE_ADDRESS, CELL_CHANNEL( CELL ), FORWARD_SLOT_OFFSET( 3 ),
+    FORWARD_SLOT },
+};
 
 int main( void )
 {
@@ -44,64 +144,302 @@ int main( void )
   // Stop watchdog timer to prevent time out reset
   WDTCTL = WDTPW + WDTHOLD;
    
+  route_init( &route, DEVICE_ADDRESS, 0 );
+  
   // Make sure processor is running at 12MHz
   setup_oscillator();
    
   // Initialize LEDs
   setup_leds();
+  
+#if TRACE_ENABLE || ISR_PROFILE || STATS_ENABLE
+  // Trace, profile and statistics dumps are sent through the UART
+  setup_uart();
+#endif
    
   // Initialize timer
   set_ccr( 0, TIMER_LIMIT );
   setup_timer_a(MODE_UP);
+  setup_soft_timers();
+  setup_clock_sync();
+  
+  // Housekeeping once per timer period. Timer A1 is left to the profiler
+  // (see profiler.h)
+  soft_timer_start( &heartbeat_timer, TIMER_LIMIT + 1, TIMER_LIMIT + 1,
+                    heartbeat );
+  
+#if ISR_PROFILE
+  setup_isr_profiler();
+#endif
   
-  set_ccr( 2, 10 );
-  register_timer_callback( heartbeat, 2 );
+  setup_events( LPM3_bits );
+  register_event_handler( EVENT_FORWARD, forward_message );
+  
+  // Forward slots start once the first sync message arrives
+  setup_tdma( forward_table, FORWARD_SLOTS, MAJOR_CYCLE, forward_slot );
   
   // Initialize radio and enable receive callback function
   setup_radio( process_rx );
+  radio_set_channel( CELL_CHANNEL( CELL ) );
+  
+#if FLOOD_BEACONS
+  // Re-send beacons right as they end, along with every other node
+  radio_flood( 0x66, sizeof(packet_header_t) + SYNC_RELAYS_OFFSET, 
+               FLOOD_MAX_RELAYS );
+#endif
   
   // Full Power
   WriteSinglePATable(0xC0);
   
   // Enable interrupts, otherwise nothing will work
   eint();
+  
+  // Sleep and run event handlers, never returns
+  run_events();
+  
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t heartbeat()
+ * @brief  Soft timer callback every timer period (~2s). Blink, and keep
+ *         track of how long the access point has been quiet
+ * ****************************************************************************/
+uint8_t heartbeat()
+{
+  
+  led1_toggle();
+  
+  // Look for the access point on the cell's next channel when it goes quiet
+  if( ++silence > CELL_TIMEOUT )
+  {
+    silence = 0;
+    set_channel( ( move_index < SURVEY_CHANNELS ) ? move_index :
+                                 ( channel_index + 1 ) % SURVEY_CHANNELS );
+    move_index = SURVEY_CHANNELS;
+  }
    
-  while (1)
+  // Nothing for the main loop to do
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     void set_channel( uint8_t index )
+ * @brief  Switch to the cell's index-th channel, to listen and forward on
+ * ****************************************************************************/
+void set_channel( uint8_t index )
+{
+  uint8_t slot;
+  
+  channel_index = index;
+  
+  for( slot = 0; slot < FORWARD_SLOTS; slot++ )
   {
-    // Enter sleep mode
-    __bis_SR_register( LPM3_bits + GIE );
-    __no_operation();
-    
-    if ( new_message )
+    forward_table[slot].channel = SURVEY_CHANNEL( CELL, channel_index );
+  }
+  radio_set_channel( SURVEY_CHANNEL( CELL, channel_index ) );
+}
+
+/*******************************************************************************
+ * @fn     uint8_t move_timer()
+ * @brief  Soft timer callback, the re-sends of the last beacon announcing a
+ *         move are over
+ * ****************************************************************************/
+uint8_t move_timer()
+{
+  if( move_index < SURVEY_CHANNELS )
+  {
+    set_channel( move_index );
+    move_index = SURVEY_CHANNELS;
+  }
+  
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t forward_slot( const tdma_slot_t* slot )
+ * @brief  TDMA callback, one of the forward slots started. If the oldest
+ *         packets went out, free their entries, then queue the oldest packets
+ *         that are still fresh for the next slot
+ * ****************************************************************************/
+uint8_t forward_slot( const tdma_slot_t* slot )
+{
+  uint8_t sent = 0;
+  
+  if( forward_batch && !tdma_queued() )
+  {
+    forward_stats.forwarded += forward_batch;
+    while( forward_batch )
     {
-      volatile uint16_t delay;
-      
-      for( delay=0x9fff; delay > 0; delay-- )
-      {
-        __no_operation();
-      }
-      
-      radio_tx( tx_buffer, sizeof(packet_header_t) + sizeof(packet_data_t) );
-      led2_toggle();    
+      forward_pop();
+      forward_batch--;
     }
     
-    new_message = 0;
-        
+    // The aggregate may still be going out, build the next one in the other
+    // buffer
+    if( forward_originated )
+    {
+      forward_next ^= 1;
+      forward_originated = 0;
+    }
+    sent = 1;
   }
   
-  return 0;
+  forward_drop_stale();
+  forward_queue_head();
+  
+  return sent ? post_event( EVENT_FORWARD ) : 0;
 }
 
 /*******************************************************************************
- * @fn     uint8_t heartbeat()
- * @brief  TODO
+ * @fn     void forward_push( uint8_t* packet )
+ * @brief  Add a received packet at the end of the queue, dropping the oldest
+ *         one if it's full
  * ****************************************************************************/
-uint8_t heartbeat()
+void forward_push( uint8_t* packet )
 {
+  forward_entry_t* entry;
   
-  led1_toggle();
-   
-  return 1;
+  forward_stats.received++;
+  
+  if( FORWARD_QUEUE_LEN == forward_count )
+  {
+    TRACE( TRACE_FORWARD_DROP, forward_queue[forward_head].packet[1] )
+    forward_pop();
+    forward_stats.dropped_full++;
+  }
+  
+  entry = &forward_queue[(forward_head + forward_count) % FORWARD_QUEUE_LEN];
+  entry->received = get_timestamp();
+  // Add one to account for the byte with the packet length
+  memcpy( entry->packet, packet, packet[0] + 1 );
+  forward_count++;
+  
+  // The head may have changed
+  forward_queue_head();
+}
+
+/*******************************************************************************
+ * @fn     void forward_pop()
+ * @brief  Remove the oldest packet
+ * ****************************************************************************/
+void forward_pop()
+{
+  forward_head = ( forward_head + 1 ) % FORWARD_QUEUE_LEN;
+  forward_count--;
+}
+
+/*******************************************************************************
+ * @fn     void forward_drop_stale()
+ * @brief  Drop packets from the head of the queue that are too old to forward
+ * ****************************************************************************/
+void forward_drop_stale()
+{
+  uint32_t now = get_timestamp();
+  
+  while( forward_count && 
+         ((now - forward_queue[forward_head].received) > FORWARD_MAX_AGE) )
+  {
+    TRACE( TRACE_FORWARD_DROP, forward_queue[forward_head].packet[1] )
+    forward_pop();
+    forward_stats.dropped_stale++;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void forward_queue_head()
+ * @brief  Give the oldest packets to the TDMA layer for the next forward
+ *         slot, in one aggregate if more than one is waiting. The TDMA layer
+ *         only sends it if it fits in what's left of the slot after the guard
+ *         times, otherwise it waits for a later slot
+ * ****************************************************************************/
+void forward_queue_head()
+{
+  uint8_t* aggregate;
+  uint8_t* packet;
+  route_header_t* route_header;
+  uint8_t hops = 0;
+  
+  forward_batch = 0;
+  
+  if( 0 == forward_count )
+  {
+    tdma_queue( 0, 0 );
+    return;
+  }
+  
+  aggregate = forward_aggregate[forward_next];
+  aggregate_start( aggregate, DEVICE_ADDRESS, AGGREGATE_PACKET, 
+                   REPEATER_FLAG );
+  
+  while( forward_batch < forward_count )
+  {
+    packet = forward_queue[(forward_head + forward_batch) % 
+                           FORWARD_QUEUE_LEN].packet;
+    if( !aggregate_add( aggregate, packet, AGGREGATE_LEN ) )
+    {
+      break;
+    }
+    
+    route_header = (route_header_t*)(packet + sizeof(packet_header_t));
+    if( ROUTE_HOPS( route_header ) > hops )
+    {
+      hops = ROUTE_HOPS( route_header );
+    }
+    forward_batch++;
+  }
+  
+  if( forward_batch < 2 )
+  {
+    // Nothing to share the overhead with, send the packet as it is
+    forward_batch = 1;
+    packet = forward_queue[forward_head].packet;
+    tdma_queue( packet, packet[0] + 1 );
+    return;
+  }
+  
+  // Rebuilding an aggregate that wasn't sent yet keeps its sequence number
+  route_header = (route_header_t*)(aggregate + sizeof(packet_header_t));
+  if( !forward_originated )
+  {
+    route_originate( &route, route_header );
+    forward_originated = 1;
+  }
+  
+  // The aggregate counts as far along as its furthest travelled packet, so
+  // ROUTE_MAX_HOPS still holds for packets aggregated again further on
+  route_header->next_hop = route.parent;
+  route_header->hops_depth = ( hops << 4 ) | route.depth;
+  
+  tdma_queue( aggregate, aggregate[0] + 1 );
+}
+
+/*******************************************************************************
+ * @fn     void forward_message()
+ * @brief  a packet was forwarded
+ * ****************************************************************************/
+void forward_message()
+{
+  led2_toggle();
+
+#if ISR_PROFILE || STATS_ENABLE
+  // Once per beacon, like the access point
+  if( dump_sequence != last_sync_sequence )
+  {
+    dump_sequence = last_sync_sequence;
+#if ISR_PROFILE
+    isr_profile_dump();
+#endif
+#if STATS_ENABLE
+    event_stats_dump();
+    tdma_stats_dump();
+    soft_timer_stats_dump();
+#endif
+  }
+#endif
+#if TRACE_ENABLE
+  trace_dump();
+#endif
 }
 
 /*******************************************************************************
@@ -111,23 +449,110 @@ uint8_t heartbeat()
 uint8_t process_rx( uint8_t* buffer, uint8_t size )
 {
   packet_header_t* header;
+  packet_footer_t* footer;
+  route_header_t* route_header;
+  uint32_t sync_time;
+  uint8_t sequence;
+  uint8_t relays;
+  uint8_t offset;
+  uint8_t move;
+  uint8_t left;
+  
   header = (packet_header_t*)(buffer);
 
-  //packet_footer_t* footer;
   // Add one to account for the byte with the packet length
-  //footer = (packet_footer_t*)(buffer + header->length + 1 );
+  footer = (packet_footer_t*)(buffer + header->length + 1 );
   
   // Erase buffer just for fun
   //memset( buffer, 0x00, size );
   
   led3_toggle();
-  if( header->type == 0xAA )
+  if( (header->type == 0x66) && 
+      (header->length >= sizeof(packet_header_t) + SYNC_PAYLOAD_LEN - 1) &&
+      !(last_sync_valid && (last_sync_sequence == 
+                buffer[sizeof(packet_header_t) + SYNC_SEQUENCE_OFFSET])) )
   {
-    memcpy( tx_buffer, buffer, sizeof(packet_header_t) + sizeof(packet_data_t) );  
-    new_message = 1;
+    // Same clock sync and flood handling as the end devices, see 
+    // end_device.c
+    relays = buffer[sizeof(packet_header_t) + SYNC_RELAYS_OFFSET];
+    
+    route_age( &route );
+    if( 0 == relays )
+    {
+      route_heard( &route, header->source, 0, route_quality( footer->rssi ) );
+    }
+    
+    sequence = buffer[sizeof(packet_header_t) + SYNC_SEQUENCE_OFFSET];
+    memcpy( &sync_time, buffer + sizeof(packet_header_t) + SYNC_TIME_OFFSET,
+            sizeof(uint32_t) );
+    
+    if( last_sync_valid && ((uint8_t)(last_sync_sequence + 1) == sequence) )
+    {
+      clock_sync_beacon( last_sync, sync_time );
+    }
+    last_sync = radio_rx_timestamp() - RADIO_FLOOD_DELAY( BEACON_LEN, relays );
+    last_sync_sequence = sequence;
+    last_sync_valid = 1;
+    silence = 0;
+    
+    if( survey_find_move( buffer + sizeof(packet_header_t) + SYNC_NACK_OFFSET,
+                          NACK_ENTRIES, &move, &left ) &&
+        (move < SURVEY_CHANNELS) )
+    {
+      move_index = move;
+      if( 0 == left )
+      {
+        soft_timer_start( &move_delay, FLOOD_REMAINING( relays ) + 1, 0,
+                          move_timer );
+      }
+    }
+    
+    if( clock_sync_points() )
+    {
+      tdma_sync( local_to_global( last_sync ) );
+    }
+  }
+  else if( ROUTED_PACKET( header->type ) && 
+           (header->length >= sizeof(packet_header_t) + ROUTE_HEADER_LEN - 1) &&
+           ((header->length <= PACKET_LEN) || 
+            (header->type == AGGREGATE_PACKET)) )
+  {
+    route_header = (route_header_t*)(buffer + sizeof(packet_header_t));
+    
+    // Other relays can be parents too
+    if( header->flags & REPEATER_FLAG )
+    {
+      route_heard( &route, route_header->sender, ROUTE_DEPTH( route_header ),
+                   route_quality( footer->rssi ) );
+    }
+    
+    // Only forward packets sent to this relay, once
+    if( ROUTE_FORWARD == route_receive( &route, header->source, 
+                                        route_header ) )
+    {
+      if( header->type == AGGREGATE_PACKET )
+      {
+        // Queued one by one, they are aggregated again with whatever else
+        // is waiting
+        offset = 0;
+        while( aggregate_split( buffer, &offset, forward_split, PACKET_LEN ) )
+        {
+          ((packet_header_t*)forward_split)->flags |= REPEATER_FLAG;
+          forward_push( forward_split );
+        }
+      }
+      else
+      {
+        // Tells listeners this relay can forward for them
+        header->flags |= REPEATER_FLAG;
+        
+        // Sent from the timer interrupt in one of the next forward slots
+        forward_push( buffer );
+      }
+    }
   }
   
   
-  return 1;
+  return 0;
 }
 
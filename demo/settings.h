@@ -8,22 +8,253 @@
 #define _SETTINGS_H
 
 #include "common.h"
+#include "tdma.h"
+#include "energy.h"
+#include "route.h"
+#include "aggregate.h"
+#include "nack.h"
+#include "survey.h"
+#include "adc.h"
+#include "pack12.h"
 
-#define ADC_MAX_SAMPLES (50)
+// Samples are 12 bits, sent packed two to three bytes (see pack12.h):
+// ADC_MAX_SAMPLES take the ADC_SAMPLES_LEN bytes a sample packet has room for
+#define ADC_MAX_SAMPLES (33)
+#define ADC_SAMPLES_LEN PACK12_LEN( ADC_MAX_SAMPLES )
 
-#define MAX_DEVICES (5)
+// End devices convert ADC_CHANNELS inputs at every sample instant (see
+// adc.h), A0 first: 1 for A0 alone, 3 for the three axes of the gyro on A0
+// to A2. A sample block holds ADC_BLOCK_SAMPLES samples of each input, one
+// input after the other, so that it fits in a sample packet
+#define ADC_CHANNELS (1)
+#define ADC_BLOCK_SAMPLES ( ADC_MAX_SAMPLES / ADC_CHANNELS )
+#define ADC_BLOCK_LEN ( ADC_BLOCK_SAMPLES * ADC_CHANNELS )
 
-#define TIMER_LIMIT (65400)
+// Conversions start on the timer match of the sample clock, in hardware,
+// instead of when its interrupt gets to run (see ADC_TRIGGER_TIMER). Other
+// interrupts then can't delay the sampling instants. The timer only makes
+// one trigger per instant, set to 0 to sample several inputs
+#define ADC_TIMER_TRIGGER (1)
+
+// Full sample blocks wait in a ring for the sample slot (see sample_ring.h),
+// up to SAMPLE_RING_BLOCKS of them, a power of two. The ring only fills up
+// when blocks are made faster than the slot comes around, or while the
+// device has no slot
+#define SAMPLE_RING_BLOCKS (4)
+
+#if ADC_CHANNELS > ADC_MAX_CHANNELS
+#error "Each ADC input needs a DMA channel of its own"
+#endif
+
+#if ADC_TIMER_TRIGGER && (ADC_CHANNELS > 1)
+#error "A timer trigger only converts one ADC input"
+#endif
+
+// Sample slots handed out by the access point (see JOIN_PACKET)
+#define MAX_SLOTS (16)
+
+// Timer A0 counts 0...TIMER_LIMIT, a timer period is TIMER_LIMIT + 1 ticks
+// (~2s)
+#define TIMER_LIMIT (65399)
 
 #define SAMPLE_RATE (109)
 
+// Sample on the global grid (see sample_grid.h) so all devices sample at the
+// same instants. Set to 0 to free run from the local timer
+#define SAMPLE_GRID (1)
+
+// Sample packets carry the grid index of their first sample ahead of the
+// samples, least significant byte first. Only the low 3 bytes are sent so
+// the route header fits (wraps every ~15h, the host unwraps it)
+#define GRID_INDEX_LEN (3)
+#define GRID_INDEX_MASK ( (1UL << (8 * GRID_INDEX_LEN)) - 1 )
+
+// Sample blocks are numbered (see nack.h) from the grid index of their first
+// sample. Blocks start at least ADC_BLOCK_SAMPLES apart so the numbers
+// differ, and back to back blocks get consecutive numbers
+#define BLOCK_NUMBER( index ) \
+  ( (uint8_t)( ((index) & GRID_INDEX_MASK) / ADC_BLOCK_SAMPLES ) )
+
 #define REST_TIME (300)
 
+// TDMA superframe, a timer period is exactly 12 of them so superframes
+// start at the same counter values every period
 #define MAJOR_CYCLE (5450)
 
-#define MINOR_CYCLE (495)
+#if (TIMER_LIMIT + 1) % MAJOR_CYCLE
+#error "A timer period must be a whole number of major cycles"
+#endif
+
+// The access point sends a sync beacon every SYNC_PERIOD timer periods
+// (~8s). The end devices fit their clock skew to the beacons (see
+// clock_sync.h) so they can be far apart
+#define SYNC_PERIOD (4)
+
+// Sync beacon payload, after the packet header. Each beacon carries the
+// time its previous beacon's sync word went out (see radio_tx_timestamp),
+// the receivers pair it with their own sync word time for that beacon
+#define SYNC_RELAYS_OFFSET (0)   // uint8_t, times the beacon was re-sent
+#define SYNC_SEQUENCE_OFFSET (1) // uint8_t, beacon sequence number
+#define SYNC_TIME_OFFSET (2)     // uint32_t, time of beacon sequence - 1
+#define SYNC_MAP_OFFSET (6)      // uint8_t[MAX_SLOTS], owner of each slot
+#define SYNC_NACK_OFFSET (6 + MAX_SLOTS) // NACK_ENTRIES re-send requests
+#define SYNC_CELL_OFFSET \
+  ( SYNC_NACK_OFFSET + NACK_ENTRIES * NACK_ENTRY_LEN ) // uint8_t, see CELLS
+#define SYNC_PAYLOAD_LEN ( SYNC_CELL_OFFSET + 1 )
+
+// The access point asks for the sample blocks it missed with up to
+// NACK_ENTRIES requests per beacon (see nack.h), address 0 when unused. The
+// device named in the k-th request re-sends one block per superframe in the
+// k-th free sample slot, so nothing is re-sent once every slot is taken.
+// Requests only cover the blocks an end device keeps (NACK_WINDOW), losses
+// longer ago than that before the beacon stay lost. Set to 0 to turn
+// re-sends off
+//
+// With the default SYNC_PERIOD of 4 a device sends 48 blocks between beacons
+// and keeps 24, so most losses are gone before they can be asked for:
+// tools/nacksim recovers only 4-38% of the lost blocks, and more requests
+// per beacon don't change that. Recovery needs a shorter SYNC_PERIOD, at 1
+// it's 87-97% with 1% loss and 25-38% with 20% (4 to 12 devices)
+#define NACK_ENTRIES (2)
+
+// The network is split in CELLS cells, each an access point on its own
+// radio channel with its own beacons, slot map and TDMA schedule, so the
+// sample slots of all cells are in use at once. Nodes are built for a cell
+// (make CELL=n), end devices that find their cell full move to the cell its
+// beacon names (SYNC_CELL_OFFSET), and go back to CELL after CELL_TIMEOUT
+// timer periods without a beacon. Channels are 200kHz apart and the receive
+// filter is 541kHz wide, cells are CELL_SPACING channels apart (see
+// tools/cellsim for what that buys)
+#define CELLS (1)
+#define CELL_SPACING (4)
+#define CELL_CHANNEL( cell ) ( 0x14 + CELL_SPACING * (cell) )
+#define CELL_TIMEOUT ( 3 * SYNC_PERIOD )
+
+// Each cell can use SURVEY_CHANNELS channels, CELL_CHANNEL( cell ) first,
+// interleaved with the other cells' so they never share one. The access
+// point measures the noise on all of them (see survey.h) when it starts and
+// then on one per major cycle, in the quiet time between the beacon's
+// re-sends and the first sample slot. Every SURVEY_VISITS visits to each
+// channel it prints the results (see print_survey in access_point.c) and,
+// if another channel is clearly quieter, moves the cell there. The move is
+// announced in SURVEY_ANNOUNCE beacons, in place of the last re-send request,
+// and everyone switches at the end of the last one's re-sends. Nodes that
+// missed it look for their access point on the next channel (the announced
+// one first) after CELL_TIMEOUT timer periods without a beacon. Set
+// SURVEY_CHANNELS to 1 to stay on CELL_CHANNEL
+#define SURVEY_CHANNELS (8)
+#define SURVEY_CHANNEL( cell, index ) \
+  ( CELL_CHANNEL( cell ) + CELL_SPACING * CELLS * (index) )
+#define SURVEY_SAMPLES (32)   // Per visit, see RADIO_SURVEY_SAMPLE_CYCLES
+#define SURVEY_VISITS (32)
+#define SURVEY_ANNOUNCE (3)
+#define SURVEY_GUARD (40)
+#define SURVEY_OFFSET ( FLOOD_WINDOW + SURVEY_GUARD )
+
+// First byte of the UART record with the survey results. Can't be mistaken
+// for a packet length (see PROFILE_RECORD_MARKER)
+#define SURVEY_RECORD_MARKER (0xF3)
+
+#if (SURVEY_CHANNELS > 1) && (NACK_ENTRIES < 1)
+#error "Moving to another channel is announced in a re-send request entry"
+#endif
+
+// Beacons are flooded (see radio_flood): relays and end devices re-send a
+// beacon the moment it ends, up to FLOOD_MAX_RELAYS times, so it reaches
+// nodes out of the access point's range within a few ms. Receivers take
+// RADIO_FLOOD_DELAY off the sync word time of the copy they got to get the
+// access point's. Set FLOOD_BEACONS to 0 to only hear the access point
+#define FLOOD_BEACONS (1)
+#define FLOOD_MAX_RELAYS (3)
+#define BEACON_LEN ( 4 + SYNC_PAYLOAD_LEN )
+
+// Air time taken by a beacon and its re-sends, from the access point's sync
+// word. The slots start after it
+#if FLOOD_BEACONS
+#define FLOOD_WINDOW RADIO_FLOOD_DELAY( BEACON_LEN, FLOOD_MAX_RELAYS + 1 )
+#else
+#define FLOOD_WINDOW (0)
+#endif
+
+// Ticks from the end of a beacon copy that was re-sent relays times until
+// every re-send is out
+#if FLOOD_BEACONS
+#define FLOOD_REMAINING( relays ) \
+  ( ((relays) < FLOOD_MAX_RELAYS) ? \
+    FLOOD_WINDOW - RADIO_FLOOD_DELAY( BEACON_LEN, (relays) + 1 ) : 0 )
+#else
+#define FLOOD_REMAINING( relays ) (0)
+#endif
+
+// Slot lengths follow what each device sends per superframe (see tdma.h).
+// Packets have a 4 byte header, followed by the route header in the ones
+// sent toward the access point (see ROUTED_PACKET)
+#define SAMPLE_SLOT TDMA_SLOT_LENGTH( 4 + ROUTE_HEADER_LEN + GRID_INDEX_LEN + \
+                                      ADC_SAMPLES_LEN )
+#define POWER_SLOT TDMA_SLOT_LENGTH( 4 + ROUTE_HEADER_LEN + \
+                                     sizeof(energy_report_t) )
+
+// Sample slots are packed back to back after the sync beacon (and its
+// re-sends)
+#define SAMPLE_SLOT_OFFSET( index ) \
+  ( (REST_TIME/2) + FLOOD_WINDOW + SAMPLE_SLOT * (index) )
+
+// Send sample blocks delta/Rice compressed (see codec.h) when they fit in
+// fewer bytes than the packed block. Set to 0 to always send packed samples
+#define COMPRESS_SAMPLES (1)
+
+#define SAMPLES_PACKET (0xAA)
+#define COMPRESSED_SAMPLES_PACKET (0xAC)
+
+// The access point sets ENERGY_REQUEST_FLAG in every ENERGY_REPORT_PERIOD-th
+// sync beacon. Each device answers with a POWER_PACKET in a second set of
+// slots that starts after the sample slots of the first major cycle
+#define ENERGY_REPORT_PERIOD (30)
+#define ENERGY_REPORT_SLOT ( SAMPLE_SLOT_OFFSET( MAX_SLOTS ) )
+
+// Devices without a slot send a JOIN_PACKET (header only) in one of
+// JOIN_WINDOW contention slots after the energy report slots, in the first
+// major cycle after a beacon. The access point answers with the slot map of
+// the next beacon (0 marks a free slot). Slots not heard from for
+// SLOT_TIMEOUT beacons are taken back and the map is compacted
+#define JOIN_PACKET (0x67)
+#define JOIN_SLOT TDMA_SLOT_LENGTH( 4 + ROUTE_HEADER_LEN )
+#define JOIN_WINDOW (4)
+#define JOIN_OFFSET ( ENERGY_REPORT_SLOT + POWER_SLOT * MAX_SLOTS )
+#define SLOT_TIMEOUT (8)
+
+// Packets that go to the access point, possibly through relays. They carry
+// a route header (see route.h) right after the packet header
+#define ROUTED_PACKET( type ) ( ((type) == SAMPLES_PACKET) || \
+                                ((type) == COMPRESSED_SAMPLES_PACKET) || \
+                                ((type) == POWER_PACKET) || \
+                                ((type) == JOIN_PACKET) || \
+                                ((type) == AGGREGATE_PACKET) )
+
+// Relays send the packets they forward together in AGGREGATE_PACKETs (see
+// aggregate.h), up to AGGREGATE_LEN long: AGGREGATE_PACKETS full sample
+// packets. It's longer than the radio FIFO, radio_tx streams it
+#define AGGREGATE_PACKET (0x68)
+#define AGGREGATE_PACKETS (4)
+#define AGGREGATE_LEN ( 4 + ROUTE_HEADER_LEN - 1 + \
+        AGGREGATE_PACKETS * AGGREGATE_SIZE( 4 + ROUTE_HEADER_LEN + \
+                                            GRID_INDEX_LEN + \
+                                            ADC_SAMPLES_LEN - 1 ) )
+
+// Relays forward what they heard in FORWARD_SLOTS slots of their own at the
+// end of every major cycle, after the sample, energy report and join slots,
+// so relayed packets never overlap an end device's slot. Each slot fits the
+// longest aggregate
+#define FORWARD_SLOTS (4)
+#define FORWARD_SLOT TDMA_SLOT_LENGTH( AGGREGATE_LEN + 1 )
+#define FORWARD_SLOT_OFFSET( index ) \
+  ( JOIN_OFFSET + JOIN_SLOT * JOIN_WINDOW + FORWARD_SLOT * (index) )
 
-#define MAJOR_CYCLE_LOOP (60000)
+// Everything above has to fit in the first major cycle (see also
+// tools/schedcheck). The slot lengths use sizeof and casts, which #if can't
+// evaluate, so a layout that runs past it gives an array of negative size
+typedef char forward_slots_fit_major_cycle[
+  ( FORWARD_SLOT_OFFSET( FORWARD_SLOTS ) <= MAJOR_CYCLE ) ? 1 : -1 ];
 
 
 #endif /* _SETTINGS_H */\
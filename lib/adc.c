@@ -0,0 +1,394 @@
+/** @file adc.c
+*
+* @brief ADC12 sampling of several inputs, moved to block buffers by DMA
+*
+*   With software triggers every adc_start converts the inputs once, one
+*   after the other (sequence-of-channels mode with ADC12MSC). With timer
+*   triggers the converter runs in repeat-sequence mode and every rising
+*   edge of the timer output converts the next input, nothing is left for
+*   the CPU to do at the sampling instant. Either way the end of the
+*   sequence triggers one DMA channel per input, each copies its conversion
+*   result to the next word of its part of the block. The CPU only runs when
+*   a block is full, to point the DMA at the block after the next one.
+*
+*   The DMA channels run in repeated single transfer mode: when a block is
+*   full they reload the size and destination from their registers and go
+*   on with the next block right away. Those registers are rewritten while
+*   a block fills, so the interrupt has a whole block of time to run.
+*
+*   Conversions are 12 bits, right justified, the DMA copies them word by
+*   word. The conversion takes 4 ADC12CLK cycles more than an 8-bit one,
+*   next to the 512 of the sampling time.
+*
+*   adc_jitter_dump() sends one framed record through the UART:
+*   [0] ADC_JITTER_RECORD_MARKER
+*   [1] DEVICE_ADDRESS
+*   [2] trigger (ADC_TRIGGER_SOFTWARE or ADC_TRIGGER_TIMER)
+*   [3] ADC_JITTER_BINS
+*   [4...] adc_jitter_t, little endian
+*
+* @author Alvaro Prieto
+*/
+#include "adc.h"
+#include "timers.h"
+#include "profiler.h"
+#include "trace.h"
+#include <signal.h>
+#if ADC_JITTER
+#include <string.h>
+#include "uart.h"
+#endif
+
+static uint8_t dummy_callback( uint8_t );
+static void point_block( uint8_t, uint8_t );
+#if ADC_JITTER
+static void jitter_update( void );
+#endif
+
+// DMA channel register block layout, as word offsets from DMA0CTL
+#define DMA_STRIDE (8)      // DMA1CTL at +0x10
+#define DMA_SA_OFFSET (1)   // DMAxSAL at +0x02
+#define DMA_DA_OFFSET (3)   // DMAxDAL at +0x06
+#define DMA_SZ_OFFSET (5)   // DMAxSZ at +0x0A
+
+#define dma_channel( channel ) ( &DMA0CTL + DMA_STRIDE * (channel) )
+
+static uint16_t* adc_buffer;
+static uint8_t adc_channels;
+static uint8_t adc_samples;
+static uint8_t adc_trigger;
+static uint8_t (*block_callback)( uint8_t );
+
+// Block the DMA is writing to
+static volatile uint8_t filling;
+
+// Where the sample of the current sampling instant goes. Counted by
+// adc_start, the DMA may not have stored it yet
+static uint8_t sample_block;
+static uint8_t sample_position;
+
+#if ADC_JITTER
+#define RECORD_HEADER_LEN (4)
+
+static volatile uint16_t stamps[ADC_JITTER_STAMPS];
+static uint8_t stamp_next;
+static uint16_t last_stamp;
+static uint16_t last_interval;
+static uint8_t stamp_count;
+static adc_jitter_t jitter;
+
+static uint8_t record[RECORD_HEADER_LEN + sizeof(jitter)];
+#endif
+
+/*******************************************************************************
+ * @fn     void setup_adc( const uint8_t* inputs, uint8_t channels,
+ *                         uint16_t* buffer, uint8_t samples, uint8_t trigger,
+ *                         uint8_t (*callback)( uint8_t ) )
+ * @brief  Sample channels ADC inputs (ADC12INCH_x) into buffer, blocks of
+ *         samples samples per input (see ADC_BUFFER_LEN), on trigger (see
+ *         ADC_TRIGGER_TIMER). callback gets the block that was just filled,
+ *         from the DMA interrupt, and returns 1 to wake up the main loop
+ * ****************************************************************************/
+void setup_adc( const uint8_t* inputs, uint8_t channels, uint16_t* buffer,
+                uint8_t samples, uint8_t trigger,
+                uint8_t (*callback)( uint8_t ) )
+{
+  volatile uint16_t* dma;
+  uint8_t channel;
+
+  if( channels > ADC_MAX_CHANNELS )
+  {
+    channels = ADC_MAX_CHANNELS;
+  }
+
+  adc_buffer = buffer;
+  adc_channels = channels;
+  adc_samples = samples;
+  adc_trigger = trigger;
+  block_callback = ( 0 != callback ) ? callback : dummy_callback;
+
+  // Enable 2.5V shared reference, disable temperature sensor to save power
+  REFCTL0 |= REFMSTR+REFVSEL_2+REFON+REFTCOFF;
+
+  // Turn on ADC12, set sampling time
+  if( ADC_TRIGGER_TIMER == trigger )
+  {
+    // Every rising edge of TA0.1 samples and converts the next input
+    ADC12CTL0 = ADC12ON + ADC12SHT0_10;
+    ADC12CTL1 = ADC12SHP + ADC12SHS_1 + ADC12CONSEQ_3;
+    set_ccr_output( ADC_TIMER_CCR, OUTMOD_1 );
+  }
+  else
+  {
+    // Convert the whole sequence every time ADC12SC is set
+    ADC12CTL0 = ADC12ON + ADC12SHT0_10 + ADC12MSC;
+    ADC12CTL1 = ADC12SHP + ADC12SHS_0 + ADC12CONSEQ_1;
+  }
+  ADC12CTL2 = ADC12RES_2;
+
+  // ref+=AVcc, ADC12MEMx holds the conversion of input x of the list
+  for( channel = 0; channel < channels; channel++ )
+  {
+    ((volatile uint8_t*)&ADC12MCTL0)[channel] = inputs[channel];
+  }
+  ((volatile uint8_t*)&ADC12MCTL0)[channels - 1] |= ADC12EOS;
+
+  // The DMA reads the results, no ADC interrupts
+  ADC12IE = 0;
+
+  for( channel = 0; channel < channels; channel++ )
+  {
+    dma = dma_channel( channel );
+
+    // DMA0TSEL, DMA1TSEL and DMA2TSEL are the bytes of DMACTL0 and DMACTL1
+    ((volatile uint8_t*)&DMACTL0)[channel] = ADC_DMA_TRIGGER;
+
+    dma[DMA_SA_OFFSET] = (uint16_t)( &ADC12MEM0 + channel );
+    dma[DMA_SA_OFFSET + 1] = 0;
+    dma[DMA_DA_OFFSET + 1] = 0;
+
+    // Word from the fixed result register to the next word of the block
+    dma[0] = DMADT_4 + DMADSTINCR_3 + DMASRCINCR_0;
+  }
+
+  // DMA0 goes first, the last channel's transfer ends the sequence
+  dma_channel( channels - 1 )[0] |= DMAIE;
+
+  point_block( 0, 1 );
+  sample_block = 0;
+  sample_position = 0;
+
+#if ADC_JITTER
+  // Timer A1 free running from SMCLK, same as the profiler's
+  TA1CTL = TASSEL__SMCLK + MC_2 + TACLR;
+
+  memset( &jitter, 0x00, sizeof(jitter) );
+  jitter.min_cycles = 0xFFFF;
+  stamp_next = 0;
+  stamp_count = 0;
+
+  // The channel after the inputs' copies TA1R once they are done, in a ring
+  dma = dma_channel( channels );
+  ((volatile uint8_t*)&DMACTL0)[channels] = ADC_DMA_TRIGGER;
+  dma[DMA_SA_OFFSET] = (uint16_t)&TA1R;
+  dma[DMA_SA_OFFSET + 1] = 0;
+  dma[DMA_DA_OFFSET] = (uint16_t)stamps;
+  dma[DMA_DA_OFFSET + 1] = 0;
+  dma[DMA_SZ_OFFSET] = ADC_JITTER_STAMPS;
+  dma[0] = DMADT_4 + DMADSTINCR_3 + DMASRCINCR_0 + DMAEN;
+#endif
+
+  ADC12CTL0 |= ADC12ENC;
+}
+
+/*******************************************************************************
+ * @fn     void adc_start( void )
+ * @brief  Convert the inputs once. With timer triggers the conversion
+ *         already started at the timer match, this only counts it
+ * ****************************************************************************/
+void adc_start( void )
+{
+  if( ADC_TRIGGER_SOFTWARE == adc_trigger )
+  {
+    ADC12CTL0 |= ADC12SC;
+  }
+
+  if( ++sample_position == adc_samples )
+  {
+    sample_position = 0;
+    sample_block ^= 1;
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t adc_restart( void )
+ * @brief  Start the block being filled over. Returns 1 if the sample of the
+ *         current instant is its first, 0 if a timer triggered conversion
+ *         was already stored in the old block and the next one is the first
+ *         (don't call adc_start for it then)
+ * ****************************************************************************/
+uint8_t adc_restart( void )
+{
+  uint8_t current = 1;
+
+  if( (ADC_TRIGGER_TIMER == adc_trigger) && !(ADC12CTL1 & ADC12BUSY) )
+  {
+    current = 0;
+  }
+
+  point_block( filling, 1 );
+  sample_block = filling;
+  sample_position = 0;
+
+  return current;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t adc_block( void )
+ * @brief  Block the sample of the current instant goes to, 0 or 1
+ * ****************************************************************************/
+uint8_t adc_block( void )
+{
+  return sample_block;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t adc_position( void )
+ * @brief  Position of the sample of the current instant in its block
+ * ****************************************************************************/
+uint8_t adc_position( void )
+{
+  return sample_position;
+}
+
+/*******************************************************************************
+ * @fn     void point_block( uint8_t block, uint8_t restart )
+ * @brief  Point the DMA channels at block, the one after it is loaded when
+ *         block is full. With restart, block starts over right away,
+ *         otherwise it was already loaded
+ * ****************************************************************************/
+static void point_block( uint8_t block, uint8_t restart )
+{
+  volatile uint16_t* dma;
+  uint8_t channel;
+
+  for( channel = 0; channel < adc_channels; channel++ )
+  {
+    dma = dma_channel( channel );
+
+    if( restart )
+    {
+      // Setting DMAEN loads the size and addresses
+      dma[0] &= ~DMAEN;
+      dma[DMA_SZ_OFFSET] = adc_samples;
+      dma[DMA_DA_OFFSET] = (uint16_t)
+                  &adc_buffer[( block * adc_channels + channel ) * adc_samples];
+      dma[0] |= DMAEN;
+    }
+
+    dma[DMA_DA_OFFSET] = (uint16_t)
+            &adc_buffer[( (block ^ 1) * adc_channels + channel ) * adc_samples];
+  }
+
+  filling = block;
+}
+
+#if ADC_JITTER
+/*******************************************************************************
+ * @fn     void jitter_update( void )
+ * @brief  Add the sample intervals timestamped since the last call to the
+ *         statistics. Runs once per block so the ring never wraps past the
+ *         stamps not read yet
+ * ****************************************************************************/
+static void jitter_update( void )
+{
+  uint8_t stamp_end;
+  uint16_t stamp;
+  uint16_t interval;
+  uint16_t change;
+  uint8_t bin;
+
+  // The DMA counts down the stamps left before it wraps to the start
+  stamp_end = ( ADC_JITTER_STAMPS -
+                dma_channel( adc_channels )[DMA_SZ_OFFSET] ) %
+              ADC_JITTER_STAMPS;
+
+  for( ; stamp_next != stamp_end;
+       stamp_next = ( stamp_next + 1 ) % ADC_JITTER_STAMPS )
+  {
+    stamp = stamps[stamp_next];
+    interval = stamp - last_stamp;
+    last_stamp = stamp;
+
+    // An interval takes two stamps, a change two intervals
+    if( stamp_count < 2 )
+    {
+      stamp_count++;
+      if( stamp_count < 2 )
+      {
+        continue;
+      }
+    }
+    else
+    {
+      change = ( interval > last_interval ) ? interval - last_interval :
+                                              last_interval - interval;
+      for( bin = 0; (bin < ADC_JITTER_BINS - 1) && (change >> (bin + 1));
+           bin++ );
+      jitter.histogram[bin]++;
+    }
+    last_interval = interval;
+
+    if( 0xFFFF == jitter.count )
+    {
+      continue;
+    }
+    jitter.count++;
+    jitter.total_cycles += interval;
+    if( interval < jitter.min_cycles )
+    {
+      jitter.min_cycles = interval;
+    }
+    if( interval > jitter.max_cycles )
+    {
+      jitter.max_cycles = interval;
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void adc_jitter_dump( void )
+ * @brief  Send the sample interval statistics through the UART
+ * ****************************************************************************/
+void adc_jitter_dump( void )
+{
+  record[0] = ADC_JITTER_RECORD_MARKER;
+  record[1] = DEVICE_ADDRESS;
+  record[2] = adc_trigger;
+  record[3] = ADC_JITTER_BINS;
+
+  // Updated from the DMA interrupt
+  dint();
+  memcpy( &record[RECORD_HEADER_LEN], &jitter, sizeof(jitter) );
+  eint();
+
+  uart_write_escaped( record, sizeof(record) );
+}
+#endif
+
+/*******************************************************************************
+ * @fn     uint8_t dummy_callback( uint8_t block )
+ * @brief  Used when no callback is given
+ * ****************************************************************************/
+static uint8_t dummy_callback( uint8_t block )
+{
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     void dma_isr( void )
+ * @brief  DMA interrupt, a block is full and the next one is being filled
+ * ****************************************************************************/
+interrupt (DMA_VECTOR) dma_isr(void)
+{
+  PROFILE_ENTER( PROFILE_ADC_ISR )
+
+  // Reading DMAIV clears the flag, only the last channel interrupts
+  if( DMAIV )
+  {
+    point_block( filling ^ 1, 0 );
+
+    TRACE( TRACE_ADC, filling ^ 1 )
+
+#if ADC_JITTER
+    jitter_update();
+#endif
+
+    if( block_callback( filling ^ 1 ) )
+    {
+      __bic_SR_register_on_exit(LPM3_bits);
+    }
+  }
+
+  PROFILE_EXIT( PROFILE_ADC_ISR )
+}
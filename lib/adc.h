@@ -0,0 +1,75 @@
+/** @file adc.h
+*
+* @brief ADC12 sampling of several inputs, moved to block buffers by DMA
+*
+* @author Alvaro Prieto
+*/
+#ifndef _ADC_H
+#define _ADC_H
+
+#include "common.h"
+
+// One DMA channel per input, the CC430F6137 has three. Jitter measurement
+// builds (see ADC_JITTER) take one for the timestamps
+#define ADC_MAX_CHANNELS ( 3 - ADC_JITTER )
+
+// DMA trigger 24 is ADC12IFGx, set at the end of a conversion sequence (see
+// the CC430F613x datasheet)
+#define ADC_DMA_TRIGGER (24)
+
+// What starts the conversions: adc_start, or the output of Timer A0
+// ADC_TIMER_CCR going high (ADC12SHS_1), at the very tick the CCR matches.
+// Its interrupt must call adc_start after each match and set the next one
+// with set_ccr, which takes the output back down. A rising edge converts
+// one input, so several inputs take as many edges
+#define ADC_TRIGGER_SOFTWARE (0)
+#define ADC_TRIGGER_TIMER (1)
+#define ADC_TIMER_CCR (1)
+
+// Samples go to two blocks used in turn. A block holds the samples of each
+// channel one after the other:
+//
+// buffer[( block * channels + channel ) * samples + sample]
+//
+// Samples are full 12-bit conversions (0...4095), one per uint16_t
+#define ADC_BUFFER_LEN( channels, samples ) ( 2 * (channels) * (samples) )
+
+// Jitter measurement (make JITTER=1). The end of every conversion sequence
+// also triggers a DMA copy of TA1R, free running from SMCLK like the
+// profiler's (see profiler.h), to a ring of ADC_JITTER_STAMPS timestamps.
+// The block interrupt turns them into sample interval statistics, so blocks
+// must be shorter than the ring, and adc_jitter_dump() sends those through
+// the UART. Sample periods must be under 65536 cycles (5.4ms at 12MHz)
+#ifndef ADC_JITTER
+#define ADC_JITTER (0)
+#endif
+
+#define ADC_JITTER_STAMPS (128)
+
+// Histogram of the change between consecutive sample intervals, bin n
+// counts changes of 2^n...2^(n+1)-1 cycles (bin 0 also no change)
+#define ADC_JITTER_BINS (12)
+
+// First byte of the UART record. Can't be mistaken for a packet length (see
+// PROFILE_RECORD_MARKER)
+#define ADC_JITTER_RECORD_MARKER (0xF4)
+
+typedef struct
+{
+  uint16_t count;               // Sample intervals measured
+  uint16_t min_cycles;
+  uint16_t max_cycles;
+  uint32_t total_cycles;        // mean = total_cycles / count
+  uint16_t histogram[ADC_JITTER_BINS];
+} adc_jitter_t;
+
+void setup_adc( const uint8_t*, uint8_t, uint16_t*, uint8_t, uint8_t,
+                uint8_t (*)( uint8_t ) );
+void adc_start( void );
+uint8_t adc_restart( void );
+uint8_t adc_block( void );
+uint8_t adc_position( void );
+void adc_jitter_dump( void );
+
+#endif /* _ADC_H */\
+
@@ -0,0 +1,116 @@
+/** @file aggregate.c
+*
+* @brief Several routed packets sent as one radio packet, see aggregate.h
+*
+*   A relay forwarding packets from several end devices saves the preamble,
+*   sync word, CRC and slot guard times of all but one of them, plus three
+*   bytes of route header each.
+*
+* @author Alvaro Prieto
+*/
+#include "aggregate.h"
+#include <string.h>
+
+// Where the carried packets start in an aggregate
+#define AGGREGATE_FIRST ( AGGREGATE_PACKET_HEADER_LEN + ROUTE_HEADER_LEN )
+
+/*******************************************************************************
+ * @fn     void aggregate_start( uint8_t* aggregate, uint8_t source,
+ *                               uint8_t type, uint8_t flags )
+ * @brief  Start an empty aggregate. The route header after the packet header
+ *         is left for the caller (see route_originate)
+ * ****************************************************************************/
+void aggregate_start( uint8_t* aggregate, uint8_t source, uint8_t type,
+                      uint8_t flags )
+{
+  aggregate[0] = AGGREGATE_FIRST - 1;
+  aggregate[1] = source;
+  aggregate[2] = type;
+  aggregate[3] = flags;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t aggregate_add( uint8_t* aggregate, const uint8_t* packet,
+ *                                uint8_t max_length )
+ * @brief  Add a routed packet to the aggregate, as long as the aggregate's
+ *         length byte stays under max_length. Returns 1 if it was added
+ * ****************************************************************************/
+uint8_t aggregate_add( uint8_t* aggregate, const uint8_t* packet,
+                       uint8_t max_length )
+{
+  uint8_t* entry;
+  uint8_t payload;
+
+  if( (packet[0] < AGGREGATE_FIRST - 1) ||
+      (aggregate[0] + AGGREGATE_SIZE( packet[0] ) > max_length) )
+  {
+    return 0;
+  }
+
+  payload = packet[0] + 1 - AGGREGATE_FIRST;
+  entry = aggregate + aggregate[0] + 1;
+
+  entry[0] = AGGREGATE_HEADER_LEN - 1 + payload;
+  entry[1] = packet[1];
+  entry[2] = packet[2];
+  entry[3] = packet[3];
+  entry[4] = ((const route_header_t*)(packet +
+                                      AGGREGATE_PACKET_HEADER_LEN))->sequence;
+  memcpy( entry + AGGREGATE_HEADER_LEN, packet + AGGREGATE_FIRST, payload );
+
+  aggregate[0] += AGGREGATE_SIZE( packet[0] );
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t aggregate_split( const uint8_t* aggregate, uint8_t* offset,
+ *                                  uint8_t* packet, uint8_t max_length )
+ * @brief  Copy the next packet carried in the aggregate to packet, with the
+ *         aggregate's route header and the packet's own sequence number.
+ *         offset starts at 0 and is moved past the packet. Returns 0 when
+ *         there are no more, or the rest of the aggregate doesn't make sense
+ *         or holds a packet longer than max_length
+ * ****************************************************************************/
+uint8_t aggregate_split( const uint8_t* aggregate, uint8_t* offset,
+                         uint8_t* packet, uint8_t max_length )
+{
+  const uint8_t* entry;
+  uint16_t end;
+  uint8_t payload;
+
+  if( 0 == *offset )
+  {
+    *offset = AGGREGATE_FIRST;
+  }
+
+  end = aggregate[0] + 1;
+  entry = aggregate + *offset;
+
+  if( ((uint16_t)*offset + AGGREGATE_HEADER_LEN > end) ||
+      (entry[0] < AGGREGATE_HEADER_LEN - 1) ||
+      ((uint16_t)*offset + entry[0] + 1 > end) )
+  {
+    return 0;
+  }
+
+  payload = entry[0] + 1 - AGGREGATE_HEADER_LEN;
+  if( AGGREGATE_FIRST - 1 + payload > max_length )
+  {
+    return 0;
+  }
+
+  packet[0] = AGGREGATE_FIRST - 1 + payload;
+  packet[1] = entry[1];
+  packet[2] = entry[2];
+  packet[3] = entry[3];
+  memcpy( packet + AGGREGATE_PACKET_HEADER_LEN,
+          aggregate + AGGREGATE_PACKET_HEADER_LEN, ROUTE_HEADER_LEN );
+  ((route_header_t*)(packet + AGGREGATE_PACKET_HEADER_LEN))->sequence =
+                                                                     entry[4];
+  memcpy( packet + AGGREGATE_FIRST, entry + AGGREGATE_HEADER_LEN, payload );
+
+  *offset += entry[0] + 1;
+
+  return 1;
+}
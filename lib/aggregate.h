@@ -0,0 +1,39 @@
+/** @file aggregate.h
+*
+* @brief Several routed packets sent as one radio packet
+*
+* @author Alvaro Prieto
+*/
+#ifndef _AGGREGATE_H
+#define _AGGREGATE_H
+
+// No hardware dependencies here so the host simulation can build
+// aggregate.c as is
+#include <stdint.h>
+#include "route.h"
+
+// Packets here are the ones sent toward the access point: the packet header
+// (length, source, type, flags) followed by the route header and payload.
+//
+// An aggregate is one of those, made by a relay, with the packets it carries
+// as payload. Each carried packet keeps its header and the sequence number
+// from its route header, the rest of the route header only matters for the
+// hop it was last sent over, the aggregate's own route header covers it:
+//
+// [length][source][type][flags][sequence][payload...]
+//
+// where length counts the bytes after it, like the packet header's
+#define AGGREGATE_PACKET_HEADER_LEN (4)
+#define AGGREGATE_HEADER_LEN (5)
+
+// Bytes a packet takes in an aggregate, from its length byte
+#define AGGREGATE_SIZE( length ) \
+  ( (length) + 1 + AGGREGATE_HEADER_LEN - \
+    AGGREGATE_PACKET_HEADER_LEN - ROUTE_HEADER_LEN )
+
+void aggregate_start( uint8_t*, uint8_t, uint8_t, uint8_t );
+uint8_t aggregate_add( uint8_t*, const uint8_t*, uint8_t );
+uint8_t aggregate_split( const uint8_t*, uint8_t*, uint8_t*, uint8_t );
+
+#endif /* _AGGREGATE_H */\
+
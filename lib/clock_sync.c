@@ -0,0 +1,251 @@
+/** @file clock_sync.c
+*
+* @brief Beacon based clock synchronization with skew compensation
+*
+*   Every beacon gives a pair of local and reference (global) timestamps.
+*   The offset between the two clocks is fitted with a least squares line
+*   over the last CLOCK_SYNC_POINTS beacons, so the slope is the skew between
+*   the crystals. Local times are converted with the fitted line instead of
+*   resetting the timer, which keeps slots aligned through missed beacons.
+*
+*   The fit is only redone when a beacon arrives. Converting a time is one
+*   64-bit multiply.
+*
+*   Nothing here disables interrupts. Call the functions from interrupt
+*   context, or with interrupts disabled.
+*
+* @author Alvaro Prieto
+*/
+#include "clock_sync.h"
+
+// Skew estimates past this are bad data. Two +-40ppm 32.768kHz crystals
+// (see TDMA_DRIFT_PPM) are at most 80ppm apart, the rest is margin for
+// temperature
+#define MAX_SKEW ( (int32_t)(((int64_t)100 << CLOCK_SYNC_SKEW_SHIFT) / 1000000L) )
+
+#define MAX_SUM_XY ( (int64_t)1 << (62 - CLOCK_SYNC_SKEW_SHIFT) )
+
+static void fit( void );
+static int32_t offset_at( uint32_t );
+static int32_t divide_round( int32_t, uint8_t );
+
+static uint32_t local_times[CLOCK_SYNC_POINTS];
+static int32_t offsets[CLOCK_SYNC_POINTS];
+static uint8_t newest;
+static uint8_t points;
+
+// Fitted line: offset(t) = mean_offset + skew * (t - mean_local)
+static uint32_t mean_local;
+static int32_t mean_offset;
+static int32_t skew;
+
+static clock_sync_stats_t stats;
+
+/*******************************************************************************
+ * @fn     void setup_clock_sync( void )
+ * @brief  forget all beacons
+ * ****************************************************************************/
+void setup_clock_sync( void )
+{
+  points = 0;
+  newest = 0;
+  skew = 0;
+  mean_offset = 0;
+  mean_local = 0;
+}
+
+/*******************************************************************************
+ * @fn     void clock_sync_beacon( uint32_t local_time, uint32_t global_time )
+ * @brief  A beacon sent at global_time (reference clock) was received at
+ *         local_time (see get_timestamp)
+ * ****************************************************************************/
+void clock_sync_beacon( uint32_t local_time, uint32_t global_time )
+{
+  int32_t offset = (int32_t)(global_time - local_time);
+  int32_t error;
+  int32_t max_error;
+
+  if( points )
+  {
+    error = offset - offset_at( local_time );
+    stats.last_error = ( error > 0x7FFF ) ? 0x7FFF :
+                       ( error < -0x7FFF ) ? -0x7FFF : (int16_t)error;
+
+    // Allow for the skew error growing with missed beacons, ~15ppm once
+    // compensated and ~250ppm before
+    max_error = CLOCK_SYNC_MAX_ERROR +
+      (int32_t)( clock_sync_age( local_time ) >> 
+                                  (clock_sync_compensated() ? 16 : 12) );
+
+    if( (error > max_error) || (error < -max_error) )
+    {
+      setup_clock_sync();
+      stats.resets++;
+    }
+  }
+
+  if( points )
+  {
+    newest = ( newest + 1 ) % CLOCK_SYNC_POINTS;
+  }
+  local_times[newest] = local_time;
+  offsets[newest] = offset;
+
+  if( points < CLOCK_SYNC_POINTS )
+  {
+    points++;
+  }
+
+  stats.beacons++;
+
+  fit();
+}
+
+/*******************************************************************************
+ * @fn     uint8_t clock_sync_points( void )
+ * @brief  number of beacons in the fit, 0 if not synchronized
+ * ****************************************************************************/
+uint8_t clock_sync_points( void )
+{
+  return points;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t clock_sync_compensated( void )
+ * @brief  returns 1 once there are enough beacons to trust the skew
+ * ****************************************************************************/
+uint8_t clock_sync_compensated( void )
+{
+  return ( points >= CLOCK_SYNC_MIN_POINTS );
+}
+
+/*******************************************************************************
+ * @fn     uint32_t clock_sync_age( uint32_t local_time )
+ * @brief  local ticks from the last beacon to local_time
+ * ****************************************************************************/
+uint32_t clock_sync_age( uint32_t local_time )
+{
+  return local_time - local_times[newest];
+}
+
+/*******************************************************************************
+ * @fn     uint32_t local_to_global( uint32_t local_time )
+ * @brief  convert a local timestamp to reference time
+ * ****************************************************************************/
+uint32_t local_to_global( uint32_t local_time )
+{
+  return local_time + offset_at( local_time );
+}
+
+/*******************************************************************************
+ * @fn     uint32_t global_to_local( uint32_t global_time )
+ * @brief  convert a reference time to a local timestamp. The offset is looked
+ *         up at an approximate local time, the error is skew squared
+ * ****************************************************************************/
+uint32_t global_to_local( uint32_t global_time )
+{
+  return global_time - offset_at( global_time - mean_offset );
+}
+
+/*******************************************************************************
+ * @fn     void clock_sync_get_stats( clock_sync_stats_t* out )
+ * @brief  copy synchronization statistics
+ * ****************************************************************************/
+void clock_sync_get_stats( clock_sync_stats_t* out )
+{
+  *out = stats;
+  out->skew = skew;
+}
+
+/*******************************************************************************
+ * @fn     int32_t offset_at( uint32_t local_time )
+ * @brief  offset from local to reference time at local_time, from the fit
+ * ****************************************************************************/
+static int32_t offset_at( uint32_t local_time )
+{
+  int32_t delta = (int32_t)(local_time - mean_local);
+
+  return mean_offset +
+         (int32_t)( ((int64_t)delta * skew) >> CLOCK_SYNC_SKEW_SHIFT );
+}
+
+/*******************************************************************************
+ * @fn     void fit( void )
+ * @brief  least squares fit of offset vs local time over the stored beacons.
+ *         Times are taken relative to the newest beacon so they fit in 32 bits
+ * ****************************************************************************/
+static void fit( void )
+{
+  int32_t sum_x = 0;
+  int32_t sum_y = 0;
+  int32_t mean_x;
+  int32_t mean_y;
+  int32_t dx;
+  int32_t dy;
+  int64_t sum_xy = 0;
+  int64_t sum_xx = 0;
+  uint8_t index;
+
+  for( index = 0; index < points; index++ )
+  {
+    sum_x += (int32_t)(local_times[index] - local_times[newest]);
+    sum_y += offsets[index] - offsets[newest];
+  }
+
+  mean_x = divide_round( sum_x, points );
+  mean_y = divide_round( sum_y, points );
+
+  mean_local = local_times[newest] + mean_x;
+  mean_offset = offsets[newest] + mean_y;
+
+  if( points < 2 )
+  {
+    skew = 0;
+    return;
+  }
+
+  for( index = 0; index < points; index++ )
+  {
+    dx = (int32_t)(local_times[index] - local_times[newest]) - mean_x;
+    dy = offsets[index] - offsets[newest] - mean_y;
+    sum_xy += (int64_t)dx * dy;
+    sum_xx += (int64_t)dx * dx;
+  }
+
+  if( 0 == sum_xx )
+  {
+    return;
+  }
+
+  // Keep the shifted sum in 63 bits when the beacons span a long time
+  while( (sum_xy > MAX_SUM_XY) || (sum_xy < -MAX_SUM_XY) )
+  {
+    sum_xy >>= 1;
+    sum_xx >>= 1;
+  }
+
+  skew = (int32_t)( (sum_xy << CLOCK_SYNC_SKEW_SHIFT) / sum_xx );
+
+  if( skew > MAX_SKEW )
+  {
+    skew = MAX_SKEW;
+  }
+  else if( skew < -MAX_SKEW )
+  {
+    skew = -MAX_SKEW;
+  }
+}
+
+/*******************************************************************************
+ * @fn     int32_t divide_round( int32_t value, uint8_t divisor )
+ * @brief  value / divisor rounded to the nearest integer
+ * ****************************************************************************/
+static int32_t divide_round( int32_t value, uint8_t divisor )
+{
+  if( value < 0 )
+  {
+    return -( (-value + (divisor >> 1)) / divisor );
+  }
+
+  return ( value + (divisor >> 1) ) / divisor;
+}
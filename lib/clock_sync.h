@@ -0,0 +1,45 @@
+/** @file clock_sync.h
+*
+* @brief Beacon based clock synchronization with skew compensation
+*
+* @author Alvaro Prieto
+*/
+#ifndef _CLOCK_SYNC_H
+#define _CLOCK_SYNC_H
+
+// No hardware dependencies here so the host simulation can build
+// clock_sync.c as is
+#include <stdint.h>
+
+// Beacons kept for the skew regression
+#define CLOCK_SYNC_POINTS (8)
+
+// Beacons needed before the skew estimate is trusted
+#define CLOCK_SYNC_MIN_POINTS (3)
+
+// A beacon further than this from the prediction (ACLK ticks) means the
+// reference restarted, start over
+#define CLOCK_SYNC_MAX_ERROR (64)
+
+// Skew is kept in 2^-CLOCK_SYNC_SKEW_SHIFT units (~0.06 ppm)
+#define CLOCK_SYNC_SKEW_SHIFT (24)
+
+typedef struct
+{
+  uint16_t beacons;     // Beacons added
+  uint16_t resets;      // Times the history was thrown away
+  int16_t last_error;   // Last beacon vs prediction, in ACLK ticks
+  int32_t skew;         // Reference vs local clock rate - 1, see SKEW_SHIFT
+} clock_sync_stats_t;
+
+void setup_clock_sync( void );
+void clock_sync_beacon( uint32_t, uint32_t );
+uint8_t clock_sync_points( void );
+uint8_t clock_sync_compensated( void );
+uint32_t clock_sync_age( uint32_t );
+uint32_t local_to_global( uint32_t );
+uint32_t global_to_local( uint32_t );
+void clock_sync_get_stats( clock_sync_stats_t* );
+
+#endif /* _CLOCK_SYNC_H */\
+
@@ -0,0 +1,293 @@
+/** @file codec.c
+*
+* @brief Lossless sample block compression (delta + zig-zag + Rice)
+*
+*   Each sample is sent as the difference to the previous one. Differences are
+*   zig-zag mapped (0,-1,1,-2... -> 0,1,2,3...) and Rice coded with a single
+*   parameter k per block: the quotient (value >> k) in unary followed by the
+*   k low bits. Large quotients are escaped so the worst case is fixed.
+*   Differences are taken modulo 4096, a 12-bit sample can't differ from
+*   the previous one by more than that.
+*
+*   Only shifts, adds and compares by constants are used, no multiply/divide,
+*   so encoding cost per sample is bounded and small on the MSP430.
+*
+* @author Alvaro Prieto
+*/
+#include "codec.h"
+#include <string.h>
+
+// Sign extends the low 12 bits of a difference, -2048...2047
+#define DELTA( difference ) \
+  ((int16_t)((uint16_t)(difference) << (16 - CODEC_SAMPLE_BITS)) >> \
+                                        (16 - CODEC_SAMPLE_BITS))
+
+#define ZIGZAG( delta ) ((uint16_t)(((delta) << 1) ^ ((delta) >> 15)))
+#define UNZIGZAG( value ) ((uint16_t)(((value) >> 1) ^ (-((value) & 1))))
+
+typedef struct
+{
+  uint8_t* byte;
+  uint8_t mask;
+} bit_writer_t;
+
+typedef struct
+{
+  const uint8_t* byte;
+  uint8_t mask;
+  uint16_t bits_left;
+  uint8_t overrun;
+} bit_reader_t;
+
+static void put_ones( bit_writer_t*, uint8_t );
+static void put_bits( bit_writer_t*, uint16_t, uint8_t );
+static uint8_t get_bit( bit_reader_t* );
+static uint16_t get_bits( bit_reader_t*, uint8_t );
+
+/*******************************************************************************
+ * @fn     uint8_t codec_encode( const uint16_t* samples, uint8_t count,
+ *                        uint8_t* out, uint8_t out_size, uint8_t* out_length )
+ * @brief  Compress as many samples as fit in out_size bytes. Returns the number
+ *         of samples encoded and stores the used length in out_length
+ * ****************************************************************************/
+uint8_t codec_encode( const uint16_t* samples, uint8_t count,
+                      uint8_t* out, uint8_t out_size, uint8_t* out_length )
+{
+  bit_writer_t writer;
+  uint32_t sum = 0;
+  uint16_t bits_left;
+  uint16_t bits_used = 0;
+  uint16_t zz;
+  uint16_t q;
+  uint8_t needed;
+  uint8_t encoded;
+  uint8_t k;
+  int16_t delta;
+
+  *out_length = 0;
+
+  if( (0 == count) || (out_size <= CODEC_HEADER_LEN) )
+  {
+    return 0;
+  }
+
+  // Pick the Rice parameter so 2^k is close to the mean zig-zag value
+  for( encoded = 1; encoded < count; encoded++ )
+  {
+    delta = DELTA( samples[encoded] - samples[encoded - 1] );
+    sum += ZIGZAG( delta );
+  }
+
+  k = 0;
+  while( (k < CODEC_MAX_K) && (((uint32_t)count << (k + 1)) <= sum) )
+  {
+    k++;
+  }
+
+  memset( out, 0x00, out_size );
+  out[1] = k;
+  out[2] = (uint8_t)samples[0];
+  out[3] = (uint8_t)( samples[0] >> 8 ) & (CODEC_SAMPLE_MASK >> 8);
+
+  writer.byte = &out[CODEC_HEADER_LEN];
+  writer.mask = 0x80;
+  bits_left = (uint16_t)(out_size - CODEC_HEADER_LEN) << 3;
+
+  for( encoded = 1; encoded < count; encoded++ )
+  {
+    delta = DELTA( samples[encoded] - samples[encoded - 1] );
+    zz = ZIGZAG( delta );
+    q = zz >> k;
+
+    if( q < CODEC_ESCAPE_Q )
+    {
+      needed = q + 1 + k;
+    }
+    else
+    {
+      needed = CODEC_ESCAPE_Q + CODEC_SAMPLE_BITS;
+    }
+
+    // Stop at the first sample that doesn't fit
+    if( needed > bits_left )
+    {
+      break;
+    }
+    bits_left -= needed;
+    bits_used += needed;
+
+    if( q < CODEC_ESCAPE_Q )
+    {
+      put_ones( &writer, q );
+      put_bits( &writer, 0, 1 ); // Unary terminator
+      put_bits( &writer, zz, k );
+    }
+    else
+    {
+      put_ones( &writer, CODEC_ESCAPE_Q );
+      put_bits( &writer, zz, CODEC_SAMPLE_BITS );
+    }
+  }
+
+  out[0] = encoded;
+  *out_length = CODEC_HEADER_LEN + ((bits_used + 7) >> 3);
+
+  return encoded;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t codec_decode( const uint8_t* in, uint8_t in_size,
+ *                                  uint16_t* samples, uint8_t max_samples )
+ * @brief  Expand an encoded block. Returns the number of samples decoded, or 0
+ *         if the block is malformed or doesn't fit in max_samples
+ * ****************************************************************************/
+uint8_t codec_decode( const uint8_t* in, uint8_t in_size,
+                      uint16_t* samples, uint8_t max_samples )
+{
+  bit_reader_t reader;
+  uint16_t zz;
+  uint8_t count;
+  uint8_t decoded;
+  uint8_t k;
+  uint8_t q;
+
+  if( in_size < CODEC_HEADER_LEN )
+  {
+    return 0;
+  }
+
+  count = in[0];
+  k = in[1];
+
+  if( (0 == count) || (count > max_samples) || (k > CODEC_MAX_K) )
+  {
+    return 0;
+  }
+
+  samples[0] = ( in[2] | ((uint16_t)in[3] << 8) ) & CODEC_SAMPLE_MASK;
+
+  reader.byte = &in[CODEC_HEADER_LEN];
+  reader.mask = 0x80;
+  reader.bits_left = (uint16_t)(in_size - CODEC_HEADER_LEN) << 3;
+  reader.overrun = 0;
+
+  for( decoded = 1; decoded < count; decoded++ )
+  {
+    q = 0;
+    while( (q < CODEC_ESCAPE_Q) && get_bit( &reader ) )
+    {
+      q++;
+    }
+
+    if( q < CODEC_ESCAPE_Q )
+    {
+      zz = ((uint16_t)q << k) | get_bits( &reader, k );
+    }
+    else
+    {
+      zz = get_bits( &reader, CODEC_SAMPLE_BITS );
+    }
+
+    if( reader.overrun )
+    {
+      return 0;
+    }
+
+    samples[decoded] = ( samples[decoded - 1] + UNZIGZAG( zz ) ) &
+                       CODEC_SAMPLE_MASK;
+  }
+
+  return count;
+}
+
+/*******************************************************************************
+ * @fn     void put_ones( bit_writer_t* writer, uint8_t count )
+ * @brief  append count '1' bits
+ * ****************************************************************************/
+static void put_ones( bit_writer_t* writer, uint8_t count )
+{
+  while( count-- )
+  {
+    *writer->byte |= writer->mask;
+    writer->mask >>= 1;
+    if( 0 == writer->mask )
+    {
+      writer->mask = 0x80;
+      writer->byte++;
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void put_bits( bit_writer_t* writer, uint16_t value, uint8_t count )
+ * @brief  append the count low bits of value, MSB first. Output buffer is
+ *         cleared beforehand so only '1' bits are written
+ * ****************************************************************************/
+static void put_bits( bit_writer_t* writer, uint16_t value, uint8_t count )
+{
+  uint16_t value_mask;
+
+  if( 0 == count )
+  {
+    return;
+  }
+
+  value_mask = 1 << (count - 1);
+
+  while( value_mask )
+  {
+    if( value & value_mask )
+    {
+      *writer->byte |= writer->mask;
+    }
+    value_mask >>= 1;
+    writer->mask >>= 1;
+    if( 0 == writer->mask )
+    {
+      writer->mask = 0x80;
+      writer->byte++;
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t get_bit( bit_reader_t* reader )
+ * @brief  read next bit, flags overrun if the block is exhausted
+ * ****************************************************************************/
+static uint8_t get_bit( bit_reader_t* reader )
+{
+  uint8_t bit;
+
+  if( 0 == reader->bits_left )
+  {
+    reader->overrun = 1;
+    return 0;
+  }
+  reader->bits_left--;
+
+  bit = (*reader->byte & reader->mask) ? 1 : 0;
+  reader->mask >>= 1;
+  if( 0 == reader->mask )
+  {
+    reader->mask = 0x80;
+    reader->byte++;
+  }
+
+  return bit;
+}
+
+/*******************************************************************************
+ * @fn     uint16_t get_bits( bit_reader_t* reader, uint8_t count )
+ * @brief  read count bits, MSB first
+ * ****************************************************************************/
+static uint16_t get_bits( bit_reader_t* reader, uint8_t count )
+{
+  uint16_t value = 0;
+
+  while( count-- )
+  {
+    value = (value << 1) | get_bit( reader );
+  }
+
+  return value;
+}
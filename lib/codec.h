@@ -0,0 +1,36 @@
+/** @file codec.h
+*
+* @brief Lossless sample block compression (delta + zig-zag + Rice)
+*
+* @author Alvaro Prieto
+*/
+#ifndef _CODEC_H
+#define _CODEC_H
+
+// No hardware dependencies here so the host decoder can build codec.c as is
+#include <stdint.h>
+
+// Samples are 12 bits (ADC12 conversions), deltas wrap around modulo 4096
+// so they are 12 bits too
+#define CODEC_SAMPLE_BITS (12)
+#define CODEC_SAMPLE_MASK ( (1 << CODEC_SAMPLE_BITS) - 1 )
+
+// Encoded block layout:
+// [0] number of samples in the block
+// [1] Rice parameter k
+// [2..3] first sample (raw, little endian)
+// [4...] Rice coded zig-zag deltas, MSB first
+#define CODEC_HEADER_LEN (4)
+
+#define CODEC_MAX_K ( CODEC_SAMPLE_BITS - 1 )
+
+// Quotients this large are escaped and the zig-zag value is sent raw, so no
+// sample ever takes more than CODEC_ESCAPE_Q + CODEC_SAMPLE_BITS bits
+// (bounded cycle count)
+#define CODEC_ESCAPE_Q (8)
+
+uint8_t codec_encode( const uint16_t*, uint8_t, uint8_t*, uint8_t, uint8_t* );
+uint8_t codec_decode( const uint8_t*, uint8_t, uint16_t*, uint8_t );
+
+#endif /* _CODEC_H */\
+
@@ -0,0 +1,194 @@
+/** @file energy.c
+*
+* @brief Radio and CPU state residency counters and charge estimate
+*
+*   The radio driver and the main loop sleep path report every state change.
+*   The time spent in the state being left is added to its counter, so the
+*   counters only cost a timestamp per transition.
+*
+*   Time spent in interrupt handlers while the main loop sleeps is counted
+*   as sleep time.
+*
+* @author Alvaro Prieto
+*/
+#include "energy.h"
+#include "timers.h"
+#include "intrinsics.h"
+
+static void account( uint32_t*, uint8_t*, uint8_t, uint32_t* );
+
+static energy_counters_t counters;
+
+static uint8_t radio_state = ENERGY_RADIO_IDLE;
+static uint8_t cpu_state = ENERGY_CPU_ACTIVE;
+static uint8_t vcore_level = 0;
+
+static uint32_t radio_since;
+static uint32_t cpu_since;
+static uint32_t vcore_since;
+
+static const uint16_t radio_currents[TOTAL_RADIO_STATES] = {
+  CURRENT_RADIO_IDLE, CURRENT_RADIO_RX, CURRENT_RADIO_TX };
+
+static const uint16_t cpu_currents[TOTAL_CPU_STATES] = {
+  CURRENT_CPU_ACTIVE, CURRENT_CPU_LPM0, CURRENT_CPU_LPM3 };
+
+/*******************************************************************************
+ * @fn     void setup_energy( void )
+ * @brief  clear all counters. Timer A0 must be running (see setup_timer_a)
+ * ****************************************************************************/
+void setup_energy( void )
+{
+  uint16_t interrupt_state;
+  uint8_t index;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+
+  for( index = 0; index < TOTAL_RADIO_STATES; index++ )
+  {
+    counters.radio[index] = 0;
+  }
+  for( index = 0; index < TOTAL_CPU_STATES; index++ )
+  {
+    counters.cpu[index] = 0;
+  }
+  for( index = 0; index < TOTAL_VCORE_LEVELS; index++ )
+  {
+    counters.vcore[index] = 0;
+  }
+
+  radio_since = get_timestamp();
+  cpu_since = radio_since;
+  vcore_since = radio_since;
+
+  __set_interrupt_state( interrupt_state );
+}
+
+/*******************************************************************************
+ * @fn     void energy_radio_state( uint8_t state )
+ * @brief  radio is entering state (ENERGY_RADIO_xx)
+ * ****************************************************************************/
+void energy_radio_state( uint8_t state )
+{
+  account( counters.radio, &radio_state, state, &radio_since );
+}
+
+/*******************************************************************************
+ * @fn     void energy_cpu_state( uint8_t state )
+ * @brief  CPU is entering state (ENERGY_CPU_xx)
+ * ****************************************************************************/
+void energy_cpu_state( uint8_t state )
+{
+  account( counters.cpu, &cpu_state, state, &cpu_since );
+}
+
+/*******************************************************************************
+ * @fn     void energy_sleep_state( uint16_t lpm_bits )
+ * @brief  CPU is about to sleep with lpm_bits (LPM0_bits, LPM3_bits)
+ * ****************************************************************************/
+void energy_sleep_state( uint16_t lpm_bits )
+{
+  if( LPM3_bits == lpm_bits )
+  {
+    energy_cpu_state( ENERGY_CPU_LPM3 );
+  }
+  else
+  {
+    // LPM1/2 are counted as LPM0, the higher of their currents
+    energy_cpu_state( ENERGY_CPU_LPM0 );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void energy_vcore( uint8_t level )
+ * @brief  PMM core voltage changed to level
+ * ****************************************************************************/
+void energy_vcore( uint8_t level )
+{
+  if( level < TOTAL_VCORE_LEVELS )
+  {
+    account( counters.vcore, &vcore_level, level, &vcore_since );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void get_energy_counters( energy_counters_t* out )
+ * @brief  copy the counters, including the time spent in the current states
+ * ****************************************************************************/
+void get_energy_counters( energy_counters_t* out )
+{
+  uint16_t interrupt_state;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+
+  // Close the current intervals without changing state
+  account( counters.radio, &radio_state, radio_state, &radio_since );
+  account( counters.cpu, &cpu_state, cpu_state, &cpu_since );
+  account( counters.vcore, &vcore_level, vcore_level, &vcore_since );
+
+  *out = counters;
+
+  __set_interrupt_state( interrupt_state );
+}
+
+/*******************************************************************************
+ * @fn     uint32_t energy_charge_per_hour( const energy_counters_t* in )
+ * @brief  Estimated charge drawn per hour in uAh (which is also the average
+ *         current in uA) from the datasheet currents and residency counters.
+ *         Returns 0 until enough time has been counted
+ * ****************************************************************************/
+uint32_t energy_charge_per_hour( const energy_counters_t* in )
+{
+  uint32_t total = 0;
+  uint32_t scale;
+  uint32_t charge = 0;
+  uint8_t index;
+
+  // Every CPU state is counted exactly once, so use them for the total time
+  for( index = 0; index < TOTAL_CPU_STATES; index++ )
+  {
+    total += in->cpu[index];
+  }
+
+  // Work in 1/1024ths of the total time so nothing overflows 32 bits
+  scale = total >> 10;
+  if( 0 == scale )
+  {
+    return 0;
+  }
+
+  for( index = 0; index < TOTAL_RADIO_STATES; index++ )
+  {
+    charge += (in->radio[index] / scale) * radio_currents[index];
+  }
+  for( index = 0; index < TOTAL_CPU_STATES; index++ )
+  {
+    charge += (in->cpu[index] / scale) * cpu_currents[index];
+  }
+
+  return charge >> 10;
+}
+
+/*******************************************************************************
+ * @fn     void account( uint32_t* residency, uint8_t* state, uint8_t new_state,
+ *                                                          uint32_t* since )
+ * @brief  add the time since the last change to the current state's counter
+ * ****************************************************************************/
+static void account( uint32_t* residency, uint8_t* state, uint8_t new_state,
+                     uint32_t* since )
+{
+  uint16_t interrupt_state;
+  uint32_t now;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+
+  now = get_timestamp();
+  residency[*state] += now - *since;
+  *since = now;
+  *state = new_state;
+
+  __set_interrupt_state( interrupt_state );
+}
@@ -0,0 +1,57 @@
+/** @file energy.h
+*
+* @brief Radio and CPU state residency counters and charge estimate
+*
+* @author Alvaro Prieto
+*/
+#ifndef _ENERGY_H
+#define _ENERGY_H
+
+#include "common.h"
+
+#define ENERGY_RADIO_IDLE (0)
+#define ENERGY_RADIO_RX (1)
+#define ENERGY_RADIO_TX (2)
+#define TOTAL_RADIO_STATES (3)
+
+#define ENERGY_CPU_ACTIVE (0)
+#define ENERGY_CPU_LPM0 (1)
+#define ENERGY_CPU_LPM3 (2)
+#define TOTAL_CPU_STATES (3)
+
+#define TOTAL_VCORE_LEVELS (4)
+
+// Typical currents in uA from the CC430F613x datasheet (3V, 915MHz, 12MHz
+// MCLK). TX is for the 0dBm PA setting, it roughly doubles at +10dBm
+#define CURRENT_RADIO_IDLE (1700)
+#define CURRENT_RADIO_RX (18000)
+#define CURRENT_RADIO_TX (17000)
+#define CURRENT_CPU_ACTIVE (3100)
+#define CURRENT_CPU_LPM0 (90)
+#define CURRENT_CPU_LPM3 (2)
+
+// All times in ACLK ticks
+typedef struct
+{
+  uint32_t radio[TOTAL_RADIO_STATES];
+  uint32_t cpu[TOTAL_CPU_STATES];
+  uint32_t vcore[TOTAL_VCORE_LEVELS];
+} energy_counters_t;
+
+// POWER_PACKET payload
+typedef struct
+{
+  energy_counters_t counters;
+  uint32_t charge_per_hour; // uAh
+} energy_report_t;
+
+void setup_energy( void );
+void energy_radio_state( uint8_t );
+void energy_cpu_state( uint8_t );
+void energy_sleep_state( uint16_t );
+void energy_vcore( uint8_t );
+void get_energy_counters( energy_counters_t* );
+uint32_t energy_charge_per_hour( const energy_counters_t* );
+
+#endif /* _ENERGY_H */\
+
@@ -0,0 +1,223 @@
+/** @file events.c
+*
+* @brief Run-to-completion event scheduler for the main loop
+*
+*   Interrupt handlers only capture what is time critical and post an event.
+*   The main loop runs the handler of the highest priority pending event and
+*   sleeps in the configured low power mode when there is nothing left to do.
+*   Pending events are bits in a byte, so posting the same event twice before
+*   it runs only runs the handler once.
+*
+*   With STATS_ENABLE, event_stats_dump() sends one framed record through the
+*   UART:
+*   [0] EVENT_STATS_RECORD_MARKER
+*   [1] DEVICE_ADDRESS
+*   [2] TOTAL_EVENTS
+*   [3...] event_stats_t, little endian
+*
+* @author Alvaro Prieto
+*/
+#include "events.h"
+#include "timers.h"
+#include "intrinsics.h"
+#include "trace.h"
+#include "energy.h"
+#if STATS_ENABLE
+#include <string.h>
+#include "uart.h"
+#endif
+
+#define RECORD_HEADER_LEN (3)
+
+static void dummy_handler( void );
+
+static const uint8_t event_masks[TOTAL_EVENTS] = {
+  0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80 };
+
+static void (*event_handlers[TOTAL_EVENTS])( void );
+
+static volatile uint8_t pending_events;
+static volatile uint8_t pending_count;
+
+static uint16_t sleep_mode;
+
+static event_stats_t stats;
+
+#if STATS_ENABLE
+static uint8_t record[RECORD_HEADER_LEN + sizeof(event_stats_t)];
+#endif
+
+/*******************************************************************************
+ * @fn     void setup_events( uint16_t lpm_bits )
+ * @brief  Initialize handlers and set the low power mode used when idle
+ *         (LPM0_bits, LPM3_bits...)
+ * ****************************************************************************/
+void setup_events( uint16_t lpm_bits )
+{
+  uint8_t index;
+
+  for( index = 0; index < TOTAL_EVENTS; index++ )
+  {
+    event_handlers[index] = dummy_handler;
+  }
+
+  pending_events = 0;
+  pending_count = 0;
+  sleep_mode = lpm_bits;
+}
+
+/*******************************************************************************
+ * @fn     void register_event_handler( uint8_t event, void (*handler)(void) )
+ * @brief  set the function run from the main loop when event is posted
+ * ****************************************************************************/
+void register_event_handler( uint8_t event, void (*handler)(void) )
+{
+  if( event < TOTAL_EVENTS )
+  {
+    event_handlers[event] = handler;
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t post_event( uint8_t event )
+ * @brief  mark event as pending. Safe to call from interrupts. Always returns
+ *         1 so callbacks can 'return post_event(...)' to wake up the main loop
+ * ****************************************************************************/
+uint8_t post_event( uint8_t event )
+{
+  uint16_t interrupt_state;
+  uint8_t mask;
+
+  if( event >= TOTAL_EVENTS )
+  {
+    return 0;
+  }
+
+  mask = event_masks[event];
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+  if( pending_events & mask )
+  {
+    stats.coalesced++;
+  }
+  else
+  {
+    pending_events |= mask;
+    pending_count++;
+    if( pending_count > stats.max_depth )
+    {
+      stats.max_depth = pending_count;
+    }
+  }
+  __set_interrupt_state( interrupt_state );
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     void set_sleep_mode( uint16_t lpm_bits )
+ * @brief  change the deepest low power mode the main loop is allowed to use,
+ *         e.g. LPM0_bits while the UART is needed
+ * ****************************************************************************/
+void set_sleep_mode( uint16_t lpm_bits )
+{
+  sleep_mode = lpm_bits;
+}
+
+/*******************************************************************************
+ * @fn     void run_events( void )
+ * @brief  Main loop. Enables interrupts and never returns
+ * ****************************************************************************/
+void run_events( void )
+{
+  uint32_t start_time;
+  uint32_t run_time;
+  uint8_t event;
+
+  while (1)
+  {
+    dint();
+    if( 0 == pending_events )
+    {
+      // Setting GIE and the LPM bits in one instruction, so no event can
+      // slip in between the check and going to sleep
+      energy_sleep_state( sleep_mode );
+      __bis_SR_register( sleep_mode + GIE );
+      __no_operation();
+      energy_cpu_state( ENERGY_CPU_ACTIVE );
+      continue;
+    }
+
+    // Lowest set bit is the highest priority
+    for( event = 0; !(pending_events & event_masks[event]); event++ );
+
+    pending_events &= ~event_masks[event];
+    pending_count--;
+    eint();
+
+    TRACE( TRACE_HANDLER | TRACE_BEGIN, event )
+    start_time = get_timestamp();
+    event_handlers[event]();
+    run_time = get_timestamp() - start_time;
+    TRACE( TRACE_HANDLER | TRACE_END, event )
+
+    stats.dispatched++;
+    if( run_time > stats.max_run_time[event] )
+    {
+      stats.max_run_time[event] = (run_time > 0xFFFF) ? 0xFFFF : run_time;
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void get_event_stats( event_stats_t* out )
+ * @brief  copy queue depth and handler run time statistics and reset them
+ * ****************************************************************************/
+void get_event_stats( event_stats_t* out )
+{
+  uint16_t interrupt_state;
+  uint8_t index;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+  *out = stats;
+  stats.dispatched = 0;
+  stats.coalesced = 0;
+  stats.max_depth = pending_count;
+  for( index = 0; index < TOTAL_EVENTS; index++ )
+  {
+    stats.max_run_time[index] = 0;
+  }
+  __set_interrupt_state( interrupt_state );
+}
+
+#if STATS_ENABLE
+/*******************************************************************************
+ * @fn     void event_stats_dump( void )
+ * @brief  send the statistics through the UART (see record format above) and
+ *         reset them
+ * ****************************************************************************/
+void event_stats_dump( void )
+{
+  event_stats_t out;
+
+  get_event_stats( &out );
+
+  record[0] = EVENT_STATS_RECORD_MARKER;
+  record[1] = DEVICE_ADDRESS;
+  record[2] = TOTAL_EVENTS;
+  memcpy( &record[RECORD_HEADER_LEN], &out, sizeof(out) );
+
+  uart_write_escaped( record, sizeof(record) );
+}
+#endif
+
+/*******************************************************************************
+ * @fn     void dummy_handler( void )
+ * @brief  empty function works as default handler
+ * ****************************************************************************/
+static void dummy_handler( void )
+{
+  __no_operation();
+}
@@ -0,0 +1,36 @@
+/** @file events.h
+*
+* @brief Run-to-completion event scheduler for the main loop
+*
+* @author Alvaro Prieto
+*/
+#ifndef _EVENTS_H
+#define _EVENTS_H
+
+#include "common.h"
+
+// Event ids double as priorities, 0 is dispatched first
+#define TOTAL_EVENTS (8)
+
+// First byte of the UART record (build with STATS=1). Can't be mistaken for a
+// packet length (see PROFILE_RECORD_MARKER)
+#define EVENT_STATS_RECORD_MARKER (0xF5)
+
+typedef struct
+{
+  uint16_t dispatched;                  // Handlers run
+  uint16_t coalesced;                   // Posts of an already pending event
+  uint8_t max_depth;                    // Most events pending at once
+  uint16_t max_run_time[TOTAL_EVENTS];  // Worst handler run time, ACLK ticks
+} event_stats_t;
+
+void setup_events( uint16_t );
+void register_event_handler( uint8_t, void (*)(void) );
+uint8_t post_event( uint8_t );
+void set_sleep_mode( uint16_t );
+void run_events( void );
+void get_event_stats( event_stats_t* );
+void event_stats_dump( void );
+
+#endif /* _EVENTS_H */\
+
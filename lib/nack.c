@@ -0,0 +1,164 @@
+/** @file nack.c
+*
+* @brief Requests to re-send sample blocks the access point missed, see
+*        nack.h
+*
+*   The access point keeps a bitmap of the blocks it missed from each sender
+*   and asks for the oldest of them in the next sync beacon. Senders re-send
+*   them from the blocks they kept, oldest first.
+*
+* @author Alvaro Prieto
+*/
+#include "nack.h"
+
+// Blocks the access point tracks. Older ones are delivered as they come
+#define NACK_MASK ( ((uint32_t)1 << NACK_WINDOW) - 1 )
+
+// Blocks the access point asks for. A block is one superframe older when
+// its re-send goes out, the sender sends a new block first
+#define NACK_REQUEST_MASK ( ((uint32_t)1 << (NACK_WINDOW - 2)) - 1 )
+
+/*******************************************************************************
+ * @fn     void nack_init( nack_tracker_t* tracker )
+ * @brief  Forget everything about a sender, e.g. when its slot is given to
+ *         someone else
+ * ****************************************************************************/
+void nack_init( nack_tracker_t* tracker )
+{
+  tracker->missing = 0;
+  tracker->newest = 0;
+  tracker->valid = 0;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t nack_heard( nack_tracker_t* tracker, uint8_t block )
+ * @brief  A block arrived. Blocks skipped since the newest one are marked
+ *         missing. Returns 0 if the block had already arrived
+ * ****************************************************************************/
+uint8_t nack_heard( nack_tracker_t* tracker, uint8_t block )
+{
+  uint32_t bit;
+  uint8_t ahead;
+  uint8_t age;
+
+  if( 0 == tracker->valid )
+  {
+    tracker->missing = 0;
+    tracker->newest = block;
+    tracker->valid = 1;
+    return 1;
+  }
+
+  ahead = block - tracker->newest;
+  if( 0 == ahead )
+  {
+    return 0;
+  }
+
+  if( ahead < 0x80 )
+  {
+    // Newer block, the ones between it and the last newest never came
+    if( ahead > NACK_WINDOW )
+    {
+      tracker->missing = NACK_MASK;
+    }
+    else
+    {
+      tracker->missing = ( tracker->missing << ahead ) |
+                         ( ((uint32_t)1 << (ahead - 1)) - 1 );
+      tracker->missing &= NACK_MASK;
+    }
+    tracker->newest = block;
+    return 1;
+  }
+
+  // Older block, a re-send. Too old to be tracked, it can't be told from a
+  // copy
+  age = tracker->newest - block;
+  if( age > NACK_WINDOW )
+  {
+    return 1;
+  }
+
+  bit = (uint32_t)1 << (age - 1);
+  if( tracker->missing & bit )
+  {
+    tracker->missing &= ~bit;
+    return 1;
+  }
+
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t nack_request( const nack_tracker_t* tracker,
+ *                               uint8_t address, uint8_t* entry )
+ * @brief  Write a request for address' oldest missing blocks to entry
+ *         (NACK_ENTRY_LEN bytes). Returns 0 if nothing is missing
+ * ****************************************************************************/
+uint8_t nack_request( const nack_tracker_t* tracker, uint8_t address,
+                      uint8_t* entry )
+{
+  uint32_t wanted;
+  uint16_t bits = 0;
+  uint8_t oldest;
+  uint8_t index;
+
+  wanted = tracker->missing & NACK_REQUEST_MASK;
+  if( (0 == tracker->valid) || (0 == wanted) )
+  {
+    return 0;
+  }
+
+  oldest = NACK_WINDOW - 1;
+  while( !(wanted & ((uint32_t)1 << oldest)) )
+  {
+    oldest--;
+  }
+
+  // Bit oldest - i of wanted is block first + i
+  for( index = 0; (index < NACK_SPAN) && (index <= oldest); index++ )
+  {
+    if( wanted & ((uint32_t)1 << (oldest - index)) )
+    {
+      bits |= (uint16_t)1 << index;
+    }
+  }
+
+  entry[0] = address;
+  entry[1] = tracker->newest - 1 - oldest;
+  entry[2] = (uint8_t)bits;
+  entry[3] = (uint8_t)(bits >> 8);
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t nack_next( uint8_t* entry, uint8_t* block )
+ * @brief  Take the oldest block still asked for out of a request. Returns 0
+ *         when there are none left
+ * ****************************************************************************/
+uint8_t nack_next( uint8_t* entry, uint8_t* block )
+{
+  uint16_t bits;
+  uint8_t index;
+
+  bits = entry[2] | ( (uint16_t)entry[3] << 8 );
+  if( 0 == bits )
+  {
+    return 0;
+  }
+
+  index = 0;
+  while( !(bits & ((uint16_t)1 << index)) )
+  {
+    index++;
+  }
+
+  bits &= ~( (uint16_t)1 << index );
+  entry[2] = (uint8_t)bits;
+  entry[3] = (uint8_t)(bits >> 8);
+  *block = entry[1] + index;
+
+  return 1;
+}
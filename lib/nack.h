@@ -0,0 +1,42 @@
+/** @file nack.h
+*
+* @brief Requests to re-send sample blocks the access point missed
+*
+* @author Alvaro Prieto
+*/
+#ifndef _NACK_H
+#define _NACK_H
+
+// No hardware dependencies here so the host simulation can build nack.c
+// as is
+#include <stdint.h>
+
+// Blocks are numbered by their sender, one more for each block. The end
+// devices keep their last NACK_WINDOW blocks to re-send them, the access
+// point only asks for blocks that are still there (up to 31)
+#define NACK_WINDOW (24)
+
+// A request, sent by the access point in the sync beacon:
+//
+// [address][first block][bitmap low][bitmap high]
+//
+// bit i of the bitmap set means block first + i is missing, so one request
+// asks for up to NACK_SPAN blocks
+#define NACK_ENTRY_LEN (4)
+#define NACK_SPAN (16)
+
+// What the access point knows about one sender's blocks
+typedef struct
+{
+  uint32_t missing;   // bit i: block newest - 1 - i never arrived
+  uint8_t newest;     // Newest block heard
+  uint8_t valid;      // Set once the first block is heard
+} nack_tracker_t;
+
+void nack_init( nack_tracker_t* );
+uint8_t nack_heard( nack_tracker_t*, uint8_t );
+uint8_t nack_request( const nack_tracker_t*, uint8_t, uint8_t* );
+uint8_t nack_next( uint8_t*, uint8_t* );
+
+#endif /* _NACK_H */\
+
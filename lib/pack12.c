@@ -0,0 +1,68 @@
+/** @file pack12.c
+*
+* @brief 12-bit samples packed two to three bytes, see pack12.h
+*
+*   Written for the MSP430: samples go a pair at a time through word
+*   registers, with byte moves and shifts by 8 (SWPB) doing most of the work.
+*   Each pair takes a single 4-bit shift (one RLAM/RRUM on the MSP430X) and
+*   no multiply, divide or branch besides the loop's. That's what the C is
+*   written for: neither the code the compiler makes of it nor its cycle count
+*   on the target has been checked, tools/packbench only times it on the host.
+*
+* @author Alvaro Prieto
+*/
+#include "pack12.h"
+
+/*******************************************************************************
+ * @fn     void pack12( const uint16_t* samples, uint8_t count, uint8_t* out )
+ * @brief  Pack count samples to out, PACK12_LEN( count ) bytes. Samples must
+ *         be under 4096 (see PACK12_MAX)
+ * ****************************************************************************/
+void pack12( const uint16_t* samples, uint8_t count, uint8_t* out )
+{
+  uint16_t first;
+  uint16_t second;
+  uint8_t pairs;
+
+  for( pairs = count >> 1; pairs; pairs-- )
+  {
+    first = *samples++;
+    second = *samples++ << 4;
+
+    *out++ = (uint8_t)first;
+    *out++ = (uint8_t)( first >> 8 ) | (uint8_t)second;
+    *out++ = (uint8_t)( second >> 8 );
+  }
+
+  if( count & 1 )
+  {
+    first = *samples;
+
+    *out++ = (uint8_t)first;
+    *out = (uint8_t)( first >> 8 );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void unpack12( const uint8_t* in, uint8_t count, uint16_t* samples )
+ * @brief  Unpack count samples from in, PACK12_LEN( count ) bytes
+ * ****************************************************************************/
+void unpack12( const uint8_t* in, uint8_t count, uint16_t* samples )
+{
+  uint8_t middle;
+  uint8_t pairs;
+
+  for( pairs = count >> 1; pairs; pairs-- )
+  {
+    middle = in[1];
+
+    *samples++ = in[0] | ( (uint16_t)( middle & 0x0F ) << 8 );
+    *samples++ = ( ( (uint16_t)in[2] << 8 ) | middle ) >> 4;
+    in += 3;
+  }
+
+  if( count & 1 )
+  {
+    *samples = in[0] | ( (uint16_t)( in[1] & 0x0F ) << 8 );
+  }
+}
@@ -0,0 +1,29 @@
+/** @file pack12.h
+*
+* @brief 12-bit samples packed two to three bytes
+*
+* @author Alvaro Prieto
+*/
+#ifndef _PACK12_H
+#define _PACK12_H
+
+// No hardware dependencies here so the host tools can build pack12.c as is
+#include <stdint.h>
+
+// Samples are 12 bits (0...4095), every pair of them is one little endian
+// 24-bit word, the first one in the low 12 bits:
+//
+// [0] first[7:0]
+// [1] second[3:0] first[11:8]
+// [2] second[11:4]
+//
+// An odd last sample takes two bytes, the high 4 bits of the second are 0
+#define PACK12_LEN( samples ) ( ( 3 * (samples) + 1 ) / 2 )
+
+#define PACK12_MAX (0x0FFF)
+
+void pack12( const uint16_t*, uint8_t, uint8_t* );
+void unpack12( const uint8_t*, uint8_t, uint16_t* );
+
+#endif /* _PACK12_H */\
+
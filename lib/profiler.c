@@ -0,0 +1,149 @@
+/** @file profiler.c
+*
+* @brief ISR execution time and latency profiler (build with PROFILE=1)
+*
+*   Each profiled ISR captures TA1R on entry and exit (see PROFILE_ENTER and
+*   PROFILE_EXIT). The capture pair costs a fixed number of cycles, measured
+*   once at startup and subtracted from every sample.
+*
+*   isr_profile_dump() sends one framed record through the UART:
+*   [0] PROFILE_RECORD_MARKER
+*   [1] DEVICE_ADDRESS
+*   [2] TOTAL_PROFILED_ISRS
+*   [3] PROFILE_HISTOGRAM_BINS
+*   [4,5] measurement overhead in cycles (already subtracted)
+*   [6...] one isr_profile_t per ISR, little endian
+*
+* @author Alvaro Prieto
+*/
+#include "profiler.h"
+
+#if ISR_PROFILE
+
+#include <string.h>
+#include "intrinsics.h"
+#include "uart.h"
+
+#define RECORD_HEADER_LEN (6)
+
+static isr_profile_t profiles[TOTAL_PROFILED_ISRS];
+static uint16_t profile_overhead;
+
+static uint8_t record[RECORD_HEADER_LEN + sizeof(profiles)];
+
+/*******************************************************************************
+ * @fn     void setup_isr_profiler( void )
+ * @brief  Start Timer A1 from SMCLK, set up the capture register and measure
+ *         the cost of an empty PROFILE_ENTER/PROFILE_EXIT pair
+ * ****************************************************************************/
+void setup_isr_profiler( void )
+{
+  uint16_t profile_entry;
+  uint16_t cycles;
+  uint8_t index;
+
+  TA1CTL = TASSEL__SMCLK + MC_2 + TACLR;
+
+  // Capture on both edges of a software controlled input, synchronized to the
+  // timer clock
+  TA1CCTL2 = CM_3 + CCIS_2 + SCS + CAP;
+
+  memset( profiles, 0x00, sizeof(profiles) );
+  for( index = 0; index < TOTAL_PROFILED_ISRS; index++ )
+  {
+    profiles[index].min_cycles = 0xFFFF;
+  }
+
+  profile_overhead = 0xFFFF;
+  for( index = 0; index < 8; index++ )
+  {
+    profile_entry = PROFILE_CAPTURE();
+    cycles = PROFILE_CAPTURE() - profile_entry;
+    if( cycles < profile_overhead )
+    {
+      profile_overhead = cycles;
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void isr_profile_record( uint8_t isr, uint16_t cycles )
+ * @brief  add one execution time sample, called from PROFILE_EXIT
+ * ****************************************************************************/
+void isr_profile_record( uint8_t isr, uint16_t cycles )
+{
+  isr_profile_t* profile;
+  uint16_t value;
+  uint8_t bin = 0;
+
+  if( isr >= TOTAL_PROFILED_ISRS )
+  {
+    return;
+  }
+  profile = &profiles[isr];
+
+  // Stop once the counters are full so the mean stays right
+  if( 0xFFFF == profile->count )
+  {
+    return;
+  }
+
+  cycles = ( cycles > profile_overhead ) ? cycles - profile_overhead : 0;
+
+  profile->count++;
+  profile->total_cycles += cycles;
+
+  if( cycles < profile->min_cycles )
+  {
+    profile->min_cycles = cycles;
+  }
+  if( cycles > profile->max_cycles )
+  {
+    profile->max_cycles = cycles;
+  }
+
+  for( value = cycles >> 1; value; value >>= 1 )
+  {
+    bin++;
+  }
+  profile->histogram[bin]++;
+}
+
+/*******************************************************************************
+ * @fn     void isr_profile_latency( uint8_t isr, uint16_t ticks )
+ * @brief  record how late an interrupt started (e.g. TAR - TACCRn)
+ * ****************************************************************************/
+void isr_profile_latency( uint8_t isr, uint16_t ticks )
+{
+  if( (isr < TOTAL_PROFILED_ISRS) && (ticks > profiles[isr].max_latency) &&
+      (ticks < 0x8000) )
+  {
+    profiles[isr].max_latency = ticks;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void isr_profile_dump( void )
+ * @brief  send all statistics through the UART (see record format above)
+ * ****************************************************************************/
+void isr_profile_dump( void )
+{
+  uint16_t interrupt_state;
+
+  record[0] = PROFILE_RECORD_MARKER;
+  record[1] = DEVICE_ADDRESS;
+  record[2] = TOTAL_PROFILED_ISRS;
+  record[3] = PROFILE_HISTOGRAM_BINS;
+  record[4] = (uint8_t)profile_overhead;
+  record[5] = (uint8_t)(profile_overhead >> 8);
+
+  // Copy with interrupts off so every ISR's numbers are consistent
+  interrupt_state = __get_interrupt_state();
+  dint();
+  memcpy( &record[RECORD_HEADER_LEN], profiles, sizeof(profiles) );
+  __set_interrupt_state( interrupt_state );
+
+  uart_write_escaped( record, sizeof(record) );
+}
+
+#endif /* ISR_PROFILE */
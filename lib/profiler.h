@@ -0,0 +1,70 @@
+/** @file profiler.h
+*
+* @brief ISR execution time and latency profiler (build with PROFILE=1)
+*
+* @author Alvaro Prieto
+*/
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include "common.h"
+
+// Profiled interrupt service routines
+#define PROFILE_RADIO_ISR (0)
+#define PROFILE_TIMER0_A0_ISR (1)
+#define PROFILE_TIMER0_A1_ISR (2)
+#define PROFILE_TIMER1_A0_ISR (3)
+#define PROFILE_TIMER1_A1_ISR (4)
+#define PROFILE_UART_ISR (5)
+#define PROFILE_ADC_ISR (6)      // Once per sample block, see adc.c
+#define TOTAL_PROFILED_ISRS (7)
+
+// Execution time histogram, bin n counts runs of 2^n...2^(n+1)-1 cycles
+#define PROFILE_HISTOGRAM_BINS (16)
+
+// First byte of the UART record. Can't be mistaken for a packet length
+#define PROFILE_RECORD_MARKER (0xF1)
+
+// Timer1_A3 runs from SMCLK (== MCLK) in profiling builds and CCR2 is used
+// for software triggered captures of TA1R
+#define PROFILE_CCR (2)
+
+typedef struct
+{
+  uint16_t count;
+  uint16_t min_cycles;
+  uint16_t max_cycles;
+  uint32_t total_cycles;       // mean = total_cycles / count
+  uint16_t max_latency;        // Worst start delay of timer interrupts, ACLK ticks
+  uint16_t histogram[PROFILE_HISTOGRAM_BINS];
+} isr_profile_t;
+
+#if ISR_PROFILE
+
+// Toggling the capture input between GND and VCC captures TA1R into TA1CCR2.
+// It always takes the same number of cycles, so the cost can be subtracted
+#define PROFILE_CAPTURE() ( TA1CCTL2 ^= CCIS0, TA1CCR2 )
+
+// Must be the first line in the ISR, before any other declaration
+#define PROFILE_ENTER( isr ) uint16_t profile_entry = PROFILE_CAPTURE();
+
+// Must be the last line in the ISR
+#define PROFILE_EXIT( isr ) isr_profile_record( isr, PROFILE_CAPTURE() - profile_entry );
+
+#define PROFILE_LATENCY( isr, ticks ) isr_profile_latency( isr, ticks );
+
+#else
+
+#define PROFILE_ENTER( isr )
+#define PROFILE_EXIT( isr )
+#define PROFILE_LATENCY( isr, ticks )
+
+#endif /* ISR_PROFILE */
+
+void setup_isr_profiler( void );
+void isr_profile_record( uint8_t, uint16_t );
+void isr_profile_latency( uint8_t, uint16_t );
+void isr_profile_dump( void );
+
+#endif /* _PROFILER_H */\
+
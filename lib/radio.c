@@ -2,15 +2,52 @@
 *
 * @brief Radio functions
 *
+*   Flooding (radio_flood) works like Glossy: every node re-sends a flooded
+*   packet the moment it ends, so all the nodes that got it transmit the
+*   same bytes at the same time and the copies overlap on the air. The
+*   re-send is started by the radio state machine (MCSM1 RXOFF_MODE = TX),
+*   not the CPU, so the turnaround is the same on every node to a fraction
+*   of a bit. The CPU only has to refill the TX FIFO while the preamble and
+*   sync word go out.
+*
+*   Packets longer than the FIFO (up to RADIO_MAX_PACKET_LEN) are streamed:
+*   the TX FIFO is topped up each time it drains under its threshold
+*   (RFIFG2 falling edge), the RX FIFO is emptied each time it fills over
+*   its threshold (RFIFG0 rising edge). FIFOTHR leaves about 1ms for each.
+*
 * @author Alvaro Prieto
 */
 #include "radio.h"
+#include "profiler.h"
+#include "trace.h"
+#include "energy.h"
+#include "timers.h"
+#include "intrinsics.h"
 #include <signal.h>
 
+// Wrap-safe comparison of 32-bit tick counts
+#define TIME_BEFORE( a, b ) ((int32_t)((a) - (b)) < 0)
+
+// MCSM1 reset value: CCA unless receiving, RX and TX end in IDLE
+#define MCSM1_DEFAULT (0x30)
+// Flooding: no CCA (the other nodes are sending the same packet), RX ends
+// in TX, TX ends in IDLE
+#define MCSM1_FLOOD (0x08)
+
+// RXBYTES polls to wait for the first bytes of a packet, at least four
+// byte times
+#define FLOOD_SYNC_WAIT (200)
+
 static uint8_t dummy_callback( uint8_t*, uint8_t );
 inline void tx_done( void );
 inline void rx_enable();
 inline void rx_disable();
+static void setup_timestamps( void );
+static uint32_t stamp_packet( uint8_t );
+static void flood_sync( void );
+static uint8_t flood_relay( uint8_t );
+static void tx_refill( void );
+static void rx_drain( void );
 
 // Receive buffer
 static uint8_t rx_buffer[RX_BUFFER_SIZE];
@@ -23,6 +60,30 @@ extern RF_SETTINGS rfSettings;
 // Holds pointers to all callback functions for CCR registers (and overflow)
 static uint8_t (*rx_callback)( uint8_t*, uint8_t ) = dummy_callback;
 
+// Sync word times of the last packets, see stamp_packet
+static uint32_t rx_timestamp;
+static uint32_t tx_timestamp;
+static uint8_t tx_size;
+static uint8_t timestamp_captured;
+
+// Flooding, see radio_flood
+static uint8_t flood_type = 0;
+static uint8_t flood_counter_offset;
+static uint8_t flood_max_relays;
+static uint8_t flood_armed = 0;
+static uint32_t flood_holdoff;
+
+// Bytes of the current packet already read, by flood_sync or as the RX
+// FIFO filled up
+static uint8_t rx_prefix = 0;
+
+// Rest of a packet that didn't fit in the TX FIFO, see radio_tx
+static uint8_t* tx_pending;
+static uint8_t tx_left = 0;
+
+// CHANNR, see radio_set_channel
+static uint8_t channel;
+
 /*******************************************************************************
  * @fn     void setup_radio( uint8_t (*callback)(void) )
  * @brief  Initialize radio and register Rx Callback function
@@ -34,6 +95,7 @@ void setup_radio( uint8_t (*callback)(uint8_t*, uint8_t) )
   
   // Increase PMMCOREV level to 2 for proper radio operation
   SetVCore(2);
+  energy_vcore( 2 );
   
   ResetRadioCore();
   
@@ -44,29 +106,408 @@ void setup_radio( uint8_t (*callback)(uint8_t*, uint8_t) )
   PMMCTL0_H = 0x00;
   
   WriteRfSettings(&rfSettings);
+  channel = rfSettings.channr;
   
   WriteSinglePATable(PATABLE_VAL);
 
+  setup_timestamps();
+
   rx_enable();
 }
 
 /*******************************************************************************
  * @fn     void radio_tx( uint8_t* buffer, uint8_t size )
- * @brief  Send message through radio
+ * @brief  Send message through radio. Packets longer than the FIFO are
+ *         written as it empties, so buffer must not change until the packet
+ *         is sent
  * ****************************************************************************/
 void radio_tx( uint8_t* buffer, uint8_t size )
 {
+  uint8_t first;
+  
+  TRACE( TRACE_RADIO_TX | TRACE_BEGIN, size )
+
+  if( RADIO_SURVEY == radio_mode )
+  {
+    // Interrupted a channel survey, send on our own channel and end it
+    WriteSingleReg( CHANNR, channel );
+  }
+
   rx_disable();
   radio_mode = RADIO_TX;
+  tx_size = size;
     
   RF1AIES |= BIT9;
   RF1AIFG &= ~BIT9; // Clear pending interrupts
   RF1AIE |= BIT9; // Enable TX end-of-packet interrupt
   
-  WriteBurstReg(RF_TXFIFOWR, buffer, size);
+  first = ( size > RADIO_FIFO_SIZE ) ? RADIO_FIFO_SIZE : size;
+  WriteBurstReg(RF_TXFIFOWR, buffer, first);
+  
+  tx_pending = buffer + first;
+  tx_left = size - first;
+  if( tx_left )
+  {
+    RF1AIES |= BIT2; // Falling edge of RFIFG2, TX FIFO under the threshold
+    RF1AIFG &= ~BIT2;
+    RF1AIE |= BIT2;
+  }
   
   Strobe( RF_STX ); // Strobe STX
+  energy_radio_state( ENERGY_RADIO_TX );
+  
+}
+
+/*******************************************************************************
+ * @fn     uint32_t radio_rx_timestamp( void )
+ * @brief  sync word time of the packet passed to the rx callback, valid
+ *         while the callback runs
+ * ****************************************************************************/
+uint32_t radio_rx_timestamp( void )
+{
+  return rx_timestamp;
+}
+
+/*******************************************************************************
+ * @fn     uint32_t radio_tx_timestamp( void )
+ * @brief  sync word time of the last packet sent
+ * ****************************************************************************/
+uint32_t radio_tx_timestamp( void )
+{
+  return tx_timestamp;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t radio_timestamp_captured( void )
+ * @brief  returns 1 if the last timestamp came from the GDO0 capture, 0 if it
+ *         was estimated
+ * ****************************************************************************/
+uint8_t radio_timestamp_captured( void )
+{
+  return timestamp_captured;
+}
+
+/*******************************************************************************
+ * @fn     void radio_flood( uint8_t type, uint8_t counter_offset,
+ *                           uint8_t max_relays )
+ * @brief  Re-send received packets of this type right as they end, as long
+ *         as the relay counter (the byte at counter_offset, which must be
+ *         under RADIO_FLOOD_PREFIX_MAX) is under max_relays. The counter is
+ *         incremented in the copy sent, the receive callback gets the
+ *         packet as received. A node sends each flood once. type 0 stops
+ *         flooding
+ * ****************************************************************************/
+void radio_flood( uint8_t type, uint8_t counter_offset, uint8_t max_relays )
+{
+  uint16_t interrupt_state;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+
+  flood_type = type;
+  flood_counter_offset = counter_offset;
+  flood_max_relays = max_relays;
+  flood_armed = 0;
+  flood_holdoff = get_timestamp();
+  WriteSingleReg( MCSM1, MCSM1_DEFAULT );
+
+  // Pick the interrupt edge for the new mode
+  if( RADIO_RX == radio_mode )
+  {
+    rx_enable();
+  }
+
+  __set_interrupt_state( interrupt_state );
+}
+
+/*******************************************************************************
+ * @fn     void radio_set_channel( uint8_t new_channel )
+ * @brief  Move to another channel (CHANNR). A packet being received is
+ *         dropped, a channel survey ends. While sending, the new channel is
+ *         used once the packet is out (the synthesizer is calibrated going
+ *         from IDLE to RX or TX, see MCSM0)
+ * ****************************************************************************/
+void radio_set_channel( uint8_t new_channel )
+{
+  uint16_t interrupt_state;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+
+  if( new_channel != channel )
+  {
+    channel = new_channel;
+    WriteSingleReg( CHANNR, channel );
+
+    if( RADIO_TX != radio_mode )
+    {
+      rx_disable();
+      rx_enable();
+    }
+  }
+
+  __set_interrupt_state( interrupt_state );
+}
+
+/*******************************************************************************
+ * @fn     uint8_t radio_channel( void )
+ * @brief  current channel (CHANNR)
+ * ****************************************************************************/
+uint8_t radio_channel( void )
+{
+  return channel;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t radio_sample_rssi( uint8_t survey_channel, uint8_t* levels,
+ *                                   uint8_t count )
+ * @brief  Listen on another channel for a moment and take count RSSI status
+ *         bytes from it, then go back. Nothing is received meanwhile, a
+ *         packet coming in is dropped. Returns 0 without sampling while
+ *         sending. Blocks for RADIO_SURVEY_SETTLE_CYCLES plus
+ *         RADIO_SURVEY_SAMPLE_CYCLES per sample, with interrupts left as the
+ *         caller had them except around each register read. Sending or
+ *         changing channel from an interrupt meanwhile ends the survey, it
+ *         returns 0 then too
+ * ****************************************************************************/
+uint8_t radio_sample_rssi( uint8_t survey_channel, uint8_t* levels,
+                           uint8_t count )
+{
+  uint16_t interrupt_state;
+  uint8_t index;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+
+  if( RADIO_RX != radio_mode )
+  {
+    __set_interrupt_state( interrupt_state );
+    return 0;
+  }
+
+  // IDLE with the RX interrupts off, the synthesizer is calibrated for the
+  // survey channel on the way back to RX (see MCSM0)
+  rx_disable();
+  radio_mode = RADIO_SURVEY;
+  WriteSingleReg( CHANNR, survey_channel );
+  Strobe( RF_SRX );
+  energy_radio_state( ENERGY_RADIO_RX );
+
+  __set_interrupt_state( interrupt_state );
+  __delay_cycles( RADIO_SURVEY_SETTLE_CYCLES );
+
+  for( index = 0; index < count; index++ )
+  {
+    dint();
+    if( RADIO_SURVEY != radio_mode )
+    {
+      // Something else took the radio, it's no longer on the survey channel
+      __set_interrupt_state( interrupt_state );
+      return 0;
+    }
+    levels[index] = ReadSingleReg( RSSI );
+    __set_interrupt_state( interrupt_state );
+
+    __delay_cycles( RADIO_SURVEY_SAMPLE_CYCLES );
+  }
+
+  dint();
+
+  // Flush whatever came in on the survey channel
+  if( RADIO_SURVEY == radio_mode )
+  {
+    rx_disable();
+    WriteSingleReg( CHANNR, channel );
+    rx_enable();
+  }
+
+  __set_interrupt_state( interrupt_state );
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     void flood_sync( void )
+ * @brief  Sync word of a packet while flooding. Read the bytes up to the
+ *         relay counter and, if it's a flood to relay, let the radio go
+ *         straight to TX when it ends
+ * ****************************************************************************/
+static void flood_sync( void )
+{
+  uint16_t wait;
+  uint8_t prefix;
+  uint8_t available = 0;
+
+  prefix = flood_counter_offset + 1;
+
+  // Never empty the RX FIFO while the packet is still coming in
+  for( wait = 0; wait < FLOOD_SYNC_WAIT; wait++ )
+  {
+    available = ReadSingleReg( RXBYTES );
+    if( available > prefix )
+    {
+      break;
+    }
+  }
+
+  if( available > prefix )
+  {
+    ReadBurstReg( RF_RXFIFORD, rx_buffer, prefix );
+    rx_prefix = prefix;
+
+    if( (flood_type == rx_buffer[2]) && 
+        (rx_buffer[0] >= flood_counter_offset) &&
+        (rx_buffer[0] < RADIO_FIFO_SIZE) &&
+        (rx_buffer[flood_counter_offset] < flood_max_relays) &&
+        !TIME_BEFORE( get_timestamp(), flood_holdoff ) )
+    {
+      WriteSingleReg( MCSM1, MCSM1_FLOOD );
+      flood_armed = 1;
+    }
+  }
+
+  // Now wait for the end of the packet
+  RF1AIES |= BIT9;
+  RF1AIFG &= ~BIT9;
+  if( 0 == (RF1AIN & BIT9) )
+  {
+    // Already over, come back for it
+    RF1AIFG |= BIT9;
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t flood_relay( uint8_t size )
+ * @brief  A flood packet of size bytes (with status bytes) ended and the
+ *         radio went to TX by itself. Fill the TX FIFO before the preamble
+ *         and sync word are done. Returns 1 if it is being re-sent
+ * ****************************************************************************/
+static uint8_t flood_relay( uint8_t size )
+{
+  uint8_t length;
+
+  flood_armed = 0;
+  WriteSingleReg( MCSM1, MCSM1_DEFAULT );
+
+  if( 0 == (rx_buffer[size + CRC_LQI_IDX_OFFSET] & CRC_OK) )
+  {
+    // Don't pass on a corrupted packet, stop the preamble
+    Strobe( RF_SIDLE );
+    Strobe( RF_SFTX );
+    return 0;
+  }
+
+  length = rx_buffer[0] + 1;
+
+  rx_buffer[flood_counter_offset]++;
+  WriteBurstReg( RF_TXFIFOWR, rx_buffer, length );
+  rx_buffer[flood_counter_offset]--;
+
+  radio_mode = RADIO_TX;
+  tx_size = length;
+
+  RF1AIES |= BIT9;
+  RF1AIFG &= ~BIT9;
+  RF1AIE |= BIT9; // Enable TX end-of-packet interrupt
+  energy_radio_state( ENERGY_RADIO_TX );
+  TRACE( TRACE_RADIO_TX | TRACE_BEGIN, length )
+
+  // Later copies of this flood are still on the way, don't send it again
+  flood_holdoff = get_timestamp() + 
+                  RADIO_FLOOD_DELAY( length, flood_max_relays + 1 );
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     void tx_refill( void )
+ * @brief  The TX FIFO drained under its threshold, write as much of the rest
+ *         of the packet as fits
+ * ****************************************************************************/
+static void tx_refill( void )
+{
+  uint8_t space;
+  
+  space = RADIO_FIFO_SIZE - ( ReadSingleReg( TXBYTES ) & 0x7F );
+  if( space > tx_left )
+  {
+    space = tx_left;
+  }
+  
+  WriteBurstReg( RF_TXFIFOWR, tx_pending, space );
+  tx_pending += space;
+  tx_left -= space;
+  
+  if( 0 == tx_left )
+  {
+    RF1AIE &= ~BIT2;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void rx_drain( void )
+ * @brief  The RX FIFO filled over its threshold while a long packet comes in,
+ *         read all but the last byte (the FIFO must not be emptied while
+ *         receiving)
+ * ****************************************************************************/
+static void rx_drain( void )
+{
+  uint8_t available;
+  
+  available = ReadSingleReg( RXBYTES ) & 0x7F;
+  if( (available < 2) || (rx_prefix + available > RX_BUFFER_SIZE) )
+  {
+    return;
+  }
   
+  ReadBurstReg( RF_RXFIFORD, rx_buffer + rx_prefix, available - 1 );
+  rx_prefix += available - 1;
+}
+
+/*******************************************************************************
+ * @fn     void setup_timestamps( void )
+ * @brief  route GDO0 out to P2.6 and capture P2.7 with RADIO_CAPTURE_CCR
+ * ****************************************************************************/
+static void setup_timestamps( void )
+{
+  PMAPPWD = 0x02D52;                        // Get write-access to port mapping regs 
+  P2MAP6 = PM_RFGDO0;                       // GDO0 output on P2.6
+  P2MAP7 = PM_TA0CCR4A;                     // TA0 CCR4 capture input on P2.7
+  PMAPPWD = 0;                              // Lock port mapping registers
+
+  P2DIR |= BIT6;
+  P2DIR &= ~BIT7;
+  P2SEL |= BIT6 + BIT7;
+
+  // Rising edge is the sync word, falling edge the end of the packet
+  setup_capture( RADIO_CAPTURE_CCR, CM_1 );
+}
+
+/*******************************************************************************
+ * @fn     uint32_t stamp_packet( uint8_t size )
+ * @brief  Sync word time of a packet that just ended. size is the number of
+ *         bytes sent after the sync word. Uses the capture if there is one
+ *         that fits the packet, else goes back from the current time
+ * ****************************************************************************/
+static uint32_t stamp_packet( uint8_t size )
+{
+  uint32_t now;
+  uint32_t captured;
+  uint16_t duration;
+
+  now = get_timestamp();
+  duration = RADIO_BYTE_TIME( size );
+
+  // The edge must be from this packet, not a stale sync word
+  timestamp_captured = 0;
+  if( read_capture( RADIO_CAPTURE_CCR, &captured ) &&
+      ( (now - captured) <= (uint32_t)(duration << 1) ) )
+  {
+    timestamp_captured = 1;
+    return captured;
+  }
+
+  return now - duration;
 }
 
 /*******************************************************************************
@@ -75,6 +516,9 @@ void radio_tx( uint8_t* buffer, uint8_t size )
  * ****************************************************************************/
 inline void tx_done( )
 {
+  RF1AIE &= ~BIT2;
+  tx_left = 0;
+  
   rx_enable();
 }
 
@@ -86,13 +530,27 @@ inline void tx_done( )
 inline void rx_enable()
 {
   radio_mode = RADIO_RX;
+  rx_prefix = 0;
 
-  RF1AIES |= BIT9; // Falling edge of RFIFG9
+  if( flood_type )
+  {
+    RF1AIES &= ~BIT9; // Rising edge of RFIFG9, sync word, see flood_sync
+  }
+  else
+  {
+    RF1AIES |= BIT9; // Falling edge of RFIFG9
+  }
   RF1AIFG &= ~BIT9; // Clear a pending interrupt
   RF1AIE |= BIT9; // Enable the interrupt
   
+  // Long packets are read as they come in, see rx_drain
+  RF1AIES &= ~BIT0; // Rising edge of RFIFG0, RX FIFO over the threshold
+  RF1AIFG &= ~BIT0;
+  RF1AIE |= BIT0;
+  
   // Radio is in IDLE following a TX, so strobe SRX to enter Receive Mode
   Strobe( RF_SRX );
+  energy_radio_state( ENERGY_RADIO_RX );
 }
 
 /*******************************************************************************
@@ -101,15 +559,23 @@ inline void rx_enable()
  * ****************************************************************************/
 inline void rx_disable()
 {
-  RF1AIE &= ~BIT9; // Disable RX interrupts
+  RF1AIE &= ~(BIT9 + BIT0); // Disable RX interrupts
   RF1AIFG &= ~BIT9; // Clear pending IFG  // Increase PMMCOREV level to 2 for proper radio operation
   SetVCore(2);
+  energy_vcore( 2 );
 
   // It is possible that ReceiveOff is called while radio is receiving a packet.
   // Therefore, it is necessary to flush the RX FIFO after issuing IDLE strobe
   // such that the RXFIFO is empty prior to receiving a packet.
   Strobe( RF_SIDLE );
   Strobe( RF_SFRX );
+  energy_radio_state( ENERGY_RADIO_IDLE );
+
+  if( flood_armed )
+  {
+    flood_armed = 0;
+    WriteSingleReg( MCSM1, MCSM1_DEFAULT );
+  }
 }
 
 /*******************************************************************************
@@ -129,8 +595,10 @@ static uint8_t dummy_callback( uint8_t* buffer, uint8_t size )
  * ****************************************************************************/
 wakeup interrupt (CC1101_VECTOR) radio_isr (void)
 {
+  PROFILE_ENTER( PROFILE_RADIO_ISR )
   uint16_t vector_flag;
   uint8_t rx_message_size;
+  uint8_t relayed;
   //
   // NOTE: For some reason, the switch statement with argument RF1AIV does not
   // work. Adding the temporary variable 'vector_flag' fixes the problem
@@ -141,9 +609,23 @@ wakeup interrupt (CC1101_VECTOR) radio_isr (void)
   switch(vector_flag) // Prioritizing Radio Core Interrupt
   {
     case RF1AIV_NONE: break; // No RF core interrupt pending
-    case RF1AIV_RFIFG0: break; // RFIFG0
+    case RF1AIV_RFIFG0: // RFIFG0, RX FIFO over the threshold
+    {
+      if( radio_mode == RADIO_RX )
+      {
+        rx_drain();
+      }
+      break;
+    }
     case RF1AIV_RFIFG1: break; // RFIFG1
-    case RF1AIV_RFIFG2: break; // RFIFG2
+    case RF1AIV_RFIFG2: // RFIFG2, TX FIFO under the threshold
+    {
+      if( (radio_mode == RADIO_TX) && tx_left )
+      {
+        tx_refill();
+      }
+      break;
+    }
     case RF1AIV_RFIFG3: break; // RFIFG3
     case RF1AIV_RFIFG4: break; // RFIFG4
     case RF1AIV_RFIFG5: break; // RFIFG5
@@ -153,18 +635,44 @@ wakeup interrupt (CC1101_VECTOR) radio_isr (void)
     case RF1AIV_RFIFG9: // RFIFG9
     {
       
-      if(radio_mode == RADIO_RX) 
+      if( (radio_mode == RADIO_RX) && !(RF1AIES & BIT9) )
+      {
+        // Sync word, only interrupts here while flooding
+        flood_sync();
+      }
+      else if(radio_mode == RADIO_RX) 
       {
-        // Read the length byte from the FIFO
-        rx_message_size = ReadSingleReg( RXBYTES );
-        ReadBurstReg(RF_RXFIFORD, rx_buffer, rx_message_size);
+        // Read the rest of the packet, flood_sync or rx_drain may have read
+        // the start
+        rx_message_size = ReadSingleReg( RXBYTES ) & 0x7F;
+        if( rx_prefix + rx_message_size > RX_BUFFER_SIZE )
+        {
+          rx_message_size = RX_BUFFER_SIZE - rx_prefix;
+        }
+        ReadBurstReg(RF_RXFIFORD, rx_buffer + rx_prefix, rx_message_size);
+        rx_message_size += rx_prefix;
         
         // Stop here to see contents of RxBuffer
         __no_operation();
         
-        // Check the CRC results
-        if(rx_buffer[rx_message_size + CRC_LQI_IDX_OFFSET] & CRC_OK)
+        // Length, payload and status bytes, the same count as went over
+        // the air after the sync word (status replaces the CRC)
+        rx_timestamp = stamp_packet( rx_message_size );
+        
+        // Re-send first, the TX FIFO has to be filled in time
+        relayed = 0;
+        if( flood_armed )
+        {
+          relayed = flood_relay( rx_message_size );
+        }
+        
+        // Check the CRC results. Packets dropped by the radio (over
+        // PKTLEN) end with nothing in the FIFO
+        if( (rx_message_size > 2) &&
+            (rx_buffer[rx_message_size + CRC_LQI_IDX_OFFSET] & CRC_OK) )
         {
+          TRACE( TRACE_RADIO_RX, rx_message_size )
+
           if ( rx_callback(rx_buffer, rx_message_size) )
           {
             // If callback function returns 1, wake up after interrupt
@@ -175,14 +683,22 @@ wakeup interrupt (CC1101_VECTOR) radio_isr (void)
         }
         
         // Not sure why this is needed, but it fixes a problem of not
-        // receiving messages after the first one comes in
-        rx_enable();
+        // receiving messages after the first one comes in. When re-sending
+        // a flood this happens at the end of the transmission
+        if( 0 == relayed )
+        {
+          rx_enable();
+        }
         
       }
       else if(radio_mode == RADIO_TX)
       {
         RF1AIE &= ~BIT9; // Disable TX end-of-packet interrupt        
         
+        tx_timestamp = stamp_packet( tx_size + RADIO_CRC_BYTES );
+        
+        TRACE( TRACE_RADIO_TX | TRACE_END, 0 )
+        
         // Shouldn't be sleeping if it just transmitted, but in case it is
         // wake up after transmission
         __bic_SR_register_on_exit(LPM3_bits);
@@ -202,5 +718,6 @@ wakeup interrupt (CC1101_VECTOR) radio_isr (void)
     default: break;
   }
   
+  PROFILE_EXIT( PROFILE_RADIO_ISR )
 }
 
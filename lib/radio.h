@@ -12,7 +12,7 @@
 #include "RF1A.h"
 #include "hal_pmm.h"
 
-#define PACKET_LEN (54) // PACKET_LEN <= 61
+#define PACKET_LEN (61) // PACKET_LEN <= 61
 #define RSSI_IDX_OFFSET (-2) // Index of appended RSSI
 #define CRC_LQI_IDX_OFFSET (-1) // Index of appended LQI, checksum
 #define CRC_OK (BIT7) // CRC_OK bit
@@ -20,19 +20,75 @@
 
 #define RADIO_RX 0
 #define RADIO_TX 1
+#define RADIO_SURVEY 2 // On another channel for radio_sample_rssi
 
 #define RX_BUFFER_SIZE 255
+#define RADIO_FIFO_SIZE (64) // Largest packet, with length and status bytes
+
+// Longest packet (length byte value) sent or received, must match PKTLEN in
+// rfSettings. Packets that don't fit in the FIFO are streamed through it as
+// they go out or come in
+#define RADIO_MAX_PACKET_LEN (RX_BUFFER_SIZE - 3)
+
+// Over the air format, must match rfSettings (MHZ_915_CUSTOM: 250kBaud,
+// 4 byte preamble, 30/32 sync word, CRC enabled)
+#define RADIO_BAUD_RATE (249939)
+#define RADIO_PREAMBLE_BYTES (4)
+#define RADIO_SYNC_BYTES (4)
+#define RADIO_CRC_BYTES (2)
+
+// ACLK ticks to send bytes over the air, rounded up
+#define RADIO_BYTE_TIME( bytes ) \
+  ( (uint16_t)(( (uint32_t)(bytes) * 8 * 32768 + RADIO_BAUD_RATE - 1 ) / \
+  RADIO_BAUD_RATE) )
+
+// Packet timestamps are the time of the sync word. GDO0 (asserts on sync
+// word sent/received) is mapped to P2.6 and Timer A0 RADIO_CAPTURE_CCR
+// captures P2.7. With P2.6 wired to P2.7 the timestamps come from the capture,
+// otherwise they are estimated in the end of packet interrupt
+#define RADIO_CAPTURE_CCR (4)
+
+// RX to TX turnaround of the radio state machine when a flooded packet is
+// re-sent (see radio_flood), in bit times. It's the same on every node,
+// only the total delay below depends on it
+#define RADIO_RX_TX_BITS (6)
+
+// Longest counter_offset for radio_flood, the bytes up to the counter are
+// read while the packet is still coming in
+#define RADIO_FLOOD_PREFIX_MAX (8)
+
+// ACLK ticks from the sync word of a flooded packet of size bytes (length
+// byte included) to the sync word of its relays-th re-send
+#define RADIO_FLOOD_DELAY( size, relays ) \
+  ( (uint16_t)(( (uint32_t)(relays) * \
+  ( ((size) + RADIO_PREAMBLE_BYTES + RADIO_SYNC_BYTES + RADIO_CRC_BYTES) * 8 + \
+  RADIO_RX_TX_BITS ) * 32768 + RADIO_BAUD_RATE / 2 ) / RADIO_BAUD_RATE) )
+
+// Channel survey timing (see radio_sample_rssi) in MCLK cycles at 12MHz.
+// The synthesizer calibrates and the RSSI settles within ~800us of going to
+// RX, then it is sampled every ~30us, about as often as it changes with the
+// 541kHz receive filter
+#define RADIO_SURVEY_SETTLE_CYCLES (9600)
+#define RADIO_SURVEY_SAMPLE_CYCLES (360)
 
 // Packet type and flag definitions
 // Should have some structure eventually, but assigning arbitrary values for now
 
 #define ACK_FLAG (1 << 4)
 #define REPEATER_FLAG (1 << 2)
+#define ENERGY_REQUEST_FLAG (1 << 0) // Beacon asks nodes for a POWER_PACKET
 
 #define POWER_PACKET (0x05)
 
 void setup_radio( uint8_t (*)(uint8_t*, uint8_t) );
 void radio_tx( uint8_t*, uint8_t );
+uint32_t radio_rx_timestamp( void );
+uint32_t radio_tx_timestamp( void );
+uint8_t radio_timestamp_captured( void );
+void radio_flood( uint8_t, uint8_t, uint8_t );
+void radio_set_channel( uint8_t );
+uint8_t radio_channel( void );
+uint8_t radio_sample_rssi( uint8_t, uint8_t*, uint8_t );
 
 
 #endif /* _RADIO_H */\
@@ -0,0 +1,321 @@
+/** @file route.c
+*
+* @brief Multi-hop routing toward the access point
+*
+*   Every node keeps a depth, its number of hops from the access point. The
+*   access point's beacons are heard at depth 0, and repeaters put their own
+*   depth in every packet they send. Out of the repeaters heard recently
+*   (and the access point), each node picks as parent the one with the best
+*   mix of depth and link quality, and sends its packets to it. Only the
+*   node named in next_hop forwards a packet, so two repeaters in range of
+*   each other don't bounce packets back and forth. A node that has no
+*   parent yet sends to ROUTE_BROADCAST, and any repeater closer to the
+*   access point forwards it.
+*
+*   Every packet carries a sequence number per source. The last
+*   ROUTE_CACHE_LEN packets delivered or forwarded are remembered, and
+*   copies of them are dropped.
+*
+*   Nothing here disables interrupts. Call the functions from one
+*   interrupt, or with interrupts disabled.
+*
+* @author Alvaro Prieto
+*/
+#include <string.h>
+#include "route.h"
+
+// CC1101 RSSI offset at 250kBaud, in dB
+#define RSSI_OFFSET (74)
+
+static uint8_t seen( route_t*, uint8_t, uint8_t );
+static void remember( route_t*, uint8_t, uint8_t );
+static uint16_t cost( const route_neighbor_t* );
+static void select_parent( route_t* );
+
+/*******************************************************************************
+ * @fn     void route_init( route_t* route, uint8_t address, uint8_t sink )
+ * @brief  start with no neighbors. sink is 1 on the access point
+ * ****************************************************************************/
+void route_init( route_t* route, uint8_t address, uint8_t sink )
+{
+  memset( route, 0, sizeof(route_t) );
+
+  route->address = address;
+  route->sink = sink;
+  route->parent = ROUTE_BROADCAST;
+  route->depth = sink ? 0 : ROUTE_NO_DEPTH;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t route_quality( uint8_t rssi )
+ * @brief  link quality from the RSSI status byte appended to a packet
+ * ****************************************************************************/
+uint8_t route_quality( uint8_t rssi )
+{
+  int16_t dbm;
+
+  dbm = ( (int8_t)rssi >> 1 ) - RSSI_OFFSET + 128;
+  if( dbm < 0 )
+  {
+    return 0;
+  }
+
+  return ( dbm > 255 ) ? 255 : (uint8_t)dbm;
+}
+
+/*******************************************************************************
+ * @fn     void route_heard( route_t* route, uint8_t address, uint8_t depth,
+ *                           uint8_t quality )
+ * @brief  A packet from a repeater (or the access point) at depth was heard
+ *         with quality, see if it makes a better parent
+ * ****************************************************************************/
+void route_heard( route_t* route, uint8_t address, uint8_t depth,
+                  uint8_t quality )
+{
+  route_neighbor_t* neighbor = 0;
+  route_neighbor_t heard;
+  uint8_t index;
+
+  if( route->sink || (address == route->address) )
+  {
+    return;
+  }
+
+  for( index = 0; index < route->total_neighbors; index++ )
+  {
+    if( address == route->neighbors[index].address )
+    {
+      neighbor = &route->neighbors[index];
+      // Average out fading, 1/4 weight to the new value
+      neighbor->quality = ( 3 * (uint16_t)neighbor->quality + quality ) >> 2;
+      break;
+    }
+  }
+
+  if( 0 == neighbor )
+  {
+    if( route->total_neighbors < ROUTE_NEIGHBORS )
+    {
+      neighbor = &route->neighbors[route->total_neighbors++];
+    }
+    else
+    {
+      // Replace the worst neighbor, unless this one is even worse
+      neighbor = &route->neighbors[0];
+      for( index = 1; index < ROUTE_NEIGHBORS; index++ )
+      {
+        if( cost( &route->neighbors[index] ) > cost( neighbor ) )
+        {
+          neighbor = &route->neighbors[index];
+        }
+      }
+
+      heard.address = address;
+      heard.depth = depth;
+      heard.quality = quality;
+      if( cost( &heard ) >= cost( neighbor ) )
+      {
+        return;
+      }
+    }
+
+    neighbor->address = address;
+    neighbor->quality = quality;
+  }
+
+  neighbor->depth = depth;
+  neighbor->age = 0;
+
+  select_parent( route );
+}
+
+/*******************************************************************************
+ * @fn     void route_age( route_t* route )
+ * @brief  Call once per beacon period. Forgets neighbors not heard from in
+ *         ROUTE_NEIGHBOR_TIMEOUT calls
+ * ****************************************************************************/
+void route_age( route_t* route )
+{
+  uint8_t index = 0;
+
+  while( index < route->total_neighbors )
+  {
+    if( ++route->neighbors[index].age > ROUTE_NEIGHBOR_TIMEOUT )
+    {
+      route->neighbors[index] = route->neighbors[--route->total_neighbors];
+    }
+    else
+    {
+      index++;
+    }
+  }
+
+  select_parent( route );
+}
+
+/*******************************************************************************
+ * @fn     void route_originate( route_t* route, route_header_t* header )
+ * @brief  fill in the route header of a new packet made by this node
+ * ****************************************************************************/
+void route_originate( route_t* route, route_header_t* header )
+{
+  header->sender = route->address;
+  header->next_hop = route->parent;
+  header->sequence = route->sequence++;
+  header->hops_depth = route->depth;
+
+  // Don't forward our own packet if a neighbor echoes it
+  remember( route, route->address, header->sequence );
+  route->stats.originated++;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t route_receive( route_t* route, uint8_t source,
+ *                                route_header_t* header )
+ * @brief  A routed packet made by source was received. Returns ROUTE_DELIVER
+ *         on the access point, ROUTE_FORWARD if this node should send it on
+ *         (header is updated for that), ROUTE_DROP otherwise
+ * ****************************************************************************/
+uint8_t route_receive( route_t* route, uint8_t source, route_header_t* header )
+{
+  if( seen( route, source, header->sequence ) )
+  {
+    route->stats.duplicates++;
+    return ROUTE_DROP;
+  }
+
+  if( route->sink )
+  {
+    remember( route, source, header->sequence );
+    route->stats.delivered++;
+    return ROUTE_DELIVER;
+  }
+
+  if( (header->next_hop != route->address) &&
+      !((ROUTE_BROADCAST == header->next_hop) &&
+        (route->depth < ROUTE_DEPTH( header ))) )
+  {
+    route->stats.not_for_us++;
+    return ROUTE_DROP;
+  }
+
+  if( (ROUTE_HOPS( header ) >= ROUTE_MAX_HOPS) ||
+      (ROUTE_NO_DEPTH == route->depth) )
+  {
+    route->stats.dropped++;
+    return ROUTE_DROP;
+  }
+
+  remember( route, source, header->sequence );
+
+  header->sender = route->address;
+  header->next_hop = route->parent;
+  header->hops_depth = ( (ROUTE_HOPS( header ) + 1) << 4 ) | route->depth;
+
+  route->stats.forwarded++;
+  return ROUTE_FORWARD;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t seen( route_t* route, uint8_t source, uint8_t sequence )
+ * @brief  returns 1 if the packet is in the duplicate cache
+ * ****************************************************************************/
+static uint8_t seen( route_t* route, uint8_t source, uint8_t sequence )
+{
+  uint8_t index;
+
+  for( index = 0; index < route->total_seen; index++ )
+  {
+    if( (source == route->seen[index].source) &&
+        (sequence == route->seen[index].sequence) )
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     void remember( route_t* route, uint8_t source, uint8_t sequence )
+ * @brief  add a packet to the duplicate cache, replacing the oldest one
+ * ****************************************************************************/
+static void remember( route_t* route, uint8_t source, uint8_t sequence )
+{
+  route->seen[route->next_seen].source = source;
+  route->seen[route->next_seen].sequence = sequence;
+
+  route->next_seen = ( route->next_seen + 1 ) % ROUTE_CACHE_LEN;
+  if( route->total_seen < ROUTE_CACHE_LEN )
+  {
+    route->total_seen++;
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint16_t cost( const route_neighbor_t* neighbor )
+ * @brief  cost of reaching the access point through neighbor, lower is
+ *         better. Unusable neighbors cost 0xFFFF
+ * ****************************************************************************/
+static uint16_t cost( const route_neighbor_t* neighbor )
+{
+  uint16_t link;
+
+  if( (neighbor->quality < ROUTE_MIN_QUALITY) ||
+      (neighbor->depth >= ROUTE_MAX_HOPS) )
+  {
+    return 0xFFFF;
+  }
+
+  link = 0;
+  if( neighbor->quality < ROUTE_GOOD_QUALITY )
+  {
+    link = ROUTE_GOOD_QUALITY - neighbor->quality;
+  }
+
+  return neighbor->depth * ROUTE_HOP_COST + link;
+}
+
+/*******************************************************************************
+ * @fn     void select_parent( route_t* route )
+ * @brief  pick the cheapest neighbor as parent. The current parent is kept
+ *         unless another one is ROUTE_HYSTERESIS cheaper
+ * ****************************************************************************/
+static void select_parent( route_t* route )
+{
+  const route_neighbor_t* best = 0;
+  const route_neighbor_t* current = 0;
+  uint8_t index;
+
+  for( index = 0; index < route->total_neighbors; index++ )
+  {
+    const route_neighbor_t* neighbor = &route->neighbors[index];
+
+    if( neighbor->address == route->parent )
+    {
+      current = neighbor;
+    }
+    if( (0xFFFF != cost( neighbor )) &&
+        ((0 == best) || (cost( neighbor ) < cost( best ))) )
+    {
+      best = neighbor;
+    }
+  }
+
+  if( current && (0xFFFF != cost( current )) && best &&
+      (cost( current ) <= cost( best ) + ROUTE_HYSTERESIS) )
+  {
+    best = current;
+  }
+
+  if( best )
+  {
+    route->parent = best->address;
+    route->depth = best->depth + 1;
+  }
+  else
+  {
+    route->parent = ROUTE_BROADCAST;
+    route->depth = ROUTE_NO_DEPTH;
+  }
+}
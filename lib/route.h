@@ -0,0 +1,111 @@
+/** @file route.h
+*
+* @brief Multi-hop routing toward the access point
+*
+* @author Alvaro Prieto
+*/
+#ifndef _ROUTE_H
+#define _ROUTE_H
+
+// No hardware dependencies here so the host simulation can build route.c
+// as is
+#include <stdint.h>
+
+// next_hop for a node without a parent: any repeater closer to the access
+// point may forward it
+#define ROUTE_BROADCAST (0xFF)
+
+// Depth of a node without a route to the access point
+#define ROUTE_NO_DEPTH (0x0F)
+
+// Packets are dropped after this many forwards
+#define ROUTE_MAX_HOPS (4)
+
+// Repeaters (and the access point) kept as possible parents
+#define ROUTE_NEIGHBORS (4)
+
+// Packets (source, sequence) remembered for duplicate suppression
+#define ROUTE_CACHE_LEN (8)
+
+// Forget a neighbor after this many calls to route_age (beacons) without
+// hearing from it
+#define ROUTE_NEIGHBOR_TIMEOUT (8)
+
+// Link quality is RSSI in dBm + 128 (see route_quality). Links under
+// ROUTE_MIN_QUALITY (-95dBm) aren't used, anything over ROUTE_GOOD_QUALITY
+// (-75dBm) counts as perfect. One extra hop costs as much as ROUTE_HOP_COST
+// dB of link quality. A new parent has to be ROUTE_HYSTERESIS better than
+// the current one
+#define ROUTE_MIN_QUALITY (33)
+#define ROUTE_GOOD_QUALITY (53)
+#define ROUTE_HOP_COST (8)
+#define ROUTE_HYSTERESIS (4)
+
+// What route_receive wants done with a packet
+#define ROUTE_DROP (0)
+#define ROUTE_DELIVER (1)
+#define ROUTE_FORWARD (2)
+
+// Sent right after the packet header in every routed packet. header->source
+// stays the address of the node that made the packet
+typedef struct
+{
+  uint8_t sender;     // Node that sent this copy
+  uint8_t next_hop;   // Node that should forward it, or ROUTE_BROADCAST
+  uint8_t sequence;   // Per source
+  uint8_t hops_depth; // Forwards so far << 4 | sender's depth
+} route_header_t;
+
+#define ROUTE_HEADER_LEN (4)
+
+#define ROUTE_HOPS( header ) ( (header)->hops_depth >> 4 )
+#define ROUTE_DEPTH( header ) ( (header)->hops_depth & 0x0F )
+
+typedef struct
+{
+  uint8_t address;
+  uint8_t depth;      // Hops from the access point
+  uint8_t quality;    // Average, see ROUTE_MIN_QUALITY
+  uint8_t age;        // route_age calls since it was last heard
+} route_neighbor_t;
+
+typedef struct
+{
+  uint8_t source;
+  uint8_t sequence;
+} route_seen_t;
+
+typedef struct
+{
+  uint16_t originated;  // Packets made here
+  uint16_t delivered;   // Packets that reached the access point
+  uint16_t forwarded;   // Packets sent on toward the access point
+  uint16_t duplicates;  // Copies of packets already delivered or forwarded
+  uint16_t not_for_us;  // Packets some other node should forward
+  uint16_t dropped;     // No route, or too many hops
+} route_stats_t;
+
+typedef struct
+{
+  uint8_t address;
+  uint8_t sink;       // 1 on the access point
+  uint8_t sequence;
+  uint8_t parent;     // ROUTE_BROADCAST if there is none
+  uint8_t depth;
+  route_neighbor_t neighbors[ROUTE_NEIGHBORS];
+  uint8_t total_neighbors;
+  route_seen_t seen[ROUTE_CACHE_LEN];
+  uint8_t total_seen;
+  uint8_t next_seen;
+  route_stats_t stats;
+} route_t;
+
+void route_init( route_t*, uint8_t, uint8_t );
+uint8_t route_quality( uint8_t );
+void route_heard( route_t*, uint8_t, uint8_t, uint8_t );
+void route_age( route_t* );
+void route_originate( route_t*, route_header_t* );
+uint8_t route_receive( route_t*, uint8_t, route_header_t* );
+
+#endif /* _ROUTE_H */\
+
@@ -0,0 +1,95 @@
+/** @file sample_grid.c
+*
+* @brief Sampling on a network wide grid of global (synchronized) time
+*
+*   Sample n is due at global time n * period (see clock_sync.h), so every
+*   synchronized node samples at the same instants and the grid index names
+*   the same instant everywhere. Each instant is converted to local time
+*   with the current clock fit when it is scheduled, so skew corrections
+*   are picked up sample by sample.
+*
+*   Before the first sync global time is local time. When the clock fit
+*   jumps by more than a sample period (first sync, reference restart) the
+*   grid index jumps too, callers should check for gaps.
+*
+* @author Alvaro Prieto
+*/
+#include "sample_grid.h"
+#include "timers.h"
+#include "clock_sync.h"
+
+// Wrap-safe comparison of 32-bit tick counts
+#define TIME_BEFORE( a, b ) ((int32_t)((a) - (b)) < 0)
+
+static uint8_t sample_grid_isr( void );
+static void schedule( void );
+
+static uint8_t grid_ccr;
+static uint16_t grid_period;
+static uint32_t next_index;
+static uint8_t (*grid_callback)( uint32_t );
+
+/*******************************************************************************
+ * @fn     void setup_sample_grid( uint8_t ccr, uint16_t period,
+ *                                 uint8_t (*callback)( uint32_t ) )
+ * @brief  call callback with the grid index at every multiple of period ACLK
+ *         ticks of global time, using Timer A0 ccr. period must be less than
+ *         the timer period. The callback runs in interrupt context and its
+ *         return value is used to wake up from LPM3
+ * ****************************************************************************/
+void setup_sample_grid( uint8_t ccr, uint16_t period,
+                        uint8_t (*callback)( uint32_t ) )
+{
+  grid_ccr = ccr;
+  grid_period = period;
+  grid_callback = callback;
+
+  // Forces schedule to pick the next index from the current time
+  next_index = 0;
+
+  register_timer_callback( sample_grid_isr, ccr );
+  schedule();
+}
+
+/*******************************************************************************
+ * @fn     uint8_t sample_grid_isr( void )
+ * @brief  grid CCR callback
+ * ****************************************************************************/
+static uint8_t sample_grid_isr( void )
+{
+  uint8_t wake_up;
+
+  wake_up = grid_callback( next_index );
+
+  next_index++;
+  schedule();
+
+  return wake_up;
+}
+
+/*******************************************************************************
+ * @fn     void schedule( void )
+ * @brief  arm the CCR for next_index. Starts over from the current global time
+ *         if that instant isn't within the next two periods
+ * ****************************************************************************/
+static void schedule( void )
+{
+  uint32_t now;
+  uint32_t due;
+
+  now = get_timestamp();
+  due = global_to_local( next_index * grid_period );
+
+  if( TIME_BEFORE( due, now ) || ((due - now) > ((uint32_t)grid_period << 1)) )
+  {
+    next_index = local_to_global( now ) / grid_period + 1;
+    due = global_to_local( next_index * grid_period );
+  }
+
+  if( !set_ccr_at( grid_ccr, due ) )
+  {
+    // Two periods are more than a timer period, start over from now
+    next_index = local_to_global( now ) / grid_period + 1;
+    set_ccr_at( grid_ccr, global_to_local( next_index * grid_period ) );
+  }
+}
@@ -0,0 +1,15 @@
+/** @file sample_grid.h
+*
+* @brief Sampling on a network wide grid of global (synchronized) time
+*
+* @author Alvaro Prieto
+*/
+#ifndef _SAMPLE_GRID_H
+#define _SAMPLE_GRID_H
+
+#include "common.h"
+
+void setup_sample_grid( uint8_t, uint16_t, uint8_t (*)( uint32_t ) );
+
+#endif /* _SAMPLE_GRID_H */\
+
@@ -0,0 +1,99 @@
+/** @file sample_ring.c
+*
+* @brief Ring of fixed size sample blocks, see sample_ring.h
+*
+*   The producer calls sample_ring_claim for the next free block, fills it
+*   and calls sample_ring_publish. The consumer calls sample_ring_peek for
+*   the oldest published block, uses it in place and calls
+*   sample_ring_release. Nothing is copied in or out by the ring itself.
+*
+* @author Alvaro Prieto
+*/
+#include "sample_ring.h"
+
+/*******************************************************************************
+ * @fn     void sample_ring_init( sample_ring_t* ring, void* blocks,
+ *                                uint8_t size, uint8_t count )
+ * @brief  Use count blocks of size bytes at blocks. count must be a power of
+ *         two, up to 128
+ * ****************************************************************************/
+void sample_ring_init( sample_ring_t* ring, void* blocks, uint8_t size,
+                       uint8_t count )
+{
+  ring->blocks = (uint8_t*)blocks;
+  ring->size = size;
+  ring->mask = count - 1;
+  ring->ready = 0;
+  ring->consumed = 0;
+  ring->overruns = 0;
+}
+
+/*******************************************************************************
+ * @fn     void* sample_ring_claim( sample_ring_t* ring )
+ * @brief  Producer. Block to fill next, 0 if the ring is full (counted as an
+ *         overrun, the samples are dropped)
+ * ****************************************************************************/
+void* sample_ring_claim( sample_ring_t* ring )
+{
+  uint8_t ready = ring->ready;
+
+  if( (uint8_t)( ready - ring->consumed ) > ring->mask )
+  {
+    // Stops once it's full
+    if( 0xFFFF != ring->overruns )
+    {
+      ring->overruns++;
+    }
+    return 0;
+  }
+
+  return &ring->blocks[( ready & ring->mask ) * ring->size];
+}
+
+/*******************************************************************************
+ * @fn     void sample_ring_publish( sample_ring_t* ring )
+ * @brief  Producer. Hand the block from sample_ring_claim to the consumer
+ * ****************************************************************************/
+void sample_ring_publish( sample_ring_t* ring )
+{
+  SAMPLE_RING_BARRIER();
+  ring->ready = ring->ready + 1;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t sample_ring_count( const sample_ring_t* ring )
+ * @brief  Blocks published and not released yet
+ * ****************************************************************************/
+uint8_t sample_ring_count( const sample_ring_t* ring )
+{
+  return (uint8_t)( ring->ready - ring->consumed );
+}
+
+/*******************************************************************************
+ * @fn     void* sample_ring_peek( sample_ring_t* ring )
+ * @brief  Consumer. Oldest published block, 0 if there is none. It stays in
+ *         the ring until sample_ring_release
+ * ****************************************************************************/
+void* sample_ring_peek( sample_ring_t* ring )
+{
+  uint8_t consumed = ring->consumed;
+
+  if( ring->ready == consumed )
+  {
+    return 0;
+  }
+  SAMPLE_RING_BARRIER();
+
+  return &ring->blocks[( consumed & ring->mask ) * ring->size];
+}
+
+/*******************************************************************************
+ * @fn     void sample_ring_release( sample_ring_t* ring )
+ * @brief  Consumer. Done with the block from sample_ring_peek, the producer
+ *         can fill it again
+ * ****************************************************************************/
+void sample_ring_release( sample_ring_t* ring )
+{
+  SAMPLE_RING_BARRIER();
+  ring->consumed = ring->consumed + 1;
+}
@@ -0,0 +1,55 @@
+/** @file sample_ring.h
+*
+* @brief Ring of fixed size sample blocks, handed from an interrupt to the
+*        main loop without disabling interrupts
+*
+* @author Alvaro Prieto
+*/
+#ifndef _SAMPLE_RING_H
+#define _SAMPLE_RING_H
+
+// No hardware dependencies here so the host stress test can build
+// sample_ring.c as is
+#include <stdint.h>
+
+// One producer (an interrupt) fills blocks and publishes them, one consumer
+// (the main loop) reads them in order and releases them. Each side only
+// writes its own index, ready for the producer and consumed for the
+// consumer, and a byte write can't be torn, so neither side has to disable
+// interrupts. The indices count blocks modulo 256 and the ring has a power
+// of two blocks, up to 128, so ready - consumed is the number of blocks
+// published and not released yet.
+//
+// A block the producer finishes when the ring is full is dropped and
+// counted in overruns, the blocks the consumer hasn't released are never
+// written over.
+
+// The block must be written before the index that publishes it, and read
+// before the index that releases it. The MSP430 doesn't reorder memory
+// accesses, only the compiler has to be kept from it. The host stress test
+// runs the two sides on separate threads, that takes a fence
+#if defined(__MSP430__)
+#define SAMPLE_RING_BARRIER() __asm__ __volatile__( "" : : : "memory" )
+#else
+#define SAMPLE_RING_BARRIER() __sync_synchronize()
+#endif
+
+typedef struct
+{
+  uint8_t* blocks;              // count * size bytes
+  uint8_t size;                 // Bytes per block
+  uint8_t mask;                 // count - 1
+  volatile uint8_t ready;       // Blocks published, producer only
+  volatile uint8_t consumed;    // Blocks released, consumer only
+  volatile uint16_t overruns;   // Blocks dropped, producer only, up to 65535
+} sample_ring_t;
+
+void sample_ring_init( sample_ring_t*, void*, uint8_t, uint8_t );
+void* sample_ring_claim( sample_ring_t* );
+void sample_ring_publish( sample_ring_t* );
+uint8_t sample_ring_count( const sample_ring_t* );
+void* sample_ring_peek( sample_ring_t* );
+void sample_ring_release( sample_ring_t* );
+
+#endif /* _SAMPLE_RING_H */\
+
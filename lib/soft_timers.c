@@ -0,0 +1,381 @@
+/** @file soft_timers.c
+*
+* @brief Software timers multiplexed over a single Timer_A0 CCR
+*
+*   Timers live in a hashed timing wheel: the slot is picked from the
+*   deadline, and each slot is an unsorted doubly linked list, so starting and
+*   cancelling a timer are O(1). The CCR is only armed for the next deadline
+*   (no periodic tick). The wheel is scanned when re-arming, which is bounded
+*   by SOFT_TIMER_SLOTS.
+*
+*   Deadlines are in get_timestamp() ticks. The CCR is never armed more than
+*   one wheel revolution ahead so that timers from later revolutions, which
+*   share slots with near ones, get looked at again.
+*
+*   With STATS_ENABLE, soft_timer_stats_dump() sends one framed record through
+*   the UART:
+*   [0] SOFT_TIMER_STATS_RECORD_MARKER
+*   [1] DEVICE_ADDRESS
+*   [2...] soft_timer_stats_t, little endian
+*
+* @author Alvaro Prieto
+*/
+#include "soft_timers.h"
+#include "timers.h"
+#include "intrinsics.h"
+#if STATS_ENABLE
+#include <string.h>
+#include "uart.h"
+#endif
+
+#define RECORD_HEADER_LEN (2)
+
+#define SLOT_MASK (SOFT_TIMER_SLOTS - 1)
+#define SLOT_OF( time ) ((uint8_t)((time) >> SOFT_TIMER_SLOT_SHIFT) & SLOT_MASK)
+
+// Wrap-safe comparison of 32-bit tick counts
+#define TIME_BEFORE( a, b ) ((int32_t)((a) - (b)) < 0)
+
+static uint8_t soft_timer_isr( void );
+static void link_timer( soft_timer_t* );
+static void unlink_timer( soft_timer_t* );
+static void rearm( void );
+
+static soft_timer_t* wheel[SOFT_TIMER_SLOTS];
+
+static uint32_t current_time;
+
+// Everything up to this time has already been expired
+static uint32_t last_service;
+
+static uint32_t armed_deadline;
+static uint8_t armed;
+static uint8_t active_timers;
+
+static soft_timer_stats_t stats;
+
+#if STATS_ENABLE
+static uint8_t record[RECORD_HEADER_LEN + sizeof(soft_timer_stats_t)];
+#endif
+
+/*******************************************************************************
+ * @fn     void setup_soft_timers( void )
+ * @brief  Initialize the wheel and take over SOFT_TIMER_CCR. Timer A0 must
+ *         already be running (see setup_timer_a)
+ * ****************************************************************************/
+void setup_soft_timers( void )
+{
+  uint8_t slot;
+
+  for( slot = 0; slot < SOFT_TIMER_SLOTS; slot++ )
+  {
+    wheel[slot] = 0;
+  }
+
+  current_time = get_timestamp();
+  last_service = current_time;
+  armed = 0;
+  active_timers = 0;
+
+  register_timer_callback( soft_timer_isr, SOFT_TIMER_CCR );
+}
+
+/*******************************************************************************
+ * @fn     void soft_timer_start( soft_timer_t* timer, uint16_t delay,
+ *                                uint16_t period, uint8_t (*callback)(void) )
+ * @brief  (Re)start timer to call callback after delay ACLK ticks, then every
+ *         period ticks if period is not zero. The callback runs in interrupt
+ *         context and its return value is used to wake up from LPM3
+ * ****************************************************************************/
+void soft_timer_start( soft_timer_t* timer, uint16_t delay, uint16_t period,
+                       uint8_t (*callback)(void) )
+{
+  uint16_t interrupt_state;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+
+  if( soft_timer_active( timer ) )
+  {
+    unlink_timer( timer );
+    active_timers--;
+  }
+
+  current_time = get_timestamp();
+
+  timer->deadline = current_time + delay;
+  timer->period = period;
+  timer->callback = callback;
+
+  link_timer( timer );
+  active_timers++;
+
+  // Only touch the hardware if this one is due before whatever is armed
+  if( !armed || TIME_BEFORE( timer->deadline, armed_deadline ) )
+  {
+    rearm();
+  }
+
+  __set_interrupt_state( interrupt_state );
+}
+
+/*******************************************************************************
+ * @fn     void soft_timer_cancel( soft_timer_t* timer )
+ * @brief  Stop timer. The CCR is left armed, an early wake up is harmless
+ * ****************************************************************************/
+void soft_timer_cancel( soft_timer_t* timer )
+{
+  uint16_t interrupt_state;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+
+  if( soft_timer_active( timer ) )
+  {
+    unlink_timer( timer );
+    active_timers--;
+  }
+
+  __set_interrupt_state( interrupt_state );
+}
+
+/*******************************************************************************
+ * @fn     uint8_t soft_timer_active( soft_timer_t* timer )
+ * @brief  returns 1 if timer is queued
+ * ****************************************************************************/
+uint8_t soft_timer_active( soft_timer_t* timer )
+{
+  return ( (0 != timer->prev) || (wheel[SLOT_OF(timer->deadline)] == timer) );
+}
+
+/*******************************************************************************
+ * @fn     void soft_timer_get_stats( soft_timer_stats_t* out )
+ * @brief  copy expiry cost statistics and reset them
+ * ****************************************************************************/
+void soft_timer_get_stats( soft_timer_stats_t* out )
+{
+  uint16_t interrupt_state;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+
+  *out = stats;
+  stats.expired = 0;
+  stats.services = 0;
+  stats.service_time = 0;
+  stats.max_late = 0;
+  stats.max_service = 0;
+  stats.max_callbacks = 0;
+
+  __set_interrupt_state( interrupt_state );
+}
+
+#if STATS_ENABLE
+/*******************************************************************************
+ * @fn     void soft_timer_stats_dump( void )
+ * @brief  send the expiry statistics through the UART (see record format
+ *         above) and reset them
+ * ****************************************************************************/
+void soft_timer_stats_dump( void )
+{
+  soft_timer_stats_t out;
+
+  soft_timer_get_stats( &out );
+
+  record[0] = SOFT_TIMER_STATS_RECORD_MARKER;
+  record[1] = DEVICE_ADDRESS;
+  memcpy( &record[RECORD_HEADER_LEN], &out, sizeof(out) );
+
+  uart_write_escaped( record, sizeof(record) );
+}
+#endif
+
+/*******************************************************************************
+ * @fn     uint8_t soft_timer_isr( void )
+ * @brief  SOFT_TIMER_CCR callback. Expire everything that is due and arm the
+ *         CCR for the next deadline
+ * ****************************************************************************/
+static uint8_t soft_timer_isr( void )
+{
+  soft_timer_t* timer;
+  uint32_t elapsed;
+  uint32_t late;
+  uint8_t wake_up = 0;
+  uint8_t handled = 0;
+  uint8_t slot;
+  uint8_t steps;
+
+  current_time = get_timestamp();
+  armed = 0;
+
+  // Only walk the slots that time has gone through since the last service
+  if( (current_time - last_service) >= SOFT_TIMER_REVOLUTION )
+  {
+    steps = SOFT_TIMER_SLOTS;
+  }
+  else
+  {
+    steps = ((SLOT_OF(current_time) - SLOT_OF(last_service)) & SLOT_MASK) + 1;
+  }
+
+  slot = SLOT_OF(last_service);
+
+  while( steps-- )
+  {
+    timer = wheel[slot];
+    while( timer )
+    {
+      if( TIME_BEFORE( current_time, timer->deadline ) )
+      {
+        timer = timer->next;
+        continue;
+      }
+
+      unlink_timer( timer );
+
+      late = current_time - timer->deadline;
+      if( late > stats.max_late )
+      {
+        stats.max_late = (late > 0xFFFF) ? 0xFFFF : (uint16_t)late;
+      }
+
+      if( timer->period )
+      {
+        timer->deadline += timer->period;
+        link_timer( timer );
+      }
+      else
+      {
+        active_timers--;
+      }
+
+      wake_up |= timer->callback();
+      stats.expired++;
+      handled++;
+
+      // The callback is allowed to start/cancel timers, start over
+      timer = wheel[slot];
+    }
+
+    slot = (slot + 1) & SLOT_MASK;
+  }
+
+  last_service = current_time;
+
+  rearm();
+
+  elapsed = get_timestamp() - current_time;
+  stats.services++;
+  stats.service_time += elapsed;
+  if( elapsed > stats.max_service )
+  {
+    stats.max_service = (elapsed > 0xFFFF) ? 0xFFFF : (uint16_t)elapsed;
+  }
+  if( handled > stats.max_callbacks )
+  {
+    stats.max_callbacks = handled;
+  }
+
+  return wake_up;
+}
+
+/*******************************************************************************
+ * @fn     void rearm( void )
+ * @brief  Find the next deadline within one revolution and program the CCR.
+ *         Must be called with interrupts disabled and current_time updated
+ * ****************************************************************************/
+static void rearm( void )
+{
+  soft_timer_t* timer;
+  uint32_t next;
+  uint32_t window_end;
+  uint8_t slot;
+  uint8_t step;
+
+  if( 0 == active_timers )
+  {
+    clear_ccr( SOFT_TIMER_CCR );
+    armed = 0;
+    return;
+  }
+
+  // Wake up at least once per revolution to look at the far away timers
+  next = current_time + SOFT_TIMER_REVOLUTION;
+
+  slot = SLOT_OF(current_time);
+  window_end = (current_time | ((1 << SOFT_TIMER_SLOT_SHIFT) - 1)) + 1;
+
+  // The current slot comes around again at the end: timers in it from the
+  // next revolution can still be less than one revolution away
+  for( step = 0; step <= SOFT_TIMER_SLOTS; step++ )
+  {
+    for( timer = wheel[slot]; timer; timer = timer->next )
+    {
+      // Timers from later revolutions share the slot, skip them
+      if( TIME_BEFORE( timer->deadline, window_end ) &&
+          TIME_BEFORE( timer->deadline, next ) )
+      {
+        next = timer->deadline;
+      }
+    }
+
+    if( TIME_BEFORE( next, window_end ) )
+    {
+      break;
+    }
+
+    slot = (slot + 1) & SLOT_MASK;
+    window_end += (1 << SOFT_TIMER_SLOT_SHIFT);
+  }
+
+  armed_deadline = next;
+  armed = 1;
+
+  // next is never more than a revolution ahead, but a timer can be overdue
+  // by a timer period if interrupts were held off that long
+  if( !set_ccr_at( SOFT_TIMER_CCR, next ) )
+  {
+    set_ccr_at( SOFT_TIMER_CCR, get_timestamp() );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void link_timer( soft_timer_t* timer )
+ * @brief  add timer to the head of its wheel slot
+ * ****************************************************************************/
+static void link_timer( soft_timer_t* timer )
+{
+  uint8_t slot = SLOT_OF(timer->deadline);
+
+  timer->prev = 0;
+  timer->next = wheel[slot];
+  if( wheel[slot] )
+  {
+    wheel[slot]->prev = timer;
+  }
+  wheel[slot] = timer;
+}
+
+/*******************************************************************************
+ * @fn     void unlink_timer( soft_timer_t* timer )
+ * @brief  remove timer from its wheel slot
+ * ****************************************************************************/
+static void unlink_timer( soft_timer_t* timer )
+{
+  if( timer->prev )
+  {
+    timer->prev->next = timer->next;
+  }
+  else
+  {
+    wheel[SLOT_OF(timer->deadline)] = timer->next;
+  }
+
+  if( timer->next )
+  {
+    timer->next->prev = timer->prev;
+  }
+
+  timer->next = 0;
+  timer->prev = 0;
+}
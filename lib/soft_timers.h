@@ -0,0 +1,55 @@
+/** @file soft_timers.h
+*
+* @brief Software timers multiplexed over a single Timer_A0 CCR
+*
+* @author Alvaro Prieto
+*/
+#ifndef _SOFT_TIMERS_H
+#define _SOFT_TIMERS_H
+
+#include "common.h"
+
+// Capture compare register used by the software timers. The demos use
+// CCR0-CCR2 directly, so take one of the free ones.
+#define SOFT_TIMER_CCR (3)
+
+// Timing wheel geometry. Each slot covers 2^SOFT_TIMER_SLOT_SHIFT ACLK ticks,
+// one revolution of the wheel covers SOFT_TIMER_SLOTS of them (125ms)
+#define SOFT_TIMER_SLOT_SHIFT (8)
+#define SOFT_TIMER_SLOTS (16)
+#define SOFT_TIMER_REVOLUTION ((uint32_t)SOFT_TIMER_SLOTS << SOFT_TIMER_SLOT_SHIFT)
+
+typedef struct soft_timer
+{
+  struct soft_timer* next;
+  struct soft_timer* prev;
+  uint32_t deadline;
+  uint16_t period;  // 0 for one-shot timers
+  uint8_t (*callback)( void );
+} soft_timer_t;
+
+// First byte of the UART record (build with STATS=1). Can't be mistaken for a
+// packet length (see PROFILE_RECORD_MARKER)
+#define SOFT_TIMER_STATS_RECORD_MARKER (0xF7)
+
+// service_time / expired is the average cost of one expiry, service_time /
+// services that of one interrupt
+typedef struct
+{
+  uint16_t expired;         // Number of timer expirations
+  uint16_t services;        // Number of service calls (SOFT_TIMER_CCR interrupts)
+  uint32_t service_time;    // Total time spent in service calls, in ACLK ticks
+  uint16_t max_late;        // Worst lateness of an expiry, in ACLK ticks
+  uint16_t max_service;     // Worst time spent in one service call, in ACLK ticks
+  uint16_t max_callbacks;   // Most expirations handled in one service call
+} soft_timer_stats_t;
+
+void setup_soft_timers( void );
+void soft_timer_start( soft_timer_t*, uint16_t, uint16_t, uint8_t (*)(void) );
+void soft_timer_cancel( soft_timer_t* );
+uint8_t soft_timer_active( soft_timer_t* );
+void soft_timer_get_stats( soft_timer_stats_t* );
+void soft_timer_stats_dump( void );
+
+#endif /* _SOFT_TIMERS_H */\
+
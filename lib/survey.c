@@ -0,0 +1,180 @@
+/** @file survey.c
+*
+* @brief Noise statistics of radio channels from RSSI samples, see survey.h
+*
+*   The access point samples the RSSI of each channel it could use while its
+*   own network is quiet. A channel's busy share is how often something was
+*   on the air, its noise floor the mean of the samples when nothing was.
+*   The least busy channel wins, the noise floor breaks ties.
+*
+* @author Alvaro Prieto
+*/
+#include "survey.h"
+
+/*******************************************************************************
+ * @fn     void survey_reset( survey_channel_t* channels, uint8_t count )
+ * @brief  Forget the samples of count channels
+ * ****************************************************************************/
+void survey_reset( survey_channel_t* channels, uint8_t count )
+{
+  uint8_t index;
+
+  for( index = 0; index < count; index++ )
+  {
+    channels[index].samples = 0;
+    channels[index].busy = 0;
+    channels[index].quiet_sum = 0;
+    channels[index].peak = 0;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void survey_sample( survey_channel_t* channel, uint8_t level )
+ * @brief  Add an RSSI sample (dBm + 128). Samples past 65535 are ignored
+ * ****************************************************************************/
+void survey_sample( survey_channel_t* channel, uint8_t level )
+{
+  if( 0xFFFF == channel->samples )
+  {
+    return;
+  }
+
+  channel->samples++;
+  if( level >= SURVEY_BUSY_LEVEL )
+  {
+    channel->busy++;
+  }
+  else
+  {
+    channel->quiet_sum += level;
+  }
+
+  if( level > channel->peak )
+  {
+    channel->peak = level;
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t survey_floor( const survey_channel_t* channel )
+ * @brief  Noise floor (dBm + 128), SURVEY_BUSY_LEVEL if the channel was
+ *         never quiet
+ * ****************************************************************************/
+uint8_t survey_floor( const survey_channel_t* channel )
+{
+  uint16_t quiet;
+
+  quiet = channel->samples - channel->busy;
+  if( 0 == quiet )
+  {
+    return SURVEY_BUSY_LEVEL;
+  }
+
+  return (uint8_t)( ( channel->quiet_sum + quiet / 2 ) / quiet );
+}
+
+/*******************************************************************************
+ * @fn     uint8_t survey_busy( const survey_channel_t* channel )
+ * @brief  Percentage of the samples the channel was in use, 100 if it was
+ *         never sampled
+ * ****************************************************************************/
+uint8_t survey_busy( const survey_channel_t* channel )
+{
+  if( 0 == channel->samples )
+  {
+    return 100;
+  }
+
+  return (uint8_t)( ( (uint32_t)channel->busy * 100 + channel->samples / 2 ) /
+                    channel->samples );
+}
+
+/*******************************************************************************
+ * @fn     uint8_t survey_pick( const survey_channel_t* channels,
+ *                              uint8_t count, uint8_t current )
+ * @brief  Index of the channel to use, current unless another one is clearly
+ *         quieter (see SURVEY_BUSY_MARGIN). Channels never sampled aren't
+ *         picked
+ * ****************************************************************************/
+uint8_t survey_pick( const survey_channel_t* channels, uint8_t count,
+                     uint8_t current )
+{
+  uint8_t best = current;
+  uint8_t best_busy = 0;
+  uint8_t best_floor = 0;
+  uint8_t current_busy;
+  uint8_t current_floor;
+  uint8_t busy;
+  uint8_t floor;
+  uint8_t index;
+
+  current_busy = survey_busy( &channels[current] );
+  current_floor = survey_floor( &channels[current] );
+
+  for( index = 0; index < count; index++ )
+  {
+    if( (index == current) || (0 == channels[index].samples) )
+    {
+      continue;
+    }
+
+    busy = survey_busy( &channels[index] );
+    floor = survey_floor( &channels[index] );
+
+    // Only channels clearly quieter than the current one are worth moving
+    // to, the quietest of them wins
+    if( !((busy + SURVEY_BUSY_MARGIN <= current_busy) ||
+          ((busy <= current_busy) &&
+           (floor + SURVEY_FLOOR_MARGIN <= current_floor))) )
+    {
+      continue;
+    }
+
+    if( (best == current) || (busy < best_busy) ||
+        ((busy == best_busy) && (floor < best_floor)) )
+    {
+      best = index;
+      best_busy = busy;
+      best_floor = floor;
+    }
+  }
+
+  return best;
+}
+
+/*******************************************************************************
+ * @fn     void survey_announce( uint8_t* entry, uint8_t index, uint8_t left )
+ * @brief  Write the announcement of a move to channel index, left beacons
+ *         before it, to entry (NACK_ENTRY_LEN bytes)
+ * ****************************************************************************/
+void survey_announce( uint8_t* entry, uint8_t index, uint8_t left )
+{
+  entry[0] = SURVEY_MOVE;
+  entry[1] = index;
+  entry[2] = left;
+  entry[3] = 0;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t survey_find_move( const uint8_t* entries, uint8_t count,
+ *                                   uint8_t* index, uint8_t* left )
+ * @brief  Look for a move announcement in count request entries. Returns 0
+ *         if there is none
+ * ****************************************************************************/
+uint8_t survey_find_move( const uint8_t* entries, uint8_t count,
+                          uint8_t* index, uint8_t* left )
+{
+  uint8_t entry;
+
+  for( entry = 0; entry < count; entry++ )
+  {
+    if( SURVEY_MOVE == entries[entry * NACK_ENTRY_LEN] )
+    {
+      *index = entries[entry * NACK_ENTRY_LEN + 1];
+      *left = entries[entry * NACK_ENTRY_LEN + 2];
+      return 1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,55 @@
+/** @file survey.h
+*
+* @brief Noise statistics of radio channels from RSSI samples, to pick the
+*        quietest one
+*
+* @author Alvaro Prieto
+*/
+#ifndef _SURVEY_H
+#define _SURVEY_H
+
+// No hardware dependencies here so the host simulation can build survey.c
+// as is
+#include <stdint.h>
+#include "nack.h"
+
+// Levels are RSSI in dBm + 128, like link qualities (see route_quality).
+// Samples at or over SURVEY_BUSY_LEVEL (-90dBm, a few dB over the receiver
+// sensitivity) count as the channel being in use, the rest make up its noise
+// floor
+#define SURVEY_BUSY_LEVEL ( 128 - 90 )
+
+// A channel is only picked over the current one when it is busy
+// SURVEY_BUSY_MARGIN percent less of the time, or no more often with a noise
+// floor SURVEY_FLOOR_MARGIN dB lower, so the network doesn't keep moving
+// between two channels that are about the same
+#define SURVEY_BUSY_MARGIN (5)
+#define SURVEY_FLOOR_MARGIN (6)
+
+// Moving to another channel is announced in place of a re-send request in
+// the sync beacon (see nack.h):
+//
+// [SURVEY_MOVE][channel index][beacons left][0]
+//
+// beacons left is 0 in the last beacon sent on the old channel
+#define SURVEY_MOVE (0xFF)
+
+// What one channel sounded like
+typedef struct
+{
+  uint16_t samples;
+  uint16_t busy;        // Samples at or over SURVEY_BUSY_LEVEL
+  uint32_t quiet_sum;   // Sum of the other samples
+  uint8_t peak;         // Loudest sample
+} survey_channel_t;
+
+void survey_reset( survey_channel_t*, uint8_t );
+void survey_sample( survey_channel_t*, uint8_t );
+uint8_t survey_floor( const survey_channel_t* );
+uint8_t survey_busy( const survey_channel_t* );
+uint8_t survey_pick( const survey_channel_t*, uint8_t, uint8_t );
+void survey_announce( uint8_t*, uint8_t, uint8_t );
+uint8_t survey_find_move( const uint8_t*, uint8_t, uint8_t*, uint8_t* );
+
+#endif /* _SURVEY_H */\
+
@@ -0,0 +1,393 @@
+/** @file tdma.c
+*
+* @brief Table driven TDMA MAC
+*
+*   The superframe is described by a slot table that can be different on
+*   every node. Only the slots owned by this device (DEVICE_ADDRESS) are
+*   scheduled. Slot times are kept in reference (global) time, counted from
+*   the last superframe start given to tdma_sync, and converted to local
+*   timestamps with clock_sync. TDMA_CCR is armed at the start of each slot
+*   plus a guard time. The guard grows with the time since the last beacon,
+*   so a node whose clock drifted early or late still stays inside its slot.
+*
+*   The packet for a slot is queued beforehand and sent straight from the
+*   timer interrupt, so the start of transmission doesn't depend on what
+*   the main loop is doing. It goes out on the slot's channel, the radio
+*   stays there afterwards.
+*
+*   With STATS_ENABLE, tdma_stats_dump() sends one framed record through the
+*   UART:
+*   [0] TDMA_STATS_RECORD_MARKER
+*   [1] DEVICE_ADDRESS
+*   [2...] tdma_stats_t, little endian
+*
+* @author Alvaro Prieto
+*/
+#include "tdma.h"
+#include "timers.h"
+#include "clock_sync.h"
+#include "intrinsics.h"
+#if STATS_ENABLE
+#include <string.h>
+#include "uart.h"
+#endif
+
+#define RECORD_HEADER_LEN (2)
+
+// Wrap-safe comparison of 32-bit tick counts
+#define TIME_BEFORE( a, b ) ((int32_t)((a) - (b)) < 0)
+
+static uint8_t tdma_isr( void );
+static uint8_t find_slot( uint8_t );
+static uint8_t count_slots( uint8_t );
+static void next_slot( void );
+static void schedule( void );
+static uint8_t dummy_callback( const tdma_slot_t* );
+
+static const tdma_slot_t* slots;
+static uint8_t total_slots;
+static uint16_t superframe_length;
+static uint8_t (*slot_callback)( const tdma_slot_t* ) = dummy_callback;
+
+static uint32_t superframe_start;
+static uint16_t current_guard;
+static uint8_t current_slot;
+static uint8_t synced;
+
+static uint8_t* queued_buffer;
+static uint8_t queued_size;
+
+static tdma_stats_t stats;
+
+#if STATS_ENABLE
+static uint8_t record[RECORD_HEADER_LEN + sizeof(tdma_stats_t)];
+#endif
+
+/*******************************************************************************
+ * @fn     void setup_tdma( const tdma_slot_t* table, uint8_t table_size,
+ *                          uint16_t superframe,
+ *                          uint8_t (*callback)( const tdma_slot_t* ) )
+ * @brief  Use table (sorted by offset) as the superframe schedule. Slots are
+ *         only used after tdma_sync. callback is called from the timer
+ *         interrupt after each of this device's slots starts, and its return
+ *         value is used to wake up from LPM3. superframe must be shorter than
+ *         the timer period and divide the sync period
+ * ****************************************************************************/
+void setup_tdma( const tdma_slot_t* table, uint8_t table_size,
+                 uint16_t superframe, uint8_t (*callback)( const tdma_slot_t* ) )
+{
+  slots = table;
+  total_slots = table_size;
+  superframe_length = superframe;
+  slot_callback = callback;
+
+  synced = 0;
+  queued_buffer = 0;
+
+  register_timer_callback( tdma_isr, TDMA_CCR );
+}
+
+/*******************************************************************************
+ * @fn     void tdma_set_table( const tdma_slot_t* table, uint8_t table_size )
+ * @brief  Replace the slot table, e.g. after a new slot assignment. Takes
+ *         effect at the next tdma_sync
+ * ****************************************************************************/
+void tdma_set_table( const tdma_slot_t* table, uint8_t table_size )
+{
+  uint16_t interrupt_state;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+
+  slots = table;
+  total_slots = table_size;
+
+  // Don't send in a slot that may belong to someone else now
+  current_slot = total_slots;
+  clear_ccr( TDMA_CCR );
+
+  __set_interrupt_state( interrupt_state );
+}
+
+/*******************************************************************************
+ * @fn     void tdma_sync( uint32_t sync_time )
+ * @brief  A superframe started at sync_time (global time, see clock_sync.h).
+ *         Add the beacon to clock_sync first. Superframes keep going without
+ *         tdma_sync until the guard times get too large
+ * ****************************************************************************/
+void tdma_sync( uint32_t sync_time )
+{
+  uint16_t interrupt_state;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+
+  superframe_start = sync_time;
+  synced = 1;
+
+  current_slot = find_slot( 0 );
+  schedule();
+
+  __set_interrupt_state( interrupt_state );
+}
+
+/*******************************************************************************
+ * @fn     uint8_t tdma_synced( void )
+ * @brief  returns 1 while slots are being scheduled
+ * ****************************************************************************/
+uint8_t tdma_synced( void )
+{
+  return synced;
+}
+
+/*******************************************************************************
+ * @fn     void tdma_queue( uint8_t* buffer, uint8_t size )
+ * @brief  Send buffer at the start of the next slot. The buffer must not be
+ *         changed until it is sent (the slot callback is called after that).
+ *         Queueing again replaces the previous packet, a null buffer
+ *         cancels it
+ * ****************************************************************************/
+void tdma_queue( uint8_t* buffer, uint8_t size )
+{
+  uint16_t interrupt_state;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+
+  queued_buffer = buffer;
+  queued_size = size;
+
+  __set_interrupt_state( interrupt_state );
+}
+
+/*******************************************************************************
+ * @fn     uint8_t tdma_queued( void )
+ * @brief  returns 1 while the queued packet hasn't been sent
+ * ****************************************************************************/
+uint8_t tdma_queued( void )
+{
+  return ( 0 != queued_buffer );
+}
+
+/*******************************************************************************
+ * @fn     void tdma_get_stats( tdma_stats_t* out )
+ * @brief  copy slot statistics and reset them
+ * ****************************************************************************/
+void tdma_get_stats( tdma_stats_t* out )
+{
+  uint16_t interrupt_state;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+
+  *out = stats;
+  stats.sent = 0;
+  stats.empty = 0;
+  stats.skipped = 0;
+  stats.unsynced = 0;
+  stats.max_guard = 0;
+
+  __set_interrupt_state( interrupt_state );
+}
+
+#if STATS_ENABLE
+/*******************************************************************************
+ * @fn     void tdma_stats_dump( void )
+ * @brief  send the slot statistics through the UART (see record format above)
+ *         and reset them
+ * ****************************************************************************/
+void tdma_stats_dump( void )
+{
+  tdma_stats_t out;
+
+  tdma_get_stats( &out );
+
+  record[0] = TDMA_STATS_RECORD_MARKER;
+  record[1] = DEVICE_ADDRESS;
+  memcpy( &record[RECORD_HEADER_LEN], &out, sizeof(out) );
+
+  uart_write_escaped( record, sizeof(record) );
+}
+#endif
+
+/*******************************************************************************
+ * @fn     uint8_t tdma_isr( void )
+ * @brief  TDMA_CCR callback, start of one of this device's slots
+ * ****************************************************************************/
+static uint8_t tdma_isr( void )
+{
+  uint8_t wake_up;
+
+  if( 0 == synced )
+  {
+    return 0;
+  }
+
+  if( 0 == queued_buffer )
+  {
+    stats.empty++;
+  }
+  else if( (TDMA_AIRTIME( queued_size ) + TDMA_TURNAROUND +
+            (current_guard << 1)) > slots[current_slot].length )
+  {
+    // Would run into the next slot, keep it for when the guard is smaller
+    stats.skipped++;
+  }
+  else
+  {
+    radio_set_channel( slots[current_slot].channel );
+    radio_tx( queued_buffer, queued_size );
+    queued_buffer = 0;
+    stats.sent++;
+  }
+
+  wake_up = slot_callback( &slots[current_slot] );
+
+  next_slot();
+  schedule();
+
+  return wake_up;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t find_slot( uint8_t index )
+ * @brief  first slot owned by this device starting at index. Returns
+ *         total_slots if there is none
+ * ****************************************************************************/
+static uint8_t find_slot( uint8_t index )
+{
+  while( (index < total_slots) && (DEVICE_ADDRESS != slots[index].owner) )
+  {
+    index++;
+  }
+
+  return index;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t count_slots( uint8_t index )
+ * @brief  number of slots owned by this device starting at index
+ * ****************************************************************************/
+static uint8_t count_slots( uint8_t index )
+{
+  uint8_t count = 0;
+
+  for( index = find_slot( index ); index < total_slots;
+       index = find_slot( index + 1 ) )
+  {
+    count++;
+  }
+
+  return count;
+}
+
+/*******************************************************************************
+ * @fn     void next_slot( void )
+ * @brief  move current_slot to the next owned slot, in the next superframe
+ *         if needed
+ * ****************************************************************************/
+static void next_slot( void )
+{
+  current_slot = find_slot( current_slot + 1 );
+  if( current_slot >= total_slots )
+  {
+    superframe_start += superframe_length;
+    current_slot = find_slot( 0 );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void schedule( void )
+ * @brief  arm TDMA_CCR for the first usable slot from current_slot on. Must be
+ *         called with interrupts disabled
+ * ****************************************************************************/
+static void schedule( void )
+{
+  uint32_t start;
+  uint32_t elapsed;
+  uint32_t behind;
+  uint16_t guard;
+
+  // Nothing owned by this device
+  if( current_slot >= total_slots )
+  {
+    clear_ccr( TDMA_CCR );
+    return;
+  }
+
+  // After a long gap go straight to the superframe before the current one,
+  // instead of walking every slot in between with interrupts disabled. The
+  // loop below then looks at two superframes of slots at most, a slot from
+  // the previous one can still be usable while its guard time runs
+  elapsed = local_to_global( get_timestamp() ) - superframe_start;
+  if( ((int32_t)elapsed > 0) && (elapsed >= 2 * (uint32_t)superframe_length) )
+  {
+    behind = elapsed / superframe_length - 1;
+    stats.skipped += count_slots( current_slot ) +
+                     (uint16_t)( behind - 1 ) * count_slots( 0 );
+    superframe_start += behind * superframe_length;
+    current_slot = find_slot( 0 );
+  }
+
+  while( 1 )
+  {
+    start = global_to_local( superframe_start + slots[current_slot].offset );
+    elapsed = clock_sync_age( start );
+    if( (int32_t)elapsed < 0 )
+    {
+      elapsed = 0;
+    }
+
+    if( (0 == clock_sync_points()) || (elapsed > TDMA_MAX_UNSYNCED) )
+    {
+      // Drifted too far to trust the schedule, wait for the next sync
+      synced = 0;
+      stats.unsynced++;
+      clear_ccr( TDMA_CCR );
+      return;
+    }
+
+    if( clock_sync_compensated() )
+    {
+      guard = TDMA_GUARD( elapsed, TDMA_RESIDUAL_PPM );
+    }
+    else
+    {
+      guard = TDMA_GUARD( elapsed, TDMA_DRIFT_PPM );
+    }
+
+    // Skip slots that already started, sending late would run into the
+    // next slot
+    if( TIME_BEFORE( get_timestamp(), start + guard ) )
+    {
+      break;
+    }
+
+    stats.skipped++;
+    next_slot();
+  }
+
+  current_guard = guard;
+  if( guard > stats.max_guard )
+  {
+    stats.max_guard = guard;
+  }
+
+  if( !set_ccr_at( TDMA_CCR, start + guard ) )
+  {
+    // Slots are never a timer period ahead unless the clock fit is off,
+    // don't trust the schedule then either
+    synced = 0;
+    stats.unsynced++;
+    clear_ccr( TDMA_CCR );
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t dummy_callback( const tdma_slot_t* slot )
+ * @brief  empty slot callback, for when none is registered
+ * ****************************************************************************/
+static uint8_t dummy_callback( const tdma_slot_t* slot )
+{
+  return 0;
+}
@@ -0,0 +1,83 @@
+/** @file tdma.h
+*
+* @brief Table driven TDMA MAC
+*
+* @author Alvaro Prieto
+*/
+#ifndef _TDMA_H
+#define _TDMA_H
+
+#include "common.h"
+#include "radio.h"
+
+// Timer A0 capture compare register used to start the slots
+#define TDMA_CCR (2)
+
+// Drift between two +-40ppm crystals, before the skew is compensated
+#define TDMA_DRIFT_PPM (80)
+
+// Drift left after skew compensation (see clock_sync.h), temperature and
+// estimate error
+#define TDMA_RESIDUAL_PPM (2)
+
+// Timer quantization and beacon timestamp error, in ACLK ticks. tools/syncsim
+// shows up to 6 ticks with software timestamps
+#define TDMA_MIN_GUARD (6)
+
+// Stop transmitting if no sync was received for this long (ACLK ticks)
+#define TDMA_MAX_UNSYNCED (1310720)
+
+// First byte of the UART record (build with STATS=1). Can't be mistaken for a
+// packet length (see PROFILE_RECORD_MARKER)
+#define TDMA_STATS_RECORD_MARKER (0xF6)
+
+// IDLE to TX with automatic calibration (~720us), in ACLK ticks
+#define TDMA_TURNAROUND (25)
+
+// Guard time after elapsed ticks without sync, with ppm drift. The drift is
+// elapsed * ppm / 10^6 ticks, worked out as (elapsed / 2^10) * ppm / 977 so
+// the product fits 32 bits (2^10 * 977 = 1000448, about 10^6)
+#define TDMA_GUARD( elapsed, ppm ) \
+  ( TDMA_MIN_GUARD + (uint16_t)((((elapsed) >> 10) * (ppm)) / 977) + 1 )
+
+// Air time of a packet of size bytes (including the length byte), rounded up
+#define TDMA_AIRTIME( size ) \
+  RADIO_BYTE_TIME( (size) + RADIO_PREAMBLE_BYTES + RADIO_SYNC_BYTES + \
+                   RADIO_CRC_BYTES )
+
+// Slot length needed to send one packet of size bytes once the skew is
+// compensated. Nodes with more data per superframe get bigger packets or own
+// more than one slot
+#define TDMA_SLOT_LENGTH( size ) \
+  ( TDMA_AIRTIME( size ) + TDMA_TURNAROUND + \
+    2 * TDMA_GUARD( TDMA_MAX_UNSYNCED, TDMA_RESIDUAL_PPM ) )
+
+typedef struct
+{
+  uint8_t owner;    // Device address
+  uint8_t channel;  // Radio channel (CHANNR) to send on
+  uint16_t offset;  // From the start of the superframe, in ACLK ticks
+  uint16_t length;  // In ACLK ticks, see TDMA_SLOT_LENGTH
+} tdma_slot_t;
+
+typedef struct
+{
+  uint16_t sent;        // Packets sent in a slot
+  uint16_t empty;       // Slots with nothing queued
+  uint16_t skipped;     // Slots missed or where the guard time didn't fit
+  uint16_t unsynced;    // Times transmission stopped for lack of sync
+  uint16_t max_guard;   // Largest guard time used, in ACLK ticks
+} tdma_stats_t;
+
+void setup_tdma( const tdma_slot_t*, uint8_t, uint16_t,
+                                            uint8_t (*)( const tdma_slot_t* ) );
+void tdma_set_table( const tdma_slot_t*, uint8_t );
+void tdma_sync( uint32_t );
+uint8_t tdma_synced( void );
+void tdma_queue( uint8_t*, uint8_t );
+uint8_t tdma_queued( void );
+void tdma_get_stats( tdma_stats_t* );
+void tdma_stats_dump( void );
+
+#endif /* _TDMA_H */\
+
@@ -5,188 +5,375 @@
 * @author Alvaro Prieto
 */
 #include "timers.h"
+#include "intrinsics.h"
+#include "profiler.h"
+#include "trace.h"
 #include <signal.h>
 
 
 static uint8_t dummy_callback( void );
+static uint8_t timer_dispatch( uint8_t, uint16_t );
+static uint32_t read_timestamp( uint16_t* );
+static uint32_t timer_period( void );
+static uint16_t read_counter( void );
+
+// Register block layout, as word offsets from TAxCTL
+#define CCTL_OFFSET (1) // TAxCCTL0 at +0x02
+#define TAR_OFFSET (8)  // TAxR at +0x10
+#define CCR_OFFSET (9)  // TAxCCR0 at +0x12
 
 // Holds pointers to all callback functions for CCR registers (and overflow)
-static uint8_t (*ccr_callbacks[TOTAL_CCRS + 1])( void ) ;
-static uint8_t timer_mode;
+static uint8_t (*ta0_callbacks[TOTAL_CCRS + 1])( void ) ;
+static uint8_t (*ta1_callbacks[TOTAL_CCRS_A1 + 1])( void ) ;
+
+typedef struct
+{
+  volatile uint16_t* ctl;
+  uint8_t (**callbacks)( void );
+  uint8_t total_ccrs;
+} timer_a_t;
+
+static const timer_a_t timer_a[TOTAL_TIMERS] = {
+  { &TA0CTL, ta0_callbacks, TOTAL_CCRS },
+  { &TA1CTL, ta1_callbacks, TOTAL_CCRS_A1 }
+};
+
+// Upper part of the extended timebase. ACLK ticks accumulated at every
+// counter wrap (and at every clear_timer)
+static volatile uint32_t overflow_time;
+
+/*******************************************************************************
+ * @fn     void setup_timer( uint8_t timer, uint8_t mode )
+ * @brief  Initialize callback functions and start timer from ACLK
+ * ****************************************************************************/
+void setup_timer( uint8_t timer, uint8_t mode )
+{
+  const timer_a_t* timer_regs;
+  uint8_t index;
+
+  if( timer >= TOTAL_TIMERS )
+  {
+    return;
+  }
+  timer_regs = &timer_a[timer];
+
+  // Make sure all callback functions are pointing somewhere
+  for( index = 0; index <= timer_regs->total_ccrs; index++ )
+  {
+    timer_regs->callbacks[index] = dummy_callback;
+  }
+
+  // ACLK used so that counter remains active in LPM
+  *timer_regs->ctl = TASSEL__ACLK + mode + TAIE + TACLR;
+}
 
 /*******************************************************************************
  * @fn     void setup_timer_a( uint8_t mode )
- * @brief  Initialize callback functions and start timer in up mode
+ * @brief  Initialize callback functions and start timer A0
  * ****************************************************************************/
 void setup_timer_a( uint8_t mode )
 {
-    uint8_t index;
-    timer_mode = mode;
-    
-    // Make sure all callback functions are pointing somewhere
-    for( index = 0; index <= TOTAL_CCRS; index++ )
-    {
-      ccr_callbacks[index] = dummy_callback;
-    }
-
-    // ACLK, continuos mode, clear TAR
-		// ACLK used so that counter remains active in LPM
-  	TA0CTL = TASSEL__ACLK + timer_mode + TAIE + TACLR;	
+  overflow_time = 0;
 
+  setup_timer( TIMER_A0, mode );
 }
 
 /*******************************************************************************
- * @fn     register_timer_callback( uint8_t (*callback)(void), uint8_t ccr_number )
- * @brief  add callback function for CCR[ccr_number]
+ * @fn     register_ccr_callback( uint8_t timer, uint8_t (*callback)(void),
+ *                                                        uint8_t ccr_number )
+ * @brief  add callback function for CCR[ccr_number] (or overflow)
  * ****************************************************************************/
-void register_timer_callback( uint8_t (*callback)(void), uint8_t ccr_number )
+void register_ccr_callback( uint8_t timer, uint8_t (*callback)(void),
+                            uint8_t ccr_number )
 {
-  if( ccr_number <= (TOTAL_CCRS) )
+  if( (timer < TOTAL_TIMERS) && (ccr_number <= timer_a[timer].total_ccrs) )
   {
-    ccr_callbacks[ccr_number] = callback;
+    timer_a[timer].callbacks[ccr_number] = callback;
   }
   return;
 }
 
 /*******************************************************************************
- * @fn     set_ccr( uint8_t ccr_index, uint16_t value )
- * @brief  set the CCR value and enable interrupts on it
+ * @fn     set_timer_ccr( uint8_t timer, uint8_t ccr_index, uint16_t value )
+ * @brief  set the CCR value and enable interrupts on it. Its output goes low
+ *         and keeps its mode (see set_ccr_output), so with OUTMOD_1 the
+ *         compare is a rising edge
  * ****************************************************************************/
-void set_ccr( uint8_t ccr_index, uint16_t value )
+void set_timer_ccr( uint8_t timer, uint8_t ccr_index, uint16_t value )
 {
-  // (TA0CCR0_ + (ccr_index << 2)) = value;
-  // NOTE, this could be done in a simpler way by adding the ccr_index/2 to the
-  // address of TA0CCR0. The compiler is angry and I can't figure out why, so
-  // this is a temporary fix...
-  switch (ccr_index)
+  volatile uint16_t* ctl;
+  uint16_t mode;
+
+  if( (timer < TOTAL_TIMERS) && (ccr_index < timer_a[timer].total_ccrs) )
   {
-    case (0):
-    {
-      TA0CCR0 = value;
-      TA0CCTL0 = CCIE;
-      break;
-    }
-    case (1):
-    {
-      TA0CCR1 = value;
-      TA0CCTL1 = CCIE;
-      break;
-    }
-    case (2):
-    {
-      TA0CCR2 = value;
-      TA0CCTL2 = CCIE;
-      break;
-    }
-    case (3):
-    {
-      TA0CCR3 = value;
-      TA0CCTL3 = CCIE;
-      break;
-    }
-    case (4):
-    {
-      TA0CCR4 = value;
-      TA0CCTL4 = CCIE;
-      break;
-    }
+    ctl = timer_a[timer].ctl;
+    mode = ctl[CCTL_OFFSET + ccr_index] & OUTMOD_7;
+    ctl[CCR_OFFSET + ccr_index] = value;
+    // OUTMOD_0 with OUT clear drives the output low
+    ctl[CCTL_OFFSET + ccr_index] = CCIE;
+    ctl[CCTL_OFFSET + ccr_index] = CCIE + mode;
   }
 }
 
 /*******************************************************************************
- * @fn     clear_ccr( uint8_t ccr_index )
+ * @fn     clear_timer_ccr( uint8_t timer, uint8_t ccr_index )
  * @brief  clear the CCR value and disable interrupts on it
  * ****************************************************************************/
-void clear_ccr( uint8_t ccr_index )
+void clear_timer_ccr( uint8_t timer, uint8_t ccr_index )
 {
-  switch (ccr_index)
+  volatile uint16_t* ctl;
+
+  if( (timer < TOTAL_TIMERS) && (ccr_index < timer_a[timer].total_ccrs) )
   {
-    case (0):
-    {
-      TA0CCR0 = 0;
-      TA0CCTL0 &= ~CCIE;
-      break;
-    }
-    case (1):
-    {
-      TA0CCR1 = 0;
-      TA0CCTL1 &= ~CCIE;
-      break;
-    }
-    case (2):
-    {
-      TA0CCR2 = 0;
-      TA0CCTL2 &= ~CCIE;
-      break;
-    }
-    case (3):
-    {
-      TA0CCR3 = 0;
-      TA0CCTL3 &= ~CCIE;
-      break;
-    }
-    case (4):
-    {
-      TA0CCR4 = 0;
-      TA0CCTL4 &= ~CCIE;
-      break;
-    }
-    default:
-    {
-      //Shouldn't happen... 
-      break;   
-    }
+    ctl = timer_a[timer].ctl;
+    ctl[CCR_OFFSET + ccr_index] = 0;
+    ctl[CCTL_OFFSET + ccr_index] &= ~CCIE;
   }
 }
 
 /*******************************************************************************
- * @fn     increment_ccr( uint8_t ccr_index, uint16_t value )
+ * @fn     increment_timer_ccr( uint8_t timer, uint8_t ccr_index, uint16_t value )
  * @brief  increment the CCR by [value]
  * ****************************************************************************/
-void increment_ccr( uint8_t ccr_index, uint16_t value )
+void increment_timer_ccr( uint8_t timer, uint8_t ccr_index, uint16_t value )
 {
-  switch (ccr_index)
+  if( (timer < TOTAL_TIMERS) && (ccr_index < timer_a[timer].total_ccrs) )
   {
-    case (0):
-    {
-      TA0CCR0 += value;
-      break;
-    }
-    case (1):
-    {
-      TA0CCR1 += value;
-      break;
-    }
-    case (2):
-    {
-      TA0CCR2 += value;
-      break;
-    }
-    case (3):
-    {
-      TA0CCR3 += value;
-      break;
-    }
-    case (4):
-    {
-      TA0CCR4 += value;
-      break;
-    }
-    default:
-    {
-      //Shouldn't happen...  
-      break;  
-    }
+    timer_a[timer].ctl[CCR_OFFSET + ccr_index] += value;
   }
 }
 
 /*******************************************************************************
- * @fn     void dummy_callback( void )
- * @brief  empty function works as default callback
+ * @fn     uint8_t set_ccr_at( uint8_t ccr_index, uint32_t timestamp )
+ * @brief  arm the CCR to fire at an absolute timestamp (see get_timestamp)
+ *         and return 1. Times passed by less than one timer period fire as
+ *         soon as possible. Returns 0 and leaves the CCR alone if timestamp
+ *         is a timer period or more away, ahead or behind, the CCR can't
+ *         tell those times from the near ones
+ * ****************************************************************************/
+uint8_t set_ccr_at( uint8_t ccr_index, uint32_t timestamp )
+{
+  uint16_t interrupt_state;
+  uint16_t count;
+  uint32_t delta;
+  uint32_t value;
+  uint32_t period;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+
+  delta = timestamp - read_timestamp( &count );
+  period = timer_period();
+
+  if( ((int32_t)delta >= (int32_t)period) ||
+      ((int32_t)delta <= -(int32_t)period) )
+  {
+    __set_interrupt_state( interrupt_state );
+    return 0;
+  }
+
+  // Just missed, leave a couple of ticks so the counter can't pass the CCR
+  // before it is set
+  if( (int32_t)delta < 2 )
+  {
+    delta = 2;
+  }
+
+  value = count + delta;
+  if( value >= period )
+  {
+    value -= period;
+  }
+
+  set_ccr( ccr_index, (uint16_t)value );
+
+  __set_interrupt_state( interrupt_state );
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     uint32_t get_timestamp( void )
+ * @brief  monotonic 32-bit time in ACLK ticks (wraps after ~36 hours).
+ *         Safe to call from interrupts and with interrupts disabled
+ * ****************************************************************************/
+uint32_t get_timestamp( void )
+{
+  uint16_t interrupt_state;
+  uint16_t count;
+  uint32_t timestamp;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+
+  timestamp = read_timestamp( &count );
+
+  __set_interrupt_state( interrupt_state );
+
+  return timestamp;
+}
+
+/*******************************************************************************
+ * @fn     uint32_t timestamp_at( uint16_t count )
+ * @brief  timestamp of a Timer A0 counter value from less than one timer period
+ *         ago, such as a capture
+ * ****************************************************************************/
+uint32_t timestamp_at( uint16_t count )
+{
+  uint16_t interrupt_state;
+  uint16_t now;
+  uint32_t timestamp;
+  uint32_t delta;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+
+  timestamp = read_timestamp( &now );
+
+  if( now >= count )
+  {
+    delta = now - count;
+  }
+  else
+  {
+    delta = timer_period() - count + now;
+  }
+
+  __set_interrupt_state( interrupt_state );
+
+  return timestamp - delta;
+}
+
+/*******************************************************************************
+ * @fn     void set_ccr_output( uint8_t ccr_index, uint16_t mode )
+ * @brief  set the output mode (OUTMOD_x) of a Timer A0 CCR, for peripherals
+ *         triggered by its output such as the ADC12 (see adc.h)
+ * ****************************************************************************/
+void set_ccr_output( uint8_t ccr_index, uint16_t mode )
+{
+  volatile uint16_t* ctl = timer_a[TIMER_A0].ctl;
+
+  ctl[CCTL_OFFSET + ccr_index] = ( ctl[CCTL_OFFSET + ccr_index] & ~OUTMOD_7 ) |
+                                 mode;
+}
+
+/*******************************************************************************
+ * @fn     void setup_capture( uint8_t ccr_index, uint16_t edge )
+ * @brief  use a Timer A0 CCR to capture its CCIxA input on edge (CM_1 rising,
+ *         CM_2 falling). No interrupt, see read_capture
+ * ****************************************************************************/
+void setup_capture( uint8_t ccr_index, uint16_t edge )
+{
+  volatile uint16_t* ctl = timer_a[TIMER_A0].ctl;
+
+  // Synchronous capture so the CCR is never read mid update
+  ctl[CCTL_OFFSET + ccr_index] = edge + CCIS_0 + SCS + CAP;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t read_capture( uint8_t ccr_index, uint32_t* timestamp )
+ * @brief  if exactly one capture happened since the last call, store its
+ *         timestamp and return 1. Captures must be less than one timer
+ *         period old
+ * ****************************************************************************/
+uint8_t read_capture( uint8_t ccr_index, uint32_t* timestamp )
+{
+  volatile uint16_t* ctl = timer_a[TIMER_A0].ctl;
+  uint16_t flags;
+  uint16_t count;
+
+  flags = ctl[CCTL_OFFSET + ccr_index];
+  count = ctl[CCR_OFFSET + ccr_index];
+  ctl[CCTL_OFFSET + ccr_index] &= ~(CCIFG + COV);
+
+  // Nothing captured, or more than one edge and the first one was lost
+  if( CCIFG != (flags & (CCIFG + COV)) )
+  {
+    return 0;
+  }
+
+  *timestamp = timestamp_at( count );
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     void clear_timer( void )
+ * @brief  restart the counter in up mode. Elapsed ticks are folded into the
+ *         extended timebase so timestamps stay monotonic
  * ****************************************************************************/
 inline void clear_timer()
 {
+  uint16_t interrupt_state;
+  uint16_t count;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+
+  // Writing TA0CTL also drops a pending TAIFG, which read_timestamp has
+  // already accounted for
+  overflow_time = read_timestamp( &count );
   TA0CTL = TASSEL__ACLK + MC_1 + TAIE + TACLR;
+
+  __set_interrupt_state( interrupt_state );
+}
+
+/*******************************************************************************
+ * @fn     uint32_t read_timestamp( uint16_t* count )
+ * @brief  extended time and the raw counter value it was built from.
+ *         Interrupts must be disabled
+ * ****************************************************************************/
+static uint32_t read_timestamp( uint16_t* count )
+{
+  uint32_t base;
+
+  base = overflow_time;
+  *count = read_counter();
+
+  // The counter may have wrapped without the overflow interrupt having run
+  // yet. If TAIFG is pending, the wrap isn't in overflow_time. Read the
+  // counter again: the first read may have been taken just before the wrap
+  if( TA0CTL & TAIFG )
+  {
+    *count = read_counter();
+    base += timer_period();
+  }
+
+  return base + *count;
+}
+
+/*******************************************************************************
+ * @fn     uint32_t timer_period( void )
+ * @brief  number of ticks between counter wraps
+ * ****************************************************************************/
+static uint32_t timer_period( void )
+{
+  if( MODE_UP == (TA0CTL & MC_3) )
+  {
+    // Up mode counts 0...TA0CCR0
+    return (uint32_t)TA0CCR0 + 1;
+  }
+
+  return 0x10000;
+}
+
+/*******************************************************************************
+ * @fn     uint16_t read_counter( void )
+ * @brief  read TA0R. The timer runs from ACLK, asynchronous to MCLK, so read
+ *         until two consecutive values agree
+ * ****************************************************************************/
+static uint16_t read_counter( void )
+{
+  uint16_t first;
+  uint16_t second;
+
+  do
+  {
+    first = TA0R;
+    second = TA0R;
+  } while( first != second );
+
+  return first;
 }
 
 /*******************************************************************************
@@ -200,15 +387,62 @@ static uint8_t dummy_callback( void )
   return 0;
 }
 
+/*******************************************************************************
+ * @fn     uint8_t timer_dispatch( uint8_t timer, uint16_t vector )
+ * @brief  call the callback for a TAxIV value. Returns the callback's wake up.
+ *         Its cost against the switch it replaced was only counted from the
+ *         instructions, never measured. PROFILE=1 times the TIMERx_A1 ISRs
+ *         around it, callbacks included
+ * ****************************************************************************/
+static uint8_t timer_dispatch( uint8_t timer, uint16_t vector )
+{
+  const timer_a_t* timer_regs = &timer_a[timer];
+  uint8_t index;
+
+  if( TIV_OVERFLOW == vector )
+  {
+    if( TIMER_A0 == timer )
+    {
+      // Extend the timebase first, the callback slot stays free for users
+      overflow_time += timer_period();
+    }
+    TRACE( TRACE_TIMER, (timer << 4) | timer_regs->total_ccrs )
+    return timer_regs->callbacks[timer_regs->total_ccrs]();
+  }
+
+  // TAxIV is 2 for CCR1, 4 for CCR2...
+  index = vector >> 1;
+  if( (index > 0) && (index < timer_regs->total_ccrs) )
+  {
+    if( TIMER_A0 == timer )
+    {
+      PROFILE_LATENCY( PROFILE_TIMER0_A1_ISR,
+                       TA0R - timer_regs->ctl[CCR_OFFSET + index] )
+    }
+    TRACE( TRACE_TIMER, (timer << 4) | index )
+    return timer_regs->callbacks[index]();
+  }
+
+  return 0;
+}
+
  /*******************************************************************************
  * @fn     void timerA0Interrupt( void )
  * @brief  Timer0 A0 Interrupt vector for CCR0
  * ****************************************************************************/
 interrupt (TIMER0_A0_VECTOR) timerA0Interrupt(void)
 {  
+  PROFILE_ENTER( PROFILE_TIMER0_A0_ISR )
 
-  ccr_callbacks[0]();
+  TRACE( TRACE_TIMER, (TIMER_A0 << 4) )
+
+  // Depending on the return value of the callback function, exit LPM3
+  if( ta0_callbacks[0]() )
+  {
+    __bic_SR_register_on_exit(LPM3_bits);
+  }
 
+  PROFILE_EXIT( PROFILE_TIMER0_A0_ISR )
 }
 
 /*******************************************************************************
@@ -217,54 +451,47 @@ interrupt (TIMER0_A0_VECTOR) timerA0Interrupt(void)
  * ****************************************************************************/
 interrupt (TIMER0_A1_VECTOR) timerA1Interrupt(void) // CHANGE
 {
-  uint8_t wake_up = 0;
-	//
-	// Figure out what caused the interrupt and respond accordingly
-	//
-	switch ( TA0IV )
-	{
-
-		case ( TIV_CCR1 ):
-    {
-      wake_up = ccr_callbacks[1]();
-		  break;
-    }
-    
-    case ( TIV_CCR2 ):
-    {
-      wake_up = ccr_callbacks[2]();
-		  break;
-    }
-    
-    case ( TIV_CCR3 ):
-    {
-      wake_up = ccr_callbacks[3]();
-		  break;
-    }
-    
-    case ( TIV_CCR4 ):
-    {
-      wake_up = ccr_callbacks[4]();
-		  break;
-    }
-    
-		case ( TIV_OVERFLOW ):
-    { 
-      wake_up = ccr_callbacks[5]();
-			break;
-    }
-    
-		default:
-    {
-			break;
-		}
-	}
-	
-	// Depending on the return value of the callback function, exit LPM3
-	if( wake_up )
-	{
-	  __bic_SR_register_on_exit(LPM3_bits);
-	}
+  PROFILE_ENTER( PROFILE_TIMER0_A1_ISR )
+
+  // Reading TA0IV clears the highest priority pending flag
+  if( timer_dispatch( TIMER_A0, TA0IV ) )
+  {
+    __bic_SR_register_on_exit(LPM3_bits);
+  }
 
+  PROFILE_EXIT( PROFILE_TIMER0_A1_ISR )
 }
 
+ /*******************************************************************************
+ * @fn     void timer1A0Interrupt( void )
+ * @brief  Timer1 A0 Interrupt vector for CCR0
+ * ****************************************************************************/
+interrupt (TIMER1_A0_VECTOR) timer1A0Interrupt(void)
+{  
+  PROFILE_ENTER( PROFILE_TIMER1_A0_ISR )
+
+  TRACE( TRACE_TIMER, (TIMER_A1 << 4) )
+
+  if( ta1_callbacks[0]() )
+  {
+    __bic_SR_register_on_exit(LPM3_bits);
+  }
+
+  PROFILE_EXIT( PROFILE_TIMER1_A0_ISR )
+}
+
+/*******************************************************************************
+ * @fn     void timer1A1Interrupt( void )
+ * @brief  Timer1 A1 Interrupt vector for CCR1-2 and overflow
+ * ****************************************************************************/
+interrupt (TIMER1_A1_VECTOR) timer1A1Interrupt(void)
+{
+  PROFILE_ENTER( PROFILE_TIMER1_A1_ISR )
+
+  if( timer_dispatch( TIMER_A1, TA1IV ) )
+  {
+    __bic_SR_register_on_exit(LPM3_bits);
+  }
+
+  PROFILE_EXIT( PROFILE_TIMER1_A1_ISR )
+}
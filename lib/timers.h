@@ -9,18 +9,45 @@
 
 #include "common.h"
 
+// Timer_A instances, used as index by the generic functions. Timer A1 runs
+// from SMCLK in profiling and ADC jitter builds (see profiler.h and adc.h),
+// the demos leave it alone
+#define TIMER_A0 (0)
+#define TIMER_A1 (1)
+#define TOTAL_TIMERS (2)
+
 #define TOTAL_CCRS 5 // Number of capture compare registers
+#define TOTAL_CCRS_A1 3 // Number of capture compare registers in Timer1_A3
 
 #define MODE_OFF MC_0
 #define MODE_UP MC_1
 #define MODE_CONTINUOUS MC_2
 #define MODE_UPDOWN MC_3
 
+void setup_timer( uint8_t, uint8_t );
+void register_ccr_callback( uint8_t, uint8_t (*)(void), uint8_t );
+void set_timer_ccr( uint8_t, uint8_t, uint16_t );
+void clear_timer_ccr( uint8_t, uint8_t );
+void increment_timer_ccr( uint8_t, uint8_t, uint16_t );
+
+// Timer A0 shorthands. The overflow callback is registered as ccr_number
+// TOTAL_CCRS (TOTAL_CCRS_A1 on Timer A1)
+#define register_timer_callback( callback, ccr_number ) \
+  register_ccr_callback( TIMER_A0, callback, ccr_number )
+#define set_ccr( ccr_index, value ) \
+  set_timer_ccr( TIMER_A0, ccr_index, value )
+#define clear_ccr( ccr_index ) \
+  clear_timer_ccr( TIMER_A0, ccr_index )
+#define increment_ccr( ccr_index, value ) \
+  increment_timer_ccr( TIMER_A0, ccr_index, value )
+
 void setup_timer_a( uint8_t );
-void register_timer_callback( uint8_t (*)(void), uint8_t);
-void set_ccr( uint8_t, uint16_t );
-void clear_ccr( uint8_t );
-void increment_ccr( uint8_t, uint16_t );
+uint8_t set_ccr_at( uint8_t, uint32_t );
+uint32_t get_timestamp( void );
+uint32_t timestamp_at( uint16_t );
+void set_ccr_output( uint8_t, uint16_t );
+void setup_capture( uint8_t, uint16_t );
+uint8_t read_capture( uint8_t, uint32_t* );
 inline void clear_timer();
 #endif /* _TIMERS_H */\
 
@@ -0,0 +1,109 @@
+/** @file trace.c
+*
+* @brief Binary event trace ring buffer (build with TRACE=1)
+*
+*   Fixed size records (timestamp, event id, argument) go into a RAM ring,
+*   overwriting the oldest ones when full. trace_dump() sends and empties the
+*   ring through the UART, tools/trace2json.c turns that into a timeline.
+*
+* @author Alvaro Prieto
+*/
+#include "trace.h"
+
+#if TRACE_ENABLE
+
+#include "intrinsics.h"
+#include "timers.h"
+#include "uart.h"
+
+#define RING_MASK (TRACE_RECORDS - 1)
+
+static trace_record_t ring[TRACE_RECORDS];
+static uint8_t ring_head;
+static uint8_t ring_used;
+static uint8_t records_lost;
+static uint8_t dumping;
+
+/*******************************************************************************
+ * @fn     void trace_event( uint8_t event, uint8_t arg )
+ * @brief  add a record, safe to call from interrupts. Use the TRACE macro so
+ *         calls disappear when tracing is off
+ * ****************************************************************************/
+void trace_event( uint8_t event, uint8_t arg )
+{
+  trace_record_t* record;
+  uint16_t interrupt_state;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+
+  // Records can't be added while the ring is being sent
+  if( dumping )
+  {
+    if( records_lost < 0xFF )
+    {
+      records_lost++;
+    }
+    __set_interrupt_state( interrupt_state );
+    return;
+  }
+
+  record = &ring[ring_head];
+  record->time = get_timestamp();
+  record->event = event;
+  record->arg = arg;
+
+  ring_head = (ring_head + 1) & RING_MASK;
+  if( ring_used < TRACE_RECORDS )
+  {
+    ring_used++;
+  }
+  else if( records_lost < 0xFF )
+  {
+    records_lost++;
+  }
+
+  __set_interrupt_state( interrupt_state );
+}
+
+/*******************************************************************************
+ * @fn     void trace_dump( void )
+ * @brief  send all records as one escaped UART frame and empty the ring.
+ *         Blocks until sent, call from the main loop
+ * ****************************************************************************/
+void trace_dump( void )
+{
+  uint8_t header[TRACE_HEADER_LEN];
+  uint16_t interrupt_state;
+  uint8_t first;
+  uint8_t index;
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+  dumping = 1;
+  header[0] = TRACE_RECORD_MARKER;
+  header[1] = DEVICE_ADDRESS;
+  header[2] = ring_used;
+  header[3] = records_lost;
+  records_lost = 0;
+  __set_interrupt_state( interrupt_state );
+
+  first = (ring_head - ring_used) & RING_MASK;
+
+  uart_put_char( 0x7e );
+  uart_put_escaped( header, TRACE_HEADER_LEN );
+  for( index = 0; index < header[2]; index++ )
+  {
+    uart_put_escaped( (uint8_t*)&ring[(first + index) & RING_MASK],
+                      TRACE_RECORD_LEN );
+  }
+  uart_put_char( 0x7e );
+
+  interrupt_state = __get_interrupt_state();
+  dint();
+  ring_used = 0;
+  dumping = 0;
+  __set_interrupt_state( interrupt_state );
+}
+
+#endif /* TRACE_ENABLE */
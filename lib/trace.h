@@ -0,0 +1,30 @@
+/** @file trace.h
+*
+* @brief Binary event trace ring buffer (build with TRACE=1)
+*
+* @author Alvaro Prieto
+*/
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include "common.h"
+#include "trace_events.h"
+
+// Ring size in records, must be a power of two
+#define TRACE_RECORDS (64)
+
+#if TRACE_ENABLE
+
+#define TRACE( event, arg ) trace_event( event, arg );
+
+#else
+
+#define TRACE( event, arg )
+
+#endif /* TRACE_ENABLE */
+
+void trace_event( uint8_t, uint8_t );
+void trace_dump( void );
+
+#endif /* _TRACE_H */\
+
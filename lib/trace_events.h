@@ -0,0 +1,48 @@
+/** @file trace_events.h
+*
+* @brief Trace event ids and record layout, shared with tools/trace2json.c
+*
+* @author Alvaro Prieto
+*/
+#ifndef _TRACE_EVENTS_H
+#define _TRACE_EVENTS_H
+
+#include <stdint.h>
+
+// First byte of the UART record. Can't be mistaken for a packet length
+#define TRACE_RECORD_MARKER (0xF2)
+
+// Dump layout:
+// [0] TRACE_RECORD_MARKER
+// [1] device address
+// [2] number of records
+// [3] records lost since the last dump (saturates at 255)
+// [4...] trace_record_t, oldest first, little endian
+#define TRACE_HEADER_LEN (4)
+
+// Events that take time are traced twice, with TRACE_BEGIN and TRACE_END,
+// everything else is a single instant
+#define TRACE_BEGIN (0x40)
+#define TRACE_END (0x80)
+#define TRACE_ID_MASK (0x3F)
+
+#define TRACE_RADIO_TX (0x01)   // arg: packet length, begin/end
+#define TRACE_RADIO_RX (0x02)   // arg: packet length
+#define TRACE_TIMER (0x03)      // arg: (timer << 4) | ccr, TOTAL_CCRS is overflow
+#define TRACE_ADC (0x04)        // arg: sample block that was completed
+#define TRACE_UART_RX (0x05)    // arg: received character
+#define TRACE_HANDLER (0x06)    // arg: event id, begin/end
+#define TRACE_SYNC (0x07)       // arg: beacon source
+#define TRACE_USER (0x20)       // First id free for applications
+
+typedef struct
+{
+  uint32_t time;    // get_timestamp() ACLK ticks
+  uint8_t event;
+  uint8_t arg;
+} trace_record_t;
+
+#define TRACE_RECORD_LEN (6)
+
+#endif /* _TRACE_EVENTS_H */\
+
@@ -5,6 +5,8 @@
 * @author Alvaro Prieto
 */
 #include "uart.h"
+#include "profiler.h"
+#include "trace.h"
 
 /*******************************************************************************
  * @fn     void setup_uart( void )
@@ -61,10 +63,21 @@ void uart_write( uint8_t* buffer, uint16_t length )
  * @brief  transmit whole buffer while escaping characters
  * ****************************************************************************/
 void uart_write_escaped( uint8_t* buffer, uint16_t length )
+{
+  uart_put_char( 0x7e );
+  uart_put_escaped( buffer, length );
+  uart_put_char( 0x7e );
+}
+
+/*******************************************************************************
+ * @fn     uart_put_escaped( uint8_t* buffer, uint16_t length )
+ * @brief  transmit buffer escaping characters, without the frame delimiters.
+ *         Used to send one frame in several pieces
+ * ****************************************************************************/
+void uart_put_escaped( uint8_t* buffer, uint16_t length )
 {
   uint16_t buffer_index;
     
-  uart_put_char( 0x7e );
   for( buffer_index = 0; buffer_index < length; buffer_index++ )
   {
     if( (buffer[buffer_index] == 0x7e) | (buffer[buffer_index] == 0x7d) )
@@ -77,7 +90,6 @@ void uart_write_escaped( uint8_t* buffer, uint16_t length )
       uart_put_char( buffer[buffer_index] );
     }
   }
-  uart_put_char( 0x7e );
 }
 
 /*******************************************************************************
@@ -86,6 +98,8 @@ void uart_write_escaped( uint8_t* buffer, uint16_t length )
  * ****************************************************************************/
 wakeup interrupt ( USCI_A0_VECTOR ) uart_isr(void) // CHANGE
 {
+  PROFILE_ENTER( PROFILE_UART_ISR )
+
   //PJOUT ^= 0x2;
 
   switch(UCA0IV)
@@ -96,6 +110,7 @@ wakeup interrupt ( USCI_A0_VECTOR ) uart_isr(void) // CHANGE
     }
     case 2:	// Vector 2 - RXIFG
     {
+      TRACE( TRACE_UART_RX, UCA0RXBUF )
 
       //while (!(UCA0IFG&UCTXIFG));	// USCI_A0 TX buffer ready?
       //UCA0TXBUF = UCA0RXBUF;		// TX -> RXed character
@@ -110,4 +125,6 @@ wakeup interrupt ( USCI_A0_VECTOR ) uart_isr(void) // CHANGE
 
     default: break;
   }
+
+  PROFILE_EXIT( PROFILE_UART_ISR )
 }
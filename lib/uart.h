@@ -18,5 +18,7 @@ void uart_write( uint8_t*, uint16_t );
 
 void uart_write_escaped( uint8_t*, uint16_t );
 
+void uart_put_escaped( uint8_t*, uint16_t );
+
 #endif /* _UART_H */\
 
@@ -0,0 +1,351 @@
+/** @file aggsim.c
+*
+* @brief  Airtime a relay saves by sending what it forwards in aggregates
+*         (lib/aggregate.c) instead of one packet per forward slot.
+*
+*         Every superframe each child of the relay sends one sample packet,
+*         the relay forwards them in its forward slots. Blocks are either a
+*         slow signal, which the end devices send compressed (lib/codec.c),
+*         or noise, sent packed (lib/pack12.c). Both ways of forwarding are counted in bytes on
+*         the air (with preamble, sync word and CRC) and in channel time
+*         (the slot time each transmission really needs, with the turnaround
+*         and guard times, see TDMA_SLOT_LENGTH).
+*
+*         Every aggregate is also split again the way the access point does
+*         and compared with the packets that went in. Exits with an error if
+*         any packet doesn't come back out the same.
+*
+*         usage: aggsim [superframes] [seed]
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "aggregate.h"
+#include "codec.h"
+#include "pack12.h"
+
+// Must match radio.h and tdma.h
+#define RADIO_BAUD_RATE (249939)
+#define RADIO_PREAMBLE_BYTES (4)
+#define RADIO_SYNC_BYTES (4)
+#define RADIO_CRC_BYTES (2)
+#define TDMA_MIN_GUARD (6)
+#define TDMA_RESIDUAL_PPM (2)
+#define TDMA_MAX_UNSYNCED (1310720)
+#define TDMA_TURNAROUND (25)
+
+// Must match demo/settings.h
+#define PACKET_LEN (61)
+#define ADC_MAX_SAMPLES (33)
+#define ADC_SAMPLES_LEN PACK12_LEN( ADC_MAX_SAMPLES )
+#define GRID_INDEX_LEN (3)
+#define FORWARD_SLOTS (4)
+#define SAMPLES_PACKET (0xAA)
+#define COMPRESSED_SAMPLES_PACKET (0xAC)
+#define AGGREGATE_PACKET (0x68)
+#define REPEATER_FLAG (1<<2)
+#define AGGREGATE_LEN ( 4 + ROUTE_HEADER_LEN - 1 + \
+        4 * AGGREGATE_SIZE( 4 + ROUTE_HEADER_LEN + GRID_INDEX_LEN + \
+                            ADC_SAMPLES_LEN - 1 ) )
+
+#define MAX_CHILDREN (8)
+
+#define SLOW_SIGNAL (0)
+#define NOISE (1)
+
+typedef struct
+{
+  long packets;
+  long transmissions;
+  long bytes;
+  double channel;   // ACLK ticks
+  int most_slots;   // Forward slots needed in one superframe
+} tally_t;
+
+static int failures = 0;
+
+/*******************************************************************************
+ * @fn     uint32_t byte_time( int bytes )
+ * @brief  RADIO_BYTE_TIME from radio.h
+ * ****************************************************************************/
+static uint32_t byte_time( int bytes )
+{
+  return ( (uint32_t)bytes * 8 * 32768 + RADIO_BAUD_RATE - 1 ) /
+                                                              RADIO_BAUD_RATE;
+}
+
+/*******************************************************************************
+ * @fn     int on_air( int size )
+ * @brief  bytes sent for a packet of size bytes (length byte included)
+ * ****************************************************************************/
+static int on_air( int size )
+{
+  return size + RADIO_PREAMBLE_BYTES + RADIO_SYNC_BYTES + RADIO_CRC_BYTES;
+}
+
+/*******************************************************************************
+ * @fn     uint32_t channel_time( int size )
+ * @brief  TDMA_SLOT_LENGTH from tdma.h, ACLK ticks
+ * ****************************************************************************/
+static uint32_t channel_time( int size )
+{
+  uint32_t guard = TDMA_MIN_GUARD +
+                   ((TDMA_MAX_UNSYNCED >> 10) * TDMA_RESIDUAL_PPM) / 977 + 1;
+
+  return byte_time( on_air( size ) ) + TDMA_TURNAROUND + 2 * guard;
+}
+
+/*******************************************************************************
+ * @fn     void make_packet( uint8_t* packet, int child, int signal,
+ *                           uint8_t sequence )
+ * @brief  a sample packet the way end_device.c builds it, as the relay
+ *         queues it (route header updated, REPEATER_FLAG set)
+ * ****************************************************************************/
+static void make_packet( uint8_t* packet, int child, int signal,
+                         uint8_t sequence )
+{
+  static double phase[MAX_CHILDREN];
+  uint16_t block[ADC_MAX_SAMPLES];
+  uint8_t* data = packet + 4 + ROUTE_HEADER_LEN + GRID_INDEX_LEN;
+  route_header_t* route_header = (route_header_t*)(packet + 4);
+  uint8_t length;
+  int index;
+
+  for( index = 0; index < ADC_MAX_SAMPLES; index++ )
+  {
+    if( SLOW_SIGNAL == signal )
+    {
+      phase[child] += 0.02;
+      block[index] = (uint16_t)( 2048 + 1440 * sin( phase[child] ) +
+                                 ( rand() % 33 ) - 16 );
+    }
+    else
+    {
+      block[index] = (uint16_t)( rand() & PACK12_MAX );
+    }
+  }
+
+  packet[1] = child + 1;
+  packet[3] = REPEATER_FLAG;
+
+  if( ADC_MAX_SAMPLES == codec_encode( block, ADC_MAX_SAMPLES, data,
+                                       ADC_SAMPLES_LEN, &length ) )
+  {
+    packet[2] = COMPRESSED_SAMPLES_PACKET;
+  }
+  else
+  {
+    pack12( block, ADC_MAX_SAMPLES, data );
+    length = ADC_SAMPLES_LEN;
+    packet[2] = SAMPLES_PACKET;
+  }
+
+  for( index = 0; index < GRID_INDEX_LEN; index++ )
+  {
+    packet[4 + ROUTE_HEADER_LEN + index] = (uint8_t)rand();
+  }
+
+  packet[0] = 4 + ROUTE_HEADER_LEN + GRID_INDEX_LEN + length - 1;
+
+  route_header->sender = 100;
+  route_header->next_hop = 0;
+  route_header->sequence = sequence;
+  route_header->hops_depth = ( 1 << 4 ) | 1;
+}
+
+/*******************************************************************************
+ * @fn     void check_split( const uint8_t* aggregate,
+ *                           uint8_t packets[][PACKET_LEN + 1], int count )
+ * @brief  split an aggregate and compare with what went in
+ * ****************************************************************************/
+static void check_split( const uint8_t* aggregate,
+                         uint8_t packets[][PACKET_LEN + 1], int count )
+{
+  uint8_t packet[PACKET_LEN + 1];
+  const route_header_t* expected;
+  const route_header_t* got;
+  uint8_t offset = 0;
+  int found = 0;
+
+  while( aggregate_split( aggregate, &offset, packet, PACKET_LEN ) )
+  {
+    if( found >= count )
+    {
+      failures++;
+      return;
+    }
+
+    expected = (const route_header_t*)(packets[found] + 4);
+    got = (const route_header_t*)(packet + 4);
+
+    if( (packet[0] != packets[found][0]) ||
+        memcmp( packet + 1, packets[found] + 1, 3 ) ||
+        (got->sequence != expected->sequence) ||
+        memcmp( packet + 4 + ROUTE_HEADER_LEN,
+                packets[found] + 4 + ROUTE_HEADER_LEN,
+                packet[0] + 1 - 4 - ROUTE_HEADER_LEN ) )
+    {
+      failures++;
+      return;
+    }
+    found++;
+  }
+
+  if( found != count )
+  {
+    failures++;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void superframe( int children, int signal, tally_t* single,
+ *                          tally_t* aggregated )
+ * @brief  forward one packet from each child both ways
+ * ****************************************************************************/
+static void superframe( int children, int signal, tally_t* single,
+                        tally_t* aggregated )
+{
+  static uint8_t packets[MAX_CHILDREN][PACKET_LEN + 1];
+  static uint8_t sequence = 0;
+  uint8_t aggregate[AGGREGATE_LEN + 1];
+  int first;
+  int count;
+  int size;
+  int slots = 0;
+  int child;
+
+  for( child = 0; child < children; child++ )
+  {
+    make_packet( packets[child], child, signal, sequence );
+
+    size = packets[child][0] + 1;
+    single->packets++;
+    single->transmissions++;
+    single->bytes += on_air( size );
+    single->channel += channel_time( size );
+  }
+  sequence++;
+
+  if( children > single->most_slots )
+  {
+    single->most_slots = children;
+  }
+
+  // Same batching as forward_queue_head in demo/relay.c
+  for( first = 0; first < children; first += count )
+  {
+    aggregate_start( aggregate, 200, AGGREGATE_PACKET, REPEATER_FLAG );
+    memset( aggregate + 4, 0, ROUTE_HEADER_LEN );
+
+    for( count = 0; first + count < children; count++ )
+    {
+      if( !aggregate_add( aggregate, packets[first + count], AGGREGATE_LEN ) )
+      {
+        break;
+      }
+    }
+
+    if( count < 2 )
+    {
+      count = 1;
+      size = packets[first][0] + 1;
+    }
+    else
+    {
+      size = aggregate[0] + 1;
+      check_split( aggregate, &packets[first], count );
+    }
+
+    aggregated->packets += count;
+    aggregated->transmissions++;
+    aggregated->bytes += on_air( size );
+    aggregated->channel += channel_time( size );
+    slots++;
+  }
+
+  if( slots > aggregated->most_slots )
+  {
+    aggregated->most_slots = slots;
+  }
+}
+
+int main( int argc, char** argv )
+{
+  static const int children_cases[] = { 2, 4, 8 };
+  static const char* signal_names[] = { "slow signal (compressed)",
+                                        "noise (raw)" };
+  tally_t single;
+  tally_t aggregated;
+  double tick_ms = 1000.0 / 32768;
+  int superframes = 1000;
+  int seed = 1;
+  int signal;
+  int index;
+  int count;
+
+  if( argc > 1 )
+  {
+    superframes = atoi( argv[1] );
+  }
+  if( argc > 2 )
+  {
+    seed = atoi( argv[2] );
+  }
+  if( superframes < 1 )
+  {
+    printf( "at least one superframe\n" );
+    return 1;
+  }
+
+  printf( "relay forwarding one sample packet per child per superframe, "
+          "%d superframes\n", superframes );
+  printf( "aggregates up to %d bytes, %d forward slots\n\n", AGGREGATE_LEN + 1,
+          FORWARD_SLOTS );
+
+  for( signal = SLOW_SIGNAL; signal <= NOISE; signal++ )
+  {
+    printf( "%s\n", signal_names[signal] );
+    printf( "%8s %21s %21s %14s %13s\n", "children", "bytes/superframe",
+            "channel ms/superframe", "airtime saved", "forward slots" );
+
+    for( index = 0; index < 3; index++ )
+    {
+      memset( &single, 0, sizeof(single) );
+      memset( &aggregated, 0, sizeof(aggregated) );
+      srand( seed );
+
+      for( count = 0; count < superframes; count++ )
+      {
+        superframe( children_cases[index], signal, &single, &aggregated );
+      }
+
+      printf( "%8d %9.1f -> %8.1f %9.2f -> %8.2f %5.1f%% %5.1f%% %5d -> %3d\n",
+              children_cases[index],
+              (double)single.bytes / superframes,
+              (double)aggregated.bytes / superframes,
+              single.channel * tick_ms / superframes,
+              aggregated.channel * tick_ms / superframes,
+              100.0 * ( single.bytes - aggregated.bytes ) / single.bytes,
+              100.0 * ( single.channel - aggregated.channel ) /
+                                                              single.channel,
+              single.most_slots, aggregated.most_slots );
+    }
+    printf( "\n" );
+  }
+
+  printf( "airtime saved: bytes on the air, then channel time\n" );
+  printf( "forward slots: most needed in one superframe, one packet per "
+          "slot -> aggregated\n" );
+
+  if( failures )
+  {
+    printf( "%d aggregates didn't split back into their packets\n",
+            failures );
+    return 1;
+  }
+
+  return 0;
+}
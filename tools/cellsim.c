@@ -0,0 +1,216 @@
+/** @file cellsim.c
+*
+* @brief  Capacity of the demo network (demo/settings.h) split in cells on
+*         different radio channels.
+*
+*         Each end device sends its samples every superframe, in as many
+*         sample packets (of up to ADC_MAX_SAMPLES samples) as it takes, each
+*         in a sample slot of its own, and has an energy report slot. The
+*         sample and energy report slots share what is left of the major
+*         cycle after the beacon flood, the join window and the forward
+*         slots. A cell holds as many devices as fit in that time and in its
+*         slot map (MAX_SLOTS sample slots).
+*
+*         With one access point per channel the cells run at the same time,
+*         so the number of devices grows with the channels. One access point
+*         hopping between the channels, one superframe on each, only hears
+*         one of them at a time: every device sends the samples of several
+*         superframes at once. That only helps while they still fit in one
+*         sample packet, past that it's no better than one channel. Both are
+*         printed for a few sample rates.
+*
+*         usage: cellsim [channels]
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// Must match radio.h
+#define RADIO_BAUD_RATE (249939)
+#define RADIO_PREAMBLE_BYTES (4)
+#define RADIO_SYNC_BYTES (4)
+#define RADIO_CRC_BYTES (2)
+#define RADIO_RX_TX_BITS (6)
+
+// Must match tdma.h
+#define TDMA_RESIDUAL_PPM (2)
+#define TDMA_MIN_GUARD (6)
+#define TDMA_MAX_UNSYNCED (1310720)
+#define TDMA_TURNAROUND (25)
+
+// Must match settings.h, energy.h and route.h
+#define ADC_MAX_SAMPLES (33)
+#define GRID_INDEX_LEN (3)
+#define ROUTE_HEADER_LEN (4)
+#define ENERGY_REPORT_LEN (44)
+#define MAX_SLOTS (16)
+#define REST_TIME (300)
+#define MAJOR_CYCLE (5450)
+#define SYNC_PAYLOAD_LEN ( 6 + MAX_SLOTS + 2 * 4 + 1 )
+#define FLOOD_MAX_RELAYS (3)
+#define JOIN_WINDOW (4)
+#define FORWARD_SLOTS (4)
+#define AGGREGATE_HEADER_LEN (5)
+
+#define HEADER_LEN (4)
+
+// 12-bit samples, packed two to three bytes (see pack12.h)
+#define SAMPLE_PACKET_LEN( samples ) \
+  ( HEADER_LEN + ROUTE_HEADER_LEN + GRID_INDEX_LEN + \
+    ( 3 * (samples) + 1 ) / 2 )
+#define POWER_PACKET_LEN ( HEADER_LEN + ROUTE_HEADER_LEN + ENERGY_REPORT_LEN )
+#define JOIN_PACKET_LEN ( HEADER_LEN + ROUTE_HEADER_LEN )
+#define AGGREGATE_MAX \
+  ( HEADER_LEN + ROUTE_HEADER_LEN + 4 * ( SAMPLE_PACKET_LEN( ADC_MAX_SAMPLES ) \
+    + AGGREGATE_HEADER_LEN - HEADER_LEN - ROUTE_HEADER_LEN ) )
+
+#define MAX_CHANNELS (16)
+
+typedef struct
+{
+  int devices;    // Per cell
+  int packets;    // Sample packets per device per superframe
+  char limit;     // 'm' slot map, 'a' airtime
+} cell_t;
+
+/*******************************************************************************
+ * @fn     uint32_t byte_time( int bytes )
+ * @brief  RADIO_BYTE_TIME from radio.h
+ * ****************************************************************************/
+static uint32_t byte_time( int bytes )
+{
+  return ( (uint32_t)bytes * 8 * 32768 + RADIO_BAUD_RATE - 1 ) /
+                                                              RADIO_BAUD_RATE;
+}
+
+/*******************************************************************************
+ * @fn     uint32_t slot_length( int size )
+ * @brief  TDMA_SLOT_LENGTH from tdma.h
+ * ****************************************************************************/
+static uint32_t slot_length( int size )
+{
+  uint32_t guard = TDMA_MIN_GUARD +
+                   ((TDMA_MAX_UNSYNCED >> 10) * TDMA_RESIDUAL_PPM) / 977 + 1;
+
+  return byte_time( size + RADIO_PREAMBLE_BYTES + RADIO_SYNC_BYTES +
+                    RADIO_CRC_BYTES ) + TDMA_TURNAROUND + 2 * guard;
+}
+
+/*******************************************************************************
+ * @fn     uint32_t slots_time( void )
+ * @brief  ticks of the major cycle left for sample and energy report slots
+ * ****************************************************************************/
+static uint32_t slots_time( void )
+{
+  int size = HEADER_LEN + SYNC_PAYLOAD_LEN;
+  uint32_t flood_window;
+
+  // RADIO_FLOOD_DELAY( BEACON_LEN, FLOOD_MAX_RELAYS + 1 )
+  flood_window = ( (uint32_t)( FLOOD_MAX_RELAYS + 1 ) *
+                   ( ( size + RADIO_PREAMBLE_BYTES + RADIO_SYNC_BYTES +
+                       RADIO_CRC_BYTES ) * 8 + RADIO_RX_TX_BITS ) * 32768 +
+                   RADIO_BAUD_RATE / 2 ) / RADIO_BAUD_RATE;
+
+  return MAJOR_CYCLE - ( REST_TIME / 2 + flood_window +
+                         JOIN_WINDOW * slot_length( JOIN_PACKET_LEN ) +
+                         FORWARD_SLOTS * slot_length( AGGREGATE_MAX + 1 ) );
+}
+
+/*******************************************************************************
+ * @fn     cell_t cell_capacity( int samples )
+ * @brief  devices in one cell sending samples samples each superframe
+ * ****************************************************************************/
+static cell_t cell_capacity( int samples )
+{
+  cell_t cell;
+  uint32_t device_time;
+  int airtime_devices;
+  int map_devices;
+  int left;
+
+  cell.packets = ( samples + ADC_MAX_SAMPLES - 1 ) / ADC_MAX_SAMPLES;
+
+  device_time = slot_length( POWER_PACKET_LEN );
+  for( left = samples; left > 0; left -= ADC_MAX_SAMPLES )
+  {
+    device_time += slot_length( SAMPLE_PACKET_LEN( left > ADC_MAX_SAMPLES ?
+                                                   ADC_MAX_SAMPLES : left ) );
+  }
+
+  airtime_devices = slots_time() / device_time;
+  map_devices = MAX_SLOTS / cell.packets;
+
+  if( map_devices <= airtime_devices )
+  {
+    cell.devices = map_devices;
+    cell.limit = 'm';
+  }
+  else
+  {
+    cell.devices = airtime_devices;
+    cell.limit = 'a';
+  }
+
+  return cell;
+}
+
+int main( int argc, char** argv )
+{
+  static const int rate_cases[] = { 25, 50, 100, 150, 300, 600, 1200, 2400 };
+  static const int channel_cases[] = { 1, 2, 4 };
+  cell_t cell;
+  cell_t hopping;
+  int hop_channels = 4;
+  int samples;
+  int rate;
+  int index;
+  int count;
+
+  if( argc > 1 )
+  {
+    hop_channels = atoi( argv[1] );
+  }
+  if( (hop_channels < 2) || (hop_channels > MAX_CHANNELS) )
+  {
+    printf( "2 to %d channels\n", MAX_CHANNELS );
+    return 1;
+  }
+
+  printf( "%u ticks of each %d tick major cycle for sample and energy "
+          "report slots\n\n", slots_time(), MAJOR_CYCLE );
+  printf( "%6s %8s %8s  %-29s %s\n", "", "samples/", "packets/",
+          "end devices, one access", "one access point" );
+  printf( "%6s %8s %8s  %-29s %s\n", "rate", "superfr.", "device",
+          "point per channel", "hopping" );
+  printf( "%6s %8s %8s ", "", "", "" );
+  for( count = 0; count < 3; count++ )
+  {
+    printf( " %6d ch", channel_cases[count] );
+  }
+  printf( "  %6d ch\n", hop_channels );
+
+  for( index = 0; index < sizeof(rate_cases) / sizeof(rate_cases[0]);
+       index++ )
+  {
+    rate = rate_cases[index];
+    samples = ( rate * MAJOR_CYCLE + 32767 ) / 32768;
+    cell = cell_capacity( samples );
+
+    // A channel's superframe comes every hop_channels superframes
+    hopping = cell_capacity( samples * hop_channels );
+
+    printf( "%4dHz %8d %8d ", rate, samples, cell.packets );
+    for( count = 0; count < 3; count++ )
+    {
+      printf( " %8d%c", cell.devices * channel_cases[count], cell.limit );
+    }
+    printf( "  %8d%c\n", hopping.devices * hop_channels, hopping.limit );
+  }
+
+  printf( "\nlimited by: m slot map (%d sample slots per cell), a airtime\n",
+          MAX_SLOTS );
+
+  return 0;
+}
@@ -0,0 +1,344 @@
+/** @file energysim.c
+*
+* @brief  Host test of the residency counters and charge estimate
+*         (lib/energy.c), on a simulated Timer A0 (see tools/host).
+*
+*         An end device's superframe is scripted as a sequence of radio
+*         (IDLE, RX, TX) and CPU (active, LPM0, LPM3) states, each held for a
+*         number of ticks, and played for the given number of superframes
+*         across many counter wraps. The counters are read every few
+*         superframes and at the end, and must match the time spent in each
+*         state to the tick. energy_charge_per_hour must match the average
+*         current worked out from the datasheet currents, within the
+*         rounding of its fixed point math.
+*
+*         Exits with an error if anything doesn't match.
+*
+*         usage: energysim [superframes]
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include "energy.h"
+#include "timers.h"
+#include "timer_a.h"
+
+// Same as the demos (see demo/settings.h)
+#define TIMER_LIMIT (65399)
+
+// Counters checked every this many superframes
+#define CHECK_PERIOD (7)
+
+// Core voltage level set once the first superframe is over, like
+// setup_oscillator does at startup
+#define VCORE_LEVEL (2)
+
+typedef struct
+{
+  uint8_t radio;    // ENERGY_RADIO_xx
+  uint16_t cpu;     // 0 when active, LPM0_bits or LPM3_bits
+  uint32_t ticks;
+} step_t;
+
+// One superframe (MAJOR_CYCLE ticks) of an end device that sends a sample
+// packet and listens for the beacon
+static const step_t superframe[] = {
+  { ENERGY_RADIO_IDLE, 0,         40 },   // Prepare the next packet
+  { ENERGY_RADIO_IDLE, LPM3_bits, 1800 },
+  { ENERGY_RADIO_TX,   LPM3_bits, 55 },   // Sample slot
+  { ENERGY_RADIO_IDLE, 0,         12 },
+  { ENERGY_RADIO_IDLE, LPM3_bits, 3000 },
+  { ENERGY_RADIO_RX,   LPM0_bits, 250 },  // Beacon, UART kept running
+  { ENERGY_RADIO_RX,   0,         20 },
+  { ENERGY_RADIO_IDLE, LPM3_bits, 273 },
+};
+#define SUPERFRAME_STEPS ( sizeof(superframe) / sizeof(step_t) )
+
+static const uint16_t radio_currents[TOTAL_RADIO_STATES] = {
+  CURRENT_RADIO_IDLE, CURRENT_RADIO_RX, CURRENT_RADIO_TX };
+
+static const uint16_t cpu_currents[TOTAL_CPU_STATES] = {
+  CURRENT_CPU_ACTIVE, CURRENT_CPU_LPM0, CURRENT_CPU_LPM3 };
+
+// Time that should be in each counter
+static energy_counters_t expected;
+
+/*******************************************************************************
+ * @fn     uint8_t cpu_state( uint16_t bits )
+ * @brief  ENERGY_CPU_xx a step's CPU state is counted as
+ * ****************************************************************************/
+static uint8_t cpu_state( uint16_t bits )
+{
+  if( 0 == bits )
+  {
+    return ENERGY_CPU_ACTIVE;
+  }
+
+  return ( LPM3_bits == bits ) ? ENERGY_CPU_LPM3 : ENERGY_CPU_LPM0;
+}
+
+/*******************************************************************************
+ * @fn     double average_current( const energy_counters_t* in )
+ * @brief  average current in uA over the time counted
+ * ****************************************************************************/
+static double average_current( const energy_counters_t* in )
+{
+  double charge = 0;
+  double total = 0;
+  uint8_t index;
+
+  for( index = 0; index < TOTAL_CPU_STATES; index++ )
+  {
+    total += in->cpu[index];
+    charge += (double)in->cpu[index] * cpu_currents[index];
+  }
+  for( index = 0; index < TOTAL_RADIO_STATES; index++ )
+  {
+    charge += (double)in->radio[index] * radio_currents[index];
+  }
+
+  return ( total > 0 ) ? charge / total : 0;
+}
+
+/*******************************************************************************
+ * @fn     int check_charge( const char* name, const energy_counters_t* in )
+ * @brief  compare energy_charge_per_hour with the exact average. It works in
+ *         1/1024ths of the total time and rounds each term down. Returns 1
+ *         if it's off by more than that
+ * ****************************************************************************/
+static int check_charge( const char* name, const energy_counters_t* in )
+{
+  double exact = average_current( in );
+  double total = 0;
+  double tolerance = 1;
+  uint32_t charge;
+  uint8_t index;
+
+  for( index = 0; index < TOTAL_CPU_STATES; index++ )
+  {
+    total += in->cpu[index];
+    tolerance += cpu_currents[index] / 1024.0;
+  }
+  for( index = 0; index < TOTAL_RADIO_STATES; index++ )
+  {
+    tolerance += radio_currents[index] / 1024.0;
+  }
+  tolerance += exact * 1024.0 / total;
+
+  charge = energy_charge_per_hour( in );
+  if( (charge < exact - tolerance) || (charge > exact + tolerance) )
+  {
+    printf( "%s: charge %lu uAh per hour, expected %.1f +-%.1f FAILED\n",
+            name, (unsigned long)charge, exact, tolerance );
+    return 1;
+  }
+
+  printf( "%s: charge %lu uAh per hour, expected %.1f\n", name,
+          (unsigned long)charge, exact );
+
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     int charge_test( void )
+ * @brief  energy_charge_per_hour on made up counters
+ * ****************************************************************************/
+static int charge_test( void )
+{
+  energy_counters_t counters = { { 0 } };
+  int failed = 0;
+
+  // Not enough time counted yet
+  counters.radio[ENERGY_RADIO_RX] = 1000;
+  counters.cpu[ENERGY_CPU_ACTIVE] = 1000;
+  if( 0 != energy_charge_per_hour( &counters ) )
+  {
+    printf( "under 1024 ticks: not 0 FAILED\n" );
+    failed = 1;
+  }
+
+  // Always listening and awake
+  counters.radio[ENERGY_RADIO_RX] = 3600L * 32768;
+  counters.cpu[ENERGY_CPU_ACTIVE] = 3600L * 32768;
+  failed |= check_charge( "always RX", &counters );
+
+  // Asleep with a 1% duty cycle, over a day
+  counters.radio[ENERGY_RADIO_RX] = 864L * 32768;
+  counters.radio[ENERGY_RADIO_IDLE] = 85536L * 32768;
+  counters.cpu[ENERGY_CPU_ACTIVE] = 864L * 32768;
+  counters.cpu[ENERGY_CPU_LPM3] = 85536L * 32768;
+  failed |= check_charge( "1% RX", &counters );
+
+  return failed;
+}
+
+/*******************************************************************************
+ * @fn     int check_counters( long superframes )
+ * @brief  read the counters and compare them with the script. Returns 1 if
+ *         any is off
+ * ****************************************************************************/
+static int check_counters( long superframes )
+{
+  energy_counters_t counters;
+  uint32_t radio_total = 0;
+  uint32_t cpu_total = 0;
+  uint32_t vcore_total = 0;
+  uint8_t index;
+  int failed = 0;
+
+  get_energy_counters( &counters );
+
+  for( index = 0; index < TOTAL_RADIO_STATES; index++ )
+  {
+    radio_total += counters.radio[index];
+    if( counters.radio[index] != expected.radio[index] )
+    {
+      printf( "superframe %ld: radio state %u counted %lu, expected %lu\n",
+              superframes, index, (unsigned long)counters.radio[index],
+              (unsigned long)expected.radio[index] );
+      failed = 1;
+    }
+  }
+  for( index = 0; index < TOTAL_CPU_STATES; index++ )
+  {
+    cpu_total += counters.cpu[index];
+    if( counters.cpu[index] != expected.cpu[index] )
+    {
+      printf( "superframe %ld: CPU state %u counted %lu, expected %lu\n",
+              superframes, index, (unsigned long)counters.cpu[index],
+              (unsigned long)expected.cpu[index] );
+      failed = 1;
+    }
+  }
+  for( index = 0; index < TOTAL_VCORE_LEVELS; index++ )
+  {
+    vcore_total += counters.vcore[index];
+    if( counters.vcore[index] != expected.vcore[index] )
+    {
+      printf( "superframe %ld: core level %u counted %lu, expected %lu\n",
+              superframes, index, (unsigned long)counters.vcore[index],
+              (unsigned long)expected.vcore[index] );
+      failed = 1;
+    }
+  }
+
+  // Every tick is in exactly one state of each kind
+  if( (radio_total != timer_a_elapsed()) || (cpu_total != timer_a_elapsed()) ||
+      (vcore_total != timer_a_elapsed()) )
+  {
+    printf( "superframe %ld: totals %lu %lu %lu, %lu ticks went by\n",
+            superframes, (unsigned long)radio_total, (unsigned long)cpu_total,
+            (unsigned long)vcore_total, (unsigned long)timer_a_elapsed() );
+    failed = 1;
+  }
+
+  return failed;
+}
+
+/*******************************************************************************
+ * @fn     int script_test( long superframes )
+ * @brief  play the script and check the counters along the way
+ * ****************************************************************************/
+static int script_test( long superframes )
+{
+  energy_counters_t counters;
+  const step_t* step;
+  uint8_t radio = ENERGY_RADIO_IDLE;
+  uint8_t cpu = ENERGY_CPU_ACTIVE;
+  uint8_t vcore = 0;
+  long frame;
+  uint8_t index;
+  int failed = 0;
+
+  // Up mode with the demos' period, starting just before a wrap
+  set_ccr( 0, TIMER_LIMIT );
+  setup_timer_a( MODE_UP );
+  timer_a_start( TIMER_LIMIT - 100 );
+  eint();
+
+  setup_energy();
+
+  for( frame = 0; frame < superframes; frame++ )
+  {
+    if( (1 == frame) && (VCORE_LEVEL != vcore) )
+    {
+      vcore = VCORE_LEVEL;
+      energy_vcore( vcore );
+    }
+
+    for( index = 0; index < SUPERFRAME_STEPS; index++ )
+    {
+      step = &superframe[index];
+
+      if( step->radio != radio )
+      {
+        radio = step->radio;
+        energy_radio_state( radio );
+      }
+      if( cpu_state( step->cpu ) != cpu )
+      {
+        cpu = cpu_state( step->cpu );
+        if( ENERGY_CPU_ACTIVE == cpu )
+        {
+          energy_cpu_state( cpu );
+        }
+        else
+        {
+          energy_sleep_state( step->cpu );
+        }
+      }
+
+      timer_a_run( step->ticks );
+
+      expected.radio[radio] += step->ticks;
+      expected.cpu[cpu] += step->ticks;
+      expected.vcore[vcore] += step->ticks;
+    }
+
+    // Reading the counters mustn't change what they count next
+    if( 0 == ( frame % CHECK_PERIOD ) )
+    {
+      failed |= check_counters( frame + 1 );
+    }
+  }
+
+  failed |= check_counters( superframes );
+
+  get_energy_counters( &counters );
+  failed |= check_charge( "script", &counters );
+
+  printf( "%ld superframes, %lu ticks: radio idle %lu, RX %lu, TX %lu, "
+          "CPU active %lu, LPM0 %lu, LPM3 %lu%s\n", superframes,
+          (unsigned long)timer_a_elapsed(),
+          (unsigned long)counters.radio[ENERGY_RADIO_IDLE],
+          (unsigned long)counters.radio[ENERGY_RADIO_RX],
+          (unsigned long)counters.radio[ENERGY_RADIO_TX],
+          (unsigned long)counters.cpu[ENERGY_CPU_ACTIVE],
+          (unsigned long)counters.cpu[ENERGY_CPU_LPM0],
+          (unsigned long)counters.cpu[ENERGY_CPU_LPM3],
+          failed ? " FAILED" : "" );
+
+  return failed;
+}
+
+int main( int argc, char** argv )
+{
+  long superframes = 500;
+  int failed = 0;
+
+  if( argc > 1 )
+  {
+    superframes = atol( argv[1] );
+  }
+  if( superframes < 1 )
+  {
+    printf( "at least one superframe\n" );
+    return 1;
+  }
+
+  failed |= charge_test();
+  failed |= script_test( superframes );
+
+  return failed;
+}
@@ -0,0 +1,373 @@
+/** @file floodcheck.c
+*
+* @brief  Timing budget of flooded beacons (radio_flood in lib/radio.c).
+*
+*         Nodes that got the same copy of a flood re-send it together, the
+*         copies only add up on the air if they start within a fraction of
+*         a bit of each other. Each hop, a few nodes hear one sender and
+*         start their re-send with:
+*         - radio: the state machine goes RX -> TX by itself (MCSM1
+*           RXOFF_MODE). End of packet detection is off by the bit sync
+*           error, the turnaround is counted on the node's own crystal
+*           (+-40 ppm) and starts on an edge of the 26MHz radio clock
+*         - CPU: the end of packet interrupt strobes STX, held off by
+*           whatever was running (same script as tools/stampsim), or waits
+*           for the next 32kHz tick to strobe it from a timer
+*         The spread of the start times of the nodes in a hop must stay
+*         under a quarter bit. Nodes further out hear the whole hop, so the
+*         spread over all the hops so far is also printed.
+*
+*         On the radio path the CPU still has to fill the TX FIFO before the
+*         preamble and sync word are out. The worst interrupt latency plus
+*         the FIFO copies in the end of packet interrupt are checked
+*         against that.
+*
+*         Exits with an error if the radio path misses either budget.
+*
+*         usage: floodcheck [floods] [nodes per hop]
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#define ACLK_HZ (32768.0)
+#define MCLK_HZ (12032000.0)    // 367 x 32768, see oscillator.c
+#define XOSC_HZ (26000000.0)
+
+// Must match radio.h
+#define RADIO_BAUD_RATE (249939)
+#define RADIO_PREAMBLE_BYTES (4)
+#define RADIO_SYNC_BYTES (4)
+#define RADIO_CRC_BYTES (2)
+#define RADIO_RX_TX_BITS (6)
+
+// Must match demo/settings.h
+#define HEADER_LEN (4)
+#define SYNC_PAYLOAD_LEN ( 6 + 16 + 2 * 4 + 1 )
+#define SYNC_RELAYS_OFFSET (0)
+#define FLOOD_MAX_RELAYS (3)
+#define BEACON_LEN ( HEADER_LEN + SYNC_PAYLOAD_LEN )
+
+#define MAX_NODES (16)
+
+// Radio timing errors, in bits and ppm
+#define BIT_SYNC_ERROR (1.0 / 8)
+#define CRYSTAL_PPM (40.0)
+
+// End of packet interrupt, CPU cycles. Entry and flood_relay bookkeeping,
+// and each byte moved through the RF1A FIFO registers
+#define ISR_OVERHEAD_CYCLES (300)
+#define FIFO_BYTE_CYCLES (24)
+
+typedef struct
+{
+  const char* name;
+  double latency;   // Interrupt held off for up to this long (us)
+  int weight;       // How often it happens
+} latency_t;
+
+// What the radio interrupt can find running while a beacon is flooded. No
+// TDMA slots, they start after the flood (see FLOOD_WINDOW)
+static const latency_t script[] = {
+  { "wake up from LPM3", 8.0, 60 },
+  { "ADC12 interrupt", 25.0, 20 },
+  { "event loop dint() section", 10.0, 10 },
+  { "soft timer service", 80.0, 10 },
+};
+
+#define SCRIPT_LENGTH ( sizeof(script) / sizeof(script[0]) )
+
+#define RADIO_PATH (0)
+#define CPU_STROBE (1)
+#define CPU_TIMER (2)
+#define PATHS (3)
+
+static const char* path_names[PATHS] = { "radio", "CPU STX", "CPU timer" };
+
+typedef struct
+{
+  double hop_max[FLOOD_MAX_RELAYS + 1];
+  double total_max[FLOOD_MAX_RELAYS + 1];
+  double hop_sum[FLOOD_MAX_RELAYS + 1];
+  int over[FLOOD_MAX_RELAYS + 1];
+} spread_t;
+
+/*******************************************************************************
+ * @fn     double uniform( double low, double high )
+ * @brief  random number in [low, high)
+ * ****************************************************************************/
+static double uniform( double low, double high )
+{
+  return low + ( high - low ) * ( rand() / ( RAND_MAX + 1.0 ) );
+}
+
+/*******************************************************************************
+ * @fn     double script_latency( void )
+ * @brief  pick an interrupt latency (us) from the script
+ * ****************************************************************************/
+static double script_latency( void )
+{
+  int total = 0;
+  int pick;
+  unsigned int index;
+
+  for( index = 0; index < SCRIPT_LENGTH; index++ )
+  {
+    total += script[index].weight;
+  }
+
+  pick = rand() % total;
+  for( index = 0; index < SCRIPT_LENGTH; index++ )
+  {
+    pick -= script[index].weight;
+    if( pick < 0 )
+    {
+      break;
+    }
+  }
+
+  // Anywhere within the blocking section
+  return script[index].latency * rand() / RAND_MAX;
+}
+
+/*******************************************************************************
+ * @fn     double worst_latency( void )
+ * @brief  longest interrupt latency in the script (us)
+ * ****************************************************************************/
+static double worst_latency( void )
+{
+  double worst = 0;
+  unsigned int index;
+
+  for( index = 0; index < SCRIPT_LENGTH; index++ )
+  {
+    if( script[index].latency > worst )
+    {
+      worst = script[index].latency;
+    }
+  }
+
+  return worst;
+}
+
+/*******************************************************************************
+ * @fn     double resend( int path, double end, double bit )
+ * @brief  when a node starts its re-send (us), for a packet that ended at
+ *         end on the sender's clock
+ * ****************************************************************************/
+static double resend( int path, double end, double bit )
+{
+  double ppm = uniform( -CRYSTAL_PPM, CRYSTAL_PPM ) * 1e-6;
+  double detected = end + uniform( -BIT_SYNC_ERROR, BIT_SYNC_ERROR ) * bit;
+  double start;
+  double tick;
+
+  if( RADIO_PATH == path )
+  {
+    start = detected + RADIO_RX_TX_BITS * bit * ( 1.0 + ppm );
+    tick = 1e6 / XOSC_HZ;
+    return ceil( start / tick ) * tick;
+  }
+
+  start = detected + script_latency() +
+          ISR_OVERHEAD_CYCLES * 1e6 / ( MCLK_HZ * ( 1.0 + ppm ) );
+
+  if( CPU_TIMER == path )
+  {
+    // The node's ACLK phase has nothing to do with anyone else's
+    tick = 1e6 / ( ACLK_HZ * ( 1.0 + ppm ) );
+    start += uniform( 0, tick );
+  }
+
+  return start;
+}
+
+/*******************************************************************************
+ * @fn     void flood( int path, int nodes, double bit, spread_t* spread )
+ * @brief  one flood from the access point, FLOOD_MAX_RELAYS hops
+ * ****************************************************************************/
+static void flood( int path, int nodes, double bit, spread_t* spread )
+{
+  double duration;
+  double sender;
+  double start;
+  double hop_min;
+  double hop_max;
+  double total_min;
+  double total_max;
+  double starts[MAX_NODES];
+  double ends[MAX_NODES];
+  int senders;
+  int relays;
+  int node;
+
+  // Preamble to CRC
+  duration = ( BEACON_LEN + RADIO_PREAMBLE_BYTES + RADIO_SYNC_BYTES +
+               RADIO_CRC_BYTES ) * 8 * bit;
+
+  // The access point alone, packets end on each sender's own clock
+  ends[0] = duration * ( 1.0 + uniform( -CRYSTAL_PPM, CRYSTAL_PPM ) * 1e-6 );
+  senders = 1;
+
+  for( relays = 1; relays <= FLOOD_MAX_RELAYS; relays++ )
+  {
+    // The spread within a hop, everyone hears the same sender
+    sender = ends[rand() % senders];
+    hop_min = 0;
+    hop_max = 0;
+
+    for( node = 0; node < nodes; node++ )
+    {
+      start = resend( path, sender, bit );
+      if( 0 == node || start < hop_min )
+      {
+        hop_min = start;
+      }
+      if( 0 == node || start > hop_max )
+      {
+        hop_max = start;
+      }
+    }
+
+    spread->hop_sum[relays] += hop_max - hop_min;
+    if( hop_max - hop_min > spread->hop_max[relays] )
+    {
+      spread->hop_max[relays] = hop_max - hop_min;
+    }
+    if( hop_max - hop_min > bit / 4 )
+    {
+      spread->over[relays]++;
+    }
+
+    // Further out, each node hears some node of the hop before, so the
+    // spread adds up over the hops
+    total_min = 0;
+    total_max = 0;
+    for( node = 0; node < nodes; node++ )
+    {
+      start = resend( path, ends[rand() % senders], bit );
+      if( 0 == node || start < total_min )
+      {
+        total_min = start;
+      }
+      if( 0 == node || start > total_max )
+      {
+        total_max = start;
+      }
+      starts[node] = start;
+    }
+
+    if( total_max - total_min > spread->total_max[relays] )
+    {
+      spread->total_max[relays] = total_max - total_min;
+    }
+
+    for( node = 0; node < nodes; node++ )
+    {
+      ends[node] = starts[node] + duration *
+                   ( 1.0 + uniform( -CRYSTAL_PPM, CRYSTAL_PPM ) * 1e-6 );
+    }
+    senders = nodes;
+  }
+}
+
+/*******************************************************************************
+ * @fn     int check_fifo( double bit )
+ * @brief  TX FIFO refill deadline on the radio path, returns 1 if missed
+ * ****************************************************************************/
+static int check_fifo( double bit )
+{
+  double deadline;
+  double first_byte;
+  double cycle = 1e6 / MCLK_HZ;
+  int read_bytes;
+
+  // The relay counter and the bytes before it were read at the sync word
+  read_bytes = BEACON_LEN + RADIO_CRC_BYTES - ( SYNC_RELAYS_OFFSET +
+                                                HEADER_LEN + 1 );
+
+  deadline = ( RADIO_PREAMBLE_BYTES + RADIO_SYNC_BYTES ) * 8 * bit;
+  first_byte = worst_latency() + ( ISR_OVERHEAD_CYCLES +
+               ( read_bytes + 1 ) * FIFO_BYTE_CYCLES ) * cycle;
+
+  printf( "\nTX FIFO: first byte written %.1fus after the end of packet "
+          "(worst case),\n  preamble and sync word take %.1fus\n",
+          first_byte, deadline );
+  printf( "  rest of the packet written at %.1fus per byte, sent at %.1fus "
+          "per byte\n", FIFO_BYTE_CYCLES * cycle, 8 * bit );
+
+  return ( first_byte >= deadline ) || ( FIFO_BYTE_CYCLES * cycle >= 8 * bit );
+}
+
+int main( int argc, char** argv )
+{
+  static spread_t spreads[PATHS];
+  double bit = 1e6 / RADIO_BAUD_RATE;
+  int floods = 10000;
+  int nodes = 4;
+  int failed = 0;
+  int path;
+  int relays;
+  int count;
+
+  if( argc > 1 )
+  {
+    floods = atoi( argv[1] );
+  }
+  if( argc > 2 )
+  {
+    nodes = atoi( argv[2] );
+  }
+  if( (nodes < 2) || (nodes > MAX_NODES) || (floods < 1) )
+  {
+    printf( "2 to %d nodes per hop\n", MAX_NODES );
+    return 1;
+  }
+
+  for( path = 0; path < PATHS; path++ )
+  {
+    srand( 1 );
+    for( count = 0; count < floods; count++ )
+    {
+      flood( path, nodes, bit, &spreads[path] );
+    }
+  }
+
+  printf( "%d floods, %d nodes per hop, %d byte beacon, bit %.2fus, "
+          "limit %.2fus\n", floods, nodes, BEACON_LEN, bit, bit / 4 );
+  printf( "%-10s %4s %10s %10s %10s %12s\n", "path", "hop", "mean", "max",
+          "over limit", "all hops max" );
+
+  for( path = 0; path < PATHS; path++ )
+  {
+    for( relays = 1; relays <= FLOOD_MAX_RELAYS; relays++ )
+    {
+      printf( "%-10s %4d %8.3fus %8.3fus %9.1f%% %10.3fus\n",
+              path_names[path], relays,
+              spreads[path].hop_sum[relays] / floods,
+              spreads[path].hop_max[relays],
+              100.0 * spreads[path].over[relays] / floods,
+              spreads[path].total_max[relays] );
+    }
+  }
+
+  for( relays = 1; relays <= FLOOD_MAX_RELAYS; relays++ )
+  {
+    if( spreads[RADIO_PATH].over[relays] )
+    {
+      printf( "radio path spread over a quarter bit at hop %d\n", relays );
+      failed = 1;
+    }
+  }
+
+  if( check_fifo( bit ) )
+  {
+    printf( "radio path misses the TX FIFO deadline\n" );
+    failed = 1;
+  }
+
+  return failed;
+}
@@ -0,0 +1,93 @@
+/** @file io.h
+*
+* @brief Host stand-in for the mspgcc device header, with just what the host
+*        tools need to build lib/timers.c and the code on top of it as is.
+*        Timer A0 is simulated by tools/host/timer_a.c
+*
+* @author Alvaro Prieto
+*/
+#ifndef _HOST_IO_H
+#define _HOST_IO_H
+
+#include <stdint.h>
+
+// Timer_A register blocks, laid out like the hardware's in words from TAxCTL
+// (see lib/timers.c)
+#define HOST_TIMER_WORDS (24)
+
+extern volatile uint16_t host_ta0[HOST_TIMER_WORDS];
+extern volatile uint16_t host_ta1[HOST_TIMER_WORDS];
+
+// Reading TA0R and TA0IV does something on the hardware, so they go through
+// the simulation
+volatile uint16_t* host_ta0r( void );
+uint16_t host_ta0iv( void );
+
+#define TA0CTL host_ta0[0]
+#define TA0CCTL0 host_ta0[1]
+#define TA0CCTL1 host_ta0[2]
+#define TA0CCTL2 host_ta0[3]
+#define TA0CCTL3 host_ta0[4]
+#define TA0CCTL4 host_ta0[5]
+#define TA0R (*host_ta0r())
+#define TA0CCR0 host_ta0[9]
+#define TA0CCR1 host_ta0[10]
+#define TA0CCR2 host_ta0[11]
+#define TA0CCR3 host_ta0[12]
+#define TA0CCR4 host_ta0[13]
+#define TA0IV host_ta0iv()
+
+#define TA1CTL host_ta1[0]
+#define TA1R host_ta1[8]
+#define TA1IV host_ta1[23]
+
+// TAxCTL
+#define TASSEL__ACLK (0x0100)
+#define TASSEL__SMCLK (0x0200)
+#define MC_0 (0x0000)
+#define MC_1 (0x0010)
+#define MC_2 (0x0020)
+#define MC_3 (0x0030)
+#define TACLR (0x0004)
+#define TAIE (0x0002)
+#define TAIFG (0x0001)
+
+// TAxCCTLn
+#define CM_1 (0x4000)
+#define CM_2 (0x8000)
+#define CM_3 (0xC000)
+#define CCIS_0 (0x0000)
+#define CCIS_2 (0x2000)
+#define SCS (0x0800)
+#define CAP (0x0100)
+#define OUTMOD_1 (0x0020)
+#define OUTMOD_7 (0x00E0)
+#define CCIE (0x0010)
+#define COV (0x0002)
+#define CCIFG (0x0001)
+
+// TAxIV value for the counter wrap
+#define TIV_OVERFLOW (0x000E)
+
+#define TIMER1_A1_VECTOR (48)
+#define TIMER1_A0_VECTOR (50)
+#define TIMER0_A1_VECTOR (52)
+#define TIMER0_A0_VECTOR (54)
+
+// Status register
+#define GIE (0x0008)
+#define LPM0_bits (0x0010)
+#define LPM3_bits (0x00D0)
+
+// Interrupts are only taken between ticks of the simulated timer, while
+// host_interrupts is set
+extern uint8_t host_interrupts;
+
+#define eint() ( host_interrupts = 1 )
+#define dint() ( host_interrupts = 0 )
+#define nop()
+#define __no_operation()
+#define __bic_SR_register_on_exit( bits )
+
+#endif /* _HOST_IO_H */\
+
@@ -0,0 +1,15 @@
+/** @file signal.h
+*
+* @brief Host stand-in for the mspgcc interrupt declarations. Interrupt
+*        handlers become plain functions the timer simulation calls (see
+*        timer_a.c)
+*
+* @author Alvaro Prieto
+*/
+#ifndef _HOST_SIGNAL_H
+#define _HOST_SIGNAL_H
+
+#define interrupt( vector ) void
+
+#endif /* _HOST_SIGNAL_H */\
+
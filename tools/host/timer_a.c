@@ -0,0 +1,240 @@
+/** @file timer_a.c
+*
+* @brief Host simulation of Timer A0, for the tools that run lib/timers.c
+*        and the code on top of it.
+*
+*   The counter only moves when a tool says so, one ACLK tick at a time, in
+*   up (MC_1) or continuous (MC_2) mode. Each tick sets TAIFG and the CCIFG
+*   flags the way the hardware does. Pending interrupts run between ticks
+*   while interrupts are enabled, through the handlers in lib/timers.c, CCR0
+*   first and then in TA0IV order. A tick can also be made to happen right
+*   after a given TA0R read, to land in the middle of the code reading it.
+*
+* @author Alvaro Prieto
+*/
+#include "timer_a.h"
+#include "intrinsics.h"
+
+// Register block layout, as word offsets from TAxCTL (see lib/timers.c)
+#define CCTL_OFFSET (1)
+#define CCR_OFFSET (9)
+#define TOTAL_CCRS (5)
+
+#define PENDING( flags, enable, flag ) \
+  ( ((enable) | (flag)) == ((flags) & ((enable) | (flag))) )
+
+void timerA0Interrupt( void );
+void timerA1Interrupt( void );
+
+static void tick( void );
+
+volatile uint16_t host_ta0[HOST_TIMER_WORDS];
+volatile uint16_t host_ta1[HOST_TIMER_WORDS];
+uint8_t host_interrupts;
+
+static uint16_t counter;
+static uint64_t elapsed;
+
+// What the last TA0R read gave back
+static volatile uint16_t counter_read;
+
+// TA0R reads left before the counter ticks on its own, 0 for never
+static uint16_t reads_to_tick;
+
+/*******************************************************************************
+ * @fn     void timer_a_start( uint16_t count )
+ * @brief  start counting from count, with no flags pending. Call after
+ *         setup_timer_a and set_ccr( 0, ... ) for up mode
+ * ****************************************************************************/
+void timer_a_start( uint16_t count )
+{
+  uint8_t ccr;
+
+  counter = count;
+  elapsed = 0;
+  reads_to_tick = 0;
+
+  TA0CTL &= ~(TACLR + TAIFG);
+  for( ccr = 0; ccr < TOTAL_CCRS; ccr++ )
+  {
+    host_ta0[CCTL_OFFSET + ccr] &= ~CCIFG;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void timer_a_run( uint32_t ticks )
+ * @brief  let ticks ACLK ticks go by, taking the interrupts as they come
+ * ****************************************************************************/
+void timer_a_run( uint32_t ticks )
+{
+  while( ticks-- )
+  {
+    tick();
+    timer_a_service();
+  }
+}
+
+/*******************************************************************************
+ * @fn     void timer_a_service( void )
+ * @brief  run the pending interrupts, if they are enabled
+ * ****************************************************************************/
+void timer_a_service( void )
+{
+  uint8_t ccr;
+  uint8_t pending;
+
+  while( host_interrupts )
+  {
+    // Interrupts are disabled while a handler runs, as on the hardware
+    if( PENDING( TA0CCTL0, CCIE, CCIFG ) )
+    {
+      TA0CCTL0 &= ~CCIFG;
+      host_interrupts = 0;
+      timerA0Interrupt();
+      host_interrupts = 1;
+      continue;
+    }
+
+    pending = PENDING( TA0CTL, TAIE, TAIFG );
+    for( ccr = 1; ccr < TOTAL_CCRS; ccr++ )
+    {
+      pending |= PENDING( host_ta0[CCTL_OFFSET + ccr], CCIE, CCIFG );
+    }
+    if( !pending )
+    {
+      return;
+    }
+
+    host_interrupts = 0;
+    timerA1Interrupt();
+    host_interrupts = 1;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void timer_a_tick_after_reads( uint16_t reads )
+ * @brief  tick right after the reads-th TA0R read from now, 0 to cancel.
+ *         Interrupts aren't run, the code reading TA0R has them disabled
+ * ****************************************************************************/
+void timer_a_tick_after_reads( uint16_t reads )
+{
+  reads_to_tick = reads;
+}
+
+/*******************************************************************************
+ * @fn     uint16_t timer_a_count( void )
+ * @brief  counter value, without it counting as a TA0R read
+ * ****************************************************************************/
+uint16_t timer_a_count( void )
+{
+  return counter;
+}
+
+/*******************************************************************************
+ * @fn     uint64_t timer_a_elapsed( void )
+ * @brief  ticks since timer_a_start
+ * ****************************************************************************/
+uint64_t timer_a_elapsed( void )
+{
+  return elapsed;
+}
+
+/*******************************************************************************
+ * @fn     volatile uint16_t* host_ta0r( void )
+ * @brief  TA0R read
+ * ****************************************************************************/
+volatile uint16_t* host_ta0r( void )
+{
+  counter_read = counter;
+
+  // The value read is the one from before the tick
+  if( reads_to_tick && (0 == --reads_to_tick) )
+  {
+    tick();
+  }
+
+  return &counter_read;
+}
+
+/*******************************************************************************
+ * @fn     uint16_t host_ta0iv( void )
+ * @brief  TA0IV read, highest priority enabled flag pending. Clears it
+ * ****************************************************************************/
+uint16_t host_ta0iv( void )
+{
+  uint8_t ccr;
+
+  for( ccr = 1; ccr < TOTAL_CCRS; ccr++ )
+  {
+    if( PENDING( host_ta0[CCTL_OFFSET + ccr], CCIE, CCIFG ) )
+    {
+      host_ta0[CCTL_OFFSET + ccr] &= ~CCIFG;
+      return ccr << 1;
+    }
+  }
+
+  if( PENDING( TA0CTL, TAIE, TAIFG ) )
+  {
+    TA0CTL &= ~TAIFG;
+    return TIV_OVERFLOW;
+  }
+
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     unsigned short __get_interrupt_state( void )
+ * @brief  GIE if interrupts are enabled
+ * ****************************************************************************/
+unsigned short __get_interrupt_state( void )
+{
+  return host_interrupts ? GIE : 0;
+}
+
+/*******************************************************************************
+ * @fn     void __set_interrupt_state( unsigned short state )
+ * @brief  set GIE back from __get_interrupt_state
+ * ****************************************************************************/
+void __set_interrupt_state( unsigned short state )
+{
+  if( state & GIE )
+  {
+    host_interrupts = 1;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void tick( void )
+ * @brief  one ACLK tick. Up mode wraps after TA0CCR0, continuous after 0xFFFF
+ * ****************************************************************************/
+static void tick( void )
+{
+  uint16_t mode = TA0CTL & MC_3;
+  uint8_t ccr;
+
+  if( (MC_1 != mode) && (MC_2 != mode) )
+  {
+    return;
+  }
+
+  if( ((MC_1 == mode) && (counter == TA0CCR0)) || (0xFFFF == counter) )
+  {
+    counter = 0;
+    TA0CTL |= TAIFG;
+  }
+  else
+  {
+    counter++;
+  }
+  elapsed++;
+
+  // Compare mode CCRs flag the counter reaching them
+  for( ccr = 0; ccr < TOTAL_CCRS; ccr++ )
+  {
+    if( !(host_ta0[CCTL_OFFSET + ccr] & CAP) &&
+        (counter == host_ta0[CCR_OFFSET + ccr]) )
+    {
+      host_ta0[CCTL_OFFSET + ccr] |= CCIFG;
+    }
+  }
+}
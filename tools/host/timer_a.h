@@ -0,0 +1,20 @@
+/** @file timer_a.h
+*
+* @brief Host simulation of Timer A0, see timer_a.c
+*
+* @author Alvaro Prieto
+*/
+#ifndef _HOST_TIMER_A_H
+#define _HOST_TIMER_A_H
+
+#include "common.h"
+
+void timer_a_start( uint16_t );
+void timer_a_run( uint32_t );
+void timer_a_service( void );
+void timer_a_tick_after_reads( uint16_t );
+uint16_t timer_a_count( void );
+uint64_t timer_a_elapsed( void );
+
+#endif /* _HOST_TIMER_A_H */\
+
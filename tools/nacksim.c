@@ -0,0 +1,316 @@
+/** @file nacksim.c
+*
+* @brief  Sample blocks recovered by re-send requests (lib/nack.c) on a lossy
+*         channel.
+*
+*         Every superframe each end device sends one sample block in its
+*         slot, each packet is lost with the same probability. Every beacon
+*         period the access point asks for the blocks it missed, up to
+*         NACK_ENTRIES devices at a time in turn, and each of them re-sends
+*         one block per superframe in a free slot, from the last NACK_WINDOW
+*         blocks it sent. Beacons and re-sends are lost like any packet. A
+*         device that missed a beacon keeps going with the request and slot
+*         from the one before, which may have been given to someone else.
+*
+*         Prints the share of blocks that arrive the first time and in the
+*         end, for a few network sizes and loss rates. Exits with an error
+*         if the access point ever delivers the same block twice.
+*
+*         usage: nacksim [beacon period in superframes] [superframes] [seed]
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "nack.h"
+
+// Must match demo/settings.h
+#define MAX_SLOTS (16)
+#define NACK_ENTRIES (2)
+#define SYNC_PERIOD (4)
+#define MAJOR_CYCLES (12)   // Per timer period
+
+// Blocks at the end still waiting for a request aren't counted
+#define TAIL_PERIODS (2)
+
+typedef struct
+{
+  uint8_t request[NACK_ENTRY_LEN];
+  int spare;                  // Re-send slot, -1 if none
+  long sent[NACK_WINDOW];     // Block numbers kept, -1 if unused
+  int sent_next;
+  nack_tracker_t tracker;     // At the access point
+  uint8_t* delivered;         // By block number, at the access point
+  uint8_t* first_time;
+} device_t;
+
+typedef struct
+{
+  long blocks;
+  long first_time;
+  long delivered;
+  long resends;
+  long duplicates;
+} tally_t;
+
+/*******************************************************************************
+ * @fn     int lost( double loss )
+ * @brief  1 if a packet is lost
+ * ****************************************************************************/
+static int lost( double loss )
+{
+  return ( rand() / ( RAND_MAX + 1.0 ) ) < loss;
+}
+
+/*******************************************************************************
+ * @fn     void deliver( device_t* device, long block, int resend,
+ *                       tally_t* tally )
+ * @brief  a block arrived at the access point, deliver_packet in
+ *         demo/access_point.c
+ * ****************************************************************************/
+static void deliver( device_t* device, long block, int resend, tally_t* tally )
+{
+  if( !nack_heard( &device->tracker, (uint8_t)block ) )
+  {
+    return;
+  }
+
+  if( device->delivered[block] )
+  {
+    tally->duplicates++;
+  }
+  device->delivered[block] = 1;
+  if( !resend )
+  {
+    device->first_time[block] = 1;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void beacon( device_t* devices, int count, int* turn, double loss )
+ * @brief  update_requests in demo/access_point.c, and update_slot in
+ *         demo/end_device.c for the devices that hear the beacon
+ * ****************************************************************************/
+static void beacon( device_t* devices, int count, int* turn, double loss )
+{
+  uint8_t entries[NACK_ENTRIES][NACK_ENTRY_LEN];
+  int requests = 0;
+  int device;
+  int index;
+  int slot;
+
+  memset( entries, 0, sizeof(entries) );
+
+  // Devices hold the first count slots, the rest are free
+  for( index = 0; (index < MAX_SLOTS) && (requests < NACK_ENTRIES) &&
+                  (requests < MAX_SLOTS - count); index++ )
+  {
+    slot = ( *turn + index ) % MAX_SLOTS;
+    if( (slot < count) &&
+        nack_request( &devices[slot].tracker, slot + 1, entries[requests] ) )
+    {
+      requests++;
+      *turn = ( slot + 1 ) % MAX_SLOTS;
+    }
+  }
+
+  for( device = 0; device < count; device++ )
+  {
+    if( lost( loss ) )
+    {
+      continue;
+    }
+
+    memset( devices[device].request, 0, NACK_ENTRY_LEN );
+    devices[device].spare = -1;
+    for( index = 0; index < NACK_ENTRIES; index++ )
+    {
+      if( device + 1 == entries[index][0] )
+      {
+        memcpy( devices[device].request, entries[index], NACK_ENTRY_LEN );
+        devices[device].spare = count + index;
+        break;
+      }
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     long resend_block( device_t* device )
+ * @brief  send_resend in demo/end_device.c, the block re-sent or -1
+ * ****************************************************************************/
+static long resend_block( device_t* device )
+{
+  uint8_t block;
+  int index;
+
+  while( nack_next( device->request, &block ) )
+  {
+    for( index = 0; index < NACK_WINDOW; index++ )
+    {
+      if( (device->sent[index] >= 0) &&
+          ((uint8_t)device->sent[index] == block) )
+      {
+        return device->sent[index];
+      }
+    }
+  }
+
+  return -1;
+}
+
+/*******************************************************************************
+ * @fn     void run( int count, double loss, int period, long superframes,
+ *                   tally_t* tally )
+ * @brief  count devices for superframes superframes
+ * ****************************************************************************/
+static void run( int count, double loss, int period, long superframes,
+                 tally_t* tally )
+{
+  static device_t devices[MAX_SLOTS];
+  long resent[MAX_SLOTS];
+  int users[MAX_SLOTS];
+  long superframe;
+  long counted;
+  long block;
+  int turn = 0;
+  int device;
+
+  for( device = 0; device < count; device++ )
+  {
+    memset( &devices[device], 0, sizeof(device_t) );
+    memset( devices[device].sent, 0xFF, sizeof(devices[device].sent) );
+    devices[device].spare = -1;
+    nack_init( &devices[device].tracker );
+    devices[device].delivered = calloc( superframes, 1 );
+    devices[device].first_time = calloc( superframes, 1 );
+  }
+
+  for( superframe = 0; superframe < superframes; superframe++ )
+  {
+    if( 0 == superframe % period )
+    {
+      beacon( devices, count, &turn, loss );
+    }
+
+    // Sample slots, the block of the superframe is block superframe
+    for( device = 0; device < count; device++ )
+    {
+      devices[device].sent[devices[device].sent_next] = superframe;
+      devices[device].sent_next = ( devices[device].sent_next + 1 ) %
+                                  NACK_WINDOW;
+      if( !lost( loss ) )
+      {
+        deliver( &devices[device], superframe, 0, tally );
+      }
+    }
+
+    // Re-send slots, two devices in the same one collide
+    memset( users, 0, sizeof(users) );
+    for( device = 0; device < count; device++ )
+    {
+      resent[device] = -1;
+      if( devices[device].spare >= 0 )
+      {
+        resent[device] = resend_block( &devices[device] );
+        if( resent[device] >= 0 )
+        {
+          users[devices[device].spare]++;
+          tally->resends++;
+        }
+      }
+    }
+    for( device = 0; device < count; device++ )
+    {
+      if( (resent[device] >= 0) && (1 == users[devices[device].spare]) &&
+          !lost( loss ) )
+      {
+        deliver( &devices[device], resent[device], 1, tally );
+      }
+    }
+  }
+
+  counted = superframes - TAIL_PERIODS * period;
+  for( device = 0; device < count; device++ )
+  {
+    for( block = 0; block < counted; block++ )
+    {
+      tally->blocks++;
+      tally->first_time += devices[device].first_time[block];
+      tally->delivered += devices[device].delivered[block];
+    }
+    free( devices[device].delivered );
+    free( devices[device].first_time );
+  }
+}
+
+int main( int argc, char** argv )
+{
+  static const int count_cases[] = { 4, 8, 12 };
+  static const double loss_cases[] = { 0.01, 0.05, 0.1, 0.2 };
+  tally_t tally;
+  long superframes = 100000;
+  long duplicates = 0;
+  int period = SYNC_PERIOD * MAJOR_CYCLES;
+  int seed = 1;
+  unsigned int count;
+  unsigned int loss;
+
+  if( argc > 1 )
+  {
+    period = atoi( argv[1] );
+  }
+  if( argc > 2 )
+  {
+    superframes = atol( argv[2] );
+  }
+  if( argc > 3 )
+  {
+    seed = atoi( argv[3] );
+  }
+  if( (period < 1) || (superframes <= TAIL_PERIODS * period) )
+  {
+    printf( "more than %d beacon periods\n", TAIL_PERIODS );
+    return 1;
+  }
+
+  printf( "beacon every %d superframes, %d requests per beacon, "
+          "%d blocks kept, %ld superframes\n\n", period, NACK_ENTRIES,
+          NACK_WINDOW, superframes );
+  printf( "%7s %5s %11s %9s %10s %14s\n", "devices", "loss", "first time",
+          "in the end", "recovered", "re-sends/block" );
+
+  for( count = 0; count < sizeof(count_cases) / sizeof(count_cases[0]);
+       count++ )
+  {
+    for( loss = 0; loss < sizeof(loss_cases) / sizeof(loss_cases[0]);
+         loss++ )
+    {
+      memset( &tally, 0, sizeof(tally) );
+      srand( seed );
+      run( count_cases[count], loss_cases[loss], period, superframes,
+           &tally );
+
+      printf( "%7d %4.0f%% %10.2f%% %8.2f%% %9.1f%% %14.3f\n",
+              count_cases[count], 100.0 * loss_cases[loss],
+              100.0 * tally.first_time / tally.blocks,
+              100.0 * tally.delivered / tally.blocks,
+              100.0 * ( tally.delivered - tally.first_time ) /
+                      ( tally.blocks - tally.first_time ),
+              (double)tally.resends / tally.blocks );
+      duplicates += tally.duplicates;
+    }
+  }
+
+  printf( "\nrecovered: share of the blocks lost the first time that were "
+          "re-sent\n" );
+
+  if( duplicates )
+  {
+    printf( "%ld blocks delivered twice\n", duplicates );
+    return 1;
+  }
+
+  return 0;
+}
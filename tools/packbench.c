@@ -0,0 +1,391 @@
+/** @file packbench.c
+*
+* @brief  Host side unpacking of 12-bit samples (lib/pack12.c), and how
+*         densely the sample packets carry them.
+*
+*         Unpacks a capture of sample packets (ADC_MAX_SAMPLES samples
+*         packed to ADC_SAMPLES_LEN bytes each) with:
+*         - pack12: unpack12 from lib/pack12.c, the end devices' code, one
+*           pair of samples at a time
+*         - swar: 6 bytes, 4 samples at a time from one 64-bit load
+*         - ssse3: 12 bytes, 8 samples at a time with one byte shuffle
+*           (x86 hosts that have it)
+*         and prints the time each takes per sample, one packet at a time and
+*         over the same samples packed as one long run. Every unpacker must
+*         give back the samples that were packed, exits with an error if one
+*         doesn't.
+*
+*         Then prints the bits sent per sample: packed, and delta/Rice
+*         compressed (lib/codec.c) for a slow signal and for noise, the way
+*         send_samples in demo/end_device.c picks between them.
+*
+*         usage: packbench [packets] [rounds]
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "pack12.h"
+#include "codec.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_SSSE3 (1)
+#include <tmmintrin.h>
+#else
+#define HAVE_SSSE3 (0)
+#endif
+
+// Must match demo/settings.h
+#define ADC_MAX_SAMPLES (33)
+#define ADC_SAMPLES_LEN PACK12_LEN( ADC_MAX_SAMPLES )
+
+typedef void (*unpacker_t)( const uint8_t*, size_t, uint16_t* );
+
+static int failures = 0;
+
+/*******************************************************************************
+ * @fn     double now( void )
+ * @brief  monotonic time, s
+ * ****************************************************************************/
+static double now( void )
+{
+  struct timespec time;
+
+  clock_gettime( CLOCK_MONOTONIC, &time );
+
+  return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+/*******************************************************************************
+ * @fn     void unpack_pack12( const uint8_t* in, size_t count,
+ *                             uint16_t* samples )
+ * @brief  unpack12 from lib/pack12.c, for any count
+ * ****************************************************************************/
+static void unpack_pack12( const uint8_t* in, size_t count, uint16_t* samples )
+{
+  // Keep the runs even so they start on a byte
+  while( count > 254 )
+  {
+    unpack12( in, 254, samples );
+    in += PACK12_LEN( 254 );
+    samples += 254;
+    count -= 254;
+  }
+
+  unpack12( in, (uint8_t)count, samples );
+}
+
+/*******************************************************************************
+ * @fn     void unpack_swar( const uint8_t* in, size_t count,
+ *                           uint16_t* samples )
+ * @brief  four samples (two 24-bit words) per 64-bit load. The load reads 2
+ *         bytes past the 6 it uses, so the last ones go through unpack12
+ * ****************************************************************************/
+static void unpack_swar( const uint8_t* in, size_t count, uint16_t* samples )
+{
+  const uint8_t* end = in + PACK12_LEN( count );
+  uint64_t word;
+
+  // Little endian hosts, same as the packets
+  while( (count >= 4) && (in + sizeof(word) <= end) )
+  {
+    memcpy( &word, in, sizeof(word) );
+
+    samples[0] = word & PACK12_MAX;
+    samples[1] = ( word >> 12 ) & PACK12_MAX;
+    samples[2] = ( word >> 24 ) & PACK12_MAX;
+    samples[3] = ( word >> 36 ) & PACK12_MAX;
+
+    in += 6;
+    samples += 4;
+    count -= 4;
+  }
+
+  unpack_pack12( in, count, samples );
+}
+
+#if HAVE_SSSE3
+/*******************************************************************************
+ * @fn     void unpack_ssse3( const uint8_t* in, size_t count,
+ *                            uint16_t* samples )
+ * @brief  eight samples per 16-byte load. Each 16-bit lane gets the two
+ *         bytes its sample is in, the even ones keep the low 12 bits and the
+ *         odd ones the high 12. The load reads 4 bytes past the 12 it uses,
+ *         so the last ones go through unpack12
+ * ****************************************************************************/
+__attribute__((target("ssse3")))
+static void unpack_ssse3( const uint8_t* in, size_t count, uint16_t* samples )
+{
+  const uint8_t* end = in + PACK12_LEN( count );
+  const __m128i shuffle = _mm_setr_epi8( 0, 1, 1, 2, 3, 4, 4, 5,
+                                         6, 7, 7, 8, 9, 10, 10, 11 );
+  const __m128i even = _mm_set1_epi32( PACK12_MAX );
+  __m128i bytes;
+  __m128i lanes;
+
+  while( (count >= 8) && (in + sizeof(bytes) <= end) )
+  {
+    bytes = _mm_loadu_si128( (const __m128i*)in );
+    lanes = _mm_shuffle_epi8( bytes, shuffle );
+    lanes = _mm_or_si128( _mm_and_si128( lanes, even ),
+                          _mm_andnot_si128( even,
+                                            _mm_srli_epi16( lanes, 4 ) ) );
+    _mm_storeu_si128( (__m128i*)samples, lanes );
+
+    in += 12;
+    samples += 8;
+    count -= 8;
+  }
+
+  unpack_pack12( in, count, samples );
+}
+#endif
+
+/*******************************************************************************
+ * @fn     void pack_run( const uint16_t* samples, size_t count, uint8_t* out )
+ * @brief  pack12 from lib/pack12.c, for any count
+ * ****************************************************************************/
+static void pack_run( const uint16_t* samples, size_t count, uint8_t* out )
+{
+  while( count > 254 )
+  {
+    pack12( samples, 254, out );
+    out += PACK12_LEN( 254 );
+    samples += 254;
+    count -= 254;
+  }
+
+  pack12( samples, (uint8_t)count, out );
+}
+
+/*******************************************************************************
+ * @fn     void bench( const char* name, unpacker_t unpacker,
+ *                     const uint8_t* packed, const uint8_t* run,
+ *                     const uint16_t* samples, uint16_t* out, long packets,
+ *                     int rounds )
+ * @brief  time one unpacker on the packets and on the run, and check what it
+ *         gives back
+ * ****************************************************************************/
+static void bench( const char* name, unpacker_t unpacker,
+                   const uint8_t* packed, const uint8_t* run,
+                   const uint16_t* samples, uint16_t* out, long packets,
+                   int rounds )
+{
+  size_t total = (size_t)packets * ADC_MAX_SAMPLES;
+  double start;
+  double per_packet;
+  double whole;
+  long packet;
+  int round;
+
+  memset( out, 0xFF, total * sizeof(uint16_t) );
+  start = now();
+  for( round = 0; round < rounds; round++ )
+  {
+    for( packet = 0; packet < packets; packet++ )
+    {
+      unpacker( &packed[packet * ADC_SAMPLES_LEN], ADC_MAX_SAMPLES,
+                &out[packet * ADC_MAX_SAMPLES] );
+    }
+  }
+  per_packet = now() - start;
+
+  if( memcmp( out, samples, total * sizeof(uint16_t) ) )
+  {
+    printf( "%s: samples don't come back out the same\n", name );
+    failures++;
+  }
+
+  memset( out, 0xFF, total * sizeof(uint16_t) );
+  start = now();
+  for( round = 0; round < rounds; round++ )
+  {
+    unpacker( run, total, out );
+  }
+  whole = now() - start;
+
+  if( memcmp( out, samples, total * sizeof(uint16_t) ) )
+  {
+    printf( "%s: samples don't come back out the same in one run\n", name );
+    failures++;
+  }
+
+  printf( "%8s %14.3f %14.1f %14.3f %10.0f\n", name,
+          1e9 * per_packet / ( (double)rounds * total ),
+          1e9 * per_packet / ( (double)rounds * packets ),
+          1e9 * whole / ( (double)rounds * total ),
+          (double)rounds * total / whole / 1e6 );
+}
+
+/*******************************************************************************
+ * @fn     void check_odd( void )
+ * @brief  pack and unpack every count up to 255, odd ones end mid byte
+ * ****************************************************************************/
+static void check_odd( void )
+{
+  uint16_t samples[255];
+  uint16_t out[255];
+  uint8_t packed[PACK12_LEN( 255 ) + 1];
+  int count;
+  int index;
+
+  for( count = 0; count <= 255; count++ )
+  {
+    for( index = 0; index < count; index++ )
+    {
+      samples[index] = rand() & PACK12_MAX;
+    }
+    memset( packed, 0xA5, sizeof(packed) );
+    pack12( samples, count, packed );
+    unpack12( packed, count, out );
+
+    if( memcmp( out, samples, count * sizeof(uint16_t) ) ||
+        (0xA5 != packed[PACK12_LEN( count )]) )
+    {
+      printf( "pack12: %d samples don't come back out the same\n", count );
+      failures++;
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void density( const char* name, int noise, long packets )
+ * @brief  mean bits per sample in the sample packets, packed or compressed
+ *         whichever is shorter
+ * ****************************************************************************/
+static void density( const char* name, int noise, long packets )
+{
+  uint16_t block[ADC_MAX_SAMPLES];
+  uint16_t decoded[ADC_MAX_SAMPLES];
+  uint8_t data[ADC_SAMPLES_LEN];
+  double phase = 0.0;
+  long compressed = 0;
+  long bytes = 0;
+  long packet;
+  uint8_t length;
+  int index;
+
+  for( packet = 0; packet < packets; packet++ )
+  {
+    for( index = 0; index < ADC_MAX_SAMPLES; index++ )
+    {
+      if( noise )
+      {
+        block[index] = rand() & PACK12_MAX;
+      }
+      else
+      {
+        phase += 0.02;
+        block[index] = (uint16_t)( 2048 + 1440 * sin( phase ) +
+                                   ( rand() % 33 ) - 16 );
+      }
+    }
+
+    if( ADC_MAX_SAMPLES == codec_encode( block, ADC_MAX_SAMPLES, data,
+                                         ADC_SAMPLES_LEN, &length ) )
+    {
+      compressed++;
+      if( (ADC_MAX_SAMPLES != codec_decode( data, length, decoded,
+                                            ADC_MAX_SAMPLES )) ||
+          memcmp( decoded, block, sizeof(block) ) )
+      {
+        printf( "codec: %s block doesn't come back out the same\n", name );
+        failures++;
+      }
+    }
+    else
+    {
+      length = ADC_SAMPLES_LEN;
+    }
+    bytes += length;
+  }
+
+  printf( "%12s %10.2f %12.1f%%\n", name,
+          8.0 * bytes / ( (double)packets * ADC_MAX_SAMPLES ),
+          100.0 * compressed / packets );
+}
+
+int main( int argc, char** argv )
+{
+  uint16_t* samples;
+  uint16_t* out;
+  uint8_t* packed;
+  uint8_t* run;
+  long packets = 20000;
+  long packet;
+  long index;
+  int rounds = 50;
+
+  if( argc > 1 )
+  {
+    packets = atol( argv[1] );
+  }
+  if( argc > 2 )
+  {
+    rounds = atoi( argv[2] );
+  }
+  if( (packets < 1) || (rounds < 1) )
+  {
+    printf( "at least one packet and one round\n" );
+    return 1;
+  }
+  srand( 1 );
+
+  samples = malloc( packets * ADC_MAX_SAMPLES * sizeof(uint16_t) );
+  out = malloc( packets * ADC_MAX_SAMPLES * sizeof(uint16_t) );
+  packed = malloc( packets * ADC_SAMPLES_LEN );
+  run = malloc( PACK12_LEN( packets * ADC_MAX_SAMPLES ) );
+  if( !samples || !out || !packed || !run )
+  {
+    printf( "out of memory\n" );
+    return 1;
+  }
+
+  for( index = 0; index < packets * ADC_MAX_SAMPLES; index++ )
+  {
+    samples[index] = rand() & PACK12_MAX;
+  }
+
+  // Packed one packet at a time like the end devices do, the odd last
+  // sample of a packet doesn't share its byte with the next packet's first
+  for( packet = 0; packet < packets; packet++ )
+  {
+    pack12( &samples[packet * ADC_MAX_SAMPLES], ADC_MAX_SAMPLES,
+            &packed[packet * ADC_SAMPLES_LEN] );
+  }
+  pack_run( samples, packets * ADC_MAX_SAMPLES, run );
+
+  check_odd();
+
+  printf( "%ld packets of %d samples in %d bytes, %d rounds\n\n", packets,
+          ADC_MAX_SAMPLES, ADC_SAMPLES_LEN, rounds );
+  printf( "%8s %14s %14s %14s %10s\n", "unpacker", "ns/sample", "ns/packet",
+          "ns/sample run", "Msample/s" );
+
+  bench( "pack12", unpack_pack12, packed, run, samples, out, packets,
+         rounds );
+  bench( "swar", unpack_swar, packed, run, samples, out, packets,
+         rounds );
+#if HAVE_SSSE3
+  if( __builtin_cpu_supports( "ssse3" ) )
+  {
+    bench( "ssse3", unpack_ssse3, packed, run, samples, out, packets,
+           rounds );
+  }
+#endif
+
+  printf( "\n%12s %10s %13s\n", "signal", "bits/sample", "compressed" );
+  density( "slow signal", 0, packets );
+  density( "noise", 1, packets );
+
+  free( samples );
+  free( out );
+  free( packed );
+  free( run );
+
+  return failures ? 1 : 0;
+}
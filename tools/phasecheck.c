@@ -0,0 +1,157 @@
+/** @file phasecheck.c
+*
+* @brief  Residual phase error between end devices sampling on the global
+*         sample grid (see lib/sample_grid.h).
+*
+*         Reads sample instants logged on a common timebase, one per line as
+*         "node seconds", e.g. the rising edges of every node's LED1 (turned
+*         on by start_sample) exported from a logic analyzer. The first node
+*         in the log is the reference. Each sample of the other nodes is
+*         matched with the closest reference sample and the difference is
+*         the phase error.
+*
+*         usage: phasecheck < edges.txt
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define ACLK_HZ (32768.0)
+#define MAX_NODES (256)
+#define MAX_SAMPLES (1000000)
+
+typedef struct
+{
+  double sum;
+  double sum_squares;
+  double worst;
+  int count;
+} phase_stats_t;
+
+static double* reference;
+static int reference_count;
+
+/*******************************************************************************
+ * @fn     double closest( double time )
+ * @brief  difference to the closest reference sample (reference is sorted)
+ * ****************************************************************************/
+static double closest( double time )
+{
+  int low = 0;
+  int high = reference_count - 1;
+  int middle;
+
+  while( high - low > 1 )
+  {
+    middle = ( low + high ) / 2;
+    if( reference[middle] <= time )
+    {
+      low = middle;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+
+  if( fabs( time - reference[low] ) < fabs( time - reference[high] ) )
+  {
+    return time - reference[low];
+  }
+
+  return time - reference[high];
+}
+
+/*******************************************************************************
+ * @fn     int compare( const void* a, const void* b )
+ * @brief  qsort comparison for doubles
+ * ****************************************************************************/
+static int compare( const void* a, const void* b )
+{
+  double difference = *(const double*)a - *(const double*)b;
+
+  return ( difference > 0 ) - ( difference < 0 );
+}
+
+int main( void )
+{
+  static phase_stats_t stats[MAX_NODES];
+  static int nodes[MAX_SAMPLES];
+  static double times[MAX_SAMPLES];
+  int reference_node = -1;
+  int total = 0;
+  int node;
+  int index;
+  double error;
+  double mean;
+  double tick_us = 1e6 / ACLK_HZ;
+
+  reference = malloc( sizeof(double) * MAX_SAMPLES );
+
+  while( (total < MAX_SAMPLES) &&
+         (2 == scanf( "%d %lf", &nodes[total], &times[total] )) )
+  {
+    if( (nodes[total] < 0) || (nodes[total] >= MAX_NODES) )
+    {
+      continue;
+    }
+    if( reference_node < 0 )
+    {
+      reference_node = nodes[total];
+    }
+    if( nodes[total] == reference_node )
+    {
+      reference[reference_count++] = times[total];
+    }
+    total++;
+  }
+
+  if( reference_count < 2 )
+  {
+    fprintf( stderr, "not enough samples from the reference node\n" );
+    return 1;
+  }
+
+  qsort( reference, reference_count, sizeof(double), compare );
+
+  for( index = 0; index < total; index++ )
+  {
+    node = nodes[index];
+    if( node == reference_node )
+    {
+      continue;
+    }
+
+    error = closest( times[index] ) * 1e6;
+    stats[node].sum += error;
+    stats[node].sum_squares += error * error;
+    if( fabs( error ) > stats[node].worst )
+    {
+      stats[node].worst = fabs( error );
+    }
+    stats[node].count++;
+  }
+
+  printf( "phase error against node %d (us, 1 tick = %.1fus)\n",
+          reference_node, tick_us );
+  printf( "%5s %8s %9s %9s %9s %11s\n", "node", "samples", "mean", "std dev",
+          "worst", "worst ticks" );
+
+  for( node = 0; node < MAX_NODES; node++ )
+  {
+    if( 0 == stats[node].count )
+    {
+      continue;
+    }
+
+    mean = stats[node].sum / stats[node].count;
+    printf( "%5d %8d %9.1f %9.1f %9.1f %11.1f\n", node, stats[node].count,
+            mean, sqrt( stats[node].sum_squares / stats[node].count -
+                        mean * mean ),
+            stats[node].worst, stats[node].worst / tick_us );
+  }
+
+  return 0;
+}
@@ -0,0 +1,359 @@
+/** @file ringstress.c
+*
+* @brief  Stress test of the sample block ring (lib/sample_ring.c) between
+*         the DMA interrupt and send_samples in demo/end_device.c.
+*
+*         Every block the producer fills carries its sequence number in all
+*         its words. The consumer checks each block it gets is whole (no
+*         word from another block), that blocks come in order, and that
+*         every block missing was counted as an overrun.
+*
+*         First the way it runs on the MSP430: the producer is an interrupt,
+*         it runs whole at any point of the consumer's work, between the
+*         peek, the reads of the block (one word at a time) and the release,
+*         at random rates so the ring runs both empty and full. Then with
+*         the producer and consumer on two threads, neither waiting for the
+*         other, each pausing for random lengths of time between blocks.
+*
+*         usage: ringstress [blocks] [seed]
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include "sample_ring.h"
+
+// Same as the end devices (see demo/settings.h and end_device.c)
+#define RING_BLOCKS (4)
+#define BLOCK_WORDS (33)
+
+// Chances the producer runs at each point of the consumer's work, out of
+// ODDS_RANGE. Up to ~1.5 blocks per block consumed
+#define MAX_ODDS (12)
+#define ODDS_RANGE ( 8 * BLOCK_WORDS )
+
+// Longest pause between blocks on the threads, loop iterations. One pause
+// in YIELD_ODDS also gives up the CPU, so the threads take turns on a
+// single core host too
+#define MAX_PAUSE (500)
+#define YIELD_ODDS (4)
+
+typedef struct
+{
+  uint32_t sequence;
+  uint16_t samples[BLOCK_WORDS];
+} block_t;
+
+typedef struct
+{
+  sample_ring_t ring;
+  block_t blocks[RING_BLOCKS];
+  long total;               // Blocks to produce
+  unsigned int seed;        // Producer thread's random numbers
+  volatile long produced;
+  long consumed;
+  long dropped;             // Gaps seen by the consumer
+  long torn;                // Blocks not whole
+  long out_of_order;
+  uint32_t last;            // Sequence of the last block consumed + 1
+} test_t;
+
+/*******************************************************************************
+ * @fn     void setup( test_t* test, long total )
+ * @brief  empty ring, total blocks to go through it
+ * ****************************************************************************/
+static void setup( test_t* test, long total )
+{
+  sample_ring_init( &test->ring, test->blocks, sizeof(block_t), RING_BLOCKS );
+  test->total = total;
+  test->produced = 0;
+  test->consumed = 0;
+  test->dropped = 0;
+  test->torn = 0;
+  test->out_of_order = 0;
+  test->last = 0;
+}
+
+/*******************************************************************************
+ * @fn     void produce( test_t* test )
+ * @brief  one block done, the way block_done does it
+ * ****************************************************************************/
+static void produce( test_t* test )
+{
+  block_t* block;
+  uint32_t sequence = (uint32_t)test->produced;
+  int index;
+
+  block = sample_ring_claim( &test->ring );
+  if( 0 != block )
+  {
+    block->sequence = sequence;
+    for( index = 0; index < BLOCK_WORDS; index++ )
+    {
+      block->samples[index] = (uint16_t)sequence;
+    }
+    sample_ring_publish( &test->ring );
+  }
+
+  test->produced = test->produced + 1;
+}
+
+/*******************************************************************************
+ * @fn     void check( test_t* test, uint32_t sequence, int whole )
+ * @brief  account for one block the consumer got
+ * ****************************************************************************/
+static void check( test_t* test, uint32_t sequence, int whole )
+{
+  if( !whole )
+  {
+    test->torn++;
+  }
+
+  if( sequence < test->last )
+  {
+    test->out_of_order++;
+  }
+  else
+  {
+    test->dropped += sequence - test->last;
+    test->last = sequence + 1;
+  }
+
+  test->consumed++;
+}
+
+/*******************************************************************************
+ * @fn     void consume( test_t* test )
+ * @brief  check and release the oldest block, if there is one. Returns 0 if
+ *         the ring was empty
+ * ****************************************************************************/
+static int consume( test_t* test )
+{
+  block_t* block;
+  uint32_t sequence;
+  int whole = 1;
+  int index;
+
+  block = sample_ring_peek( &test->ring );
+  if( 0 == block )
+  {
+    return 0;
+  }
+
+  sequence = block->sequence;
+  for( index = 0; index < BLOCK_WORDS; index++ )
+  {
+    if( (uint16_t)sequence != block->samples[index] )
+    {
+      whole = 0;
+    }
+  }
+  if( sequence != block->sequence )
+  {
+    whole = 0;
+  }
+  sample_ring_release( &test->ring );
+
+  check( test, sequence, whole );
+
+  return 1;
+}
+
+/*******************************************************************************
+ * @fn     int report( const char* name, test_t* test )
+ * @brief  take what is left in the ring, print the counts. Returns 1 if
+ *         anything went wrong
+ * ****************************************************************************/
+static int report( const char* name, test_t* test )
+{
+  long overruns;
+  int failed;
+
+  while( consume( test ) );
+
+  // Blocks dropped after the last one that made it
+  test->dropped += test->produced - test->last;
+
+  // The ring stops counting at 65535
+  overruns = ( test->dropped < 0xFFFF ) ? test->dropped : 0xFFFF;
+
+  failed = test->torn || test->out_of_order ||
+           (overruns != test->ring.overruns) ||
+           (test->consumed + test->dropped != test->produced);
+
+  printf( "%s: %ld blocks, %ld consumed, %u overruns, %ld torn, "
+          "%ld out of order, %ld missing%s\n", name,
+          (long)test->produced, test->consumed,
+          (unsigned)test->ring.overruns, test->torn, test->out_of_order,
+          test->dropped, failed ? " FAILED" : "" );
+
+  return failed;
+}
+
+/*******************************************************************************
+ * @fn     int interrupt( int odds )
+ * @brief  whether the producer runs now
+ * ****************************************************************************/
+static int interrupt( int odds )
+{
+  return ( rand() % ODDS_RANGE ) < odds;
+}
+
+/*******************************************************************************
+ * @fn     void pause( unsigned int* seed )
+ * @brief  spin for a random time, sometimes let the other thread run
+ * ****************************************************************************/
+static void pause( unsigned int* seed )
+{
+  volatile int spin;
+  int count = rand_r( seed ) % MAX_PAUSE;
+
+  for( spin = 0; spin < count; spin++ );
+
+  if( 0 == ( rand_r( seed ) % YIELD_ODDS ) )
+  {
+    sched_yield();
+  }
+}
+
+/*******************************************************************************
+ * @fn     int interrupt_test( long total )
+ * @brief  the producer interrupting the consumer anywhere
+ * ****************************************************************************/
+static int interrupt_test( long total )
+{
+  static test_t test;
+  block_t* block;
+  uint32_t sequence;
+  int odds = MAX_ODDS / 2;
+  int whole;
+  int index;
+
+  setup( &test, total );
+
+  while( test.produced < test.total )
+  {
+    // Blocks come slower or faster than the slot for a while
+    if( 0 == ( rand() % 64 ) )
+    {
+      odds = 1 + rand() % MAX_ODDS;
+    }
+
+    if( interrupt( odds ) )
+    {
+      produce( &test );
+    }
+
+    block = sample_ring_peek( &test.ring );
+    if( 0 == block )
+    {
+      continue;
+    }
+
+    sequence = block->sequence;
+    whole = 1;
+    for( index = 0; index < BLOCK_WORDS; index++ )
+    {
+      if( interrupt( odds ) )
+      {
+        produce( &test );
+      }
+      if( (uint16_t)sequence != block->samples[index] )
+      {
+        whole = 0;
+      }
+    }
+    if( sequence != block->sequence )
+    {
+      whole = 0;
+    }
+
+    if( interrupt( odds ) )
+    {
+      produce( &test );
+    }
+    sample_ring_release( &test.ring );
+
+    check( &test, sequence, whole );
+  }
+
+  return report( "interrupt", &test );
+}
+
+/*******************************************************************************
+ * @fn     void* producer_thread( void* argument )
+ * @brief  fill blocks as fast as possible
+ * ****************************************************************************/
+static void* producer_thread( void* argument )
+{
+  test_t* test = argument;
+
+  while( test->produced < test->total )
+  {
+    produce( test );
+    pause( &test->seed );
+  }
+
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     int thread_test( long total )
+ * @brief  producer and consumer on two threads
+ * ****************************************************************************/
+static int thread_test( long total )
+{
+  static test_t test;
+  pthread_t producer;
+  unsigned int seed;
+
+  setup( &test, total );
+  test.seed = rand();
+  seed = rand();
+
+  if( pthread_create( &producer, 0, producer_thread, &test ) )
+  {
+    printf( "no thread\n" );
+    return 1;
+  }
+
+  while( test.produced < test.total )
+  {
+    consume( &test );
+    pause( &seed );
+  }
+
+  pthread_join( producer, 0 );
+
+  return report( "threads", &test );
+}
+
+int main( int argc, char** argv )
+{
+  long blocks = 100000;
+  int seed = 1;
+  int failed = 0;
+
+  if( argc > 1 )
+  {
+    blocks = atol( argv[1] );
+  }
+  if( argc > 2 )
+  {
+    seed = atoi( argv[2] );
+  }
+  if( blocks < 1 )
+  {
+    printf( "at least one block\n" );
+    return 1;
+  }
+  srand( seed );
+
+  failed |= interrupt_test( blocks );
+  failed |= thread_test( blocks );
+
+  return failed;
+}
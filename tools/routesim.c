@@ -0,0 +1,401 @@
+/** @file routesim.c
+*
+* @brief  Multi-node simulation of the routing layer (lib/route.c).
+*
+*         An access point, a few relays and end devices are placed on a
+*         strip up to 300m long. Relays are at 100m (two of them, in range of
+*         each other) and at 200m. Link RSSI falls off with distance, with a
+*         fixed shadowing term per link and fading per packet. A packet is
+*         received if its RSSI is over the sensitivity. Slots are assumed
+*         collision free (see tools/schedcheck).
+*
+*         Every beacon period the access point sends a beacon and each end
+*         device sends one packet. Relays run route_receive and forward what
+*         it asks for. The same network is also run with relays re-sending
+*         every packet they hear, the way demo/relay.c used to, capped at
+*         BLIND_MAX_COPIES copies per packet.
+*
+*         usage: routesim [end devices] [beacon periods] [seed]
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "route.h"
+
+#define MAX_NODES (64)
+#define MAX_QUEUE (1024)
+
+#define SENSITIVITY (-97.0)   // dBm
+#define SHADOWING (4.0)       // dB, per link
+#define FADING (3.0)          // dB, per packet
+
+// Stop a packet bouncing between blind relays after this many copies
+#define BLIND_MAX_COPIES (32)
+
+#define ACCESS_POINT (0)
+#define RELAY (1)
+#define END_DEVICE (2)
+
+typedef struct
+{
+  int kind;
+  double x;
+  double y;
+  route_t route;
+} node_t;
+
+typedef struct
+{
+  int from;
+  uint8_t source;
+  uint8_t repeater;
+  route_header_t header;
+} transmission_t;
+
+typedef struct
+{
+  int originated;
+  int delivered;
+  int duplicates;
+  int transmissions;
+} result_t;
+
+static node_t nodes[MAX_NODES];
+static double shadowing[MAX_NODES][MAX_NODES];
+static int total_nodes;
+
+static transmission_t queue[MAX_QUEUE];
+static int queue_head;
+static int queue_tail;
+
+/*******************************************************************************
+ * @fn     double gaussian( void )
+ * @brief  normally distributed random number, mean 0, deviation 1
+ * ****************************************************************************/
+static double gaussian( void )
+{
+  double u1 = ( rand() + 1.0 ) / ( RAND_MAX + 2.0 );
+  double u2 = ( rand() + 1.0 ) / ( RAND_MAX + 2.0 );
+
+  return sqrt( -2.0 * log( u1 ) ) * cos( 2.0 * M_PI * u2 );
+}
+
+/*******************************************************************************
+ * @fn     double rssi( int from, int to )
+ * @brief  RSSI of one packet, in dBm
+ * ****************************************************************************/
+static double rssi( int from, int to )
+{
+  double distance = hypot( nodes[from].x - nodes[to].x,
+                           nodes[from].y - nodes[to].y );
+
+  if( distance < 1.0 )
+  {
+    distance = 1.0;
+  }
+
+  return -20.0 - 35.0 * log10( distance ) + shadowing[from][to] +
+         FADING * gaussian();
+}
+
+/*******************************************************************************
+ * @fn     uint8_t rssi_byte( double dbm )
+ * @brief  the RSSI status byte the radio would append (inverse of
+ *         route_quality)
+ * ****************************************************************************/
+static uint8_t rssi_byte( double dbm )
+{
+  int value = (int)floor( ( dbm + 74.0 ) * 2.0 );
+
+  if( value < -128 )
+  {
+    value = -128;
+  }
+  if( value > 127 )
+  {
+    value = 127;
+  }
+
+  return (uint8_t)(int8_t)value;
+}
+
+/*******************************************************************************
+ * @fn     void place_nodes( int end_devices )
+ * @brief  access point, relays and end devices, with shadowing per link
+ * ****************************************************************************/
+static void place_nodes( int end_devices )
+{
+  int index;
+  int other;
+
+  total_nodes = 0;
+
+  nodes[total_nodes].kind = ACCESS_POINT;
+  nodes[total_nodes].x = 0;
+  nodes[total_nodes].y = 0;
+  total_nodes++;
+
+  nodes[total_nodes].kind = RELAY;
+  nodes[total_nodes].x = 100;
+  nodes[total_nodes].y = 20;
+  total_nodes++;
+
+  nodes[total_nodes].kind = RELAY;
+  nodes[total_nodes].x = 100;
+  nodes[total_nodes].y = -20;
+  total_nodes++;
+
+  nodes[total_nodes].kind = RELAY;
+  nodes[total_nodes].x = 200;
+  nodes[total_nodes].y = 0;
+  total_nodes++;
+
+  for( index = 0; index < end_devices; index++ )
+  {
+    nodes[total_nodes].kind = END_DEVICE;
+    nodes[total_nodes].x = 30 + ( rand() % 270 );
+    nodes[total_nodes].y = ( rand() % 60 ) - 30;
+    total_nodes++;
+  }
+
+  // Links are symmetric
+  for( index = 0; index < total_nodes; index++ )
+  {
+    for( other = index + 1; other < total_nodes; other++ )
+    {
+      shadowing[index][other] = SHADOWING * gaussian();
+      shadowing[other][index] = shadowing[index][other];
+    }
+  }
+
+  // Addresses start at 1, 0 is a free slot in the beacon slot map
+  for( index = 0; index < total_nodes; index++ )
+  {
+    route_init( &nodes[index].route, index + 1,
+                ( ACCESS_POINT == nodes[index].kind ) );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void send( const transmission_t* transmission )
+ * @brief  add a transmission to the queue
+ * ****************************************************************************/
+static void send( const transmission_t* transmission )
+{
+  if( queue_tail < MAX_QUEUE )
+  {
+    queue[queue_tail++] = *transmission;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void beacon( void )
+ * @brief  the access point's beacon, heard at depth 0
+ * ****************************************************************************/
+static void beacon( void )
+{
+  int node;
+  double dbm;
+
+  for( node = 1; node < total_nodes; node++ )
+  {
+    route_age( &nodes[node].route );
+
+    dbm = rssi( ACCESS_POINT, node );
+    if( dbm >= SENSITIVITY )
+    {
+      route_heard( &nodes[node].route, nodes[ACCESS_POINT].route.address, 0,
+                   route_quality( rssi_byte( dbm ) ) );
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void deliver( int blind, result_t* result, uint8_t* copies )
+ * @brief  run the queued transmissions, and whatever they cause
+ * ****************************************************************************/
+static void deliver( int blind, result_t* result, uint8_t* copies )
+{
+  transmission_t transmission;
+  transmission_t forward;
+  node_t* receiver;
+  double dbm;
+  int node;
+
+  while( queue_head < queue_tail )
+  {
+    transmission = queue[queue_head++];
+    result->transmissions++;
+
+    for( node = 0; node < total_nodes; node++ )
+    {
+      if( node == transmission.from )
+      {
+        continue;
+      }
+
+      dbm = rssi( transmission.from, node );
+      if( dbm < SENSITIVITY )
+      {
+        continue;
+      }
+
+      receiver = &nodes[node];
+      forward = transmission;
+
+      if( transmission.repeater && (ACCESS_POINT != receiver->kind) )
+      {
+        route_heard( &receiver->route, transmission.header.sender,
+                     ROUTE_DEPTH( &transmission.header ),
+                     route_quality( rssi_byte( dbm ) ) );
+      }
+
+      if( ACCESS_POINT == receiver->kind )
+      {
+        if( ROUTE_DELIVER == route_receive( &receiver->route,
+                                            transmission.source,
+                                            &forward.header ) )
+        {
+          result->delivered++;
+        }
+        else
+        {
+          result->duplicates++;
+        }
+      }
+      else if( RELAY == receiver->kind )
+      {
+        if( blind )
+        {
+          // Re-send everything, like the old relay
+          if( copies[transmission.source] < BLIND_MAX_COPIES )
+          {
+            copies[transmission.source]++;
+            forward.from = node;
+            forward.repeater = 1;
+            send( &forward );
+          }
+        }
+        else if( ROUTE_FORWARD == route_receive( &receiver->route,
+                                                 transmission.source,
+                                                 &forward.header ) )
+        {
+          forward.from = node;
+          forward.repeater = 1;
+          send( &forward );
+        }
+      }
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void run( int end_devices, int periods, int seed, int blind,
+ *                   result_t* result )
+ * @brief  simulate periods beacon periods
+ * ****************************************************************************/
+static void run( int end_devices, int periods, int seed, int blind,
+                 result_t* result )
+{
+  static uint8_t copies[256];
+  transmission_t transmission;
+  int period;
+  int node;
+
+  srand( seed );
+  place_nodes( end_devices );
+  memset( result, 0, sizeof(result_t) );
+
+  for( period = 0; period < periods; period++ )
+  {
+    beacon();
+
+    for( node = 0; node < total_nodes; node++ )
+    {
+      if( END_DEVICE != nodes[node].kind )
+      {
+        continue;
+      }
+
+      transmission.from = node;
+      transmission.source = nodes[node].route.address;
+      transmission.repeater = 0;
+      route_originate( &nodes[node].route, &transmission.header );
+      result->originated++;
+
+      // Each packet is followed through the network before the next one,
+      // the schedule keeps them apart
+      queue_head = 0;
+      queue_tail = 0;
+      memset( copies, 0, sizeof(copies) );
+      send( &transmission );
+      deliver( blind, result, copies );
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     void print_result( const char* name, const result_t* result )
+ * @brief  delivery ratio, duplicate rate and airtime
+ * ****************************************************************************/
+static void print_result( const char* name, const result_t* result )
+{
+  int received = result->delivered + result->duplicates;
+
+  printf( "%-8s delivered %5.1f%%  duplicates %5.1f%% of received  "
+          "transmissions per packet %5.2f\n", name,
+          100.0 * result->delivered / result->originated,
+          received ? 100.0 * result->duplicates / received : 0.0,
+          (double)result->transmissions / result->originated );
+}
+
+int main( int argc, char** argv )
+{
+  result_t routed;
+  result_t blind;
+  int end_devices = 12;
+  int periods = 200;
+  int seed = 1;
+  int node;
+  int depth_count[ROUTE_NO_DEPTH + 1] = { 0 };
+
+  if( argc > 1 )
+  {
+    end_devices = atoi( argv[1] );
+  }
+  if( argc > 2 )
+  {
+    periods = atoi( argv[2] );
+  }
+  if( argc > 3 )
+  {
+    seed = atoi( argv[3] );
+  }
+  if( end_devices + 4 > MAX_NODES )
+  {
+    printf( "at most %d end devices\n", MAX_NODES - 4 );
+    return 1;
+  }
+
+  run( end_devices, periods, seed, 0, &routed );
+
+  for( node = 1; node < total_nodes; node++ )
+  {
+    depth_count[nodes[node].route.depth]++;
+  }
+  printf( "%d end devices, 3 relays, %d beacon periods\n", end_devices,
+          periods );
+  printf( "nodes at depth 1: %d, 2: %d, 3: %d, 4: %d, no route: %d\n",
+          depth_count[1], depth_count[2], depth_count[3], depth_count[4],
+          depth_count[ROUTE_NO_DEPTH] );
+
+  print_result( "routed", &routed );
+
+  run( end_devices, periods, seed, 1, &blind );
+  print_result( "blind", &blind );
+
+  return 0;
+}
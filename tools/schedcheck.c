@@ -0,0 +1,478 @@
+/** @file schedcheck.c
+*
+* @brief  Check that the demo superframe (demo/settings.h) is collision free.
+*
+*         The slot layout is rebuilt from the same macros as the demo and
+*         checked for overlaps and for fitting in the major cycle. Then a
+*         sync period of major cycles is simulated: every end device sends
+*         in its sample slot (and in its energy report slot after the
+*         beacon), a few of them are behind a relay that forwards their
+*         packets in its forward slots, several at a time in aggregates
+*         (lib/aggregate.h). Each node's clock is off by a random
+*         drift and sync error, and starts transmitting a guard time into
+*         its slot the same way lib/tdma.c does. Any two transmissions that
+*         overlap are counted as collisions. The access point's channel
+*         survey visit (see SURVEY_CHANNELS) is laid out as a slot of its
+*         own, it has to fit between the beacon and the first sample slot.
+*
+*         usage: schedcheck [devices] [relayed] [major cycles]
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+// Must match radio.h
+#define RADIO_BAUD_RATE (249939)
+#define RADIO_PREAMBLE_BYTES (4)
+#define RADIO_SYNC_BYTES (4)
+#define RADIO_CRC_BYTES (2)
+#define RADIO_RX_TX_BITS (6)
+
+// Must match tdma.h
+#define TDMA_DRIFT_PPM (80)
+#define TDMA_RESIDUAL_PPM (2)
+#define TDMA_MIN_GUARD (6)
+#define TDMA_MAX_UNSYNCED (1310720)
+#define TDMA_TURNAROUND (25)
+
+// Must match settings.h, energy.h and route.h
+#define ADC_SAMPLES_LEN (50)
+#define GRID_INDEX_LEN (3)
+#define ROUTE_HEADER_LEN (4)
+#define ENERGY_REPORT_LEN (44)
+#define MAX_SLOTS (16)
+#define TIMER_LIMIT (65399)
+#define REST_TIME (300)
+#define MAJOR_CYCLE (5450)
+#define SYNC_PERIOD (4)
+#define NACK_ENTRIES (2)
+#define NACK_ENTRY_LEN (4)
+#define SYNC_PAYLOAD_LEN ( 6 + MAX_SLOTS + NACK_ENTRIES * NACK_ENTRY_LEN + 1 )
+#define FLOOD_MAX_RELAYS (3)
+#define JOIN_WINDOW (4)
+#define FORWARD_SLOTS (4)
+#define AGGREGATE_HEADER_LEN (5)
+#define SURVEY_SAMPLES (32)
+#define SURVEY_GUARD (40)
+
+// Must match radio.h, at 12MHz MCLK. Reading the RSSI register takes
+// another ~60 cycles
+#define RADIO_SURVEY_SETTLE_CYCLES (9600)
+#define RADIO_SURVEY_SAMPLE_CYCLES (360)
+#define RSSI_READ_CYCLES (60)
+#define MCLK (12000000)
+
+#define HEADER_LEN (4)
+
+#define SAMPLE_PACKET_LEN \
+  ( HEADER_LEN + ROUTE_HEADER_LEN + GRID_INDEX_LEN + ADC_SAMPLES_LEN )
+#define POWER_PACKET_LEN ( HEADER_LEN + ROUTE_HEADER_LEN + ENERGY_REPORT_LEN )
+#define JOIN_PACKET_LEN ( HEADER_LEN + ROUTE_HEADER_LEN )
+
+// Bytes a packet takes in an aggregate, and the longest aggregate: four
+// sample packets
+#define AGGREGATE_SIZE( size ) \
+  ( (size) + AGGREGATE_HEADER_LEN - HEADER_LEN - ROUTE_HEADER_LEN )
+#define AGGREGATE_MAX \
+  ( HEADER_LEN + ROUTE_HEADER_LEN + 4 * AGGREGATE_SIZE( SAMPLE_PACKET_LEN ) )
+
+#define MAX_TRANSMISSIONS (256)
+
+typedef struct
+{
+  const char* name;
+  int index;
+  uint32_t offset;
+  uint32_t length;
+} slot_t;
+
+typedef struct
+{
+  const char* name;
+  int node;
+  double start;
+  double end;
+} transmission_t;
+
+static uint32_t sample_slot;
+static uint32_t power_slot;
+static uint32_t join_slot;
+static uint32_t forward_slot;
+static uint32_t join_offset;
+static uint32_t flood_window;
+static uint32_t slots_start;
+static uint32_t survey_time;
+static int escaped = 0;
+
+/*******************************************************************************
+ * @fn     uint32_t byte_time( int bytes )
+ * @brief  RADIO_BYTE_TIME from radio.h
+ * ****************************************************************************/
+static uint32_t byte_time( int bytes )
+{
+  return ( (uint32_t)bytes * 8 * 32768 + RADIO_BAUD_RATE - 1 ) /
+                                                              RADIO_BAUD_RATE;
+}
+
+/*******************************************************************************
+ * @fn     uint32_t airtime( int size )
+ * @brief  TDMA_AIRTIME from tdma.h
+ * ****************************************************************************/
+static uint32_t airtime( int size )
+{
+  return byte_time( size + RADIO_PREAMBLE_BYTES + RADIO_SYNC_BYTES +
+                    RADIO_CRC_BYTES );
+}
+
+/*******************************************************************************
+ * @fn     uint32_t flood_delay( int size, int relays )
+ * @brief  RADIO_FLOOD_DELAY from radio.h
+ * ****************************************************************************/
+static uint32_t flood_delay( int size, int relays )
+{
+  return ( (uint32_t)relays * ( ( size + RADIO_PREAMBLE_BYTES +
+           RADIO_SYNC_BYTES + RADIO_CRC_BYTES ) * 8 + RADIO_RX_TX_BITS ) *
+           32768 + RADIO_BAUD_RATE / 2 ) / RADIO_BAUD_RATE;
+}
+
+/*******************************************************************************
+ * @fn     uint32_t guard( uint32_t elapsed, uint32_t ppm )
+ * @brief  TDMA_GUARD from tdma.h
+ * ****************************************************************************/
+static uint32_t guard( uint32_t elapsed, uint32_t ppm )
+{
+  return TDMA_MIN_GUARD + ((elapsed >> 10) * ppm) / 977 + 1;
+}
+
+/*******************************************************************************
+ * @fn     uint32_t slot_length( int size )
+ * @brief  TDMA_SLOT_LENGTH from tdma.h
+ * ****************************************************************************/
+static uint32_t slot_length( int size )
+{
+  return airtime( size ) + TDMA_TURNAROUND +
+                        2 * guard( TDMA_MAX_UNSYNCED, TDMA_RESIDUAL_PPM );
+}
+
+/*******************************************************************************
+ * @fn     double uniform( double low, double high )
+ * @brief  random number in [low, high)
+ * ****************************************************************************/
+static double uniform( double low, double high )
+{
+  return low + ( high - low ) * ( rand() / ( RAND_MAX + 1.0 ) );
+}
+
+/*******************************************************************************
+ * @fn     int compare_slots( const void* a, const void* b )
+ * @brief  qsort comparison, by offset
+ * ****************************************************************************/
+static int compare_slots( const void* a, const void* b )
+{
+  return (int)((const slot_t*)a)->offset - (int)((const slot_t*)b)->offset;
+}
+
+/*******************************************************************************
+ * @fn     int check_layout( void )
+ * @brief  print the first major cycle's slots, returns the number of problems
+ * ****************************************************************************/
+static int check_layout( void )
+{
+  static slot_t slots[MAX_TRANSMISSIONS];
+  int count = 0;
+  int problems = 0;
+  int index;
+
+  slots[count].name = "beacon";
+  slots[count].index = 0;
+  slots[count].offset = 0;
+  slots[count].length = flood_window;
+  count++;
+
+  slots[count].name = "survey";
+  slots[count].index = 0;
+  slots[count].offset = flood_window + SURVEY_GUARD;
+  slots[count].length = survey_time;
+  count++;
+
+  for( index = 0; index < MAX_SLOTS; index++ )
+  {
+    slots[count].name = "sample";
+    slots[count].index = index;
+    slots[count].offset = slots_start + sample_slot * index;
+    slots[count].length = sample_slot;
+    count++;
+
+    slots[count].name = "energy report";
+    slots[count].index = index;
+    slots[count].offset = slots_start + sample_slot * MAX_SLOTS +
+                          power_slot * index;
+    slots[count].length = power_slot;
+    count++;
+  }
+
+  for( index = 0; index < JOIN_WINDOW; index++ )
+  {
+    slots[count].name = "join";
+    slots[count].index = index;
+    slots[count].offset = join_offset + join_slot * index;
+    slots[count].length = join_slot;
+    count++;
+  }
+
+  for( index = 0; index < FORWARD_SLOTS; index++ )
+  {
+    slots[count].name = "forward";
+    slots[count].index = index;
+    slots[count].offset = join_offset + join_slot * JOIN_WINDOW +
+                          forward_slot * index;
+    slots[count].length = forward_slot;
+    count++;
+  }
+
+  qsort( slots, count, sizeof(slot_t), compare_slots );
+
+  for( index = 0; index < count; index++ )
+  {
+    printf( "%5u-%5u %s %d\n", slots[index].offset,
+            slots[index].offset + slots[index].length, slots[index].name,
+            slots[index].index );
+
+    if( (index > 0) && (slots[index].offset <
+                        slots[index - 1].offset + slots[index - 1].length) )
+    {
+      printf( "  overlaps the slot before\n" );
+      problems++;
+    }
+  }
+
+  if( slots[count - 1].offset + slots[count - 1].length > MAJOR_CYCLE )
+  {
+    printf( "slots run past the major cycle (%d ticks)\n", MAJOR_CYCLE );
+    problems++;
+  }
+
+  if( (TIMER_LIMIT + 1) % MAJOR_CYCLE )
+  {
+    printf( "the timer period isn't a whole number of major cycles\n" );
+    problems++;
+  }
+
+  return problems;
+}
+
+/*******************************************************************************
+ * @fn     int transmit( transmission_t* out, const char* name, int node,
+ *                       uint32_t offset, uint32_t length, int size,
+ *                       uint32_t elapsed, int compensated )
+ * @brief  when a node's transmission in a slot is really on the air.
+ *         Returns 0 if the node would skip the slot because the guard time
+ *         doesn't fit (see tdma_isr)
+ * ****************************************************************************/
+static int transmit( transmission_t* out, const char* name, int node,
+                     uint32_t offset, uint32_t length, int size,
+                     uint32_t elapsed, int compensated )
+{
+  uint32_t ppm = compensated ? TDMA_RESIDUAL_PPM : TDMA_DRIFT_PPM;
+  uint32_t node_guard = guard( elapsed, ppm );
+  double error;
+
+  if( airtime( size ) + TDMA_TURNAROUND + 2 * node_guard > length )
+  {
+    return 0;
+  }
+
+  // Drift since the last beacon plus timestamp error, just inside what the
+  // guard covers
+  error = uniform( -1.0, 1.0 ) * ( elapsed * ppm * 1e-6 ) +
+          uniform( -(TDMA_MIN_GUARD - 1), TDMA_MIN_GUARD - 1 );
+
+  out->name = name;
+  out->node = node;
+  out->start = offset + node_guard + error;
+  out->end = out->start + TDMA_TURNAROUND + airtime( size );
+
+  if( (out->start < offset) || (out->end > offset + length) )
+  {
+    printf( "%s from node %d leaves its slot\n", name, node );
+    escaped++;
+  }
+
+  return 1;
+}
+
+int main( int argc, char** argv )
+{
+  static transmission_t on_air[MAX_TRANSMISSIONS];
+  int devices = MAX_SLOTS;
+  static int queued[MAX_TRANSMISSIONS];
+  int relayed = FORWARD_SLOTS;
+  int cycles = SYNC_PERIOD * (TIMER_LIMIT + 1) / MAJOR_CYCLE;
+  int problems;
+  int collisions = 0;
+  int skipped = 0;
+  int forwarded = 0;
+  int pending = 0;
+  int backlog = 0;
+  int batch;
+  int size;
+  int cycle;
+  int node;
+  int count;
+  int index;
+  int other;
+  uint32_t elapsed;
+  int compensated;
+
+  if( argc > 1 )
+  {
+    devices = atoi( argv[1] );
+  }
+  if( argc > 2 )
+  {
+    relayed = atoi( argv[2] );
+  }
+  if( argc > 3 )
+  {
+    cycles = atoi( argv[3] );
+  }
+  if( (devices > MAX_SLOTS) || (relayed > devices) )
+  {
+    printf( "at most %d devices, and no more relayed than devices\n",
+            MAX_SLOTS );
+    return 1;
+  }
+
+  sample_slot = slot_length( SAMPLE_PACKET_LEN );
+  power_slot = slot_length( POWER_PACKET_LEN );
+  join_slot = slot_length( JOIN_PACKET_LEN );
+  forward_slot = slot_length( AGGREGATE_MAX );
+  flood_window = flood_delay( HEADER_LEN + SYNC_PAYLOAD_LEN,
+                              FLOOD_MAX_RELAYS + 1 );
+  slots_start = (REST_TIME/2) + flood_window;
+  survey_time = ( ( RADIO_SURVEY_SETTLE_CYCLES + SURVEY_SAMPLES *
+                    ( RADIO_SURVEY_SAMPLE_CYCLES + RSSI_READ_CYCLES ) ) *
+                  (uint64_t)32768 + MCLK - 1 ) / MCLK;
+  join_offset = slots_start + sample_slot * MAX_SLOTS +
+                power_slot * MAX_SLOTS;
+
+  problems = check_layout();
+
+  srand( 1 );
+
+  for( cycle = 0; cycle < cycles; cycle++ )
+  {
+    // Time since the beacon at the start of this sync period, in ticks.
+    // Nodes that just joined have no skew estimate yet
+    elapsed = (uint32_t)( cycle % ( SYNC_PERIOD * (TIMER_LIMIT + 1) /
+                                    MAJOR_CYCLE ) ) * MAJOR_CYCLE;
+    count = 0;
+
+    for( node = 0; node < devices; node++ )
+    {
+      compensated = ( rand() % 8 ) != 0;
+
+      if( transmit( &on_air[count], "sample", node,
+                    slots_start + sample_slot * node, sample_slot,
+                    SAMPLE_PACKET_LEN,
+                    elapsed, compensated ) )
+      {
+        count++;
+        // The first nodes are behind the relay
+        if( node < relayed )
+        {
+          queued[pending++] = SAMPLE_PACKET_LEN;
+        }
+      }
+      else
+      {
+        skipped++;
+      }
+
+      if( 0 == elapsed )
+      {
+        if( transmit( &on_air[count], "energy report", node,
+                      slots_start + sample_slot * MAX_SLOTS +
+                      power_slot * node, power_slot,
+                      POWER_PACKET_LEN, elapsed, compensated ) )
+        {
+          count++;
+          if( node < relayed )
+          {
+            queued[pending++] = POWER_PACKET_LEN;
+          }
+        }
+        else
+        {
+          skipped++;
+        }
+      }
+    }
+
+    if( pending > backlog )
+    {
+      backlog = pending;
+    }
+
+    // The relay (node devices) empties its queue in its forward slots,
+    // the oldest packets that fit in one aggregate per slot. Whatever
+    // doesn't fit waits for the next cycle
+    for( index = 0; (index < FORWARD_SLOTS) && pending; index++ )
+    {
+      size = HEADER_LEN + ROUTE_HEADER_LEN;
+      for( batch = 0; batch < pending; batch++ )
+      {
+        if( size + AGGREGATE_SIZE( queued[batch] ) > AGGREGATE_MAX )
+        {
+          break;
+        }
+        size += AGGREGATE_SIZE( queued[batch] );
+      }
+      if( batch < 2 )
+      {
+        batch = 1;
+        size = queued[0];
+      }
+
+      if( transmit( &on_air[count], "forward", devices,
+                    join_offset + join_slot * JOIN_WINDOW +
+                    forward_slot * index, forward_slot,
+                    size, elapsed, 1 ) )
+      {
+        count++;
+        forwarded += batch;
+        pending -= batch;
+        for( other = 0; other < pending; other++ )
+        {
+          queued[other] = queued[other + batch];
+        }
+      }
+    }
+
+    for( index = 0; index < count; index++ )
+    {
+      for( other = index + 1; other < count; other++ )
+      {
+        if( (on_air[index].start < on_air[other].end) &&
+            (on_air[other].start < on_air[index].end) )
+        {
+          printf( "cycle %d: %s from node %d collides with %s from node %d\n",
+                  cycle, on_air[index].name, on_air[index].node,
+                  on_air[other].name, on_air[other].node );
+          collisions++;
+        }
+      }
+    }
+  }
+
+  printf( "\n%d devices, %d behind the relay, %d major cycles\n", devices,
+          relayed, cycles );
+  printf( "collisions %d, out of slot %d, slots skipped %d\n", collisions,
+          escaped, skipped );
+  printf( "forwarded %d, largest relay backlog %d, left at the end %d\n",
+          forwarded, backlog, pending );
+
+  return ( problems || collisions || escaped ) ? 1 : 0;
+}
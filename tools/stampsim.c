@@ -0,0 +1,171 @@
+/** @file stampsim.c
+*
+* @brief  Compare packet timestamp error of the GDO0 capture against the
+*         software timestamp taken in the end of packet interrupt.
+*
+*         A scripted series of packets with random lengths and sync word
+*         times (any phase of the 32kHz tick) is timestamped both ways, the
+*         same way as stamp_packet in lib/radio.c:
+*         - capture: Timer A0 latches the counter at the sync word edge
+*         - software: counter read once the end of packet interrupt runs,
+*           minus the packet duration. The interrupt is held off by
+*           whatever was running, picked from the latency script below
+*
+*         usage: stampsim [packets]
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#define ACLK_HZ (32768.0)
+
+// Must match radio.h
+#define RADIO_BAUD_RATE (249939)
+#define RADIO_CRC_BYTES (2)
+
+typedef struct
+{
+  const char* name;
+  double latency;   // Interrupt held off for up to this long (us)
+  int weight;       // How often it happens
+} latency_t;
+
+// What the radio interrupt can find running on an end device
+static const latency_t script[] = {
+  { "wake up from LPM3", 8.0, 60 },
+  { "ADC12 interrupt", 25.0, 20 },
+  { "event loop dint() section", 10.0, 10 },
+  { "soft timer service", 80.0, 5 },
+  { "TDMA slot, radio_tx from the timer interrupt", 350.0, 5 },
+};
+
+#define SCRIPT_LENGTH ( sizeof(script) / sizeof(script[0]) )
+
+typedef struct
+{
+  double sum;
+  double sum_squares;
+  double min;
+  double max;
+  int count;
+} error_stats_t;
+
+/*******************************************************************************
+ * @fn     uint32_t byte_time( int bytes )
+ * @brief  RADIO_BYTE_TIME from radio.h
+ * ****************************************************************************/
+static uint32_t byte_time( int bytes )
+{
+  return ( (uint32_t)bytes * 8 * 32768 + RADIO_BAUD_RATE - 1 ) /
+           RADIO_BAUD_RATE;
+}
+
+/*******************************************************************************
+ * @fn     double script_latency( void )
+ * @brief  pick an interrupt latency (us) from the script
+ * ****************************************************************************/
+static double script_latency( void )
+{
+  int total = 0;
+  int pick;
+  unsigned int index;
+
+  for( index = 0; index < SCRIPT_LENGTH; index++ )
+  {
+    total += script[index].weight;
+  }
+
+  pick = rand() % total;
+  for( index = 0; index < SCRIPT_LENGTH; index++ )
+  {
+    pick -= script[index].weight;
+    if( pick < 0 )
+    {
+      break;
+    }
+  }
+
+  // Anywhere within the blocking section
+  return script[index].latency * rand() / RAND_MAX;
+}
+
+/*******************************************************************************
+ * @fn     void add_error( error_stats_t* stats, double error )
+ * @brief  accumulate one timestamp error (us)
+ * ****************************************************************************/
+static void add_error( error_stats_t* stats, double error )
+{
+  if( 0 == stats->count || error < stats->min )
+  {
+    stats->min = error;
+  }
+  if( 0 == stats->count || error > stats->max )
+  {
+    stats->max = error;
+  }
+  stats->sum += error;
+  stats->sum_squares += error * error;
+  stats->count++;
+}
+
+/*******************************************************************************
+ * @fn     void print_stats( const char* name, const error_stats_t* stats )
+ * @brief  print mean, standard deviation and peak to peak jitter
+ * ****************************************************************************/
+static void print_stats( const char* name, const error_stats_t* stats )
+{
+  double mean = stats->sum / stats->count;
+  double deviation = sqrt( stats->sum_squares / stats->count - mean * mean );
+
+  printf( "%-9s %9.1f %9.1f %9.1f %9.1f %12.1f\n", name, mean, deviation,
+          stats->min, stats->max, stats->max - stats->min );
+}
+
+int main( int argc, char** argv )
+{
+  error_stats_t captured = { 0 };
+  error_stats_t software = { 0 };
+  double tick = 1e6 / ACLK_HZ;
+  double sync_word;
+  double end;
+  uint32_t stamp;
+  int packets = 100000;
+  int size;
+  int packet;
+
+  if( argc > 1 )
+  {
+    packets = atoi( argv[1] );
+  }
+
+  srand( 1 );
+
+  for( packet = 0; packet < packets; packet++ )
+  {
+    // True sync word time (us) and length byte + payload after it
+    sync_word = 1e6 + (double)rand() / RAND_MAX * 1e6;
+    size = 9 + rand() % 53;
+
+    // Capture latches the counter at the edge
+    stamp = (uint32_t)( sync_word / tick );
+    add_error( &captured, stamp * tick - sync_word );
+
+    // Counter read in the interrupt, minus the packet duration
+    end = sync_word + (size + RADIO_CRC_BYTES) * 8 * 1e6 / RADIO_BAUD_RATE;
+    stamp = (uint32_t)( (end + script_latency()) / tick ) -
+            byte_time( size + RADIO_CRC_BYTES );
+    add_error( &software, stamp * tick - sync_word );
+  }
+
+  printf( "timestamp error vs true sync word time over %d packets (us, "
+          "1 tick = %.1fus)\n", packets, tick );
+  printf( "%-9s %9s %9s %9s %9s %12s\n", "source", "mean", "std dev", "min",
+          "max", "peak-peak" );
+  print_stats( "capture", &captured );
+  print_stats( "software", &software );
+
+  return 0;
+}
@@ -0,0 +1,378 @@
+/** @file surveysim.c
+*
+* @brief  Channel picking by the access point's survey (lib/survey.c) with
+*         interference.
+*
+*         Each channel has a noise floor and may have an interferer that is
+*         on the air in bursts for some share of the time. The survey visits
+*         the channels one major cycle apart, SURVEY_SAMPLES RSSI samples
+*         per visit ~30us apart, until every channel had SURVEY_VISITS
+*         visits, then picks one the way update_survey in
+*         demo/access_point.c does.
+*
+*         Prints one round of a few fixed cases, then runs random cases and
+*         prints how often the pick was the quietest channel (within
+*         SURVEY_BUSY_MARGIN) and how often the network moved to a channel
+*         that was really no better or busier: with bursts longer than a
+*         visit, the visits to a channel can all miss them. Exits with an
+*         error if it ever moved to a channel that didn't measure quieter
+*         than the one it left.
+*
+*         usage: surveysim [rounds] [seed]
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "survey.h"
+
+// Must match demo/settings.h and radio.h
+#define SURVEY_CHANNELS (8)
+#define SURVEY_SAMPLES (32)
+#define SURVEY_VISITS (32)
+#define MAJOR_CYCLE_S ( 5450 / 32768.0 )
+#define SAMPLE_S (30e-6)
+#define SETTLE_S (800e-6)
+
+// Received noise jitters by a couple of dB, see the RSSI in the CC1101
+// datasheet
+#define NOISE_SIGMA (2.0)
+
+typedef struct
+{
+  double floor;       // dBm
+  double duty;        // Share of the time the interferer is on
+  double level;       // dBm when on
+  double burst;       // Mean on time, s
+  int on;
+  double until;       // Time the interferer switches next
+} channel_t;
+
+/*******************************************************************************
+ * @fn     double uniform( double low, double high )
+ * @brief  random number in [low, high)
+ * ****************************************************************************/
+static double uniform( double low, double high )
+{
+  return low + ( high - low ) * ( rand() / ( RAND_MAX + 1.0 ) );
+}
+
+/*******************************************************************************
+ * @fn     double gaussian( void )
+ * @brief  standard normal random number
+ * ****************************************************************************/
+static double gaussian( void )
+{
+  double u = uniform( 1e-12, 1.0 );
+  double v = uniform( 0.0, 1.0 );
+
+  return sqrt( -2.0 * log( u ) ) * cos( 2.0 * M_PI * v );
+}
+
+/*******************************************************************************
+ * @fn     double hold( const channel_t* channel )
+ * @brief  random time the interferer stays on or off, exponential with the
+ *         channel's burst length and duty cycle
+ * ****************************************************************************/
+static double hold( const channel_t* channel )
+{
+  double mean;
+
+  mean = channel->on ? channel->burst :
+                       channel->burst * ( 1.0 - channel->duty ) /
+                                        channel->duty;
+
+  return -mean * log( uniform( 1e-12, 1.0 ) );
+}
+
+/*******************************************************************************
+ * @fn     void restart( channel_t* channel, double now )
+ * @brief  state of the interferer at now, when it was last looked at much
+ *         longer ago than its bursts. On and off times are memoryless, so it
+ *         is on with the duty cycle's probability
+ * ****************************************************************************/
+static void restart( channel_t* channel, double now )
+{
+  channel->on = ( uniform( 0.0, 1.0 ) < channel->duty );
+  if( channel->duty > 0.0 )
+  {
+    channel->until = now + hold( channel );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void advance( channel_t* channel, double now )
+ * @brief  run the interferer's on/off bursts up to now
+ * ****************************************************************************/
+static void advance( channel_t* channel, double now )
+{
+  if( channel->duty <= 0.0 )
+  {
+    channel->on = 0;
+    return;
+  }
+
+  while( channel->until <= now )
+  {
+    channel->on = !channel->on;
+    channel->until += hold( channel );
+  }
+}
+
+/*******************************************************************************
+ * @fn     uint8_t level_at( channel_t* channel, double now )
+ * @brief  RSSI sample (dBm + 128, see route_quality) of the channel at now
+ * ****************************************************************************/
+static uint8_t level_at( channel_t* channel, double now )
+{
+  double dbm;
+
+  advance( channel, now );
+  dbm = channel->on ? channel->level : channel->floor;
+  dbm += NOISE_SIGMA * gaussian();
+
+  // The RSSI is in 0.5dB steps, route_quality keeps whole dB
+  dbm = floor( dbm ) + 128;
+  if( dbm < 0 )
+  {
+    return 0;
+  }
+
+  return ( dbm > 255 ) ? 255 : (uint8_t)dbm;
+}
+
+/*******************************************************************************
+ * @fn     double survey_round( channel_t* channels, survey_channel_t* stats,
+ *                              double now )
+ * @brief  visit every channel SURVEY_VISITS times, one visit per major cycle.
+ *         Returns the time at the end
+ * ****************************************************************************/
+static double survey_round( channel_t* channels, survey_channel_t* stats,
+                            double now )
+{
+  int visit;
+  int index;
+  int sample;
+  double at;
+
+  survey_reset( stats, SURVEY_CHANNELS );
+
+  for( visit = 0; visit < SURVEY_VISITS; visit++ )
+  {
+    for( index = 0; index < SURVEY_CHANNELS; index++ )
+    {
+      // Visits are a major cycle apart, far longer than any burst
+      at = now + SETTLE_S;
+      restart( &channels[index], at );
+      for( sample = 0; sample < SURVEY_SAMPLES; sample++ )
+      {
+        survey_sample( &stats[index], level_at( &channels[index], at ) );
+        at += SAMPLE_S;
+      }
+
+      now += MAJOR_CYCLE_S;
+    }
+  }
+
+  return now;
+}
+
+/*******************************************************************************
+ * @fn     void quiet_case( channel_t* channels )
+ * @brief  every channel clear, floors around -100dBm
+ * ****************************************************************************/
+static void quiet_case( channel_t* channels )
+{
+  int index;
+
+  memset( channels, 0, SURVEY_CHANNELS * sizeof(channel_t) );
+  for( index = 0; index < SURVEY_CHANNELS; index++ )
+  {
+    channels[index].floor = -101.0 + ( index % 3 );
+  }
+}
+
+/*******************************************************************************
+ * @fn     void random_case( channel_t* channels )
+ * @brief  random floors, about half the channels with an interferer
+ * ****************************************************************************/
+static void random_case( channel_t* channels )
+{
+  int index;
+
+  memset( channels, 0, SURVEY_CHANNELS * sizeof(channel_t) );
+  for( index = 0; index < SURVEY_CHANNELS; index++ )
+  {
+    channels[index].floor = uniform( -104.0, -92.0 );
+    if( uniform( 0.0, 1.0 ) < 0.5 )
+    {
+      channels[index].duty = uniform( 0.01, 0.8 );
+      channels[index].level = uniform( -85.0, -40.0 );
+      channels[index].burst = uniform( 0.0005, 0.02 );
+    }
+  }
+}
+
+/*******************************************************************************
+ * @fn     double true_busy( const channel_t* channel )
+ * @brief  percentage of samples that should be over SURVEY_BUSY_LEVEL
+ * ****************************************************************************/
+static double true_busy( const channel_t* channel )
+{
+  double busy_dbm = SURVEY_BUSY_LEVEL - 128;
+  double off;
+  double on;
+
+  off = 0.5 * erfc( ( busy_dbm - channel->floor ) /
+                    ( NOISE_SIGMA * sqrt( 2.0 ) ) );
+  on = 0.5 * erfc( ( busy_dbm - channel->level ) /
+                   ( NOISE_SIGMA * sqrt( 2.0 ) ) );
+
+  return 100.0 * ( channel->duty * on + ( 1.0 - channel->duty ) * off );
+}
+
+/*******************************************************************************
+ * @fn     void print_round( const char* name, channel_t* channels,
+ *                           int current )
+ * @brief  one survey round of a fixed case, with its results
+ * ****************************************************************************/
+static void print_round( const char* name, channel_t* channels, int current )
+{
+  survey_channel_t stats[SURVEY_CHANNELS];
+  int pick;
+  int index;
+
+  survey_round( channels, stats, 0.0 );
+  pick = survey_pick( stats, SURVEY_CHANNELS, current );
+
+  printf( "%s, on channel %d\n", name, current );
+  printf( "%8s %8s %10s %10s %6s %6s\n", "channel", "duty", "true busy",
+          "busy", "floor", "peak" );
+  for( index = 0; index < SURVEY_CHANNELS; index++ )
+  {
+    printf( "%8d %7.0f%% %9.1f%% %9d%% %6d %6d%s\n", index,
+            100.0 * channels[index].duty, true_busy( &channels[index] ),
+            survey_busy( &stats[index] ),
+            (int)survey_floor( &stats[index] ) - 128,
+            (int)stats[index].peak - 128, ( index == pick ) ? " <-" : "" );
+  }
+  printf( "\n" );
+}
+
+int main( int argc, char** argv )
+{
+  channel_t channels[SURVEY_CHANNELS];
+  survey_channel_t stats[SURVEY_CHANNELS];
+  double busy[SURVEY_CHANNELS];
+  double best;
+  double now = 0.0;
+  long rounds = 2000;
+  long round;
+  long quietest = 0;
+  long moves = 0;
+  long needless = 0;
+  long busier = 0;
+  long wrong = 0;
+  int seed = 1;
+  int current = 0;
+  int pick;
+  int index;
+
+  if( argc > 1 )
+  {
+    rounds = atol( argv[1] );
+  }
+  if( argc > 2 )
+  {
+    seed = atoi( argv[2] );
+  }
+  if( rounds < 1 )
+  {
+    printf( "at least one round\n" );
+    return 1;
+  }
+  srand( seed );
+
+  printf( "%d channels, %d visits of %d samples each per round (%.0fs)\n\n",
+          SURVEY_CHANNELS, SURVEY_VISITS, SURVEY_SAMPLES,
+          SURVEY_CHANNELS * SURVEY_VISITS * MAJOR_CYCLE_S );
+
+  quiet_case( channels );
+  print_round( "all channels clear", channels, 0 );
+
+  quiet_case( channels );
+  channels[0].duty = 0.3;
+  channels[0].level = -60.0;
+  channels[0].burst = 0.005;
+  channels[3].duty = 0.05;
+  channels[3].level = -80.0;
+  channels[3].burst = 0.002;
+  print_round( "busy neighbor on channel 0", channels, 0 );
+
+  quiet_case( channels );
+  channels[2].floor = -90.0;
+  print_round( "raised floor on channel 2", channels, 2 );
+
+  // Random cases, the network stays wherever it moved to
+  for( round = 0; round < rounds; round++ )
+  {
+    random_case( channels );
+    now = survey_round( channels, stats, now );
+    pick = survey_pick( stats, SURVEY_CHANNELS, current );
+
+    best = 100.0;
+    for( index = 0; index < SURVEY_CHANNELS; index++ )
+    {
+      busy[index] = true_busy( &channels[index] );
+      if( busy[index] < best )
+      {
+        best = busy[index];
+      }
+    }
+
+    if( busy[pick] <= best + SURVEY_BUSY_MARGIN )
+    {
+      quietest++;
+    }
+
+    if( pick != current )
+    {
+      moves++;
+      if( (busy[pick] > busy[current] - 1.0) &&
+          (channels[pick].floor > channels[current].floor - 3.0) )
+      {
+        needless++;
+      }
+      if( busy[pick] > busy[current] + SURVEY_BUSY_MARGIN )
+      {
+        busier++;
+      }
+
+      // Whatever the channels are really like, what was measured must
+      // say the new one is quieter
+      if( (survey_busy( &stats[pick] ) > survey_busy( &stats[current] )) ||
+          ((survey_busy( &stats[pick] ) == survey_busy( &stats[current] )) &&
+           (survey_floor( &stats[pick] ) >= survey_floor( &stats[current] ))) )
+      {
+        wrong++;
+      }
+      current = pick;
+    }
+  }
+
+  printf( "%ld random rounds: quietest channel picked %.1f%%, moved %.1f%%\n",
+          rounds, 100.0 * quietest / rounds, 100.0 * moves / rounds );
+  printf( "moved to no better %.2f%%, to one more than %d%% busier %.2f%% "
+          "(its bursts missed the visits)\n", 100.0 * needless / rounds,
+          SURVEY_BUSY_MARGIN, 100.0 * busier / rounds );
+
+  if( wrong )
+  {
+    printf( "%ld moves to a channel that measured no quieter\n", wrong );
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,162 @@
+/** @file syncsim.c
+*
+* @brief  Host simulation of lib/clock_sync.c with drifting crystals.
+*
+*         The reference and node crystals are off by +40 and -40 ppm (worst
+*         case for +-40 ppm parts). The node timestamps each beacon with
+*         0..jitter ticks of latency, like the software timestamp in the
+*         radio interrupt. missed beacons in a row are dropped after every
+*         received one. Between beacons, the node's global time estimate is
+*         compared to the reference clock.
+*
+*         For each beacon interval the worst estimate error is printed with
+*         and without skew compensation. The last line is the longest
+*         interval where the error stays within budget ticks, the slot
+*         guard's (TDMA_MIN_GUARD) by default. Temperature changes of the
+*         skew are not modelled.
+*
+*         usage: syncsim [budget ticks] [jitter ticks] [missed beacons]
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "clock_sync.h"
+
+#define ACLK_HZ (32768.0)
+#define REFERENCE_PPM (40.0)
+#define NODE_PPM (-40.0)
+
+// Beacons simulated per interval, after the fit is full
+#define BEACONS (CLOCK_SYNC_POINTS * 8)
+
+// Error checks between two received beacons
+#define CHECKS (64)
+
+// Default budget, TDMA_MIN_GUARD in lib/tdma.h. That's what the slot guard
+// leaves for the timestamp and estimate error
+#define MIN_GUARD (6)
+
+static int jitter = 2;
+static int missed = 0;
+
+/*******************************************************************************
+ * @fn     uint32_t ticks( double seconds, double ppm, uint32_t start )
+ * @brief  counter value of a crystal off by ppm at true time seconds
+ * ****************************************************************************/
+static uint32_t ticks( double seconds, double ppm, uint32_t start )
+{
+  return start + (uint32_t)(seconds * ACLK_HZ * (1.0 + ppm / 1e6));
+}
+
+/*******************************************************************************
+ * @fn     uint32_t simulate( double interval, uint8_t compensate )
+ * @brief  worst error in ticks with beacons every interval seconds
+ * ****************************************************************************/
+static uint32_t simulate( double interval, uint8_t compensate )
+{
+  uint32_t node_start = (uint32_t)rand();
+  uint32_t worst = 0;
+  uint32_t local;
+  uint32_t global;
+  int32_t error;
+  double received;
+  double now;
+  int beacon;
+  int check;
+
+  setup_clock_sync();
+
+  for( beacon = 0; beacon < BEACONS; beacon += 1 + missed )
+  {
+    // Reference time of the beacon, timestamped late by the node
+    received = beacon * interval;
+    global = ticks( received, REFERENCE_PPM, 0 );
+    local = ticks( received, NODE_PPM, node_start ) + rand() % (jitter + 1);
+
+    if( !compensate )
+    {
+      // Offset only, like resetting the timer on every beacon
+      setup_clock_sync();
+    }
+    clock_sync_beacon( local, global );
+
+    if( compensate && !clock_sync_compensated() )
+    {
+      continue;
+    }
+
+    // Until the next beacon that gets through
+    for( check = 1; check <= CHECKS; check++ )
+    {
+      now = received + interval * (1 + missed) * check / CHECKS;
+      error = (int32_t)( local_to_global( ticks( now, NODE_PPM, node_start ) )
+                         - ticks( now, REFERENCE_PPM, 0 ) );
+      if( (uint32_t)abs( error ) > worst )
+      {
+        worst = abs( error );
+      }
+    }
+  }
+
+  return worst;
+}
+
+int main( int argc, char** argv )
+{
+  uint32_t budget = MIN_GUARD;
+  uint32_t error;
+  uint32_t uncompensated;
+  double interval;
+  double longest = 0;
+  int run;
+
+  if( argc > 1 )
+  {
+    budget = atoi( argv[1] );
+  }
+  if( argc > 2 )
+  {
+    jitter = atoi( argv[2] );
+  }
+  if( argc > 3 )
+  {
+    missed = atoi( argv[3] );
+  }
+
+  srand( 1 );
+
+  printf( "interval(s)  worst error compensated  uncompensated (ticks)\n" );
+
+  for( interval = 2.0; interval <= 256.0; interval *= 2 )
+  {
+    error = 0;
+    uncompensated = 0;
+    for( run = 0; run < 20; run++ )
+    {
+      uint32_t value = simulate( interval, 1 );
+      if( value > error )
+      {
+        error = value;
+      }
+      value = simulate( interval, 0 );
+      if( value > uncompensated )
+      {
+        uncompensated = value;
+      }
+    }
+
+    printf( "%11.0f  %24u  %13u\n", interval, error, uncompensated );
+
+    if( error <= budget )
+    {
+      longest = interval;
+    }
+  }
+
+  printf( "longest safe interval: %.0fs (budget %u ticks, jitter %d ticks, "
+          "%d missed)\n", longest, budget, jitter, missed );
+
+  return 0;
+}
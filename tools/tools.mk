@@ -0,0 +1,91 @@
+# Host (PC) tools, built with the native compiler
+HOSTCC = gcc
+
+HOST_CFLAGS = -O2 -Wall -I"lib"
+
+# Tools that run lib/timers.c, and the code that uses it, on a simulated
+# Timer A0 with stand-ins for the device headers (see tools/host). inline
+# means what it does to mspgcc 3 (see clear_timer)
+HOST_TIMER_CFLAGS = $(HOST_CFLAGS) -I"tools/host" -fgnu89-inline
+HOST_TIMER = tools/host/timer_a.c lib/timers.c
+HOST_TIMER_DEPS = $(HOST_TIMER) tools/host/timer_a.h tools/host/io.h \
+                  tools/host/signal.h lib/timers.h
+
+tools: $(addprefix $(BUILD_DIR)/, trace2json syncsim stampsim phasecheck \
+                                  schedcheck routesim floodcheck aggsim \
+                                  nacksim cellsim surveysim packbench \
+                                  ringstress energysim wheelcheck \
+                                  wrapcheck)
+
+$(BUILD_DIR)/trace2json: tools/trace2json.c lib/trace_events.h
+	@mkdir -p $(BUILD_DIR)
+	$(HOSTCC) $(HOST_CFLAGS) tools/trace2json.c -o $@
+
+$(BUILD_DIR)/syncsim: tools/syncsim.c lib/clock_sync.c lib/clock_sync.h
+	@mkdir -p $(BUILD_DIR)
+	$(HOSTCC) $(HOST_CFLAGS) tools/syncsim.c lib/clock_sync.c -o $@
+
+$(BUILD_DIR)/stampsim: tools/stampsim.c
+	@mkdir -p $(BUILD_DIR)
+	$(HOSTCC) $(HOST_CFLAGS) tools/stampsim.c -o $@ -lm
+
+$(BUILD_DIR)/phasecheck: tools/phasecheck.c
+	@mkdir -p $(BUILD_DIR)
+	$(HOSTCC) $(HOST_CFLAGS) tools/phasecheck.c -o $@ -lm
+
+$(BUILD_DIR)/schedcheck: tools/schedcheck.c
+	@mkdir -p $(BUILD_DIR)
+	$(HOSTCC) $(HOST_CFLAGS) tools/schedcheck.c -o $@
+
+$(BUILD_DIR)/routesim: tools/routesim.c lib/route.c lib/route.h
+	@mkdir -p $(BUILD_DIR)
+	$(HOSTCC) $(HOST_CFLAGS) tools/routesim.c lib/route.c -o $@ -lm
+
+$(BUILD_DIR)/floodcheck: tools/floodcheck.c
+	@mkdir -p $(BUILD_DIR)
+	$(HOSTCC) $(HOST_CFLAGS) tools/floodcheck.c -o $@ -lm
+
+$(BUILD_DIR)/aggsim: tools/aggsim.c lib/aggregate.c lib/aggregate.h \
+                     lib/codec.c lib/codec.h lib/pack12.c lib/pack12.h
+	@mkdir -p $(BUILD_DIR)
+	$(HOSTCC) $(HOST_CFLAGS) tools/aggsim.c lib/aggregate.c lib/codec.c \
+		lib/pack12.c -o $@ -lm
+
+$(BUILD_DIR)/nacksim: tools/nacksim.c lib/nack.c lib/nack.h
+	@mkdir -p $(BUILD_DIR)
+	$(HOSTCC) $(HOST_CFLAGS) tools/nacksim.c lib/nack.c -o $@
+
+$(BUILD_DIR)/cellsim: tools/cellsim.c
+	@mkdir -p $(BUILD_DIR)
+	$(HOSTCC) $(HOST_CFLAGS) tools/cellsim.c -o $@
+
+$(BUILD_DIR)/surveysim: tools/surveysim.c lib/survey.c lib/survey.h
+	@mkdir -p $(BUILD_DIR)
+	$(HOSTCC) $(HOST_CFLAGS) tools/surveysim.c lib/survey.c -o $@ -lm
+
+$(BUILD_DIR)/packbench: tools/packbench.c lib/pack12.c lib/pack12.h \
+                        lib/codec.c lib/codec.h
+	@mkdir -p $(BUILD_DIR)
+	$(HOSTCC) $(HOST_CFLAGS) tools/packbench.c lib/pack12.c lib/codec.c \
+		-o $@ -lm
+
+$(BUILD_DIR)/ringstress: tools/ringstress.c lib/sample_ring.c lib/sample_ring.h
+	@mkdir -p $(BUILD_DIR)
+	$(HOSTCC) $(HOST_CFLAGS) tools/ringstress.c lib/sample_ring.c -o $@ \
+		-lpthread
+
+$(BUILD_DIR)/energysim: tools/energysim.c lib/energy.c lib/energy.h \
+                        $(HOST_TIMER_DEPS)
+	@mkdir -p $(BUILD_DIR)
+	$(HOSTCC) $(HOST_TIMER_CFLAGS) tools/energysim.c lib/energy.c \
+		$(HOST_TIMER) -o $@
+
+$(BUILD_DIR)/wheelcheck: tools/wheelcheck.c lib/soft_timers.c \
+                         lib/soft_timers.h $(HOST_TIMER_DEPS)
+	@mkdir -p $(BUILD_DIR)
+	$(HOSTCC) $(HOST_TIMER_CFLAGS) tools/wheelcheck.c lib/soft_timers.c \
+		$(HOST_TIMER) -o $@
+
+$(BUILD_DIR)/wrapcheck: tools/wrapcheck.c $(HOST_TIMER_DEPS)
+	@mkdir -p $(BUILD_DIR)
+	$(HOSTCC) $(HOST_TIMER_CFLAGS) tools/wrapcheck.c $(HOST_TIMER) -o $@
@@ -0,0 +1,138 @@
+/** @file trace2json.c
+*
+* @brief  Convert trace dumps captured from the UART into Chrome trace-event
+*         JSON (load it in chrome://tracing or ui.perfetto.dev).
+*
+*         Reads the raw serial capture from stdin. Frames are delimited with
+*         0x7e and escaped with 0x7d like uart_write_escaped. Frames that
+*         aren't trace dumps (packets, profiles) are skipped, so the capture
+*         can be taken from a node that prints other things too.
+*
+*         Each node becomes a process, each event group a thread, so slot
+*         overlap and turnaround gaps show up side by side.
+*
+*         usage: trace2json < capture.bin > trace.json
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include "trace_events.h"
+
+#define ACLK_HZ (32768.0)
+#define MAX_FRAME (2048)
+
+static const char* event_names[] = {
+  "unknown", "radio tx", "radio rx", "timer", "adc block", "uart rx",
+  "handler", "sync" };
+
+static int first_event = 1;
+
+/*******************************************************************************
+ * @fn     void print_record( uint8_t node, const uint8_t* record )
+ * @brief  write one trace record as a JSON event
+ * ****************************************************************************/
+static void print_record( uint8_t node, const uint8_t* record )
+{
+  uint32_t time;
+  uint8_t event;
+  uint8_t arg;
+  uint8_t id;
+  const char* phase = "i";
+  const char* name = "user";
+
+  // Little endian, as stored by the MSP430
+  time = (uint32_t)record[0] | ((uint32_t)record[1] << 8) |
+         ((uint32_t)record[2] << 16) | ((uint32_t)record[3] << 24);
+  event = record[4];
+  arg = record[5];
+
+  id = event & TRACE_ID_MASK;
+  if( id < (sizeof(event_names) / sizeof(event_names[0])) )
+  {
+    name = event_names[id];
+  }
+
+  if( event & TRACE_BEGIN )
+  {
+    phase = "B";
+  }
+  else if( event & TRACE_END )
+  {
+    phase = "E";
+  }
+
+  printf( "%s\n  {\"name\":\"%s\",\"ph\":\"%s\",\"pid\":%u,\"tid\":%u,"
+          "\"ts\":%.1f,\"s\":\"t\",\"args\":{\"arg\":%u}}",
+          first_event ? "" : ",", name, phase, node, id,
+          (double)time * 1000000.0 / ACLK_HZ, arg );
+
+  first_event = 0;
+}
+
+/*******************************************************************************
+ * @fn     void process_frame( const uint8_t* frame, int length )
+ * @brief  print the records of a trace dump frame, ignore anything else
+ * ****************************************************************************/
+static void process_frame( const uint8_t* frame, int length )
+{
+  int records;
+  int index;
+
+  if( (length < TRACE_HEADER_LEN) || (TRACE_RECORD_MARKER != frame[0]) )
+  {
+    return;
+  }
+
+  records = frame[2];
+  if( length < TRACE_HEADER_LEN + records * TRACE_RECORD_LEN )
+  {
+    fprintf( stderr, "node %u: truncated trace dump\n", frame[1] );
+    return;
+  }
+
+  if( frame[3] )
+  {
+    fprintf( stderr, "node %u: %u records lost\n", frame[1], frame[3] );
+  }
+
+  for( index = 0; index < records; index++ )
+  {
+    print_record( frame[1],
+                  &frame[TRACE_HEADER_LEN + index * TRACE_RECORD_LEN] );
+  }
+}
+
+int main( void )
+{
+  uint8_t frame[MAX_FRAME];
+  int length = 0;
+  int escaped = 0;
+  int character;
+
+  printf( "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" );
+
+  while( EOF != (character = getchar()) )
+  {
+    if( 0x7e == character )
+    {
+      // Closing (or opening) delimiter
+      process_frame( frame, length );
+      length = 0;
+      escaped = 0;
+    }
+    else if( 0x7d == character )
+    {
+      escaped = 1;
+    }
+    else if( length < MAX_FRAME )
+    {
+      frame[length++] = escaped ? (character ^ 0x20) : character;
+      escaped = 0;
+    }
+  }
+
+  printf( "\n]}\n" );
+
+  return 0;
+}
@@ -0,0 +1,436 @@
+/** @file wheelcheck.c
+*
+* @brief  Host test of the software timers (lib/soft_timers.c) on a
+*         simulated Timer A0 in up mode (see tools/host), with the demos'
+*         TIMER_LIMIT.
+*
+*         Every round starts TIMERS timers at a random point of the timer
+*         period, half the time just before the counter wraps. Delays go
+*         from a few ticks to the longest one, so deadlines land in the same
+*         wheel slot, in others, in later revolutions of the wheel and
+*         across counter wraps. Some timers are periodic. From their
+*         callbacks, timers restart themselves, start or restart others,
+*         cancel others, and periodic ones cancel themselves.
+*
+*         Each expiry is checked against what the test expects: only timers
+*         that are running expire, none early or more than MAX_LATE ticks
+*         late, in deadline order, none is missed, and cancelled ones never
+*         expire. Exits with an error on the first round that goes wrong.
+*
+*         usage: wheelcheck [rounds] [seed]
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include "soft_timers.h"
+#include "timers.h"
+#include "timer_a.h"
+
+// Same as the demos (see demo/settings.h)
+#define TIMER_LIMIT (65399)
+
+#define TIMERS (16)
+
+// set_ccr_at leaves 2 ticks when the deadline is closer than that
+#define MAX_LATE (2)
+
+// Callback actions per round, so timers starting each other stop
+// eventually
+#define ACTION_BUDGET (64)
+
+// A round fails if its timers are still running after this long, enough
+// for every action to restart a timer with the longest delay
+#define ROUND_LIMIT ( (ACTION_BUDGET + TIMERS) * (uint64_t)0x10000 )
+
+#define ACTION_NONE (0)
+#define ACTION_RESTART (1)      // Restart itself, one-shot
+#define ACTION_START (2)        // Start or restart another one
+#define ACTION_CANCEL (3)       // Cancel another one
+#define TOTAL_ACTIONS (4)
+
+typedef struct
+{
+  soft_timer_t timer;
+  uint8_t running;        // What the test expects
+  uint64_t deadline;      // timer_a_elapsed() ticks
+  uint16_t period;
+  uint8_t repeats;        // Periodic expiries left before it cancels itself
+} test_timer_t;
+
+typedef struct
+{
+  long expired;
+  long services;          // Service interrupts the stats counted
+  long restarted;
+  long started;
+  long cancelled;
+  long self_cancelled;
+  uint16_t latest;        // Worst lateness seen
+} tally_t;
+
+static uint8_t expire( uint8_t );
+
+static test_timer_t timers[TIMERS];
+static tally_t tally;
+static uint16_t round_expired;
+static int actions_left;
+static uint64_t last_deadline;
+static long errors;
+
+#define CALLBACK( index ) \
+  static uint8_t callback_##index( void ) { return expire( index ); }
+
+CALLBACK( 0 ) CALLBACK( 1 ) CALLBACK( 2 ) CALLBACK( 3 )
+CALLBACK( 4 ) CALLBACK( 5 ) CALLBACK( 6 ) CALLBACK( 7 )
+CALLBACK( 8 ) CALLBACK( 9 ) CALLBACK( 10 ) CALLBACK( 11 )
+CALLBACK( 12 ) CALLBACK( 13 ) CALLBACK( 14 ) CALLBACK( 15 )
+
+static uint8_t (* const callbacks[TIMERS])( void ) = {
+  callback_0, callback_1, callback_2, callback_3,
+  callback_4, callback_5, callback_6, callback_7,
+  callback_8, callback_9, callback_10, callback_11,
+  callback_12, callback_13, callback_14, callback_15 };
+
+/*******************************************************************************
+ * @fn     void fail( const char* what, uint8_t index )
+ * @brief  report an error, only the first few are printed
+ * ****************************************************************************/
+static void fail( const char* what, uint8_t index )
+{
+  if( errors < 10 )
+  {
+    printf( "at tick %llu, counter %u: timer %u %s\n",
+            (unsigned long long)timer_a_elapsed(), timer_a_count(), index,
+            what );
+  }
+  errors++;
+}
+
+/*******************************************************************************
+ * @fn     uint16_t random_delay( void )
+ * @brief  delay in ticks, within a wheel slot, a revolution, or further
+ * ****************************************************************************/
+static uint16_t random_delay( void )
+{
+  switch( rand() % 4 )
+  {
+    case 0:
+      return rand() % 4;
+    case 1:
+      return rand() % (1 << SOFT_TIMER_SLOT_SHIFT);
+    case 2:
+      return rand() % SOFT_TIMER_REVOLUTION;
+    default:
+      return rand() % 0x10000;
+  }
+}
+
+/*******************************************************************************
+ * @fn     void start( uint8_t index, uint16_t delay, uint16_t period )
+ * @brief  (re)start a timer and what the test expects of it
+ * ****************************************************************************/
+static void start( uint8_t index, uint16_t delay, uint16_t period )
+{
+  test_timer_t* test = &timers[index];
+
+  soft_timer_start( &test->timer, delay, period, callbacks[index] );
+
+  test->running = 1;
+  test->deadline = timer_a_elapsed() + delay;
+  test->period = period;
+}
+
+/*******************************************************************************
+ * @fn     void cancel( uint8_t index )
+ * @brief  cancel a timer, it must not expire anymore
+ * ****************************************************************************/
+static void cancel( uint8_t index )
+{
+  soft_timer_cancel( &timers[index].timer );
+  timers[index].running = 0;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t other( uint8_t index )
+ * @brief  a random timer that isn't index
+ * ****************************************************************************/
+static uint8_t other( uint8_t index )
+{
+  return ( index + 1 + rand() % (TIMERS - 1) ) % TIMERS;
+}
+
+/*******************************************************************************
+ * @fn     uint8_t expire( uint8_t index )
+ * @brief  every timer's callback, check the expiry and do something from it
+ * ****************************************************************************/
+static uint8_t expire( uint8_t index )
+{
+  test_timer_t* test = &timers[index];
+  uint64_t now = timer_a_elapsed();
+  uint8_t target;
+
+  tally.expired++;
+  round_expired++;
+
+  if( !test->running )
+  {
+    fail( "expired while not running", index );
+    return 0;
+  }
+  if( now < test->deadline )
+  {
+    fail( "expired early", index );
+  }
+  else if( now - test->deadline > MAX_LATE )
+  {
+    fail( "expired late", index );
+  }
+  else if( now - test->deadline > tally.latest )
+  {
+    tally.latest = now - test->deadline;
+  }
+
+  // Deadlines within MAX_LATE of each other can expire in the same service
+  // call, in any order
+  if( test->deadline + MAX_LATE < last_deadline )
+  {
+    fail( "expired out of order", index );
+  }
+  if( test->deadline > last_deadline )
+  {
+    last_deadline = test->deadline;
+  }
+
+  if( test->period )
+  {
+    test->deadline += test->period;
+    if( 0 == --test->repeats )
+    {
+      cancel( index );
+      tally.self_cancelled++;
+    }
+  }
+  else
+  {
+    test->running = 0;
+  }
+
+  if( actions_left <= 0 )
+  {
+    return 0;
+  }
+  actions_left--;
+
+  switch( rand() % TOTAL_ACTIONS )
+  {
+    case ACTION_RESTART:
+      start( index, random_delay(), 0 );
+      tally.restarted++;
+      break;
+
+    case ACTION_START:
+      target = other( index );
+      start( target, random_delay(), timers[target].running ?
+                                     timers[target].period : 0 );
+      tally.started++;
+      break;
+
+    case ACTION_CANCEL:
+      cancel( other( index ) );
+      tally.cancelled++;
+      break;
+
+    default:
+      break;
+  }
+
+  return index & 1;
+}
+
+/*******************************************************************************
+ * @fn     int missed( void )
+ * @brief  1 if a running timer is past its deadline by more than MAX_LATE
+ * ****************************************************************************/
+static int missed( void )
+{
+  uint64_t now = timer_a_elapsed();
+  uint8_t index;
+
+  for( index = 0; index < TIMERS; index++ )
+  {
+    if( timers[index].running && (timers[index].deadline + MAX_LATE < now) )
+    {
+      fail( "missed its deadline", index );
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     uint64_t next_deadline( void )
+ * @brief  earliest deadline of the running timers, 0 if none is running
+ * ****************************************************************************/
+static uint64_t next_deadline( void )
+{
+  uint64_t next = 0;
+  uint8_t index;
+
+  for( index = 0; index < TIMERS; index++ )
+  {
+    if( timers[index].running &&
+        ((0 == next) || (timers[index].deadline < next)) )
+    {
+      next = timers[index].deadline;
+    }
+  }
+
+  return next;
+}
+
+/*******************************************************************************
+ * @fn     int run_round( void )
+ * @brief  start the timers and run until they are all done. Returns 1 if
+ *         anything went wrong
+ * ****************************************************************************/
+static int run_round( void )
+{
+  soft_timer_stats_t stats;
+  uint64_t start_time;
+  uint64_t next;
+  uint8_t index;
+
+  // Somewhere in the period, or right before the counter wraps
+  if( rand() & 1 )
+  {
+    timer_a_run( rand() % (TIMER_LIMIT + 1) );
+  }
+  else
+  {
+    timer_a_run( ( TIMER_LIMIT - timer_a_count() ) - rand() % 16 );
+  }
+
+  soft_timer_get_stats( &stats );
+  round_expired = 0;
+  actions_left = ACTION_BUDGET;
+  last_deadline = 0;
+  start_time = timer_a_elapsed();
+
+  for( index = 0; index < TIMERS; index++ )
+  {
+    if( 0 == ( rand() % 4 ) )
+    {
+      timers[index].repeats = 1 + rand() % 4;
+      start( index, random_delay(), 1 + rand() % 8000 );
+    }
+    else
+    {
+      start( index, random_delay(), 0 );
+    }
+  }
+
+  // Some are cancelled before they get going, or restarted
+  for( index = 0; index < TIMERS; index++ )
+  {
+    switch( rand() % 8 )
+    {
+      case 0:
+        cancel( index );
+        break;
+      case 1:
+        start( index, random_delay(), timers[index].period );
+        break;
+      default:
+        break;
+    }
+  }
+
+  // Tick by tick until the next deadline has gone by
+  while( 0 != ( next = next_deadline() ) )
+  {
+    if( timer_a_elapsed() - start_time > ROUND_LIMIT )
+    {
+      fail( "and others still running at the end of the round", 0 );
+      return 1;
+    }
+
+    while( timer_a_elapsed() <= next + MAX_LATE )
+    {
+      timer_a_run( 1 );
+    }
+    if( missed() )
+    {
+      return 1;
+    }
+  }
+
+  for( index = 0; index < TIMERS; index++ )
+  {
+    if( soft_timer_active( &timers[index].timer ) )
+    {
+      fail( "still queued after it's done", index );
+    }
+  }
+
+  soft_timer_get_stats( &stats );
+  if( stats.expired != round_expired )
+  {
+    printf( "%u expiries counted, %u happened\n", stats.expired,
+            round_expired );
+    errors++;
+  }
+  if( stats.expired && (0 == stats.services) )
+  {
+    printf( "%u expiries counted in no service calls\n", stats.expired );
+    errors++;
+  }
+  tally.services += stats.services;
+
+  return ( 0 != errors );
+}
+
+int main( int argc, char** argv )
+{
+  long rounds = 200;
+  long round;
+  int seed = 1;
+
+  if( argc > 1 )
+  {
+    rounds = atol( argv[1] );
+  }
+  if( argc > 2 )
+  {
+    seed = atoi( argv[2] );
+  }
+  srand( seed );
+
+  // Up mode with the demos' period
+  set_ccr( 0, TIMER_LIMIT );
+  setup_timer_a( MODE_UP );
+  timer_a_start( 0 );
+  eint();
+
+  setup_soft_timers();
+
+  for( round = 0; round < rounds; round++ )
+  {
+    if( run_round() )
+    {
+      printf( "round %ld FAILED\n", round );
+      return 1;
+    }
+  }
+
+  printf( "%ld rounds, %llu ticks: %ld expiries in %ld service calls, latest "
+          "by %u ticks. From callbacks %ld restarts, %ld starts of others, "
+          "%ld cancels (%ld periodic timers cancelled themselves)\n", rounds,
+          (unsigned long long)timer_a_elapsed(), tally.expired,
+          tally.services, tally.latest,
+          tally.restarted, tally.started, tally.cancelled,
+          tally.self_cancelled );
+
+  return 0;
+}
@@ -0,0 +1,226 @@
+/** @file wrapcheck.c
+*
+* @brief  Host test of the extended timestamps (get_timestamp in lib/timers.c)
+*         on a simulated Timer A0 in up mode (see tools/host), with the
+*         demos' TIMER_LIMIT.
+*
+*         The counter wrap is the hard part: the overflow interrupt can't run
+*         while the timestamp is read, so read_timestamp looks at TAIFG and
+*         reads the counter again. Around the wrap, the counter ticks right
+*         after each of the TA0R reads get_timestamp makes in turn, or just
+*         before the call with the overflow interrupt still pending. Then
+*         the same with the calls at random points over many wraps.
+*
+*         Every timestamp must be the time right before or right after the
+*         tick, and never less than the one before it. Exits with an error if
+*         one isn't.
+*
+*         usage: wrapcheck [calls] [seed]
+*
+* @author Alvaro Prieto
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include "timers.h"
+#include "timer_a.h"
+
+// Same as the demos (see demo/settings.h)
+#define TIMER_LIMIT (65399)
+
+// Counter value the simulation starts from, timestamps start there too
+#define START_COUNT (TIMER_LIMIT - 1000)
+
+// Counter values checked on either side of the wrap
+#define WRAP_SPAN (4)
+
+// More TA0R reads than get_timestamp makes, even with a tick in the middle
+#define MAX_READS (8)
+
+typedef struct
+{
+  long calls;
+  long ticked;            // Calls the tick landed in the middle of
+  long late;              // Timestamps from right after the tick
+} tally_t;
+
+static tally_t tally;
+static uint32_t last_stamp;
+static long errors;
+
+/*******************************************************************************
+ * @fn     uint32_t true_time( uint64_t elapsed )
+ * @brief  what the timestamp should be after elapsed simulated ticks
+ * ****************************************************************************/
+static uint32_t true_time( uint64_t elapsed )
+{
+  return (uint32_t)( START_COUNT + elapsed );
+}
+
+/*******************************************************************************
+ * @fn     int check_call( uint16_t reads )
+ * @brief  get_timestamp with the counter ticking right after the reads-th
+ *         TA0R read. With 0 reads, it ticks just before the call with
+ *         interrupts disabled, so the overflow interrupt is still pending.
+ *         Returns 1 if the timestamp is wrong
+ * ****************************************************************************/
+static int check_call( uint16_t reads )
+{
+  uint16_t count = timer_a_count();
+  uint64_t before;
+  uint64_t after;
+  uint32_t stamp;
+
+  if( 0 == reads )
+  {
+    dint();
+    timer_a_run( 1 );
+  }
+  else
+  {
+    timer_a_tick_after_reads( reads );
+  }
+
+  before = timer_a_elapsed();
+  stamp = get_timestamp();
+  after = timer_a_elapsed();
+
+  // Didn't read TA0R that many times, no tick then
+  timer_a_tick_after_reads( 0 );
+
+  // The overflow interrupt runs now, if the counter wrapped
+  eint();
+  timer_a_service();
+
+  tally.calls++;
+  if( after != before )
+  {
+    tally.ticked++;
+  }
+
+  if( (stamp != true_time( before )) && (stamp != true_time( after )) )
+  {
+    printf( "counter %u, tick after %u reads: timestamp %lu, expected %lu "
+            "or %lu\n", count, reads, (unsigned long)stamp,
+            (unsigned long)true_time( before ),
+            (unsigned long)true_time( after ) );
+    errors++;
+  }
+  else if( (after != before) && (stamp == true_time( after )) )
+  {
+    tally.late++;
+  }
+
+  if( (int32_t)( stamp - last_stamp ) < 0 )
+  {
+    printf( "counter %u, tick after %u reads: timestamp %lu went back from "
+            "%lu\n", count, reads, (unsigned long)stamp,
+            (unsigned long)last_stamp );
+    errors++;
+  }
+  last_stamp = stamp;
+
+  return ( 0 != errors );
+}
+
+/*******************************************************************************
+ * @fn     void run_to( uint16_t count )
+ * @brief  run the counter until it next reads count
+ * ****************************************************************************/
+static void run_to( uint16_t count )
+{
+  do
+  {
+    timer_a_run( 1 );
+  } while( timer_a_count() != count );
+}
+
+/*******************************************************************************
+ * @fn     int wrap_test( void )
+ * @brief  tick after every TA0R read, at every counter value near the wrap
+ * ****************************************************************************/
+static int wrap_test( void )
+{
+  int16_t offset;
+  uint16_t reads;
+
+  for( offset = -WRAP_SPAN; offset < WRAP_SPAN; offset++ )
+  {
+    for( reads = 0; reads <= MAX_READS; reads++ )
+    {
+      run_to( ( offset < 0 ) ? TIMER_LIMIT + 1 + offset : offset );
+      if( check_call( reads ) )
+      {
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/*******************************************************************************
+ * @fn     int random_test( long calls )
+ * @brief  calls at random points, many of them near a wrap
+ * ****************************************************************************/
+static int random_test( long calls )
+{
+  long call;
+
+  for( call = 0; call < calls; call++ )
+  {
+    switch( rand() % 4 )
+    {
+      case 0:
+        timer_a_run( rand() % 4 );
+        break;
+      case 1:
+        timer_a_run( rand() % 0x20000 );
+        break;
+      default:
+        run_to( ( TIMER_LIMIT + 1 - WRAP_SPAN + rand() % (2 * WRAP_SPAN) ) %
+                ( TIMER_LIMIT + 1 ) );
+        break;
+    }
+
+    if( check_call( rand() % (MAX_READS + 1) ) )
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int main( int argc, char** argv )
+{
+  long calls = 5000;
+  int seed = 1;
+  int failed;
+
+  if( argc > 1 )
+  {
+    calls = atol( argv[1] );
+  }
+  if( argc > 2 )
+  {
+    seed = atoi( argv[2] );
+  }
+  srand( seed );
+
+  // Up mode with the demos' period
+  set_ccr( 0, TIMER_LIMIT );
+  setup_timer_a( MODE_UP );
+  timer_a_start( START_COUNT );
+  eint();
+
+  last_stamp = get_timestamp();
+
+  failed = wrap_test() || random_test( calls );
+
+  printf( "%ld calls, %llu ticks: %ld with a tick in the middle, %ld of those "
+          "timestamped after it%s\n", tally.calls,
+          (unsigned long long)timer_a_elapsed(), tally.ticked, tally.late,
+          failed ? " FAILED" : "" );
+
+  return failed;
+}